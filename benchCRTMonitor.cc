@@ -0,0 +1,66 @@
+// root includes
+#include "TStopwatch.h"
+#include "TSystem.h"
+
+// std incldes
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// the hist stage itself, so both configs run exactly the production code
+#include "makeHists_db_postgre.cc"
+
+// Time makeHists_db_postgre over one skim with the default histogram config
+// and with the same config minus its CRT histograms, and report what the CRT
+// monitoring adds. Each config runs reps times and the fastest run counts,
+// so file cache warm-up doesn't land on either side. Stdout of the hist
+// stage goes to <outDir>/bench_crt.log.
+void benchCRTMonitor(std::string skimFileName, unsigned int minRun, unsigned int maxRun,
+                     int reps = 3, std::string outDir = ".")
+{
+  // drop every config line that fills or cuts on a CRT observable
+  std::string noCRTConfigName = outDir + "/bench_nocrt.cfg";
+  {
+    std::stringstream configStrm(kDefaultHistConfig);
+    std::ofstream noCRTConfig(noCRTConfigName);
+    std::string line;
+    while (std::getline(configStrm, line))
+    {
+      std::stringstream lineStrm(line.substr(0, line.find('#')));
+      std::string name, obsName;
+      const observableDef* obs = (lineStrm >> name >> obsName) ? findObservable(obsName) : nullptr;
+      std::string branches = (obs) ? obs->Branches : "";
+      bool isCRT = obs && (obs->Kind >= kPerCRTHit || branches.find("crt") != std::string::npos);
+      if (not isCRT)
+        noCRTConfig << line << '\n';
+    }
+  }
+
+  std::string outFileName = outDir + "/bench_crt_hists.root";
+  std::string logName = outDir + "/bench_crt.log";
+  auto bestOf = [&](const std::string& options)
+  {
+    double best = std::numeric_limits<double>::max();
+    for (int rep = 0; rep < reps; ++rep)
+    {
+      gSystem->RedirectOutput(logName.c_str(), "a");
+      TStopwatch watch;
+      makeHists_db_postgre(skimFileName, outFileName, minRun, maxRun, false, options);
+      double elapsed = watch.RealTime();
+      gSystem->RedirectOutput(nullptr);
+      best = std::min(best, elapsed);
+    }
+    return best;
+  };
+
+  double withoutCRT = bestOf("hists=" + noCRTConfigName);
+  double withCRT = bestOf("");
+  gSystem->Unlink(outFileName.c_str());
+  gSystem->Unlink(noCRTConfigName.c_str());
+
+  std::cout << "Hist stage without CRT: " << withoutCRT << " s" << std::endl;
+  std::cout << "Hist stage with CRT:    " << withCRT << " s" << std::endl;
+  std::cout << "CRT monitoring adds " << 100 * (withCRT - withoutCRT) / withoutCRT << "% (target < 10%)" << std::endl;
+}
@@ -0,0 +1,93 @@
+// root includes
+#include "TFile.h"
+#include "TH2.h"
+#include "TStopwatch.h"
+#include "TSystem.h"
+
+// std incldes
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+
+// the export itself, so the comparison runs exactly the production code
+#include "exportRuns.cc"
+
+// Load one histogram's plots for nRuns runs spread over the file the way a
+// dashboard does today (open the makeHists output, read the TH2D,
+// ProjectionY the run) and from the per-run export (open it, load the run),
+// and report the time per run for both. Every exported bin must match the
+// projection. The export is written to <outDir>/bench_export.dqx.
+void benchExport(std::string histFileName, std::string histName, int nRuns = 20, std::string outDir = ".")
+{
+  std::string exportName = outDir + "/bench_export.dqx";
+  TStopwatch exportWatch;
+  exportRuns(histFileName, exportName, "hists=" + histName);
+  double exportTime = exportWatch.RealTime();
+
+  runExportReader probe;
+  if (not probe.open(exportName) || probe.hists().empty())
+  {
+    std::cout << "Could not read " << exportName << ". Bail." << std::endl;
+    return;
+  }
+  std::vector<unsigned int> runs;
+  size_t stride = std::max<size_t>(1, probe.runs().size() / nRuns);
+  for (size_t idx = 0; idx < probe.runs().size() && static_cast<int>(runs.size()) < nRuns; idx += stride)
+    runs.push_back(probe.runs()[idx]);
+
+  // today: the whole TH2D per click
+  std::vector<std::unique_ptr<TH1D>> projections;
+  TStopwatch rootWatch;
+  for (unsigned int run : runs)
+  {
+    std::unique_ptr<TFile> histFile(TFile::Open(histFileName.c_str(), "READ"));
+    std::unique_ptr<TH2D> hist(histFile->Get<TH2D>(histName.c_str()));
+    int xBin = hist->GetXaxis()->FindFixBin(run);
+    projections.emplace_back(hist->ProjectionY(("bench_" + std::to_string(run)).c_str(), xBin, xBin));
+    projections.back()->SetDirectory(nullptr);
+  }
+  double rootTime = rootWatch.RealTime();
+
+  // the export: one read per run
+  std::vector<exportRun> loaded(runs.size());
+  TStopwatch exportReadWatch;
+  for (size_t idx = 0; idx < runs.size(); ++idx)
+  {
+    runExportReader reader;
+    reader.open(exportName);
+    reader.load(runs[idx], loaded[idx]);
+  }
+  double exportReadTime = exportReadWatch.RealTime();
+
+  int nDiffer = 0;
+  for (size_t idx = 0; idx < runs.size(); ++idx)
+  {
+    const TH1D* projection = projections[idx].get();
+    std::vector<double> dense(projection->GetNbinsX() + 2, 0);
+    if (loaded[idx].Projections.empty())
+    {
+      ++nDiffer;
+      continue;
+    }
+    const exportProjection& exported = loaded[idx].Projections[0];
+    for (size_t bin = 0; bin < exported.Bins.size(); ++bin)
+      dense[exported.Bins[bin]] = exported.Contents[bin];
+    bool same = (exported.Underflow == projection->GetBinContent(0))
+             && (exported.Overflow == projection->GetBinContent(projection->GetNbinsX() + 1));
+    for (int bin = 1; same && bin <= projection->GetNbinsX(); ++bin)
+      same = (dense[bin] == projection->GetBinContent(bin));
+    if (not same)
+    {
+      ++nDiffer;
+      std::cout << "Run " << runs[idx] << " differs" << std::endl;
+    }
+  }
+  gSystem->Unlink(exportName.c_str());
+
+  std::cout << "Export of " << histName << ": " << exportTime << " s" << std::endl;
+  std::cout << "Per run, TH2D + ProjectionY: " << 1e3 * rootTime / runs.size() << " ms" << std::endl;
+  std::cout << "Per run, export:             " << 1e3 * exportReadTime / runs.size() << " ms" << std::endl;
+  std::cout << ((nDiffer == 0 && not runs.empty()) ? "PASS" : "FAIL") << ": " << runs.size() - nDiffer << " of "
+            << runs.size() << " runs identical" << std::endl;
+}
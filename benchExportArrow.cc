@@ -0,0 +1,197 @@
+// root includes
+#include "TFile.h"
+#include "TInterpreter.h"
+#include "TStopwatch.h"
+#include "TTree.h"
+
+// arrow includes
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/reader.h>
+
+// std incldes
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+// the export itself, so the check runs exactly the production code
+#include "exportArrow.cc"
+
+// what the synthetic skim holds at each entry, so the read-back can
+// recompute it instead of keeping a copy
+namespace arrowBench
+{
+  inline bool dropped(Long64_t entry) { return entry % 7 == 3; }
+  inline unsigned int run(Long64_t entry) { return 1000 + entry / 100; }
+  // per slice
+  inline int nSlices(Long64_t entry) { return entry % 4; }
+  inline float dirY(Long64_t entry, int slc) { return entry + 0.25f * slc; }
+  // per slice, per PFP
+  inline int nPFPs(int slc) { return slc + 1; }
+  inline int nHit(Long64_t entry, int slc, int pfp) { return static_cast<int>(entry * 10 + slc * 3 + pfp); }
+  // per passthrough element
+  inline int nPassthrough(Long64_t entry) { return entry % 5; }
+  inline float passthroughValue(Long64_t entry, size_t branchIdx, int idx) { return entry + 0.01f * branchIdx + 0.5f * idx; }
+}
+
+// Write a small passthrough-style skim (nEntries entries; a scalar, a
+// vector<T>, a vector<vector<T>>, a dropped flag, and a passthrough_tree with
+// every passthrough column), export it with batch=batchRows (keep it below
+// nEntries so there are several record batches) and read the Arrow file back
+// with arrow::ipc::RecordBatchFileReader. Every row count and value has to
+// match; reports the export time. The files go to <outDir>/bench_arrow.*.
+void benchExportArrow(std::string outDir = ".", Long64_t nEntries = 1000, int batchRows = 64)
+{
+  using namespace arrowBench;
+  gInterpreter->GenerateDictionary("vector<vector<int>>", "vector");
+  std::string skimName = outDir + "/bench_arrow.root";
+  std::string arrowName = outDir + "/bench_arrow.arrow";
+
+  // the skim
+  {
+    std::unique_ptr<TFile> skimFile(TFile::Open(skimName.c_str(), "RECREATE"));
+    if (not skimFile || skimFile->IsZombie())
+    {
+      std::cout << "Could not create " << skimName << ". Bail." << std::endl;
+      return;
+    }
+    TTree* skimTree = new TTree("data_validation_tree", "Data Validation Tree");
+    unsigned int skimRun = 0;
+    std::vector<float> skimDirY;
+    std::vector<std::vector<int>> skimNHit;
+    bool skimDropped = false;
+    skimTree->Branch("run", &skimRun);
+    skimTree->Branch("slc.CRLongestTrackDirY", &skimDirY);
+    skimTree->Branch("slc.pfp.trackNHit1", &skimNHit);
+    skimTree->Branch("dropped", &skimDropped);
+
+    // the CAF's leaf arrays, one count per array like the real CAF
+    const size_t nColumns = std::size(kPassthroughBranches);
+    const int maxPassthrough = 8;
+    TTree* passthroughTree = new TTree("passthrough_tree", "Passthrough Tree");
+    int passthroughCount = 0;
+    std::vector<std::vector<float>> passthroughData(nColumns, std::vector<float>(maxPassthrough));
+    std::set<std::string> countNames;
+    for (size_t idx = 0; idx < nColumns; ++idx)
+    {
+      const passthroughBranch& branch = kPassthroughBranches[idx];
+      if (countNames.insert(branch.CAFCount).second)
+        passthroughTree->Branch(branch.CAFCount, &passthroughCount, (std::string(branch.CAFCount) + "/I").c_str());
+      passthroughTree->Branch(branch.CAFName, passthroughData[idx].data(),
+                              (std::string(branch.CAFName) + "[" + branch.CAFCount + "]/F").c_str());
+    }
+
+    for (Long64_t entry = 0; entry < nEntries; ++entry)
+    {
+      skimRun = run(entry);
+      skimDropped = dropped(entry);
+      skimDirY.clear();
+      skimNHit.clear();
+      for (int slc = 0; slc < nSlices(entry) && not skimDropped; ++slc)
+      {
+        skimDirY.push_back(dirY(entry, slc));
+        skimNHit.emplace_back();
+        for (int pfp = 0; pfp < nPFPs(slc); ++pfp)
+          skimNHit.back().push_back(nHit(entry, slc, pfp));
+      }
+      skimTree->Fill();
+      passthroughCount = nPassthrough(entry);
+      for (size_t idx = 0; idx < nColumns; ++idx)
+        for (int elem = 0; elem < passthroughCount; ++elem)
+          passthroughData[idx][elem] = passthroughValue(entry, idx, elem);
+      passthroughTree->Fill();
+    }
+    skimTree->Write();
+    passthroughTree->Write();
+  }
+
+  TStopwatch exportWatch;
+  exportArrow(skimName, arrowName, "batch=" + std::to_string(batchRows));
+  double exportTime = exportWatch.RealTime();
+
+  // read it back
+  auto inFile = arrow::io::ReadableFile::Open(arrowName);
+  auto reader = (inFile.ok()) ? arrow::ipc::RecordBatchFileReader::Open(*inFile) : inFile.status();
+  if (not reader.ok())
+  {
+    std::cout << "Could not read " << arrowName << ": " << reader.status().ToString() << ". Bail." << std::endl;
+    return;
+  }
+  Long64_t nKept = 0;
+  for (Long64_t entry = 0; entry < nEntries; ++entry)
+    nKept += not dropped(entry);
+  int nFields = (*reader)->schema()->num_fields();
+  int nExpectedFields = 3 + static_cast<int>(std::size(kPassthroughBranches));
+
+  size_t nBad = 0;
+  auto check = [&](bool good, const std::string& what)
+  {
+    if (not good && nBad++ < 10)
+      std::cout << "Mismatch: " << what << std::endl;
+  };
+  check(nFields == nExpectedFields, "schema has " + std::to_string(nFields) + " columns, expected " + std::to_string(nExpectedFields));
+  check((*reader)->schema()->GetFieldByName("dropped") == nullptr, "the dropped flag was exported");
+  check((*reader)->num_record_batches() == (nKept + batchRows - 1) / batchRows,
+        std::to_string((*reader)->num_record_batches()) + " record batches for " + std::to_string(nKept) + " rows");
+
+  Long64_t entry = 0, nRows = 0;
+  for (int batchIdx = 0; batchIdx < (*reader)->num_record_batches(); ++batchIdx)
+  {
+    auto batch = (*reader)->ReadRecordBatch(batchIdx);
+    if (not batch.ok())
+    {
+      check(false, "record batch " + std::to_string(batchIdx) + ": " + batch.status().ToString());
+      break;
+    }
+    auto runs = std::dynamic_pointer_cast<arrow::UInt32Array>((*batch)->GetColumnByName("run"));
+    auto dirYs = std::dynamic_pointer_cast<arrow::ListArray>((*batch)->GetColumnByName("slc.CRLongestTrackDirY"));
+    auto nHits = std::dynamic_pointer_cast<arrow::ListArray>((*batch)->GetColumnByName("slc.pfp.trackNHit1"));
+    if (not runs || not dirYs || not nHits)
+    {
+      check(false, "record batch " + std::to_string(batchIdx) + " lacks a column or has the wrong type");
+      break;
+    }
+    auto dirYValues = std::static_pointer_cast<arrow::FloatArray>(dirYs->values());
+    auto nHitSlices = std::static_pointer_cast<arrow::ListArray>(nHits->values());
+    auto nHitValues = std::static_pointer_cast<arrow::Int32Array>(nHitSlices->values());
+    for (int64_t row = 0; row < (*batch)->num_rows(); ++row, ++entry, ++nRows)
+    {
+      while (dropped(entry))
+        ++entry;
+      std::string where = " at entry " + std::to_string(entry);
+      check(runs->Value(row) == run(entry), "run" + where);
+      check(dirYs->value_length(row) == nSlices(entry), "slc.CRLongestTrackDirY length" + where);
+      check(nHits->value_length(row) == nSlices(entry), "slc.pfp.trackNHit1 length" + where);
+      for (int slc = 0; slc < nSlices(entry) && dirYs->value_length(row) == nSlices(entry)
+                        && nHits->value_length(row) == nSlices(entry); ++slc)
+      {
+        check(dirYValues->Value(dirYs->value_offset(row) + slc) == dirY(entry, slc), "slc.CRLongestTrackDirY" + where);
+        int64_t slice = nHits->value_offset(row) + slc;
+        check(nHitSlices->value_length(slice) == nPFPs(slc), "slc.pfp.trackNHit1 slice length" + where);
+        for (int pfp = 0; pfp < nPFPs(slc) && nHitSlices->value_length(slice) == nPFPs(slc); ++pfp)
+          check(nHitValues->Value(nHitSlices->value_offset(slice) + pfp) == nHit(entry, slc, pfp), "slc.pfp.trackNHit1" + where);
+      }
+      for (size_t idx = 0; idx < std::size(kPassthroughBranches); ++idx)
+      {
+        const char* name = kPassthroughBranches[idx].Name;
+        auto list = std::dynamic_pointer_cast<arrow::ListArray>((*batch)->GetColumnByName(name));
+        if (not list || list->value_length(row) != nPassthrough(entry))
+        {
+          check(false, std::string(name) + " missing or of the wrong length" + where);
+          continue;
+        }
+        auto values = std::static_pointer_cast<arrow::FloatArray>(list->values());
+        for (int elem = 0; elem < nPassthrough(entry); ++elem)
+          check(values->Value(list->value_offset(row) + elem) == passthroughValue(entry, idx, elem), std::string(name) + where);
+      }
+    }
+  }
+  check(nRows == nKept, std::to_string(nRows) + " rows read back, expected " + std::to_string(nKept));
+
+  std::cout << "Exported " << nEntries << " entries (" << nKept << " kept) in batches of " << batchRows
+            << " in " << exportTime << " s; read back " << nRows << " rows: "
+            << ((nBad == 0) ? "all values match" : std::to_string(nBad) + " mismatches") << std::endl;
+}
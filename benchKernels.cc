@@ -0,0 +1,337 @@
+// root includes
+#include "TROOT.h"
+#include "TString.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+// std incldes
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// the skim and the hist stage's plan, so every kernel is the production code
+#include "makeTTree_db_postgre.cc"
+#include "dqHistPlan.h"
+
+// one timed kernel at one set of multiplicities
+struct kernelResult
+{
+  std::string Name;
+  std::vector<std::pair<std::string, int>> Params;
+  long Calls;
+  double NsPerCall;
+};
+
+// best of reps runs of calls calls of kernel, in ns per call
+template <typename Kernel>
+double bestNsPerCall(int reps, long calls, Kernel&& kernel)
+{
+  double best = std::numeric_limits<double>::max();
+  for (int rep = 0; rep < reps; ++rep)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (long call = 0; call < calls; ++call)
+      kernel();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count() / calls);
+  }
+  return best;
+}
+
+// a colon separated list of multiplicities
+std::vector<int> multiplicityList(const optionMap& opts, const std::string& key, const std::string& fallback)
+{
+  std::stringstream listStrm(optionValue<std::string>(opts, key, fallback));
+  std::vector<int> values;
+  std::string value;
+  while (std::getline(listStrm, value, ':'))
+    if (not value.empty())
+      values.push_back(std::max(0, std::stoi(value)));
+  return values;
+}
+
+// the flat CAF-side arrays of one synthetic event, as the skim reads them
+struct syntheticInput
+{
+  std::vector<ULong64_t> NPFP;
+  std::vector<Char_t> ClearCosmic;
+  std::vector<float> CRLongestTrackDirY;
+  std::vector<float> TrackLength, ShowerLength, TrackDirY, TrackVtxX, TrackVtxY, TrackVtxZ;
+  std::vector<caf::Plane_t> TrackBestPlane;
+  std::vector<int> ShowerBestPlane, TrackNHit1, TrackNHit2, TrackNHit3;
+  std::vector<int> MatchNHits;
+  std::vector<double> MatchTimeDiff;
+
+  // nSlices slices of nPFPs PFPs each, nMatches matches of 4 hits each; about
+  // a third of the PFPs have no track and a third no shower
+  syntheticInput(int nSlices, int nPFPs, int nMatches, std::mt19937& rng)
+  {
+    std::uniform_real_distribution<float> unit(0, 1);
+    for (int slc = 0; slc < nSlices; ++slc)
+    {
+      NPFP.push_back(nPFPs);
+      ClearCosmic.push_back(unit(rng) < 0.5);
+      CRLongestTrackDirY.push_back(2 * unit(rng) - 1);
+    }
+    for (int pfp = 0; pfp < nSlices * nPFPs; ++pfp)
+    {
+      TrackLength.push_back((unit(rng) < 0.33) ? 0 : 300 * unit(rng));
+      ShowerLength.push_back((unit(rng) < 0.33) ? 0 : 100 * unit(rng));
+      TrackDirY.push_back(2 * unit(rng) - 1);
+      TrackVtxX.push_back(400 * unit(rng) - 200);
+      TrackVtxY.push_back(400 * unit(rng) - 200);
+      TrackVtxZ.push_back(1800 * unit(rng) - 900);
+      TrackBestPlane.push_back(static_cast<caf::Plane_t>(rng() % 3));
+      ShowerBestPlane.push_back(rng() % 3);
+      TrackNHit1.push_back(rng() % 200);
+      TrackNHit2.push_back(rng() % 200);
+      TrackNHit3.push_back(rng() % 200);
+    }
+    for (int match = 0; match < nMatches; ++match)
+    {
+      MatchNHits.push_back(4);
+      for (int hit = 0; hit < 4; ++hit)
+        MatchTimeDiff.push_back(100 * unit(rng) - 50);
+    }
+  }
+  sliceInput slices() const
+  {
+    sliceInput in;
+    in.NSlices = NPFP.size();
+    in.NPFP = NPFP.data();
+    in.ClearCosmic = ClearCosmic.data();
+    in.CRLongestTrackDirY = CRLongestTrackDirY.data();
+    in.TrackLength = TrackLength.data();
+    in.ShowerLength = ShowerLength.data();
+    in.TrackBestPlane = TrackBestPlane.data();
+    in.ShowerBestPlane = ShowerBestPlane.data();
+    in.TrackDirY = TrackDirY.data();
+    in.TrackVtxX = TrackVtxX.data();
+    in.TrackVtxY = TrackVtxY.data();
+    in.TrackVtxZ = TrackVtxZ.data();
+    in.TrackNHit1 = TrackNHit1.data();
+    in.TrackNHit2 = TrackNHit2.data();
+    in.TrackNHit3 = TrackNHit3.data();
+    return in;
+  }
+};
+
+// point evt at the columns of rec, as if the entry had been read from a skim
+void viewRecord(skimRecord& rec, histEvent& evt)
+{
+  std::vector<void*> buffers;
+  rec.forEachColumn([&](auto, auto& buffer, auto&) { buffers.push_back(&buffer); });
+  size_t idx = 0;
+  histEvent::forEachColumn([&](auto column, auto member)
+  {
+    using col = decltype(column);
+    void* buffer = buffers[idx++];
+    if constexpr (col::Group == kSkimDerived)
+      return;
+    else if constexpr (std::is_arithmetic<typename col::Type>::value)
+      evt.*member = *static_cast<typename col::Type*>(buffer);
+    else
+      evt.*member = static_cast<typename col::Type*>(buffer);
+  });
+}
+
+// options (comma separated):
+//   slices=A:B:...   slices per event (default 1:4:16)
+//   pfps=A:B:...     PFPs per slice (default 2:8:32)
+//   flashes=A:B:...  flashes per event, CRT hits and CRT-PMT matches (4 hits
+//                    each) alike (default 4:32:128)
+//   calls=N          calls per timing (default 2000, runInfo a tenth of it)
+//   reps=N           timings per kernel, the fastest counts (default 5)
+//   label=TEXT       recorded in the JSON, e.g. the commit benchmarked
+// Times the pipeline's inner kernels on synthetic events over the grid of
+// multiplicities and writes ns per call to jsonName, one record per kernel
+// and multiplicity, for comparing between commits:
+//   skim.sliceFill       slice/PFP nested fill (sliceFill)
+//   skim.matchFill       CRT-PMT match flattening (matchFill)
+//   hist.derive          per-event PFP reductions (histEvent::derive)
+//   hist.fill            the default plan's per-event fill, Fill calls included
+//   skim.makeTime        one timestamp parsed
+//   skim.runInfo         one run looked up in the run database and config csv
+//   hist.checkSchema     checkSkimSchema over a skim tree
+//   hist.bind            histEvent::bind to a skim tree
+// Stdout and stderr of the kernels go to <jsonName>.log.
+void benchKernels(std::string jsonName = "bench_kernels.json", std::string options = "")
+{
+  optionMap opts = parseOptions(options);
+  std::vector<int> sliceCounts = multiplicityList(opts, "slices", "1:4:16");
+  std::vector<int> pfpCounts = multiplicityList(opts, "pfps", "2:8:32");
+  std::vector<int> flashCounts = multiplicityList(opts, "flashes", "4:32:128");
+  long calls = std::max(1L, optionValue<long>(opts, "calls", 2000));
+  int reps = std::max(1, optionValue<int>(opts, "reps", 5));
+  std::string label = optionValue<std::string>(opts, "label", "");
+  std::string logName = jsonName + ".log";
+  std::mt19937 rng(20240601);
+  std::vector<kernelResult> results;
+  skimLayout layout(optionMap{});
+  volatile size_t sink = 0;
+
+  // the skim's per-event transform
+  for (int nSlices : sliceCounts)
+    for (int nPFPs : pfpCounts)
+    {
+      syntheticInput input(nSlices, nPFPs, 0, rng);
+      sliceInput in = input.slices();
+      skimRecord out;
+      sliceFill slices;
+      double ns = bestNsPerCall(reps, calls, [&]()
+      {
+        out.clear();
+        slices.fill(out, in, layout);
+        sink = sink + out.TrackLength.size();
+      });
+      results.push_back({"skim.sliceFill", {{"slices", nSlices}, {"pfps", nPFPs}}, calls, ns});
+    }
+  for (int nFlashes : flashCounts)
+  {
+    syntheticInput input(0, 0, nFlashes, rng);
+    skimRecord out;
+    matchFill matches;
+    double ns = bestNsPerCall(reps, calls, [&]()
+    {
+      out.clear();
+      matches.fill(out, nFlashes, input.MatchNHits.data(), input.MatchTimeDiff.data());
+      sink = sink + out.CRTPMTMatchHitTimeDiff.size();
+    });
+    results.push_back({"skim.matchFill", {{"flashes", nFlashes}}, calls, ns});
+  }
+
+  // the hist stage's per-event reductions and fills, on events the skim made
+  gROOT->cd();
+  histPlan plan;
+  if (not plan.build(kDefaultHistConfig, 100, 0.5, 100.5))
+  {
+    std::cout << "Could not build the default histogram plan. Bail." << std::endl;
+    return;
+  }
+  for (int nSlices : sliceCounts)
+    for (int nPFPs : pfpCounts)
+      for (int nFlashes : flashCounts)
+      {
+        syntheticInput input(nSlices, nPFPs, nFlashes, rng);
+        skimRecord rec;
+        sliceFill slices;
+        matchFill matches;
+        slices.fill(rec, input.slices(), layout);
+        matches.fill(rec, nFlashes, input.MatchNHits.data(), input.MatchTimeDiff.data());
+        std::uniform_real_distribution<float> unit(0, 1);
+        for (int flash = 0; flash < nFlashes; ++flash)
+        {
+          rec.FlashTimeWidth.push_back(unit(rng));
+          rec.FlashTimeSD.push_back(unit(rng));
+          rec.FlashPE.push_back(1000 * unit(rng));
+          rec.CRTHitPlane.push_back(30 + rng() % 20);
+          rec.CRTHitPE.push_back(200 * unit(rng));
+          rec.CRTHitErrX.push_back(unit(rng));
+          rec.CRTHitErrY.push_back(unit(rng));
+          rec.CRTHitErrZ.push_back(unit(rng));
+          rec.CRTTrackTime.push_back(1000 * unit(rng));
+        }
+        rec.Run = 50;
+        rec.NSlices = nSlices;
+        rec.NFlashes = rec.NCRTHits = rec.NCRTTracks = rec.NCRTPMTMatches = nFlashes;
+        histEvent evt;
+        viewRecord(rec, evt);
+        std::vector<std::pair<std::string, int>> params = {{"slices", nSlices}, {"pfps", nPFPs}, {"flashes", nFlashes}};
+        double derive = bestNsPerCall(reps, calls, [&]()
+        {
+          evt.derive();
+          sink = sink + evt.Derived.NTracks;
+        });
+        results.push_back({"hist.derive", params, calls, derive});
+        double fill = bestNsPerCall(reps, calls, [&]() { plan.fill(evt, false); });
+        results.push_back({"hist.fill", params, calls, fill});
+      }
+  for (TH1* hist : plan.Hists)
+    delete hist;
+
+  // timestamps, the run lookup and binding, at no multiplicity
+  gSystem->RedirectOutput(logName.c_str(), "a");
+  {
+    std::vector<TString> timeStrs;
+    const char* const months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    for (int idx = 0; idx < 1000; ++idx)
+      timeStrs.push_back(TString::Format("Tue %s %02d %02d:%02d:%02d CDT 2024", months[idx % 12], 1 + idx % 28,
+                                         idx % 24, idx % 60, (7 * idx) % 60));
+    size_t next = 0;
+    double ns = bestNsPerCall(reps, calls, [&]()
+    {
+      sink = sink + makeTime(timeStrs[next]);
+      next = (next + 1) % timeStrs.size();
+    });
+    results.push_back({"skim.makeTime", {}, calls, ns});
+
+    long lookups = std::max(1L, calls / 10);
+    int run = 9000;
+    ns = bestNsPerCall(reps, lookups, [&]()
+    {
+      runInfo info(run++);
+      sink = sink + info.epicsExists;
+    });
+    results.push_back({"skim.runInfo", {}, lookups, ns});
+
+    skimRecord rec;
+    TTree tree("bench_kernels", "Kernel Bench Skim");
+    tree.SetDirectory(nullptr);
+    rec.forEachColumn([&](auto column, auto& buffer, auto&)
+    {
+      using col = decltype(column);
+      if (skimWrites(col::Group, false, true))
+        tree.Branch(col::Branch, &buffer);
+    });
+    tree.Fill();
+    std::ofstream nowhere;
+    ns = bestNsPerCall(reps, calls, [&]() { sink = sink + checkSkimSchema(&tree, false, nowhere); });
+    results.push_back({"hist.checkSchema", {}, calls, ns});
+    histEvent evt;
+    ns = bestNsPerCall(reps, calls, [&]() { evt.bind(&tree); });
+    results.push_back({"hist.bind", {}, calls, ns});
+    tree.ResetBranchAddresses();
+  }
+  gSystem->RedirectOutput(nullptr);
+
+  // written to a temporary and renamed, like the skim checkpoint
+  std::string tmpName = jsonName + ".tmp";
+  {
+    std::ofstream jsonStrm(tmpName, std::ios::trunc);
+    std::string escaped;
+    for (char ch : label)
+      escaped += (ch == '"' || ch == '\\') ? std::string("\\") + ch : std::string(1, ch);
+    jsonStrm << "{\"label\": \"" << escaped << "\", \"reps\": " << reps << ", \"benchmarks\": [";
+    for (size_t idx = 0; idx < results.size(); ++idx)
+    {
+      const kernelResult& result = results[idx];
+      jsonStrm << ((idx > 0) ? ",\n  " : "\n  ") << "{\"name\": \"" << result.Name << "\", \"params\": {";
+      for (size_t param = 0; param < result.Params.size(); ++param)
+        jsonStrm << ((param > 0) ? ", \"" : "\"") << result.Params[param].first << "\": " << result.Params[param].second;
+      jsonStrm << "}, \"calls\": " << result.Calls << ", \"ns_per_call\": " << result.NsPerCall << "}";
+    }
+    jsonStrm << "\n]}\n";
+    if (not jsonStrm)
+    {
+      std::cout << "Could not write " << tmpName << ". Bail." << std::endl;
+      return;
+    }
+  }
+  std::rename(tmpName.c_str(), jsonName.c_str());
+
+  for (const auto& result : results)
+  {
+    std::cout << result.Name;
+    for (const auto& param : result.Params)
+      std::cout << " " << param.first << "=" << param.second;
+    std::cout << ": " << result.NsPerCall << " ns" << std::endl;
+  }
+  std::cout << results.size() << " timings written to " << jsonName << std::endl;
+}
@@ -0,0 +1,87 @@
+// root includes
+#include "TFile.h"
+#include "TKey.h"
+#include "TStopwatch.h"
+#include "TSystem.h"
+
+// std incldes
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// the hist stage itself, so both paths run exactly the production code
+#include "makeHists_db_postgre.cc"
+
+// Time makeHists_db_postgre over one skim deriving with the hard-coded PFP
+// classification and with the same classification given as compiled
+// selection expressions (classify=), and check that every histogram comes out
+// bin for bin the same. Both derive from the slice payload (noderived), so
+// the only difference is the selection. The fastest of reps runs counts.
+// Stdout of the hist stage goes to <outDir>/bench_selection.log.
+void benchSelection(std::string skimFileName, unsigned int minRun, unsigned int maxRun,
+                    int reps = 3, std::string outDir = ".")
+{
+  std::string selectionName = outDir + "/bench_selection.sel";
+  {
+    std::ofstream selectionFile(selectionName);
+    selectionFile << "goodTrack   trackLength > 0\n"
+                  << "goodShower  showerLength > 0\n"
+                  << "clearCosmic clearCosmic != 0\n"
+                  << "neutrino    std::abs(crLongestTrackDirY) < 0.1\n";
+  }
+
+  std::string logName = outDir + "/bench_selection.log";
+  auto bestOf = [&](const std::string& outFileName, const std::string& options)
+  {
+    double best = std::numeric_limits<double>::max();
+    for (int rep = 0; rep < reps; ++rep)
+    {
+      gSystem->RedirectOutput(logName.c_str(), "a");
+      TStopwatch watch;
+      makeHists_db_postgre(skimFileName, outFileName, minRun, maxRun, false, options);
+      double elapsed = watch.RealTime();
+      gSystem->RedirectOutput(nullptr);
+      best = std::min(best, elapsed);
+    }
+    return best;
+  };
+
+  std::string hardCodedName = outDir + "/bench_selection_builtin.root";
+  std::string compiledName = outDir + "/bench_selection_compiled.root";
+  double hardCoded = bestOf(hardCodedName, "noderived");
+  double compiled = bestOf(compiledName, "noderived,classify=" + selectionName);
+
+  // every histogram of the hard-coded output, bin for bin in the compiled one
+  int nHists = 0, nDiffer = 0;
+  {
+    std::unique_ptr<TFile> hardCodedFile(TFile::Open(hardCodedName.c_str(), "READ"));
+    std::unique_ptr<TFile> compiledFile(TFile::Open(compiledName.c_str(), "READ"));
+    TIter next(hardCodedFile->GetListOfKeys());
+    while (TKey* key = (TKey*)next())
+    {
+      TH1* hist = hardCodedFile->Get<TH1>(key->GetName());
+      if (not hist)
+        continue;
+      ++nHists;
+      TH1* other = compiledFile->Get<TH1>(key->GetName());
+      bool same = other && other->GetNcells() == hist->GetNcells();
+      for (int bin = 0; same && bin < hist->GetNcells(); ++bin)
+        same = (hist->GetBinContent(bin) == other->GetBinContent(bin));
+      if (not same)
+      {
+        ++nDiffer;
+        std::cout << "Histogram " << key->GetName() << " differs" << std::endl;
+      }
+    }
+  }
+  gSystem->Unlink(hardCodedName.c_str());
+  gSystem->Unlink(compiledName.c_str());
+  gSystem->Unlink(selectionName.c_str());
+
+  std::cout << "Hist stage, hard-coded selection: " << hardCoded << " s" << std::endl;
+  std::cout << "Hist stage, compiled selection:   " << compiled << " s" << std::endl;
+  std::cout << "Compiled selection costs " << 100 * (compiled - hardCoded) / hardCoded << "%" << std::endl;
+  std::cout << ((nDiffer == 0 && nHists > 0) ? "PASS" : "FAIL") << ": " << nHists - nDiffer << " of "
+            << nHists << " histograms identical" << std::endl;
+}
@@ -0,0 +1,126 @@
+// root includes
+#include "TChain.h"
+#include "TFile.h"
+#include "TStopwatch.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+// std incldes
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <vector>
+
+// the skim itself, so both read paths run exactly the production code
+#include "makeTTree_db_postgre.cc"
+
+// Skim the same input with the per-entry read path (nobulk: header entry by
+// entry, payload with one TTree::GetEntry per event) and with the batched
+// one (header a cluster at a time through bulk I/O, payload column by
+// column), and report input entries per second for both. Each path runs reps
+// times and the fastest run counts. The two outputs must hold the same
+// branches with the same values, entry by entry: each branch is scanned
+// (TTree::Scan, full precision) from both and the scans compared. Stdout of
+// the skim goes to <outDir>/bench_batch.log.
+void benchSkimBatch(std::string srFileName, int reps = 3, std::string outDir = ".")
+{
+  std::string logName = outDir + "/bench_batch.log";
+  auto bestOf = [&](const std::string& outFileName, const std::string& options)
+  {
+    double best = std::numeric_limits<double>::max();
+    for (int rep = 0; rep < reps; ++rep)
+    {
+      gSystem->RedirectOutput(logName.c_str(), "a");
+      TStopwatch watch;
+      makeTTree_db_postgre(srFileName, outFileName, false, options + ",checkpoint=0,nometa");
+      double elapsed = watch.RealTime();
+      gSystem->RedirectOutput(nullptr);
+      best = std::min(best, elapsed);
+    }
+    return best;
+  };
+
+  std::string perEntryName = outDir + "/bench_batch_perentry.root";
+  std::string batchedName = outDir + "/bench_batch_batched.root";
+  double perEntry = bestOf(perEntryName, "nobulk");
+  double batched = bestOf(batchedName, "");
+
+  // the input entry count, for the rate
+  Long64_t nInput = 0;
+  {
+    TChain inChain("recTree");
+    if (srFileName.find(".txt") != std::string::npos)
+    {
+      std::ifstream inFileList(srFileName);
+      std::string inFile;
+      while (std::getline(inFileList, inFile))
+        if (not inFile.empty())
+          inChain.Add(inFile.c_str());
+    } else {
+      inChain.Add(srFileName.c_str());
+    }
+    nInput = inChain.GetEntries();
+  }
+
+  // the branches whose values differ, or that one output lacks
+  Long64_t perEntryOut = -1, batchedOut = -2;
+  std::vector<std::string> differing;
+  {
+    std::unique_ptr<TFile> perEntryFile(TFile::Open(perEntryName.c_str(), "READ"));
+    std::unique_ptr<TFile> batchedFile(TFile::Open(batchedName.c_str(), "READ"));
+    TTree* perEntryTree = (perEntryFile) ? perEntryFile->Get<TTree>("data_validation_tree") : nullptr;
+    TTree* batchedTree = (batchedFile) ? batchedFile->Get<TTree>("data_validation_tree") : nullptr;
+    if (perEntryTree && batchedTree)
+    {
+      perEntryOut = perEntryTree->GetEntries();
+      batchedOut = batchedTree->GetEntries();
+      std::string perEntryScan = outDir + "/bench_batch_perentry.scan";
+      std::string batchedScan = outDir + "/bench_batch_batched.scan";
+      auto scan = [&](TTree* tree, const char* branchName, const std::string& scanName)
+      {
+        tree->SetScanField(0);
+        gSystem->RedirectOutput(scanName.c_str(), "w");
+        tree->Scan(branchName, "", "colsize=26 precision=17");
+        std::cout << std::flush;
+        std::fflush(stdout);
+        gSystem->RedirectOutput(nullptr);
+      };
+      for (TObject* branch : *perEntryTree->GetListOfBranches())
+      {
+        const char* branchName = branch->GetName();
+        if (not batchedTree->GetBranch(branchName))
+        {
+          differing.push_back(std::string(branchName) + " (only per-entry)");
+          continue;
+        }
+        scan(perEntryTree, branchName, perEntryScan);
+        scan(batchedTree, branchName, batchedScan);
+        std::ifstream perEntryIn(perEntryScan, std::ios::binary), batchedIn(batchedScan, std::ios::binary);
+        std::istreambuf_iterator<char> end;
+        if (not std::equal(std::istreambuf_iterator<char>(perEntryIn), end, std::istreambuf_iterator<char>(batchedIn), end))
+          differing.push_back(branchName);
+      }
+      for (TObject* branch : *batchedTree->GetListOfBranches())
+        if (not perEntryTree->GetBranch(branch->GetName()))
+          differing.push_back(std::string(branch->GetName()) + " (only batched)");
+      gSystem->Unlink(perEntryScan.c_str());
+      gSystem->Unlink(batchedScan.c_str());
+    }
+  }
+  gSystem->Unlink(perEntryName.c_str());
+  gSystem->Unlink(batchedName.c_str());
+
+  std::cout << "Skim, per-entry read: " << perEntry << " s, " << nInput / perEntry << " entries/s" << std::endl;
+  std::cout << "Skim, batched read:   " << batched << " s, " << nInput / batched << " entries/s" << std::endl;
+  std::cout << "Speedup " << perEntry / batched << "x over " << nInput << " input entries" << std::endl;
+  bool same = (perEntryOut == batchedOut && differing.empty());
+  std::cout << ((same) ? "PASS" : "FAIL") << ": outputs hold " << perEntryOut << " and " << batchedOut << " entries, "
+            << ((differing.empty()) ? "every branch agrees" : std::to_string(differing.size()) + " branches differ:")
+            << std::endl;
+  for (const std::string& branchName : differing)
+    std::cout << "  " << branchName << std::endl;
+}
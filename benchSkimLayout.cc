@@ -0,0 +1,85 @@
+// root includes
+#include "TFile.h"
+#include "TStopwatch.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+// std incldes
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// the skim itself, so every profile runs exactly the production code
+#include "makeTTree_db_postgre.cc"
+
+// Skim the same input once per layout profile and compare output size,
+// write time, and the time to read the output back in full.
+// profiles is a ';' separated list of skim option strings, e.g.
+//   "layout=default;layout=compact;layout=fast;layout=small,floatbits=12"
+// Keep the input small (a few files); each profile reruns the whole skim.
+void benchSkimLayout(std::string srFileName, std::string outDir = ".",
+                     std::string profiles = "layout=default;layout=compact;layout=fast;layout=small")
+{
+  std::vector<std::string> profileList;
+  std::stringstream profileStrm(profiles);
+  std::string profile;
+  while (std::getline(profileStrm, profile, ';'))
+    if (not profile.empty())
+      profileList.push_back(profile);
+
+  struct benchResult
+  {
+    std::string Profile;
+    Long64_t Bytes = 0;
+    Long64_t Entries = 0;
+    double WriteSec = 0;
+    double ReadSec = 0;
+  };
+  std::vector<benchResult> results;
+
+  for (size_t idx = 0; idx < profileList.size(); ++idx)
+  {
+    benchResult result;
+    result.Profile = profileList[idx];
+    std::string outFileName = outDir + "/bench_layout_" + std::to_string(idx) + ".root";
+
+    TStopwatch writeWatch;
+    makeTTree_db_postgre(srFileName, outFileName, false, profileList[idx] + ",checkpoint=0,nodedup");
+    result.WriteSec = writeWatch.RealTime();
+
+    // read every branch of every entry, which is what the hist stage pays
+    TStopwatch readWatch;
+    std::unique_ptr<TFile> outFile(TFile::Open(outFileName.c_str(), "READ"));
+    if (not outFile || outFile->IsZombie())
+    {
+      std::cout << "Could not open " << outFileName << ", skipping profile " << profileList[idx] << std::endl;
+      continue;
+    }
+    TTree* outTree = outFile->Get<TTree>("data_validation_tree");
+    if (not outTree)
+    {
+      std::cout << "No skim tree in " << outFileName << ", skipping profile " << profileList[idx] << std::endl;
+      continue;
+    }
+    result.Entries = outTree->GetEntries();
+    for (Long64_t iEntry = 0; iEntry < result.Entries; ++iEntry)
+      outTree->GetEntry(iEntry);
+    result.ReadSec = readWatch.RealTime();
+    result.Bytes = outFile->GetSize();
+    outFile->Close();
+
+    gSystem->Unlink(outFileName.c_str());
+    gSystem->Unlink((outFileName + ".ckpt").c_str());
+    results.push_back(result);
+  }
+
+  std::cout << std::endl << "profile | MB | entries | write s | read s | read MB/s" << std::endl;
+  for (const auto& result : results)
+  {
+    double mb = result.Bytes / 1.e6;
+    std::cout << result.Profile << " | " << mb << " | " << result.Entries << " | "
+              << result.WriteSec << " | " << result.ReadSec << " | "
+              << ((result.ReadSec > 0) ? mb / result.ReadSec : 0) << std::endl;
+  }
+}
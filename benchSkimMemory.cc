@@ -0,0 +1,80 @@
+// root includes
+#include "TSystem.h"
+
+// std incldes
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Skim growing prefixes of an input list (1, 2, 4, ... files) under a memory
+// budget and show that peak RSS stays flat as the input grows. Each skim runs
+// in its own root process, since peak RSS only ever goes up within one;
+// its output goes to <outDir>/bench_memory_<N>.log.
+// Passes if the largest input peaks within tolerance of the smallest.
+void benchSkimMemory(std::string srFileList, int memBudgetMB = 2000,
+                     double tolerance = 0.1, std::string outDir = ".")
+{
+  std::vector<std::string> inFileNames;
+  std::ifstream inFileList(srFileList);
+  std::string inFile;
+  while (std::getline(inFileList, inFile))
+    if (not inFile.empty())
+      inFileNames.push_back(inFile);
+  if (inFileNames.empty())
+  {
+    std::cout << "No input files in " << srFileList << ". Bail." << std::endl;
+    return;
+  }
+
+  std::vector<size_t> nFiles;
+  std::vector<double> peakMB;
+  for (size_t prefix = 1; ; prefix *= 2)
+  {
+    prefix = std::min(prefix, inFileNames.size());
+    std::string prefixName = outDir + "/bench_memory_" + std::to_string(prefix) + ".txt";
+    std::string outFileName = outDir + "/bench_memory_" + std::to_string(prefix) + ".root";
+    std::string logName = outDir + "/bench_memory_" + std::to_string(prefix) + ".log";
+    {
+      std::ofstream prefixList(prefixName);
+      for (size_t idx = 0; idx < prefix; ++idx)
+        prefixList << inFileNames[idx] << '\n';
+    }
+    std::string command = "root -l -b -q 'makeTTree_db_postgre.cc(\"" + prefixName + "\",\"" + outFileName
+                        + "\",false,\"membudget=" + std::to_string(memBudgetMB) + ",checkpoint=0\")' > "
+                        + logName + " 2>&1";
+    gSystem->Exec(command.c_str());
+
+    // the skim ends with "Peak RSS <MB> MB ..."
+    double peak = -1;
+    std::ifstream log(logName);
+    std::string line;
+    while (std::getline(log, line))
+      if (line.compare(0, 9, "Peak RSS ") == 0)
+        std::stringstream(line.substr(9)) >> peak;
+    nFiles.push_back(prefix);
+    peakMB.push_back(peak);
+    gSystem->Unlink(prefixName.c_str());
+    gSystem->Unlink(outFileName.c_str());
+    gSystem->Unlink((outFileName + ".ckpt").c_str());
+    if (prefix == inFileNames.size())
+      break;
+  }
+
+  std::cout << std::endl << "files | peak RSS MB" << std::endl;
+  for (size_t idx = 0; idx < nFiles.size(); ++idx)
+    std::cout << nFiles[idx] << " | " << peakMB[idx] << std::endl;
+  if (peakMB.front() <= 0 || peakMB.back() <= 0)
+  {
+    std::cout << "FAIL: a skim did not report its peak RSS, see the logs" << std::endl;
+    return;
+  }
+  double growth = peakMB.back() / peakMB.front() - 1;
+  bool flat = (growth <= tolerance);
+  bool underBudget = (peakMB.back() <= memBudgetMB);
+  std::cout << ((flat && underBudget) ? "PASS" : "FAIL") << ": peak RSS grew " << 100 * growth
+            << "% from " << nFiles.front() << " to " << nFiles.back() << " files (tolerance "
+            << 100 * tolerance << "%), budget " << memBudgetMB << " MB" << std::endl;
+}
@@ -0,0 +1,396 @@
+// root includes
+#include "TFile.h"
+#include "TH2.h"
+#include "TKey.h"
+#include "TMath.h"
+#include "TStopwatch.h"
+
+// std incldes
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// local includes
+#include "dqCommon.h"
+
+// one run (x) column of a per-run TH2D: its nonzero y bins in bin order,
+// their total and a hash of the contents
+struct runColumn
+{
+  unsigned int Run = 0;
+  std::vector<int> Bins;
+  std::vector<double> Counts;
+  double Sum = 0;
+  uint64_t Hash = 0;
+  void add(int bin, double count)
+  {
+    Bins.push_back(bin);
+    Counts.push_back(count);
+    Sum += count;
+    uint64_t countBits;
+    std::memcpy(&countBits, &count, sizeof(countBits));
+    Hash = mixBits(mixBits(Hash ^ static_cast<uint64_t>(bin)) ^ countBits);
+  }
+};
+
+// every run column of one histogram, runs ascending
+struct histColumns
+{
+  std::string Name;
+  std::vector<double> YCenters;
+  std::vector<runColumn> Runs;
+};
+
+// how a run compares to its reference in one histogram
+struct runMetrics
+{
+  bool Tested = false;
+  double N = 0;
+  double NRef = 0;
+  double KSProb = 1;
+  double Chi2NDF = 0;
+  double Shift = 0;   // mean difference over its error
+  uint64_t Key = 0;   // hash of run and reference contents, what the cache is keyed on
+  // how far past the worst of its thresholds, > 1 means flagged
+  double severity(double ksCut, double chi2Cut, double shiftCut) const
+  {
+    if (not Tested)
+      return 0;
+    double ksSeverity = (KSProb > 0) ? std::log10(KSProb) / std::log10(ksCut) : 1e3;
+    return std::max({ksSeverity, Chi2NDF / chi2Cut, std::fabs(Shift) / shiftCut});
+  }
+};
+
+// KS, chi2 (both unnormalized, "UU") and mean shift of run against ref,
+// walking the nonzero bins of both in order
+runMetrics compareColumns(const runColumn& run, const runColumn& ref, const std::vector<double>& yCenters)
+{
+  runMetrics metrics;
+  metrics.Tested = true;
+  metrics.N = run.Sum;
+  metrics.NRef = ref.Sum;
+  double cdfDiff = 0, maxCdfDiff = 0;
+  double chi2 = 0;
+  int nUsedBins = 0;
+  double sumY = 0, sumY2 = 0, refSumY = 0, refSumY2 = 0;
+  double runScale = std::sqrt(ref.Sum / run.Sum), refScale = std::sqrt(run.Sum / ref.Sum);
+  size_t runIdx = 0, refIdx = 0;
+  while (runIdx < run.Bins.size() || refIdx < ref.Bins.size())
+  {
+    int runBin = (runIdx < run.Bins.size()) ? run.Bins[runIdx] : std::numeric_limits<int>::max();
+    int refBin = (refIdx < ref.Bins.size()) ? ref.Bins[refIdx] : std::numeric_limits<int>::max();
+    int bin = std::min(runBin, refBin);
+    double count = (runBin == bin) ? run.Counts[runIdx++] : 0;
+    double refCount = (refBin == bin) ? ref.Counts[refIdx++] : 0;
+    cdfDiff += count / run.Sum - refCount / ref.Sum;
+    maxCdfDiff = std::max(maxCdfDiff, std::fabs(cdfDiff));
+    double diff = runScale * count - refScale * refCount;
+    chi2 += diff * diff / (count + refCount);
+    ++nUsedBins;
+    double y = yCenters[bin];
+    sumY += count * y;
+    sumY2 += count * y * y;
+    refSumY += refCount * y;
+    refSumY2 += refCount * y * y;
+  }
+  double nEff = run.Sum * ref.Sum / (run.Sum + ref.Sum);
+  metrics.KSProb = TMath::KolmogorovProb(maxCdfDiff * std::sqrt(nEff));
+  metrics.Chi2NDF = (nUsedBins > 1) ? chi2 / (nUsedBins - 1) : 0;
+  double mean = sumY / run.Sum, refMean = refSumY / ref.Sum;
+  double var = std::max(0., sumY2 / run.Sum - mean * mean);
+  double refVar = std::max(0., refSumY2 / ref.Sum - refMean * refMean);
+  double meanErr = std::sqrt(var / run.Sum + refVar / ref.Sum);
+  metrics.Shift = (meanErr > 0) ? (mean - refMean) / meanErr : 0;
+  return metrics;
+}
+
+// options (comma separated):
+//   reference=RUN   compare every run against RUN instead of a rolling window
+//   window=N        reference is the sum of the previous N runs with at least
+//                   minevents entries (default 5)
+//   minevents=N     runs with fewer entries in a histogram are not tested in
+//                   it, nor used as reference (default 100)
+//   hists=A:B:...   only these histograms (default every per-run TH2D but the
+//                   POT weighted _wgt copies)
+//   ks=P            flag when the KS probability is below P (default 1e-6)
+//   chi2=X          flag when chi2/ndf is above X (default 5)
+//   shift=S         flag when the means differ by more than S errors (default 5)
+//   threads=N       comparisons run on N threads (default all cores)
+//   all             list every tested run, not just the flagged ones
+//   nocache         recompute everything; otherwise metrics are kept in
+//                   <outFileName>.cache and only comparisons whose run or
+//                   reference contents changed are redone
+// Writes a table of runs ranked by how far past a threshold their worst
+// histogram is, with that histogram's metrics and every histogram that failed.
+void compareRuns(std::string histFileName, std::string outFileName = "flagged_runs.tsv", std::string options = "")
+{
+  optionMap opts = parseOptions(options);
+  unsigned int referenceRun = optionValue<unsigned int>(opts, "reference", 0);
+  int window = optionValue<int>(opts, "window", 5);
+  double minEvents = optionValue<double>(opts, "minevents", 100);
+  double ksCut = optionValue<double>(opts, "ks", 1e-6);
+  double chi2Cut = optionValue<double>(opts, "chi2", 5);
+  double shiftCut = optionValue<double>(opts, "shift", 5);
+  unsigned int nThreads = optionValue<unsigned int>(opts, "threads", std::max(1u, std::thread::hardware_concurrency()));
+  bool listAll = hasOption(opts, "all");
+  bool useCache = not hasOption(opts, "nocache");
+  std::string cacheName = outFileName + ".cache";
+  std::vector<std::string> histNames;
+  {
+    std::stringstream histStrm(optionValue<std::string>(opts, "hists", ""));
+    std::string histName;
+    while (std::getline(histStrm, histName, ':'))
+      if (not histName.empty())
+        histNames.push_back(histName);
+  }
+  TStopwatch watch;
+
+  std::unique_ptr<TFile> histFile(TFile::Open(histFileName.c_str(), "READ"));
+  if (not histFile || histFile->IsZombie())
+  {
+    std::cout << "Could not open " << histFileName << ". Bail." << std::endl;
+    return;
+  }
+  TH1* nEventsPerRun = histFile->Get<TH1>("nEventsPerRun");
+  if (not nEventsPerRun)
+  {
+    std::cout << "No nEventsPerRun in " << histFileName << ", not a makeHists output? Bail." << std::endl;
+    return;
+  }
+  const TAxis* runAxis = nEventsPerRun->GetXaxis();
+  if (histNames.empty())
+  {
+    TIter nextKey(histFile->GetListOfKeys());
+    while (TKey* key = static_cast<TKey*>(nextKey()))
+    {
+      std::string name = key->GetName();
+      if (std::strcmp(key->GetClassName(), "TH2D") == 0
+          && (name.size() < 4 || name.compare(name.size() - 4, 4, "_wgt") != 0))
+        histNames.push_back(name);
+    }
+  }
+
+  // pull the nonzero bins of every run column out of ROOT up front, so the
+  // comparisons below only touch plain vectors and can run on any thread
+  std::vector<histColumns> hists;
+  for (const auto& histName : histNames)
+  {
+    TH2D* hist = histFile->Get<TH2D>(histName.c_str());
+    if (not hist || hist->GetNbinsX() != runAxis->GetNbins()
+        || hist->GetXaxis()->GetXmin() != runAxis->GetXmin())
+    {
+      std::cout << "Skipping " << histName << ": not a per-run TH2D" << std::endl;
+      continue;
+    }
+    histColumns columns;
+    columns.Name = histName;
+    int nXBins = hist->GetNbinsX();
+    int nYBins = hist->GetNbinsY();
+    columns.YCenters.resize(nYBins + 2);
+    for (int yBin = 0; yBin <= nYBins + 1; ++yBin)
+      columns.YCenters[yBin] = hist->GetYaxis()->GetBinCenter(yBin);
+    const double* contents = hist->GetArray();
+    for (int xBin = 1; xBin <= nXBins; ++xBin)
+    {
+      if (nEventsPerRun->GetBinContent(xBin) <= 0)
+        continue;
+      runColumn column;
+      column.Run = static_cast<unsigned int>(std::lround(runAxis->GetBinCenter(xBin)));
+      for (int yBin = 1; yBin <= nYBins; ++yBin)
+      {
+        double count = contents[xBin + (nXBins + 2) * yBin];
+        if (count != 0)
+          column.add(yBin, count);
+      }
+      if (column.Sum > 0)
+        columns.Runs.push_back(std::move(column));
+    }
+    hists.push_back(std::move(columns));
+    delete hist;
+  }
+  if (hists.empty())
+  {
+    std::cout << "No per-run histograms to compare. Bail." << std::endl;
+    return;
+  }
+
+  // metrics from earlier passes, keyed by histogram and run
+  std::unordered_map<std::string, runMetrics> cache;
+  if (useCache)
+  {
+    std::ifstream cacheStrm(cacheName);
+    std::string histName;
+    unsigned int run;
+    runMetrics metrics;
+    while (cacheStrm >> histName >> run >> std::hex >> metrics.Key >> std::dec
+                     >> metrics.N >> metrics.NRef >> metrics.KSProb >> metrics.Chi2NDF >> metrics.Shift)
+    {
+      metrics.Tested = true;
+      cache[histName + '\t' + std::to_string(run)] = metrics;
+    }
+  }
+
+  // one task per (histogram, run); each worker keeps a dense scratch column
+  // to sum its rolling window reference in
+  struct compareTask
+  {
+    size_t Hist;
+    size_t Run;
+  };
+  std::vector<compareTask> tasks;
+  std::vector<std::vector<runMetrics>> results(hists.size());
+  for (size_t histIdx = 0; histIdx < hists.size(); ++histIdx)
+  {
+    results[histIdx].resize(hists[histIdx].Runs.size());
+    for (size_t runIdx = 0; runIdx < hists[histIdx].Runs.size(); ++runIdx)
+      if (hists[histIdx].Runs[runIdx].Sum >= minEvents && hists[histIdx].Runs[runIdx].Run != referenceRun)
+        tasks.push_back({histIdx, runIdx});
+  }
+  std::atomic<size_t> nextTask(0);
+  std::atomic<long> nReused(0);
+  auto worker = [&]()
+  {
+    std::vector<double> scratch;
+    std::vector<char> touched;
+    runColumn ref;
+    for (size_t taskIdx = nextTask++; taskIdx < tasks.size(); taskIdx = nextTask++)
+    {
+      const histColumns& columns = hists[tasks[taskIdx].Hist];
+      const runColumn& run = columns.Runs[tasks[taskIdx].Run];
+      ref = runColumn();
+      if (referenceRun > 0)
+      {
+        auto refRun = std::lower_bound(columns.Runs.begin(), columns.Runs.end(), referenceRun,
+                                       [](const runColumn& column, unsigned int value) { return column.Run < value; });
+        if (refRun != columns.Runs.end() && refRun->Run == referenceRun)
+          ref = *refRun;
+      } else {
+        scratch.assign(columns.YCenters.size(), 0);
+        touched.assign(columns.YCenters.size(), 0);
+        int nInWindow = 0;
+        for (size_t prevIdx = tasks[taskIdx].Run; prevIdx-- > 0 && nInWindow < window; )
+        {
+          const runColumn& prev = columns.Runs[prevIdx];
+          if (prev.Sum < minEvents)
+            continue;
+          for (size_t binIdx = 0; binIdx < prev.Bins.size(); ++binIdx)
+          {
+            scratch[prev.Bins[binIdx]] += prev.Counts[binIdx];
+            touched[prev.Bins[binIdx]] = 1;
+          }
+          ++nInWindow;
+        }
+        for (size_t bin = 0; bin < scratch.size(); ++bin)
+          if (touched[bin] && scratch[bin] != 0)
+            ref.add(bin, scratch[bin]);
+      }
+      if (ref.Sum <= 0)
+        continue;
+      uint64_t key = mixBits(run.Hash ^ mixBits(ref.Hash));
+      auto cached = cache.find(columns.Name + '\t' + std::to_string(run.Run));
+      if (cached != cache.end() && cached->second.Key == key)
+      {
+        results[tasks[taskIdx].Hist][tasks[taskIdx].Run] = cached->second;
+        ++nReused;
+        continue;
+      }
+      runMetrics metrics = compareColumns(run, ref, columns.YCenters);
+      metrics.Key = key;
+      results[tasks[taskIdx].Hist][tasks[taskIdx].Run] = metrics;
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned int threadIdx = 1; threadIdx < nThreads; ++threadIdx)
+    workers.emplace_back(worker);
+  worker();
+  for (auto& thread : workers)
+    thread.join();
+
+  // rank runs by their worst histogram
+  struct runFlag
+  {
+    unsigned int Run = 0;
+    double Severity = 0;
+    std::string Worst;
+    runMetrics WorstMetrics;
+    std::string Failed;
+  };
+  std::map<unsigned int, runFlag> runFlags;
+  long nTested = 0;
+  for (size_t histIdx = 0; histIdx < hists.size(); ++histIdx)
+  {
+    for (size_t runIdx = 0; runIdx < hists[histIdx].Runs.size(); ++runIdx)
+    {
+      const runMetrics& metrics = results[histIdx][runIdx];
+      if (not metrics.Tested)
+        continue;
+      ++nTested;
+      unsigned int run = hists[histIdx].Runs[runIdx].Run;
+      runFlag& flag = runFlags[run];
+      flag.Run = run;
+      double severity = metrics.severity(ksCut, chi2Cut, shiftCut);
+      if (severity > 1)
+        flag.Failed += (flag.Failed.empty() ? "" : ",") + hists[histIdx].Name;
+      if (flag.Worst.empty() || severity > flag.Severity)
+      {
+        flag.Severity = severity;
+        flag.Worst = hists[histIdx].Name;
+        flag.WorstMetrics = metrics;
+      }
+    }
+  }
+  std::vector<runFlag> ranked;
+  for (const auto& flag : runFlags)
+    if (listAll || flag.second.Severity > 1)
+      ranked.push_back(flag.second);
+  std::sort(ranked.begin(), ranked.end(),
+            [](const runFlag& lhs, const runFlag& rhs) { return lhs.Severity > rhs.Severity; });
+
+  std::ofstream outStrm(outFileName, std::ios::trunc);
+  outStrm << "# run\tseverity\tworst\tnevents\tks_prob\tchi2ndf\tshift\tfailed\n";
+  for (const auto& flag : ranked)
+    outStrm << flag.Run << '\t' << flag.Severity << '\t' << flag.Worst << '\t'
+            << flag.WorstMetrics.N << '\t' << flag.WorstMetrics.KSProb << '\t'
+            << flag.WorstMetrics.Chi2NDF << '\t' << flag.WorstMetrics.Shift << '\t'
+            << (flag.Failed.empty() ? "-" : flag.Failed) << '\n';
+
+  // write to a temporary and rename, like the skim checkpoint
+  if (useCache)
+  {
+    std::string tmpName = cacheName + ".tmp";
+    {
+      std::ofstream cacheStrm(tmpName, std::ios::trunc);
+      cacheStrm.precision(17);
+      for (size_t histIdx = 0; histIdx < hists.size(); ++histIdx)
+        for (size_t runIdx = 0; runIdx < hists[histIdx].Runs.size(); ++runIdx)
+        {
+          const runMetrics& metrics = results[histIdx][runIdx];
+          if (metrics.Tested)
+            cacheStrm << hists[histIdx].Name << '\t' << hists[histIdx].Runs[runIdx].Run << '\t'
+                      << std::hex << metrics.Key << std::dec << '\t' << metrics.N << '\t' << metrics.NRef << '\t'
+                      << metrics.KSProb << '\t' << metrics.Chi2NDF << '\t' << metrics.Shift << '\n';
+        }
+    }
+    std::rename(tmpName.c_str(), cacheName.c_str());
+  }
+
+  long nFlagged = std::count_if(runFlags.begin(), runFlags.end(),
+                                [](const std::pair<const unsigned int, runFlag>& flag) { return flag.second.Severity > 1; });
+  std::cout << "Compared " << runFlags.size() << " runs in " << hists.size() << " histograms ("
+            << nTested << " comparisons, " << nReused << " from cache) in " << watch.RealTime() << " s on "
+            << nThreads << " threads" << std::endl;
+  std::cout << nFlagged << " runs flagged, see " << outFileName << std::endl;
+  for (size_t idx = 0; idx < ranked.size() && idx < 10 && ranked[idx].Severity > 1; ++idx)
+    std::cout << "  run " << ranked[idx].Run << "  " << ranked[idx].Worst << "  severity " << ranked[idx].Severity << std::endl;
+}
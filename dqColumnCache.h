@@ -0,0 +1,442 @@
+#ifndef DQCOLUMNCACHE_H
+#define DQCOLUMNCACHE_H
+
+// local columnar cache of a skim for makeHists_db_postgre: every branch the
+// hist stage binds, uncompressed and flat in its own file, built once and
+// then mapped into memory on later runs instead of being decompressed and
+// streamed again
+
+// root includes
+#include "TFile.h"
+#include "TTree.h"
+
+// std includes
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// system includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// local includes
+#include "dqCommon.h"
+#include "dqHistPlan.h"
+#include "dqSchema.h"
+
+// bump when the file layout or a column type changes, so old caches get rebuilt
+constexpr int kColumnCacheVersion = 3;
+
+// a whole file mapped read-only
+class mappedFile
+{
+public:
+  mappedFile() = default;
+  mappedFile(const mappedFile&) = delete;
+  mappedFile& operator=(const mappedFile&) = delete;
+  ~mappedFile()
+  {
+    if (Addr)
+      munmap(Addr, Size);
+  }
+  bool open(const std::string& fileName)
+  {
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat fileStat;
+    bool good = (fstat(fd, &fileStat) == 0);
+    Size = (good) ? fileStat.st_size : 0;
+    // an empty column maps nothing
+    if (good && Size > 0)
+    {
+      void* addr = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, fd, 0);
+      good = (addr != MAP_FAILED);
+      Addr = (good) ? addr : nullptr;
+      if (good)
+        madvise(Addr, Size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+    return good;
+  }
+  template <typename T>
+  const T* as() const { return static_cast<const T*>(Addr); }
+  size_t size() const { return Size; }
+
+private:
+  void* Addr = nullptr;
+  size_t Size = 0;
+};
+
+// histEvent holds the derived quantities in a member struct
+template <typename Owner> Owner& columnOwner(histEvent& evt);
+template <> inline histEvent& columnOwner<histEvent>(histEvent& evt) { return evt; }
+template <> inline derivedEvent& columnOwner<derivedEvent>(histEvent& evt) { return evt.Derived; }
+
+// what a column has to do: stream entries out while the cache is built, and
+// once it is mapped, copy one entry into the histEvent the plan fills from.
+// Files are <dir>/<branch>.col for the values, plus for vector branches
+// <branch>.off with each entry's first value (and the end), and for vectors
+// of vectors <branch>.inner with each inner vector's first value.
+class cacheColumn
+{
+public:
+  explicit cacheColumn(const std::string& branch) : Branch(branch) {}
+  virtual ~cacheColumn() = default;
+  const std::string Branch;
+  virtual bool begin(const std::string& dir) = 0;
+  virtual void append(histEvent& evt) = 0;
+  virtual bool end() = 0;
+  virtual bool map(const std::string& dir, Long64_t nEntries) = 0;
+  virtual void attach(histEvent& evt) = 0;
+  virtual void load(Long64_t entry, histEvent& evt) = 0;
+
+protected:
+  std::string path(const std::string& dir, const char* suffix) const { return dir + "/" + Branch + suffix; }
+  template <typename T>
+  static void put(std::ofstream& strm, const T& value) { strm.write(reinterpret_cast<const char*>(&value), sizeof(T)); }
+};
+
+// vector<bool> has no contiguous storage, so its values are cached as chars
+template <typename T>
+using cachedType = std::conditional_t<std::is_same<T, bool>::value, char, T>;
+
+template <typename T, typename Owner>
+class scalarColumn : public cacheColumn
+{
+public:
+  scalarColumn(const std::string& branch, T Owner::* member) : cacheColumn(branch), Member(member) {}
+  bool begin(const std::string& dir) override
+  {
+    DataOut.open(path(dir, ".col"), std::ios::binary | std::ios::trunc);
+    return DataOut.good();
+  }
+  void append(histEvent& evt) override { put(DataOut, columnOwner<Owner>(evt).*Member); }
+  bool end() override
+  {
+    DataOut.close();
+    return not DataOut.fail();
+  }
+  bool map(const std::string& dir, Long64_t nEntries) override
+  {
+    return Data.open(path(dir, ".col")) && Data.size() == nEntries * sizeof(T);
+  }
+  void attach(histEvent&) override {}
+  void load(Long64_t entry, histEvent& evt) override { columnOwner<Owner>(evt).*Member = Data.as<T>()[entry]; }
+
+private:
+  T Owner::* Member;
+  std::ofstream DataOut;
+  mappedFile Data;
+};
+
+template <typename T>
+class vectorColumn : public cacheColumn
+{
+public:
+  vectorColumn(const std::string& branch, std::vector<T>* histEvent::* member) : cacheColumn(branch), Member(member) {}
+  bool begin(const std::string& dir) override
+  {
+    DataOut.open(path(dir, ".col"), std::ios::binary | std::ios::trunc);
+    OffsetsOut.open(path(dir, ".off"), std::ios::binary | std::ios::trunc);
+    put(OffsetsOut, NValues);
+    return DataOut.good() && OffsetsOut.good();
+  }
+  void append(histEvent& evt) override
+  {
+    if (const std::vector<T>* values = evt.*Member)
+    {
+      std::vector<cachedType<T>> stored(values->begin(), values->end());
+      DataOut.write(reinterpret_cast<const char*>(stored.data()), stored.size() * sizeof(cachedType<T>));
+      NValues += stored.size();
+    }
+    put(OffsetsOut, NValues);
+  }
+  bool end() override
+  {
+    DataOut.close();
+    OffsetsOut.close();
+    return not DataOut.fail() && not OffsetsOut.fail();
+  }
+  bool map(const std::string& dir, Long64_t nEntries) override
+  {
+    return Data.open(path(dir, ".col")) && Offsets.open(path(dir, ".off"))
+        && Offsets.size() == (nEntries + 1) * sizeof(uint64_t)
+        && Data.size() == Offsets.as<uint64_t>()[nEntries] * sizeof(cachedType<T>);
+  }
+  void attach(histEvent& evt) override { evt.*Member = &Values; }
+  void load(Long64_t entry, histEvent&) override
+  {
+    const uint64_t* offsets = Offsets.as<uint64_t>();
+    const cachedType<T>* data = Data.as<cachedType<T>>();
+    Values.assign(data + offsets[entry], data + offsets[entry + 1]);
+  }
+
+private:
+  std::vector<T>* histEvent::* Member;
+  std::ofstream DataOut;
+  std::ofstream OffsetsOut;
+  uint64_t NValues = 0;
+  mappedFile Data;
+  mappedFile Offsets;
+  std::vector<T> Values;
+};
+
+template <typename T>
+class nestedColumn : public cacheColumn
+{
+public:
+  nestedColumn(const std::string& branch, std::vector<std::vector<T>>* histEvent::* member) : cacheColumn(branch), Member(member) {}
+  bool begin(const std::string& dir) override
+  {
+    DataOut.open(path(dir, ".col"), std::ios::binary | std::ios::trunc);
+    InnerOut.open(path(dir, ".inner"), std::ios::binary | std::ios::trunc);
+    OffsetsOut.open(path(dir, ".off"), std::ios::binary | std::ios::trunc);
+    put(InnerOut, NValues);
+    put(OffsetsOut, NInner);
+    return DataOut.good() && InnerOut.good() && OffsetsOut.good();
+  }
+  void append(histEvent& evt) override
+  {
+    if (const std::vector<std::vector<T>>* values = evt.*Member)
+    {
+      for (const auto& inner : *values)
+      {
+        DataOut.write(reinterpret_cast<const char*>(inner.data()), inner.size() * sizeof(T));
+        NValues += inner.size();
+        put(InnerOut, NValues);
+      }
+      NInner += values->size();
+    }
+    put(OffsetsOut, NInner);
+  }
+  bool end() override
+  {
+    DataOut.close();
+    InnerOut.close();
+    OffsetsOut.close();
+    return not DataOut.fail() && not InnerOut.fail() && not OffsetsOut.fail();
+  }
+  bool map(const std::string& dir, Long64_t nEntries) override
+  {
+    if (not (Data.open(path(dir, ".col")) && Inner.open(path(dir, ".inner")) && Offsets.open(path(dir, ".off"))
+             && Offsets.size() == (nEntries + 1) * sizeof(uint64_t)))
+      return false;
+    uint64_t nInner = Offsets.as<uint64_t>()[nEntries];
+    return Inner.size() == (nInner + 1) * sizeof(uint64_t)
+        && Data.size() == Inner.as<uint64_t>()[nInner] * sizeof(T);
+  }
+  void attach(histEvent& evt) override { evt.*Member = &Values; }
+  void load(Long64_t entry, histEvent&) override
+  {
+    const uint64_t* offsets = Offsets.as<uint64_t>();
+    const uint64_t* inner = Inner.as<uint64_t>();
+    const T* data = Data.as<T>();
+    // resize keeps the inner vectors' capacity from entry to entry
+    Values.resize(offsets[entry + 1] - offsets[entry]);
+    for (size_t idx = 0; idx < Values.size(); ++idx)
+    {
+      uint64_t innerIdx = offsets[entry] + idx;
+      Values[idx].assign(data + inner[innerIdx], data + inner[innerIdx + 1]);
+    }
+  }
+
+private:
+  std::vector<std::vector<T>>* histEvent::* Member;
+  std::ofstream DataOut;
+  std::ofstream InnerOut;
+  std::ofstream OffsetsOut;
+  uint64_t NValues = 0;
+  uint64_t NInner = 0;
+  mappedFile Data;
+  mappedFile Inner;
+  mappedFile Offsets;
+  std::vector<std::vector<T>> Values;
+};
+
+template <typename T, typename Owner>
+std::unique_ptr<cacheColumn> makeColumn(const char* branch, T Owner::* member)
+{
+  return std::make_unique<scalarColumn<T, Owner>>(branch, member);
+}
+template <typename T>
+std::unique_ptr<cacheColumn> makeColumn(const char* branch, std::vector<T>* histEvent::* member)
+{
+  return std::make_unique<vectorColumn<T>>(branch, member);
+}
+template <typename T>
+std::unique_ptr<cacheColumn> makeColumn(const char* branch, std::vector<std::vector<T>>* histEvent::* member)
+{
+  return std::make_unique<nestedColumn<T>>(branch, member);
+}
+
+// every column the hist stage reads (DQ_SKIM_COLUMNS), as a cache column
+inline std::vector<std::unique_ptr<cacheColumn>> cacheColumnTable()
+{
+  std::vector<std::unique_ptr<cacheColumn>> columns;
+  histEvent::forEachColumn([&](auto column, auto member)
+  {
+    using col = decltype(column);
+    if constexpr (col::Hist)
+      columns.push_back(makeColumn(col::Branch, member));
+  });
+  return columns;
+}
+
+// the cache of one skim: <dir>/manifest.txt names the source file with its
+// UUID, size and modification time, so a rewritten skim invalidates it
+class columnCache
+{
+public:
+  // stamp of the source as the manifest records it, read from the open file
+  // rather than the file system so remote (xrootd) skims are cached too: the
+  // UUID tells a rewritten skim from the old one, the size and ROOT's own
+  // modification date a skim updated in place (a merge's time_index)
+  static std::string sourceStamp(TFile* source)
+  {
+    if (not source)
+      return "";
+    return std::string(source->GetUUID().AsString()) + " " + std::to_string(source->GetSize()) + " "
+         + std::to_string(source->GetModificationDate().Convert());
+  }
+
+  // map an up to date cache; false if there is none or it is stale
+  bool open(const std::string& dir, TFile* source)
+  {
+    std::ifstream manifest(dir + "/manifest.txt");
+    std::string key, stamp;
+    int version = 0;
+    std::set<std::string> cachedBranches;
+    while (manifest >> key)
+    {
+      if (key == "version")
+        manifest >> version;
+      else if (key == "entries")
+        manifest >> Entries;
+      else if (key == "stamp")
+        std::getline(manifest >> std::ws, stamp);
+      else if (key == "column")
+      {
+        std::string branch;
+        manifest >> branch;
+        cachedBranches.insert(branch);
+      }
+    }
+    if (version != kColumnCacheVersion || stamp.empty() || stamp != sourceStamp(source))
+      return false;
+    Columns = cacheColumnTable();
+    for (auto column = Columns.begin(); column != Columns.end(); )
+    {
+      if (not cachedBranches.count((*column)->Branch))
+        column = Columns.erase(column);
+      else if (not (*column)->map(dir, Entries))
+        return false;
+      else
+        ++column;
+    }
+    return true;
+  }
+
+  // read every entry of tree once and write the columns it has; evt must
+  // already be bound to tree, derived columns only if readDerived
+  bool build(const std::string& dir, TFile* source, TTree* tree, histEvent& evt, bool readDerived)
+  {
+    mkdir(dir.c_str(), 0755);
+    std::remove((dir + "/manifest.txt").c_str());
+    std::vector<std::unique_ptr<cacheColumn>> columns = cacheColumnTable();
+    std::vector<std::unique_ptr<cacheColumn>> built;
+    tree->SetBranchStatus("*", 1);
+    for (auto& column : columns)
+    {
+      bool derived = (column->Branch.compare(0, 8, "derived.") == 0);
+      if (not tree->GetBranch(column->Branch.c_str()) || (derived && not readDerived))
+        continue;
+      if (not column->begin(dir))
+      {
+        std::cerr << "Could not write cache column " << column->Branch << " in " << dir << std::endl;
+        return false;
+      }
+      built.push_back(std::move(column));
+    }
+    Long64_t nEntries = tree->GetEntries();
+    for (Long64_t entry = 0; entry < nEntries; ++entry)
+    {
+      if (tree->GetEntry(entry) <= 0)
+      {
+        std::cerr << "Could not read entry " << entry << " while building the cache" << std::endl;
+        return false;
+      }
+      evt.widen();
+      for (auto& column : built)
+        column->append(evt);
+    }
+    for (auto& column : built)
+      if (not column->end())
+        return false;
+    // the manifest goes last: a cache without one is never opened
+    std::ofstream manifest(dir + "/manifest.txt", std::ios::trunc);
+    manifest << "version " << kColumnCacheVersion << '\n'
+             << "source " << source->GetName() << '\n'
+             << "stamp " << sourceStamp(source) << '\n'
+             << "entries " << nEntries << '\n';
+    for (const auto& column : built)
+      manifest << "column " << column->Branch << '\n';
+    return manifest.good();
+  }
+
+  // point evt at the columns it will read and keep only those; false if
+  // one of them is not in the cache. loadHeader() loads the header columns.
+  bool activate(histEvent& evt, const std::set<std::string>& branches,
+                const std::vector<std::string>& header = {"run", "subrun", "event"})
+  {
+    std::vector<std::unique_ptr<cacheColumn>> active;
+    for (auto& column : Columns)
+    {
+      if (not branches.count(column->Branch))
+        continue;
+      column->attach(evt);
+      if (std::find(header.begin(), header.end(), column->Branch) != header.end())
+        Header.push_back(column.get());
+      active.push_back(std::move(column));
+    }
+    Columns = std::move(active);
+    for (const auto& branch : branches)
+      if (std::none_of(Columns.begin(), Columns.end(),
+                       [&](const std::unique_ptr<cacheColumn>& column) { return column->Branch == branch; }))
+      {
+        std::cerr << "Branch " << branch << " is not in the cache" << std::endl;
+        return false;
+      }
+    return true;
+  }
+
+  // the event id alone, for a preview to decide on
+  void loadHeader(Long64_t entry, histEvent& evt)
+  {
+    for (cacheColumn* column : Header)
+      column->load(entry, evt);
+  }
+  void load(Long64_t entry, histEvent& evt)
+  {
+    for (auto& column : Columns)
+      column->load(entry, evt);
+  }
+  Long64_t entries() const { return Entries; }
+
+private:
+  Long64_t Entries = 0;
+  std::vector<std::unique_ptr<cacheColumn>> Columns;
+  std::vector<cacheColumn*> Header;
+};
+
+#endif
@@ -0,0 +1,489 @@
+#ifndef DQCOMMON_H
+#define DQCOMMON_H
+
+// helpers shared by makeTTree_db_postgre and makeHists_db_postgre
+
+// std includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using optionMap = std::map<std::string, std::string>;
+
+// parse a macro option string, e.g. "resume, checkpoint=50000", into
+// key/value pairs; bare keys map to an empty value
+inline optionMap parseOptions(const std::string& options)
+{
+  optionMap parsed;
+  std::stringstream optStrm(options);
+  std::string token;
+  while (std::getline(optStrm, token, ','))
+  {
+    size_t first = token.find_first_not_of(" \t");
+    if (first == std::string::npos)
+      continue;
+    size_t last = token.find_last_not_of(" \t");
+    token = token.substr(first, last - first + 1);
+    size_t eq = token.find('=');
+    if (eq == std::string::npos)
+      parsed[token] = "";
+    else
+      parsed[token.substr(0, eq)] = token.substr(eq + 1);
+  }
+  return parsed;
+}
+
+inline bool hasOption(const optionMap& opts, const std::string& key)
+{
+  return opts.find(key) != opts.end();
+}
+
+// value of key=value, or fallback if the key is missing or unparsable
+template <typename T>
+inline T optionValue(const optionMap& opts, const std::string& key, T fallback)
+{
+  auto opt = opts.find(key);
+  if (opt == opts.end() || opt->second.empty())
+    return fallback;
+  std::stringstream valStrm(opt->second);
+  T value;
+  if (not (valStrm >> value))
+  {
+    std::cerr << "Could not parse option " << key << "=" << opt->second
+              << ", using " << fallback << std::endl;
+    return fallback;
+  }
+  return value;
+}
+
+template <>
+inline std::string optionValue<std::string>(const optionMap& opts, const std::string& key, std::string fallback)
+{
+  auto opt = opts.find(key);
+  return (opt == opts.end() || opt->second.empty()) ? fallback : opt->second;
+}
+
+// deterministic 64-bit hash of an event id (splitmix64 finalizer)
+inline uint64_t mixBits(uint64_t bits)
+{
+  bits = (bits ^ (bits >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  bits = (bits ^ (bits >> 27)) * 0x94d049bb133111ebULL;
+  return bits ^ (bits >> 31);
+}
+inline uint64_t eventHash(unsigned int run, unsigned int subrun, unsigned int event)
+{
+  return mixBits(mixBits((static_cast<uint64_t>(run) << 32) | subrun) ^ event);
+}
+
+// preview sampling: an event is kept when the hash of its id falls below
+// fraction * 2^64, so the skim and hist stages pick the same events and each
+// run is sampled at the same rate, independently of file boundaries
+struct previewSampler
+{
+  double Fraction;
+  uint64_t Threshold;
+  previewSampler(double fraction = 1)
+  {
+    Fraction = (fraction > 0 && fraction < 1) ? fraction : 1;
+    Threshold = (Fraction < 1) ? static_cast<uint64_t>(Fraction * 18446744073709551616.0)
+                               : std::numeric_limits<uint64_t>::max();
+  }
+  bool active() const { return Fraction < 1; }
+  bool keep(unsigned int run, unsigned int subrun, unsigned int event) const
+  {
+    return not active() || eventHash(run, subrun, event) < Threshold;
+  }
+};
+
+// events in a run and how many of them a preview kept; the ratio is the
+// per-run scale that brings preview histograms back to full-run counts
+struct previewCounts
+{
+  long long Total = 0;
+  long long Sampled = 0;
+};
+
+// a set of runs read from a list file: one run or first-last range per line,
+// '#' starts a comment. Held as a bitset over the span of the listed runs, so
+// a lookup is a subtraction, a shift and a mask.
+class runMask
+{
+public:
+  // at most this many runs between the first and last listed (2 MB of bits)
+  static constexpr unsigned int kMaxSpan = 1u << 24;
+
+  bool load(const std::string& fileName)
+  {
+    std::ifstream listFile(fileName);
+    if (not listFile)
+    {
+      std::cout << "Cannot open run list " << fileName << std::endl;
+      return false;
+    }
+    std::vector<std::pair<unsigned int, unsigned int>> ranges;
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(listFile, line))
+    {
+      ++lineNo;
+      line = line.substr(0, line.find('#'));
+      if (line.find_first_not_of(" \t\r") == std::string::npos)
+        continue;
+      std::replace(line.begin(), line.end(), '-', ' ');
+      std::stringstream lineStrm(line);
+      unsigned int first = 0, last = 0;
+      if (not (lineStrm >> first))
+      {
+        std::cout << fileName << ":" << lineNo << ": not a run or range" << std::endl;
+        return false;
+      }
+      if (not (lineStrm >> last))
+        last = first;
+      if (last < first)
+        std::swap(first, last);
+      ranges.push_back({first, last});
+    }
+    if (ranges.empty())
+    {
+      std::cout << "Run list " << fileName << " is empty" << std::endl;
+      return false;
+    }
+    unsigned int lo = ranges.front().first, hi = ranges.front().second;
+    for (const auto& range : ranges)
+    {
+      lo = std::min(lo, range.first);
+      hi = std::max(hi, range.second);
+    }
+    if (hi - lo >= kMaxSpan)
+    {
+      std::cout << "Run list " << fileName << " spans runs " << lo << " to " << hi
+                << ", more than " << kMaxSpan << std::endl;
+      return false;
+    }
+    First = lo;
+    Span = hi - lo + 1;
+    Bits.assign(Span / 64 + 1, 0);
+    NRuns = 0;
+    for (const auto& range : ranges)
+      for (unsigned int run = range.first - lo; run <= range.second - lo; ++run)
+        if (not (Bits[run >> 6] & (1ULL << (run & 63))))
+        {
+          Bits[run >> 6] |= 1ULL << (run & 63);
+          ++NRuns;
+        }
+    return true;
+  }
+  bool active() const { return not Bits.empty(); }
+  bool contains(unsigned int run) const
+  {
+    unsigned int offset = run - First;  // wraps for runs below First
+    return offset < Span && (Bits[offset >> 6] >> (offset & 63) & 1);
+  }
+  size_t size() const { return NRuns; }
+
+private:
+  unsigned int First = 0;
+  unsigned int Span = 0;
+  size_t NRuns = 0;
+  std::vector<uint64_t> Bits;
+};
+
+// Cheap event filters evaluated on the header alone, before any payload is
+// read: run-level ones (run range, good and bad run lists) and event-level
+// ones (gate type, events without slices). Options:
+//   minrun=N, maxrun=N  only runs in [minrun, maxrun]
+//   goodruns=FILE       only the runs in FILE (runMask format)
+//   badruns=FILE        never the runs in FILE
+//   gates=A:B:...       only these gate types (db.gateType)
+//   skipempty           drop events without slices
+struct eventFilter
+{
+  unsigned int MinRun = std::numeric_limits<unsigned int>::min();
+  unsigned int MaxRun = std::numeric_limits<unsigned int>::max();
+  runMask GoodRuns;
+  runMask BadRuns;
+  std::vector<int> GateTypes;
+  bool SkipEmpty = false;
+  // events rejected by each filter
+  long long OutsideRange = 0;
+  long long NotGood = 0;
+  long long Bad = 0;
+  long long WrongGate = 0;
+  long long Empty = 0;
+
+  // minRun/maxRun are the defaults for minrun=/maxrun=; false if a run list
+  // or the gate list cannot be read
+  bool load(const optionMap& opts, unsigned int minRun = std::numeric_limits<unsigned int>::min(),
+            unsigned int maxRun = std::numeric_limits<unsigned int>::max())
+  {
+    MinRun = optionValue<unsigned int>(opts, "minrun", minRun);
+    MaxRun = optionValue<unsigned int>(opts, "maxrun", maxRun);
+    if (hasOption(opts, "goodruns") && not GoodRuns.load(optionValue<std::string>(opts, "goodruns", "")))
+      return false;
+    if (hasOption(opts, "badruns") && not BadRuns.load(optionValue<std::string>(opts, "badruns", "")))
+      return false;
+    if (hasOption(opts, "gates"))
+    {
+      std::string gateList = optionValue<std::string>(opts, "gates", "");
+      std::replace(gateList.begin(), gateList.end(), ':', ' ');
+      std::stringstream gateStrm(gateList);
+      int gateType;
+      while (gateStrm >> gateType)
+        GateTypes.push_back(gateType);
+      if (GateTypes.empty() || not gateStrm.eof())
+      {
+        std::cout << "Could not parse gates=" << optionValue<std::string>(opts, "gates", "") << std::endl;
+        return false;
+      }
+    }
+    SkipEmpty = hasOption(opts, "skipempty");
+    return true;
+  }
+  bool runActive() const
+  {
+    return MinRun != std::numeric_limits<unsigned int>::min() || MaxRun != std::numeric_limits<unsigned int>::max()
+        || GoodRuns.active() || BadRuns.active();
+  }
+  bool eventActive() const { return not GateTypes.empty() || SkipEmpty; }
+  bool active() const { return runActive() || eventActive(); }
+
+  // whether run passes the run-level filters, without counting it (for
+  // per-run tables such as the exposure)
+  bool keepsRun(unsigned int run) const
+  {
+    return run >= MinRun && run <= MaxRun && (not GoodRuns.active() || GoodRuns.contains(run))
+        && not (BadRuns.active() && BadRuns.contains(run));
+  }
+  // likewise passEvent
+  bool keepsEvent(int nSlices, int gateType) const
+  {
+    return (GateTypes.empty() || std::find(GateTypes.begin(), GateTypes.end(), gateType) != GateTypes.end())
+        && not (SkipEmpty && nSlices == 0);
+  }
+  bool passRun(unsigned int run)
+  {
+    long long* rejectedBy = nullptr;
+    if (run < MinRun || run > MaxRun)
+      rejectedBy = &OutsideRange;
+    else if (GoodRuns.active() && not GoodRuns.contains(run))
+      rejectedBy = &NotGood;
+    else if (BadRuns.active() && BadRuns.contains(run))
+      rejectedBy = &Bad;
+    if (rejectedBy)
+      ++*rejectedBy;
+    return not rejectedBy;
+  }
+  bool passEvent(int nSlices, int gateType)
+  {
+    long long* rejectedBy = nullptr;
+    if (not GateTypes.empty() && std::find(GateTypes.begin(), GateTypes.end(), gateType) == GateTypes.end())
+      rejectedBy = &WrongGate;
+    else if (SkipEmpty && nSlices == 0)
+      rejectedBy = &Empty;
+    if (rejectedBy)
+      ++*rejectedBy;
+    return not rejectedBy;
+  }
+  long long rejected() const { return OutsideRange + NotGood + Bad + WrongGate + Empty; }
+  void report(std::ostream& out) const
+  {
+    out << "Filtered out " << rejected() << " events: " << OutsideRange << " outside runs ["
+        << MinRun << ", " << MaxRun << "], " << NotGood << " not in the good run list, " << Bad
+        << " in the bad run list, " << WrongGate << " of another gate type, " << Empty
+        << " without slices" << std::endl;
+  }
+};
+
+// one row of the skim's time_index: a trigger time and the entry it belongs to
+struct timeIndexEntry
+{
+  int Sec;
+  long long Entry;
+  bool operator<(const timeIndexEntry& other) const
+  {
+    return (Sec != other.Sec) ? Sec < other.Sec : Entry < other.Entry;
+  }
+};
+
+// entries with a trigger time in [tMin, tMax], in entry order so the tree is
+// still read front to back; index must be sorted
+inline std::vector<long long> entriesInWindow(const std::vector<timeIndexEntry>& index, int tMin, int tMax)
+{
+  auto first = std::lower_bound(index.begin(), index.end(), timeIndexEntry{tMin, std::numeric_limits<long long>::min()});
+  auto last = std::upper_bound(index.begin(), index.end(), timeIndexEntry{tMax, std::numeric_limits<long long>::max()});
+  std::vector<long long> entries;
+  entries.reserve(last - first);
+  for (auto indexed = first; indexed != last; ++indexed)
+    entries.push_back(indexed->Entry);
+  std::sort(entries.begin(), entries.end());
+  return entries;
+}
+
+// Per-event quantities the hist stage derives from the slice/PFP payload.
+// The skim can store them as flat columns (option "derived"); bump
+// kDerivedVersion whenever derive() changes so older skims stop being
+// trusted and the hist stage recomputes from the nested vectors instead.
+constexpr int kDerivedVersion = 1;
+
+// The per-PFP classification derive() counts with, as predicates of the PFP
+// and its slice. Left null, derive() uses the standard definitions inline;
+// the hist stage can set them to expressions compiled at startup instead
+// (classify=FILE, see compileSelection in dqHistPlan.h). clearCosmic and
+// neutrino are exclusive: neutrino is only asked of non clear cosmic slices.
+typedef bool (*pfpPredicate)(double clearCosmic, double crLongestTrackDirY,
+                             double trackLength, double showerLength,
+                             double trackBestPlane, double showerBestPlane,
+                             double nHit1, double nHit2, double nHit3);
+struct pfpSelection
+{
+  pfpPredicate GoodTrack = nullptr;
+  pfpPredicate GoodShower = nullptr;
+  pfpPredicate ClearCosmic = nullptr;
+  pfpPredicate Neutrino = nullptr;
+  bool active() const { return GoodTrack || GoodShower || ClearCosmic || Neutrino; }
+};
+
+struct derivedEvent
+{
+  int NClearCosmics = 0;
+  int NNeutrinoCandidate = 0;
+  int NTrackHits1 = 0;
+  int NTrackHits2 = 0;
+  int NTrackHits3 = 0;
+  int NTracks = 0;
+  // one entry per PFP with a good track or shower: the track length and
+  // best plane if the track is good, the shower ones otherwise
+  std::vector<float> PFPLength;
+  std::vector<int> PFPPlane;
+
+  void clear()
+  {
+    NClearCosmics = NNeutrinoCandidate = 0;
+    NTrackHits1 = NTrackHits2 = NTrackHits3 = NTracks = 0;
+    PFPLength.clear();
+    PFPPlane.clear();
+  }
+
+  // the skim and hist stages store the payload with different element types,
+  // so take whatever indexable containers they have
+  template <typename NPFP, typename Flags, typename DirY, typename TrkLen, typename ShwLen,
+            typename TrkPlane, typename ShwPlane, typename NHit>
+  void derive(const NPFP& npfp, const Flags& clearCosmic, const DirY& crLongestTrackDirY,
+              const TrkLen& trackLength, const ShwLen& showerLength,
+              const TrkPlane& trackBestPlane, const ShwPlane& showerBestPlane,
+              const NHit& trackNHit1, const NHit& trackNHit2, const NHit& trackNHit3,
+              const pfpSelection* selection = nullptr)
+  {
+    clear();
+    for (size_t slc_idx = 0; slc_idx < npfp.size(); ++slc_idx)
+    {
+      for (size_t pfp_idx = 0; pfp_idx < npfp[slc_idx]; ++pfp_idx)
+      {
+        if (selection)
+        {
+          deriveSelected(*selection, clearCosmic[slc_idx], crLongestTrackDirY[slc_idx],
+                         trackLength[slc_idx][pfp_idx], showerLength[slc_idx][pfp_idx],
+                         trackBestPlane[slc_idx][pfp_idx], showerBestPlane[slc_idx][pfp_idx],
+                         trackNHit1[slc_idx][pfp_idx], trackNHit2[slc_idx][pfp_idx], trackNHit3[slc_idx][pfp_idx]);
+          continue;
+        }
+        // check whether it's better as a track or a shower
+        bool trkGood = (trackLength[slc_idx][pfp_idx] > 0);
+        bool shwGood = (showerLength[slc_idx][pfp_idx] > 0);
+        if (not trkGood && not shwGood)
+          continue;
+
+        // use the shower info only if the track info isn't good
+        PFPLength.push_back(static_cast<float>((trkGood) ? trackLength[slc_idx][pfp_idx]
+                                                         : showerLength[slc_idx][pfp_idx]));
+        PFPPlane.push_back(static_cast<int>((trkGood) ? trackBestPlane[slc_idx][pfp_idx]
+                                                      : showerBestPlane[slc_idx][pfp_idx]));
+
+        if (trkGood)
+        {
+          NTrackHits1 += trackNHit1[slc_idx][pfp_idx];
+          NTrackHits2 += trackNHit2[slc_idx][pfp_idx];
+          NTrackHits3 += trackNHit3[slc_idx][pfp_idx];
+          ++NTracks;
+        }
+        if (clearCosmic[slc_idx])
+        {
+          ++NClearCosmics;
+        } else if (std::abs(crLongestTrackDirY[slc_idx]) < 0.1) {
+          ++NNeutrinoCandidate;
+        }
+      }
+    }
+  }
+
+private:
+  // one PFP through the predicates of selection, the standard definition
+  // standing in for any that are not set
+  void deriveSelected(const pfpSelection& selection, double clearCosmic, double crLongestTrackDirY,
+                      double trackLength, double showerLength, double trackBestPlane, double showerBestPlane,
+                      double nHit1, double nHit2, double nHit3)
+  {
+    auto pass = [&](pfpPredicate predicate, bool standard)
+    {
+      return (predicate) ? predicate(clearCosmic, crLongestTrackDirY, trackLength, showerLength,
+                                     trackBestPlane, showerBestPlane, nHit1, nHit2, nHit3)
+                         : standard;
+    };
+    bool trkGood = pass(selection.GoodTrack, trackLength > 0);
+    bool shwGood = pass(selection.GoodShower, showerLength > 0);
+    if (not trkGood && not shwGood)
+      return;
+    PFPLength.push_back(static_cast<float>((trkGood) ? trackLength : showerLength));
+    PFPPlane.push_back(static_cast<int>((trkGood) ? trackBestPlane : showerBestPlane));
+    if (trkGood)
+    {
+      NTrackHits1 += nHit1;
+      NTrackHits2 += nHit2;
+      NTrackHits3 += nHit3;
+      ++NTracks;
+    }
+    if (pass(selection.ClearCosmic, clearCosmic != 0))
+      ++NClearCosmics;
+    else if (pass(selection.Neutrino, std::abs(crLongestTrackDirY) < 0.1))
+      ++NNeutrinoCandidate;
+  }
+};
+
+// Columns a passthrough skim (option passthrough) does not rewrite: they are
+// one-to-one copies of CAF columns, so the skim fast-clones their compressed
+// baskets into passthrough_tree, entry for entry aligned with
+// data_validation_tree, and the hist stage reads them from there. Name is the
+// skim branch, CAFName the CAF branch, CAFCount the CAF branch sizing it.
+struct passthroughBranch
+{
+  const char* Name;
+  const char* CAFName;
+  const char* CAFCount;
+};
+constexpr passthroughBranch kPassthroughBranches[] = {
+  {"flash.timeWidth", "rec.opflashes.timewidth",        "rec.opflashes..length"},
+  {"flash.timeSD",    "rec.opflashes.timesd",           "rec.opflashes..length"},
+  {"flash.PE",        "rec.opflashes.totalpe",          "rec.opflashes..length"},
+  {"crt_hit.plane",   "rec.crt_hits.plane",             "rec.crt_hits..length"},
+  {"crt_hit.PE",      "rec.crt_hits.pe",                "rec.crt_hits..length"},
+  {"crt_hit.err_x",   "rec.crt_hits.position_err.x",    "rec.crt_hits..length"},
+  {"crt_hit.err_y",   "rec.crt_hits.position_err.y",    "rec.crt_hits..length"},
+  {"crt_hit.err_z",   "rec.crt_hits.position_err.z",    "rec.crt_hits..length"},
+  {"crt_track.time",  "rec.crt_tracks.time",            "rec.crt_tracks..length"}};
+
+inline const passthroughBranch* findPassthrough(const std::string& name)
+{
+  for (const auto& branch : kPassthroughBranches)
+    if (name == branch.Name)
+      return &branch;
+  return nullptr;
+}
+
+#endif
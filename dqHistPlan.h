@@ -0,0 +1,746 @@
+#ifndef DQHISTPLAN_H
+#define DQHISTPLAN_H
+
+// declarative per-run histograms for makeHists_db_postgre: a config lists the
+// histograms, which are resolved once at startup into a flat fill plan
+
+// root includes
+#include "TH1.h"
+#include "TH2.h"
+#include "TInterpreter.h"
+#include "TTree.h"
+
+// std includes
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// local includes
+#include "dqCommon.h"
+#include "dqSchema.h"
+#include "dqTrend.h"
+
+// a column as histEvent holds it: scalars by value, the rest through the
+// pointer ROOT reads into
+template <typename T>
+using histColumn = std::conditional_t<std::is_arithmetic<T>::value, T, T*>;
+// and its narrow form, for columns that have one
+template <typename Narrow>
+using histNarrowColumn = std::conditional_t<std::is_same<Narrow, noNarrowForm>::value, noNarrowForm, Narrow*>;
+
+// widen a narrow column into its declared type
+template <typename Wide, typename Narrow>
+void widenColumn(const std::vector<Narrow>& narrow, std::vector<Wide>& wide)
+{
+  wide.assign(narrow.begin(), narrow.end());
+}
+template <typename Wide, typename Narrow>
+void widenColumn(const std::vector<std::vector<Narrow>>& narrow, std::vector<std::vector<Wide>>& wide)
+{
+  // resize keeps the inner vectors' capacity from entry to entry
+  wide.resize(narrow.size());
+  for (size_t idx = 0; idx < narrow.size(); ++idx)
+    wide[idx].assign(narrow[idx].begin(), narrow[idx].end());
+}
+
+// one entry of data_validation_tree as the hist stage reads it, a member per
+// DQ_SKIM_COLUMNS column
+struct histEvent
+{
+#define DQ_HIST_MEMBER(Tag, BranchName, ColumnGroup, ReadByHist, NoData, ...) \
+  histColumn<skimColumns::Tag::Type> Tag = NoData;                            \
+  histNarrowColumn<skimColumns::Tag::Narrow> Tag##Narrow{};
+  DQ_SKIM_COLUMNS(DQ_HIST_MEMBER)
+#undef DQ_HIST_MEMBER
+  // per-event quantities from the PFPs, read or derived
+  derivedEvent                      Derived;
+  // CRT quantities laid out flat by prepareCRT()
+  std::vector<float>                CRTHitErr;
+  std::vector<double>               CRTPMTMatchHitFlat;
+  // one per column bound in its narrow form, see bind()
+  std::vector<std::function<void()>> Wideners;
+
+  // func(tag, member pointer) for every column, derived ones (members of
+  // derivedEvent) last
+  template <typename Func>
+  static void forEachColumn(Func&& func)
+  {
+#define DQ_VISIT_MEMBER(Tag, ...) func(skimColumns::Tag{}, &histEvent::Tag);
+#define DQ_VISIT_DERIVED(Member, ...) func(skimColumns::Derived##Member{}, &derivedEvent::Member);
+    DQ_SKIM_COLUMNS(DQ_VISIT_MEMBER)
+    DQ_DERIVED_COLUMNS(DQ_VISIT_DERIVED)
+#undef DQ_VISIT_MEMBER
+#undef DQ_VISIT_DERIVED
+  }
+
+  // func(tag, member pointer, narrow member pointer) for every column with a
+  // narrow form
+  template <typename Func>
+  static void forEachNarrowColumn(Func&& func)
+  {
+#define DQ_VISIT_NARROW(Tag, ...)                                                  \
+    if constexpr (not std::is_same<skimColumns::Tag::Narrow, noNarrowForm>::value) \
+      func(skimColumns::Tag{}, &histEvent::Tag, &histEvent::Tag##Narrow);
+    DQ_SKIM_COLUMNS(DQ_VISIT_NARROW)
+#undef DQ_VISIT_NARROW
+  }
+
+  // the columns the hist stage reads; binding is free for branches that
+  // stay disabled. A passthrough skim has its kSkimDirect columns in
+  // passthrough_tree (passthroughReader). A skim with the narrow layout
+  // (skim_layout has narrow) is read into the narrow forms, which widen()
+  // copies into the declared types after every read from the tree.
+  void bind(TTree* tree, bool narrow = false)
+  {
+    bool passthrough = (tree->GetBranch("dropped") != nullptr);
+    forEachColumn([&](auto column, auto member)
+    {
+      using col = decltype(column);
+      if constexpr (col::Group != kSkimDerived && col::Hist)
+        if (skimWrites(col::Group, passthrough, false)
+            && (not narrow || std::is_same<typename col::Narrow, noNarrowForm>::value))
+          tree->SetBranchAddress(col::Branch, &(this->*member));
+    });
+    Wideners.clear();
+    if (not narrow)
+      return;
+    forEachNarrowColumn([&](auto column, auto member, auto narrowMember)
+    {
+      using col = decltype(column);
+      if (not col::Hist || not skimWrites(col::Group, passthrough, false))
+        return;
+      tree->SetBranchAddress(col::Branch, &(this->*narrowMember));
+      auto wide = std::make_shared<typename col::Type>();
+      this->*member = wide.get();
+      Wideners.push_back([this, wide, narrowMember]()
+      {
+        if (this->*narrowMember)
+          widenColumn(*(this->*narrowMember), *wide);
+      });
+    });
+  }
+  // copy the narrow columns of the entry just read into the declared types
+  void widen()
+  {
+    for (const auto& widener : Wideners)
+      widener();
+  }
+  // the derived columns the hist stage reads, into Derived
+  void bindDerived(TTree* tree)
+  {
+    forEachColumn([&](auto column, auto member)
+    {
+      using col = decltype(column);
+      if constexpr (col::Group == kSkimDerived && col::Hist)
+        tree->SetBranchAddress(col::Branch, &(Derived.*member));
+    });
+  }
+
+  void derive(const pfpSelection* selection = nullptr)
+  {
+    Derived.derive(*NPFP, *ClearCosmic, *CRLongestTrackDirY,
+                   *TrackLength, *ShowerLength, *TrackBestPlane, *ShowerBestPlane,
+                   *TrackNHit1, *TrackNHit2, *TrackNHit3, selection);
+  }
+
+  // one pass over the CRT columns: hit position error norms as a straight
+  // loop over the three error arrays (no pow, vectorizes), and the match
+  // hit time differences laid end to end so they fill like a flat column
+  void prepareCRT(bool hitErr, bool matchHits)
+  {
+    if (hitErr)
+    {
+      size_t nHits = std::min({CRTHitErrX->size(), CRTHitErrY->size(), CRTHitErrZ->size()});
+      CRTHitErr.resize(nHits);
+      const float* errX = CRTHitErrX->data();
+      const float* errY = CRTHitErrY->data();
+      const float* errZ = CRTHitErrZ->data();
+      float* err = CRTHitErr.data();
+      for (size_t hit = 0; hit < nHits; ++hit)
+        err[hit] = std::sqrt(errX[hit] * errX[hit] + errY[hit] * errY[hit] + errZ[hit] * errZ[hit]);
+    }
+    if (matchHits)
+    {
+      CRTPMTMatchHitFlat.clear();
+      for (const auto& match : *CRTPMTMatchHitTimeDiff)
+        CRTPMTMatchHitFlat.insert(CRTPMTMatchHitFlat.end(), match.begin(), match.end());
+    }
+  }
+};
+
+// how many values an observable gives per event
+enum observableKind { kPerEvent, kPerSlice, kPerFlash, kPerCRTHit, kPerCRTTrack, kPerCRTMatch, kPerCRTMatchHit, kNKinds };
+
+// what has to be computed per event before an observable can be read
+enum observablePrep { kPrepDerived = 1, kPrepCRTHitErr = 2, kPrepCRTMatchHits = 4 };
+
+// values of each kind in an event
+inline size_t multiplicity(const histEvent& evt, int kind)
+{
+  switch (kind)
+  {
+    case kPerSlice:       return evt.NSlices;
+    case kPerFlash:       return evt.NFlashes;
+    case kPerCRTHit:      return evt.NCRTHits;
+    case kPerCRTTrack:    return evt.NCRTTracks;
+    case kPerCRTMatch:    return evt.NCRTPMTMatches;
+    case kPerCRTMatchHit: return evt.CRTPMTMatchHitFlat.size();
+    default:              return 1;
+  }
+}
+
+// the scalar branch holding each kind's multiplicity
+const char* const kKindCountBranch[kNKinds] = {"", "nslc", "nflash", "ncrthit", "ncrt_track", "ncrtpmt_match", "ncrtpmt_match"};
+
+// something we can histogram against run number
+struct observableDef
+{
+  const char* Name;
+  observableKind Kind;
+  const char* Branches;  // comma separated branches it reads
+  unsigned Prepare;      // observablePrep bits
+  double (*Value)(const histEvent& evt, size_t idx);
+};
+
+// every observable a config may ask for
+inline const std::vector<observableDef>& observableTable()
+{
+  static const std::vector<observableDef> table = {
+    // per event
+    {"one",                kPerEvent, "",                 0, [](const histEvent&, size_t) { return 1.; }},
+    {"nslc",               kPerEvent, "nslc",             0, [](const histEvent& evt, size_t) { return static_cast<double>(evt.NSlices); }},
+    {"nflash",             kPerEvent, "nflash",           0, [](const histEvent& evt, size_t) { return static_cast<double>(evt.NFlashes); }},
+    {"ncrthit",            kPerEvent, "ncrthit",          0, [](const histEvent& evt, size_t) { return static_cast<double>(evt.NCRTHits); }},
+    {"ncrt_track",         kPerEvent, "ncrt_track",       0, [](const histEvent& evt, size_t) { return static_cast<double>(evt.NCRTTracks); }},
+    {"ncrtpmt_match",      kPerEvent, "ncrtpmt_match",    0, [](const histEvent& evt, size_t) { return static_cast<double>(evt.NCRTPMTMatches); }},
+    {"nClearCosmics",      kPerEvent, "",                 kPrepDerived, [](const histEvent& evt, size_t) { return static_cast<double>(evt.Derived.NClearCosmics); }},
+    {"nNeutrinoCandidate", kPerEvent, "",                 kPrepDerived, [](const histEvent& evt, size_t) { return static_cast<double>(evt.Derived.NNeutrinoCandidate); }},
+    {"nTrackHits1",        kPerEvent, "",                 kPrepDerived, [](const histEvent& evt, size_t) { return static_cast<double>(evt.Derived.NTrackHits1); }},
+    {"nTrackHits2",        kPerEvent, "",                 kPrepDerived, [](const histEvent& evt, size_t) { return static_cast<double>(evt.Derived.NTrackHits2); }},
+    {"nTrackHits3",        kPerEvent, "",                 kPrepDerived, [](const histEvent& evt, size_t) { return static_cast<double>(evt.Derived.NTrackHits3); }},
+    {"nTracks",            kPerEvent, "",                 kPrepDerived, [](const histEvent& evt, size_t) { return static_cast<double>(evt.Derived.NTracks); }},
+    {"nHitPerTrack1",      kPerEvent, "",                 kPrepDerived, [](const histEvent& evt, size_t) { return static_cast<double>(evt.Derived.NTrackHits1) / static_cast<double>(evt.Derived.NTracks); }},
+    {"nHitPerTrack2",      kPerEvent, "",                 kPrepDerived, [](const histEvent& evt, size_t) { return static_cast<double>(evt.Derived.NTrackHits2) / static_cast<double>(evt.Derived.NTracks); }},
+    {"nHitPerTrack3",      kPerEvent, "",                 kPrepDerived, [](const histEvent& evt, size_t) { return static_cast<double>(evt.Derived.NTrackHits3) / static_cast<double>(evt.Derived.NTracks); }},
+    {"flashPerCC",         kPerEvent, "nflash",           kPrepDerived, [](const histEvent& evt, size_t) { return static_cast<double>(evt.NFlashes) / static_cast<double>(evt.Derived.NClearCosmics); }},
+    {"runDuration",        kPerEvent, "db.start,db.end",  0, [](const histEvent& evt, size_t) { return static_cast<double>(evt.DBEnd - evt.DBStart); }},
+    {"cathodeV",           kPerEvent, "db.cathodeV",      0, [](const histEvent& evt, size_t) { return evt.DBCathodeV; }},
+    {"EInd1V",             kPerEvent, "db.EInd1V",        0, [](const histEvent& evt, size_t) { return evt.DBEInd1V; }},
+    {"EInd2V",             kPerEvent, "db.EInd2V",        0, [](const histEvent& evt, size_t) { return evt.DBEInd2V; }},
+    {"ECollV",             kPerEvent, "db.ECollV",        0, [](const histEvent& evt, size_t) { return evt.DBECollV; }},
+    {"WInd1V",             kPerEvent, "db.WInd1V",        0, [](const histEvent& evt, size_t) { return evt.DBWInd1V; }},
+    {"WInd2V",             kPerEvent, "db.WInd2V",        0, [](const histEvent& evt, size_t) { return evt.DBWInd2V; }},
+    {"WCollV",             kPerEvent, "db.WCollV",        0, [](const histEvent& evt, size_t) { return evt.DBWCollV; }},
+    {"gateType",           kPerEvent, "db.gateType",      0, [](const histEvent& evt, size_t) { return static_cast<double>(evt.DBGateType); }},
+    {"trigSource",         kPerEvent, "db.trigSource",    0, [](const histEvent& evt, size_t) { return static_cast<double>(evt.DBTrigSource); }},
+    // per slice
+    {"npfp",               kPerSlice, "slc.npfp",                  0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.NPFP)[idx]); }},
+    {"clearCosmic",        kPerSlice, "slc.clear_cosmic",          0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.ClearCosmic)[idx]); }},
+    {"CRLongestTrackDirY", kPerSlice, "slc.CRLongestTrackDirY",    0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.CRLongestTrackDirY)[idx]); }},
+    {"FMatchPresent",      kPerSlice, "slc.FMatchPresent",         0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.FMatchPresent)[idx]); }},
+    {"FMatchLightPE",      kPerSlice, "slc.FMatchLightPE",         0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.FMatchLightPE)[idx]); }},
+    {"FMatchScore",        kPerSlice, "slc.FMatchScore",           0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.FMatchScore)[idx]); }},
+    // per flash
+    {"flashTimeWidth",     kPerFlash, "flash.timeWidth",           0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.FlashTimeWidth)[idx]); }},
+    {"flashTimeSD",        kPerFlash, "flash.timeSD",              0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.FlashTimeSD)[idx]); }},
+    {"flashPE",            kPerFlash, "flash.PE",                  0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.FlashPE)[idx]); }},
+    // per CRT hit, track, CRT-PMT match and matched hit
+    {"crtHitPlane",        kPerCRTHit, "crt_hit.plane",            0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.CRTHitPlane)[idx]); }},
+    {"crtHitPE",           kPerCRTHit, "crt_hit.PE",               0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.CRTHitPE)[idx]); }},
+    {"crtHitErr",          kPerCRTHit, "crt_hit.err_x,crt_hit.err_y,crt_hit.err_z", kPrepCRTHitErr,
+                                                                          [](const histEvent& evt, size_t idx) { return static_cast<double>(evt.CRTHitErr[idx]); }},
+    {"crtTrackTime",       kPerCRTTrack, "crt_track.time",         0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.CRTTrackTime)[idx]); }},
+    {"crtpmtMatchNHit",    kPerCRTMatch, "crtpmt_match.nhit",      0, [](const histEvent& evt, size_t idx) { return static_cast<double>((*evt.CRTPMTMatchNHit)[idx]); }},
+    {"crtpmtMatchTimeDiff", kPerCRTMatchHit, "crtpmt_match.hit.timeDiff", kPrepCRTMatchHits,
+                                                                          [](const histEvent& evt, size_t idx) { return evt.CRTPMTMatchHitFlat[idx]; }},
+  };
+  return table;
+}
+
+inline const observableDef* findObservable(const std::string& name)
+{
+  for (const auto& obs : observableTable())
+    if (name == obs.Name)
+      return &obs;
+  return nullptr;
+}
+
+// The histograms we make by default. One histogram per line:
+//   name  observable  nbins lo hi  [wgt] [select=OBS<OP>VALUE]  | y axis title
+// nbins 0 books a per-run TH1D filled with the observable as weight,
+// otherwise a TH2D of the observable against run. wgt also writes the
+// POT weighted <name>_wgt. The selection observable must give the same
+// number of values per event as the filled one (or be per event), OP is
+// one of < <= > >= == !=. '#' starts a comment, except in the title: that
+// runs to the end of the line, so TLatex such as #mu can be used there.
+const char* const kDefaultHistConfig = R"(
+# TPC
+nSlicePerEvent    nslc                 101   -0.5    100.5  wgt  | Number of Slices Per Event
+nPFPPerEvent      npfp                 101   -0.5    100.5  wgt  | Number of PFPs Per Event
+nCCPerEvent       nClearCosmics       1001   -0.5   1000.5  wgt  | Number of Clear Cosmics Per Event
+nNeutrinoPure     nNeutrinoCandidate    26   -0.5     25.5  wgt  | Beam-like Slices per Event
+nTrkHitsPlane1    nTrackHits1        40001   -0.5  40000.5  wgt  | Number of Hits in Ind1
+nTrkHitsPlane2    nTrackHits2        40001   -0.5  40000.5  wgt  | Number of Hits in Ind2
+nTrkHitsPlane3    nTrackHits3        40001   -0.5  40000.5  wgt  | Number of Hits in Coll
+nHitPerTrkPlane1  nHitPerTrack1       5001   -0.5    100.5  wgt  | Number of Ind1 Hits per Track
+nHitPerTrkPlane2  nHitPerTrack2       5001   -0.5    100.5  wgt  | Number of Ind2 Hits per Track
+nHitPerTrkPlane3  nHitPerTrack3       5001   -0.5    100.5  wgt  | Number of Coll Hits per Track
+# PMT
+nFlashPerEvent    nflash               101   -0.5    100.5  wgt  | Number of PMT FLashes
+flashPerCC        flashPerCC          1001   -0.5      1.5  wgt  | Number of PMT FLashes per Clear Cosmic
+FlashTimeWidth    flashTimeWidth       101   -0.5     10.5  wgt  | Average Flash Width
+FlashTimeSD       flashTimeSD          510   -0.5      5.5  wgt  | Average Flash SD
+FlashPE           flashPE            20001   -0.5 200000.5  wgt  | Average Flash PE
+# CRT
+NCRTHit           ncrthit              501   -0.5    500.5  wgt  | CRT Hits
+CRTHitPEPerHit    crtHitPE           50001   -0.5   5000.5  wgt  | CRT PE Per Hit
+avgCRTHitErr      crtHitErr           5001   -0.5    500.5  wgt  | Average CRT Hit Error
+nCRTTrkPerEvent   ncrt_track           251   -0.5    250.5  wgt  | Average CRT Tracks Per Event
+CRTTrkTime        crtTrackTime         101   -0.5     10.5  wgt  | Average CRT Track Time
+nMatchesPerEvent  ncrtpmt_match         51   -0.5     50.5  wgt  | Flash Matches Per Event
+nMchHitsPerEvent  crtpmtMatchNHit      101   -0.5    100.5  wgt  | Flash Match Hits Per Event
+fmTimeDiff        crtpmtMatchTimeDiff 1001   -0.5      1.5  wgt  | Flash Match Time Difference
+# DB, off until the run database columns are trusted
+#runDuration      runDuration            0      0        0       | Duration (s)
+#cathodeV         cathodeV               0      0        0       | Cathode Voltage (V)
+#EInd1V           EInd1V                 0      0        0       | East Induction 1 Voltage (V)
+#EInd2V           EInd2V                 0      0        0       | East Induction 2 Voltage (V)
+#ECollV           ECollV                 0      0        0       | East Collection Voltage (V)
+#WInd1V           WInd1V                 0      0        0       | West Induction 1 Voltage (V)
+#WInd2V           WInd2V                 0      0        0       | West Induction 2 Voltage (V)
+#WCollV           WCollV                 0      0        0       | West Collection Voltage (V)
+#ETriggers        one                    0      0        0  select=trigSource==1  | East Cryostat Triggers
+#WTriggers        one                    0      0        0  select=trigSource==2  | West Cryostat Triggers
+#UTriggers        one                    0      0        0  select=trigSource==0  | Undecided Triggers
+#BTriggers        one                    0      0        0  select=trigSource==7  | Triggers From Both Cryostats
+)";
+
+// a selection on one observable
+struct planCut
+{
+  enum cutOp { kNone, kLess, kLessEq, kGreater, kGreaterEq, kEqual, kNotEqual };
+  const observableDef* Observable = nullptr;
+  cutOp Op = kNone;
+  double Value = 0;
+  bool pass(const histEvent& evt, size_t idx) const
+  {
+    double value = Observable->Value(evt, (Observable->Kind == kPerEvent) ? 0 : idx);
+    switch (Op)
+    {
+      case kLess:      return value <  Value;
+      case kLessEq:    return value <= Value;
+      case kGreater:   return value >  Value;
+      case kGreaterEq: return value >= Value;
+      case kEqual:     return value == Value;
+      case kNotEqual:  return value != Value;
+      default:         return true;
+    }
+  }
+};
+
+// one histogram to fill
+struct planStep
+{
+  TH1* Hist;
+  double (*Value)(const histEvent& evt, size_t idx);
+  planCut Cut;
+  bool POTWeighted;
+  size_t Metric = 0;    // its place in Hists, and in a trend node's metrics
+  double SketchLo = 0;  // the range a trend sketch of it covers
+  double SketchHi = 0;
+};
+
+// the histograms of a config, grouped by how often they are filled
+struct histPlan
+{
+  std::vector<planStep> Steps[kNKinds];
+  std::set<std::string> Branches;  // what the plan reads, besides the derived quantities
+  unsigned Prepare = 0;            // observablePrep bits over all steps
+  pfpSelection Selection;          // compiled PFP classification, if not the standard one
+
+  // every booked histogram, in config order
+  std::vector<TH1*> Hists;
+  std::vector<TH1*> POTWeightedHists;
+
+  // parse a config and book its histograms in the current directory
+  bool build(const std::string& config, unsigned int bins, double lwEdge, double upEdge, bool debug = false)
+  {
+    std::stringstream configStrm(config);
+    std::string line;
+    int lineNumber = 0;
+    bool good = true;
+    while (std::getline(configStrm, line))
+    {
+      ++lineNumber;
+      // a '#' after the '|' is part of the title, not a comment
+      if (line.find('#') < line.find('|'))
+        line = line.substr(0, line.find('#'));
+      std::string title;
+      if (line.find('|') != std::string::npos)
+      {
+        title = line.substr(line.find('|') + 1);
+        title = title.substr(std::min(title.size(), title.find_first_not_of(" \t")));
+        title = title.substr(0, title.find_last_not_of(" \t\r") + 1);
+        line = line.substr(0, line.find('|'));
+      }
+      std::stringstream lineStrm(line);
+      std::string name, obsName;
+      int nBins;
+      double lo, hi;
+      if (not (lineStrm >> name))
+        continue;
+      if (not (lineStrm >> obsName >> nBins >> lo >> hi))
+      {
+        std::cerr << "Bad histogram config line " << lineNumber << ": " << line << std::endl;
+        good = false;
+        continue;
+      }
+      const observableDef* obs = findObservable(obsName);
+      if (not obs)
+      {
+        std::cerr << "Unknown observable " << obsName << " on histogram config line " << lineNumber << std::endl;
+        good = false;
+        continue;
+      }
+      planStep step{nullptr, obs->Value, planCut{}, false};
+      std::string flag;
+      while (lineStrm >> flag)
+      {
+        if (flag == "wgt")
+          step.POTWeighted = true;
+        else if (flag.compare(0, 7, "select=") == 0 && parseCut(flag.substr(7), obs->Kind, step.Cut))
+          useObservable(*step.Cut.Observable);
+        else
+        {
+          std::cerr << "Bad flag " << flag << " on histogram config line " << lineNumber << std::endl;
+          good = false;
+        }
+      }
+      useObservable(*obs);
+
+      std::string axes = ";DAQ Run;" + title;
+      if (nBins > 0)
+        step.Hist = new TH2D(name.c_str(), axes.c_str(), bins, lwEdge, upEdge, nBins, lo, hi);
+      else
+        step.Hist = new TH1D(name.c_str(), axes.c_str(), bins, lwEdge, upEdge);
+      if (debug) std::cout << "initialized histogram " << step.Hist->GetName() << " of " << obs->Name << std::endl;
+      step.Metric = Hists.size();
+      if (nBins > 0)
+      {
+        step.SketchLo = lo;
+        step.SketchHi = hi;
+      }
+      Hists.push_back(step.Hist);
+      if (step.POTWeighted)
+        POTWeightedHists.push_back(step.Hist);
+      Steps[obs->Kind].push_back(step);
+    }
+    return good;
+  }
+
+  // every branch the plan reads, plus always
+  std::set<std::string> branchesRead(bool useDerived, const std::vector<std::string>& always) const
+  {
+    std::set<std::string> branches(Branches);
+    branches.insert(always.begin(), always.end());
+    if ((Prepare & kPrepDerived) && useDerived)
+      forEachSkimColumn([&](auto column)
+      {
+        using col = decltype(column);
+        if (col::Group == kSkimDerived && col::Hist)
+          branches.insert(col::Branch);
+      });
+    else if (Prepare & kPrepDerived)
+      branches.insert({"slc.npfp", "slc.clear_cosmic", "slc.CRLongestTrackDirY",
+                       "slc.pfp.trackLength", "slc.pfp.showerLength",
+                       "slc.pfp.trackBestPlane", "slc.pfp.showerBestPlane",
+                       "slc.pfp.trackNHit1", "slc.pfp.trackNHit2", "slc.pfp.trackNHit3"});
+    return branches;
+  }
+
+  // turn on just those the tree has (a passthrough skim keeps some elsewhere)
+  void activate(TTree* tree, bool useDerived, const std::vector<std::string>& always) const
+  {
+    tree->SetBranchStatus("*", 0);
+    for (const auto& branch : branchesRead(useDerived, always))
+      if (tree->GetBranch(branch.c_str()))
+        tree->SetBranchStatus(branch.c_str(), 1);
+  }
+
+  // what a trend pyramid follows: every histogram, in Hists order
+  std::vector<trendMetric> trendMetrics() const
+  {
+    std::vector<trendMetric> metrics(Hists.size());
+    for (int kind = 0; kind < kNKinds; ++kind)
+      for (const auto& step : Steps[kind])
+        metrics[step.Metric] = {step.Hist->GetName(), step.SketchLo, step.SketchHi};
+    return metrics;
+  }
+
+  // compute what the observables need, then fill every histogram for one
+  // event, and the aggregates of trend if given
+  void fill(histEvent& evt, bool useDerived, trendNode* trend = nullptr) const
+  {
+    if ((Prepare & kPrepDerived) && not useDerived)
+      evt.derive((Selection.active()) ? &Selection : nullptr);
+    if (Prepare & (kPrepCRTHitErr | kPrepCRTMatchHits))
+      evt.prepareCRT(Prepare & kPrepCRTHitErr, Prepare & kPrepCRTMatchHits);
+
+    double run = evt.Run;
+    for (int kind = 0; kind < kNKinds; ++kind)
+    {
+      if (Steps[kind].empty())
+        continue;
+      size_t nValues = multiplicity(evt, kind);
+      for (size_t idx = 0; idx < nValues; ++idx)
+        for (const auto& step : Steps[kind])
+          if (step.Cut.Op == planCut::kNone || step.Cut.pass(evt, idx))
+          {
+            double value = step.Value(evt, idx);
+            step.Hist->Fill(run, value);
+            if (trend)
+              trend->Metrics[step.Metric].add(value, step.SketchLo, step.SketchHi);
+          }
+    }
+  }
+
+private:
+  void useObservable(const observableDef& obs)
+  {
+    std::stringstream branchStrm(obs.Branches);
+    std::string branch;
+    while (std::getline(branchStrm, branch, ','))
+      if (not branch.empty())
+        Branches.insert(branch);
+    // the loops over slices, flashes, ... run to the event's counts
+    if (obs.Kind != kPerEvent)
+      Branches.insert(kKindCountBranch[obs.Kind]);
+    if (obs.Kind == kPerCRTMatchHit)
+      Branches.insert("crtpmt_match.hit.timeDiff");
+    Prepare |= obs.Prepare;
+  }
+
+  // OBS<OP>VALUE, e.g. clearCosmic==0
+  static bool parseCut(const std::string& cutStr, observableKind kind, planCut& cut)
+  {
+    static const std::vector<std::pair<std::string, planCut::cutOp>> ops = {
+      {"<=", planCut::kLessEq}, {">=", planCut::kGreaterEq}, {"==", planCut::kEqual},
+      {"!=", planCut::kNotEqual}, {"<", planCut::kLess}, {">", planCut::kGreater}};
+    for (const auto& op : ops)
+    {
+      size_t pos = cutStr.find(op.first);
+      if (pos == std::string::npos)
+        continue;
+      cut.Observable = findObservable(cutStr.substr(0, pos));
+      if (not cut.Observable || (cut.Observable->Kind != kPerEvent && cut.Observable->Kind != kind))
+        return false;
+      std::string valueStr = cutStr.substr(pos + op.first.size());
+      char* valueEnd = nullptr;
+      cut.Value = std::strtod(valueStr.c_str(), &valueEnd);
+      cut.Op = op.second;
+      return not valueStr.empty() && *valueEnd == '\0';
+    }
+    return false;
+  }
+};
+
+// the config text: the file named by the hists= option, or the default
+inline std::string histConfigText(const optionMap& opts)
+{
+  std::string configName = optionValue<std::string>(opts, "hists", "");
+  if (configName.empty())
+    return kDefaultHistConfig;
+  std::ifstream configFile(configName);
+  if (not configFile)
+  {
+    std::cerr << "Could not read histogram config " << configName << ", using the default" << std::endl;
+    return kDefaultHistConfig;
+  }
+  std::stringstream configStrm;
+  configStrm << configFile.rdbuf();
+  return configStrm.str();
+}
+
+// the kPassthroughBranches columns of a passthrough skim, read from its
+// passthrough_tree (fast-cloned CAF arrays, entry for entry aligned with
+// data_validation_tree) straight into vectors the histEvent points at
+class passthroughReader
+{
+public:
+  // bind the columns of branches that tree has; false if it has none of them
+  bool bind(TTree* tree, const std::set<std::string>& branches, histEvent& evt)
+  {
+    Tree = tree;
+    for (const auto& branch : branches)
+    {
+      const passthroughBranch* passthrough = findPassthrough(branch);
+      if (not passthrough)
+        continue;
+      histEvent::forEachColumn([&](auto column, auto member)
+      {
+        using col = decltype(column);
+        if constexpr (col::Group == kSkimDirect)
+          if (branch == col::Branch)
+            add(passthrough, evt.*member);
+      });
+    }
+    return not Columns.empty();
+  }
+
+  // the counts first: the CAF arrays take their length from them
+  bool read(Long64_t entry)
+  {
+    for (auto& count : Counts)
+      if (count.Branch->GetEntry(entry) <= 0)
+        return false;
+    for (auto& column : Columns)
+      if (not column->read(entry, Counts[column->Count].Value))
+        return false;
+    return true;
+  }
+
+private:
+  struct countColumn
+  {
+    std::string Name;
+    TBranch* Branch;
+    int Value;
+  };
+  class columnBase
+  {
+  public:
+    size_t Count;  // index into Counts
+    virtual ~columnBase() = default;
+    virtual bool read(Long64_t entry, int count) = 0;
+  };
+  template <typename T>
+  class column : public columnBase
+  {
+  public:
+    column(TBranch* branch, std::vector<T>*& target) : Branch(branch) { target = &Values; }
+    bool read(Long64_t entry, int count) override
+    {
+      if (static_cast<size_t>(count) > Values.capacity() || Values.capacity() == 0)
+        Values.reserve(std::max<size_t>({static_cast<size_t>(count), 2 * Values.capacity(), 1}));
+      Values.resize(count);
+      if (Values.data() != Bound)
+      {
+        Bound = Values.data();
+        Branch->SetAddress(Bound);
+      }
+      return Branch->GetEntry(entry) >= 0;
+    }
+  private:
+    TBranch* Branch;
+    T* Bound = nullptr;
+    std::vector<T> Values;
+  };
+
+  template <typename T>
+  void add(const passthroughBranch* passthrough, std::vector<T>*& target)
+  {
+    TBranch* branch = Tree->GetBranch(passthrough->CAFName);
+    if (not branch)
+      return;
+    auto count = std::find_if(Counts.begin(), Counts.end(), [&](const countColumn& c) { return c.Name == passthrough->CAFCount; });
+    if (count == Counts.end())
+    {
+      Counts.push_back({passthrough->CAFCount, Tree->GetBranch(passthrough->CAFCount), 0});
+      if (not Counts.back().Branch)
+      {
+        Counts.pop_back();
+        return;
+      }
+      Counts.back().Branch->SetAddress(&Counts.back().Value);
+      count = Counts.end() - 1;
+    }
+    Columns.emplace_back(new column<T>(branch, target));
+    Columns.back()->Count = count - Counts.begin();
+  }
+
+  TTree* Tree = nullptr;
+  std::deque<countColumn> Counts;
+  std::vector<std::unique_ptr<columnBase>> Columns;
+};
+
+// Compile a PFP classification, one "NAME EXPRESSION" per line with NAME one
+// of goodTrack, goodShower, clearCosmic, neutrino, e.g.
+//   goodTrack  trackLength > 10 && nHit1 + nHit2 + nHit3 > 20
+//   neutrino   std::abs(crLongestTrackDirY) < 0.2
+// Each expression is a C++ expression of the pfpPredicate arguments, compiled
+// once here by cling into a native function, so it costs the event loop one
+// call through a pointer. Names not given keep their standard definition.
+inline bool compileSelection(const std::string& text, pfpSelection& selection)
+{
+  static const std::vector<std::pair<std::string, pfpPredicate pfpSelection::*>> names = {
+    {"goodTrack", &pfpSelection::GoodTrack}, {"goodShower", &pfpSelection::GoodShower},
+    {"clearCosmic", &pfpSelection::ClearCosmic}, {"neutrino", &pfpSelection::Neutrino}};
+  static int nCompiled = 0;  // cling can't redeclare a function, so every one gets a new name
+
+  std::stringstream textStrm(text);
+  std::string line;
+  int lineNumber = 0;
+  bool good = true;
+  while (std::getline(textStrm, line))
+  {
+    ++lineNumber;
+    std::stringstream lineStrm(line.substr(0, line.find('#')));
+    std::string name, expression;
+    if (not (lineStrm >> name))
+      continue;
+    std::getline(lineStrm, expression);
+    auto entry = std::find_if(names.begin(), names.end(), [&](const auto& n) { return n.first == name; });
+    if (entry == names.end() || expression.find_first_not_of(" \t\r") == std::string::npos)
+    {
+      std::cerr << "Bad selection line " << lineNumber << ": " << line << std::endl;
+      good = false;
+      continue;
+    }
+    std::string function = "dqSelection_" + name + "_" + std::to_string(nCompiled++);
+    std::string code = "bool " + function + "(double clearCosmic, double crLongestTrackDirY,"
+                       " double trackLength, double showerLength, double trackBestPlane,"
+                       " double showerBestPlane, double nHit1, double nHit2, double nHit3)"
+                       " { return (" + expression + "); }";
+    pfpPredicate predicate = nullptr;
+    if (gInterpreter->Declare(code.c_str()))
+      predicate = (pfpPredicate)gInterpreter->Calc(("(long)&" + function).c_str());
+    if (not predicate)
+    {
+      std::cerr << "Could not compile selection " << name << " on line " << lineNumber << ":" << expression << std::endl;
+      good = false;
+      continue;
+    }
+    selection.*(entry->second) = predicate;
+  }
+  return good;
+}
+
+// the selection file named by the classify= option, compiled into selection;
+// false if there is one and it could not be read or compiled
+inline bool loadSelection(const optionMap& opts, pfpSelection& selection)
+{
+  std::string selectionName = optionValue<std::string>(opts, "classify", "");
+  if (selectionName.empty())
+    return true;
+  std::ifstream selectionFile(selectionName);
+  if (not selectionFile)
+  {
+    std::cerr << "Could not read selection " << selectionName << std::endl;
+    return false;
+  }
+  std::stringstream selectionStrm;
+  selectionStrm << selectionFile.rdbuf();
+  return compileSelection(selectionStrm.str(), selection);
+}
+
+#endif
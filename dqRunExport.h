@@ -0,0 +1,289 @@
+#ifndef DQRUNEXPORT_H
+#define DQRUNEXPORT_H
+
+// Per-run export of a makeHists_db_postgre output (written by exportRuns.cc):
+// every per-run histogram's run column as a 1D projection, its summary
+// numbers and a rebinned preview, stored run by run behind an index so a
+// dashboard loads one run with one read instead of deserializing whole TH2Ds.
+// No ROOT needed to read it.
+//
+// Layout, little-endian, strings as uint32 length + bytes:
+//   "DQRUNEXP", uint32 version
+//   uint32 nTotals, nTotals x string        per-run TH1 names (nEventsPerRun, ...)
+//   uint32 nHists, per hist:
+//     string name, string title, uint32 nBins, double yMin, double yMax,
+//     uint32 nEdges (0 for fixed bins, else nBins+1) x double,
+//     uint32 previewGroup (y bins per preview bin), uint8 weighted
+//   uint32 nRuns, nRuns x {uint32 run, uint64 offset, uint64 size}, runs ascending
+//   run blocks, each:
+//     nTotals x double
+//     per hist: double sum, mean, rms, underflow, overflow,
+//               uint32 n, n x uint32 bin, n x double content,
+//               (weighted only) n x double sumw2,
+//               uint32 nPreview, nPreview x float
+// Projections keep only their nonzero bins (numbered like ROOT, 1..nBins).
+
+// std includes
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+constexpr char kRunExportMagic[8] = {'D', 'Q', 'R', 'U', 'N', 'E', 'X', 'P'};
+constexpr uint32_t kRunExportVersion = 1;
+
+// append-only byte buffer for building the header and run blocks
+struct exportBuffer
+{
+  std::string Data;
+  template <typename T>
+  void put(T value)
+  {
+    Data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+  template <typename T>
+  void put(const std::vector<T>& values)
+  {
+    Data.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+  }
+  void put(const std::string& text)
+  {
+    put<uint32_t>(text.size());
+    Data.append(text);
+  }
+};
+
+// bounds-checked reads out of a loaded block; ok() turns false on overrun
+struct exportCursor
+{
+  const char* Pos;
+  const char* End;
+  bool Good = true;
+  exportCursor(const std::string& data) : Pos(data.data()), End(data.data() + data.size()) {}
+  template <typename T>
+  T get()
+  {
+    T value{};
+    if (End - Pos < static_cast<long>(sizeof(T)))
+    {
+      Good = false;
+      return value;
+    }
+    std::memcpy(&value, Pos, sizeof(T));
+    Pos += sizeof(T);
+    return value;
+  }
+  template <typename T>
+  std::vector<T> getVector(size_t size)
+  {
+    std::vector<T> values;
+    if (static_cast<size_t>(End - Pos) / sizeof(T) < size)
+    {
+      Good = false;
+      return values;
+    }
+    values.resize(size);
+    std::memcpy(values.data(), Pos, size * sizeof(T));
+    Pos += size * sizeof(T);
+    return values;
+  }
+  std::string getString()
+  {
+    uint32_t size = get<uint32_t>();
+    if (not Good || static_cast<size_t>(End - Pos) < size)
+    {
+      Good = false;
+      return "";
+    }
+    std::string text(Pos, size);
+    Pos += size;
+    return text;
+  }
+  bool ok() const { return Good; }
+};
+
+// one histogram of the export: its y axis and how its preview is grouped
+struct exportHist
+{
+  std::string Name;
+  std::string Title;
+  uint32_t NBins = 0;
+  double YMin = 0;
+  double YMax = 0;
+  std::vector<double> Edges;  // empty for fixed bins
+  uint32_t PreviewGroup = 1;
+  bool Weighted = false;
+
+  void write(exportBuffer& buffer) const
+  {
+    buffer.put(Name);
+    buffer.put(Title);
+    buffer.put<uint32_t>(NBins);
+    buffer.put<double>(YMin);
+    buffer.put<double>(YMax);
+    buffer.put<uint32_t>(Edges.size());
+    buffer.put(Edges);
+    buffer.put<uint32_t>(PreviewGroup);
+    buffer.put<uint8_t>(Weighted);
+  }
+  bool read(exportCursor& cursor)
+  {
+    Name = cursor.getString();
+    Title = cursor.getString();
+    NBins = cursor.get<uint32_t>();
+    YMin = cursor.get<double>();
+    YMax = cursor.get<double>();
+    Edges = cursor.getVector<double>(cursor.get<uint32_t>());
+    PreviewGroup = cursor.get<uint32_t>();
+    Weighted = cursor.get<uint8_t>();
+    return cursor.ok();
+  }
+  // low edge of y bin (1..NBins+1)
+  double lowEdge(int bin) const
+  {
+    return (Edges.empty()) ? YMin + (bin - 1) * (YMax - YMin) / NBins : Edges[bin - 1];
+  }
+};
+
+// one run column of one histogram
+struct exportProjection
+{
+  double Sum = 0;
+  double Mean = 0;
+  double RMS = 0;
+  double Underflow = 0;
+  double Overflow = 0;
+  std::vector<uint32_t> Bins;
+  std::vector<double> Contents;
+  std::vector<double> Sumw2;  // weighted histograms only
+  std::vector<float> Preview;
+
+  void write(exportBuffer& buffer, bool weighted) const
+  {
+    buffer.put<double>(Sum);
+    buffer.put<double>(Mean);
+    buffer.put<double>(RMS);
+    buffer.put<double>(Underflow);
+    buffer.put<double>(Overflow);
+    buffer.put<uint32_t>(Bins.size());
+    buffer.put(Bins);
+    buffer.put(Contents);
+    if (weighted)
+      buffer.put(Sumw2);
+    buffer.put<uint32_t>(Preview.size());
+    buffer.put(Preview);
+  }
+  bool read(exportCursor& cursor, bool weighted)
+  {
+    Sum = cursor.get<double>();
+    Mean = cursor.get<double>();
+    RMS = cursor.get<double>();
+    Underflow = cursor.get<double>();
+    Overflow = cursor.get<double>();
+    uint32_t nBins = cursor.get<uint32_t>();
+    Bins = cursor.getVector<uint32_t>(nBins);
+    Contents = cursor.getVector<double>(nBins);
+    Sumw2 = (weighted) ? cursor.getVector<double>(nBins) : std::vector<double>();
+    Preview = cursor.getVector<float>(cursor.get<uint32_t>());
+    return cursor.ok();
+  }
+};
+
+// everything exported for one run
+struct exportRun
+{
+  unsigned int Run = 0;
+  std::vector<double> Totals;                 // same order as runExportReader::totals()
+  std::vector<exportProjection> Projections;  // same order as runExportReader::hists()
+};
+
+// Opens an export, reads its header and index once; load() is then one seek
+// and one read of the run's block.
+class runExportReader
+{
+public:
+  bool open(const std::string& fileName)
+  {
+    File.open(fileName, std::ios::binary);
+    char magic[sizeof(kRunExportMagic)];
+    uint32_t version = 0;
+    if (not File.read(magic, sizeof(magic)) || std::memcmp(magic, kRunExportMagic, sizeof(magic)) != 0
+        || not File.read(reinterpret_cast<char*>(&version), sizeof(version)) || version != kRunExportVersion)
+      return false;
+    // the header runs up to the first block; read it in pieces until the index is in
+    std::string header;
+    auto readMore = [&](size_t size)
+    {
+      size_t old = header.size();
+      header.resize(old + size);
+      File.read(&header[old], size);
+      header.resize(old + File.gcount());
+    };
+    readMore(1 << 16);
+    while (true)
+    {
+      exportCursor cursor(header);
+      if (parseHeader(cursor))
+        return true;
+      if (not File || header.size() > (1u << 30))
+        return false;
+      readMore(header.size());
+    }
+  }
+  const std::vector<std::string>& totals() const { return Totals; }
+  const std::vector<exportHist>& hists() const { return Hists; }
+  const std::vector<unsigned int>& runs() const { return Runs; }
+  bool load(unsigned int run, exportRun& loaded)
+  {
+    auto found = std::lower_bound(Runs.begin(), Runs.end(), run);
+    if (found == Runs.end() || *found != run)
+      return false;
+    size_t idx = found - Runs.begin();
+    std::string block(Sizes[idx], '\0');
+    File.clear();
+    if (not File.seekg(Offsets[idx]) || not File.read(&block[0], block.size()))
+      return false;
+    exportCursor cursor(block);
+    loaded.Run = run;
+    loaded.Totals = cursor.getVector<double>(Totals.size());
+    loaded.Projections.resize(Hists.size());
+    for (size_t hist = 0; hist < Hists.size(); ++hist)
+      if (not loaded.Projections[hist].read(cursor, Hists[hist].Weighted))
+        return false;
+    return cursor.ok();
+  }
+
+private:
+  bool parseHeader(exportCursor& cursor)
+  {
+    Totals.assign(cursor.get<uint32_t>(), "");
+    for (auto& total : Totals)
+      total = cursor.getString();
+    Hists.assign(cursor.get<uint32_t>(), exportHist());
+    for (auto& hist : Hists)
+      if (not hist.read(cursor))
+        return false;
+    uint32_t nRuns = cursor.get<uint32_t>();
+    Runs.clear();
+    Offsets.clear();
+    Sizes.clear();
+    for (uint32_t idx = 0; idx < nRuns && cursor.ok(); ++idx)
+    {
+      Runs.push_back(cursor.get<uint32_t>());
+      Offsets.push_back(cursor.get<uint64_t>());
+      Sizes.push_back(cursor.get<uint64_t>());
+    }
+    return cursor.ok();
+  }
+
+  std::ifstream File;
+  std::vector<std::string> Totals;
+  std::vector<exportHist> Hists;
+  std::vector<unsigned int> Runs;
+  std::vector<uint64_t> Offsets;
+  std::vector<uint64_t> Sizes;
+};
+
+#endif
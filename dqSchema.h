@@ -0,0 +1,342 @@
+#ifndef DQSCHEMA_H
+#define DQSCHEMA_H
+
+// The columns of data_validation_tree, defined once. makeTTree_db_postgre
+// writes them from a skimRecord, the hist stage reads them into a histEvent,
+// and the column cache and passthrough reader visit the same list, so a
+// column is added (or its type changed) on one line of DQ_SKIM_COLUMNS and
+// everything else follows at compile time. checkSkimSchema() compares a tree
+// against the list before anything is bound.
+
+// root includes
+#include "TClass.h"
+#include "TDataType.h"
+#include "TDirectory.h"
+#include "TString.h"
+#include "TTree.h"
+
+// std includes
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+// local includes
+#include "dqCommon.h"
+
+// which skims write a column to data_validation_tree
+enum skimColumnGroup
+{
+  kSkimAlways,       // every skim
+  kSkimDirect,       // all but passthrough skims, which clone it into passthrough_tree (kPassthroughBranches)
+  kSkimPassthrough,  // passthrough skims only
+  kSkimDerived       // skims with the derived columns (option derived)
+};
+
+inline bool skimWrites(skimColumnGroup group, bool passthrough, bool derived)
+{
+  switch (group)
+  {
+    case kSkimDirect:      return not passthrough;
+    case kSkimPassthrough: return passthrough;
+    case kSkimDerived:     return derived;
+    default:               return true;
+  }
+}
+
+// COLUMN(tag, branch, group, read by the hist stage, no-data value,
+//        element type of the narrow layout or void, type)
+// Tags double as the member names of skimRecord and histEvent. Class types
+// take {} as their no-data value. trigSec is the global trigger time from the
+// CAF header (unix seconds, -1 if the CAF has none); the db.* columns stay at
+// their no-data values while the skim's database lookup is switched off.
+#define DQ_SKIM_COLUMNS(COLUMN) \
+  COLUMN(Run,                    "run",                       kSkimAlways,      true,  0,     void,           unsigned int) \
+  COLUMN(Subrun,                 "subrun",                    kSkimAlways,      true,  0,     void,           unsigned int) \
+  COLUMN(Event,                  "event",                     kSkimAlways,      true,  0,     void,           unsigned int) \
+  COLUMN(TrigSec,                "trigSec",                   kSkimAlways,      true,  -1,    void,           int) \
+  COLUMN(NSlices,                "nslc",                      kSkimAlways,      true,  0,     void,           int) \
+  COLUMN(NPFP,                   "slc.npfp",                  kSkimAlways,      true,  {},    void,           std::vector<ULong64_t>) \
+  COLUMN(ClearCosmic,            "slc.clear_cosmic",          kSkimAlways,      true,  {},    void,           std::vector<char>) \
+  COLUMN(CRLongestTrackDirY,     "slc.CRLongestTrackDirY",    kSkimAlways,      true,  {},    void,           std::vector<float>) \
+  COLUMN(FMatchPresent,          "slc.FMatchPresent",         kSkimAlways,      true,  {},    void,           std::vector<bool>) \
+  COLUMN(FMatchLightPE,          "slc.FMatchLightPE",         kSkimAlways,      true,  {},    void,           std::vector<float>) \
+  COLUMN(FMatchScore,            "slc.FMatchScore",           kSkimAlways,      true,  {},    void,           std::vector<float>) \
+  COLUMN(TrackLength,            "slc.pfp.trackLength",       kSkimAlways,      true,  {},    void,           std::vector<std::vector<float>>) \
+  COLUMN(ShowerLength,           "slc.pfp.showerLength",      kSkimAlways,      true,  {},    void,           std::vector<std::vector<float>>) \
+  COLUMN(TrackBestPlane,         "slc.pfp.trackBestPlane",    kSkimAlways,      true,  {},    char,           std::vector<std::vector<int>>) \
+  COLUMN(ShowerBestPlane,        "slc.pfp.showerBestPlane",   kSkimAlways,      true,  {},    char,           std::vector<std::vector<int>>) \
+  COLUMN(TrackDirY,              "slc.pfp.trackDirY",         kSkimAlways,      false, {},    void,           std::vector<std::vector<float>>) \
+  COLUMN(TrackVtxX,              "slc.pfp.trackVtxX",         kSkimAlways,      false, {},    void,           std::vector<std::vector<float>>) \
+  COLUMN(TrackVtxY,              "slc.pfp.trackVtxY",         kSkimAlways,      false, {},    void,           std::vector<std::vector<float>>) \
+  COLUMN(TrackVtxZ,              "slc.pfp.trackVtxZ",         kSkimAlways,      false, {},    void,           std::vector<std::vector<float>>) \
+  COLUMN(TrackNHit1,             "slc.pfp.trackNHit1",        kSkimAlways,      true,  {},    unsigned short, std::vector<std::vector<int>>) \
+  COLUMN(TrackNHit2,             "slc.pfp.trackNHit2",        kSkimAlways,      true,  {},    unsigned short, std::vector<std::vector<int>>) \
+  COLUMN(TrackNHit3,             "slc.pfp.trackNHit3",        kSkimAlways,      true,  {},    unsigned short, std::vector<std::vector<int>>) \
+  COLUMN(NFlashes,               "nflash",                    kSkimAlways,      true,  0,     void,           int) \
+  COLUMN(NCRTHits,               "ncrthit",                   kSkimAlways,      true,  0,     void,           int) \
+  COLUMN(NCRTTracks,             "ncrt_track",                kSkimAlways,      true,  0,     void,           int) \
+  COLUMN(Dropped,                "dropped",                   kSkimPassthrough, true,  false, void,           bool) \
+  COLUMN(FlashTimeWidth,         "flash.timeWidth",           kSkimDirect,      true,  {},    void,           std::vector<float>) \
+  COLUMN(FlashTimeSD,            "flash.timeSD",              kSkimDirect,      true,  {},    void,           std::vector<float>) \
+  COLUMN(FlashPE,                "flash.PE",                  kSkimDirect,      true,  {},    void,           std::vector<float>) \
+  COLUMN(CRTHitPlane,            "crt_hit.plane",             kSkimDirect,      true,  {},    short,          std::vector<int>) \
+  COLUMN(CRTHitPE,               "crt_hit.PE",                kSkimDirect,      true,  {},    void,           std::vector<float>) \
+  COLUMN(CRTHitErrX,             "crt_hit.err_x",             kSkimDirect,      true,  {},    void,           std::vector<float>) \
+  COLUMN(CRTHitErrY,             "crt_hit.err_y",             kSkimDirect,      true,  {},    void,           std::vector<float>) \
+  COLUMN(CRTHitErrZ,             "crt_hit.err_z",             kSkimDirect,      true,  {},    void,           std::vector<float>) \
+  COLUMN(CRTTrackTime,           "crt_track.time",            kSkimDirect,      true,  {},    void,           std::vector<float>) \
+  COLUMN(NCRTPMTMatches,         "ncrtpmt_match",             kSkimAlways,      true,  0,     void,           int) \
+  COLUMN(CRTPMTMatchNHit,        "crtpmt_match.nhit",         kSkimAlways,      true,  {},    void,           std::vector<int>) \
+  COLUMN(CRTPMTMatchHitTimeDiff, "crtpmt_match.hit.timeDiff", kSkimAlways,      true,  {},    void,           std::vector<std::vector<double>>) \
+  COLUMN(DBRunInfoExists,        "db.runinfo_exists",         kSkimAlways,      false, false, void,           bool) \
+  COLUMN(DBTriggerDataExists,    "db.triggerdata_exists",     kSkimAlways,      false, false, void,           bool) \
+  COLUMN(DBRun,                  "db.run",                    kSkimAlways,      false, -1,    void,           int) \
+  COLUMN(DBStart,                "db.start",                  kSkimAlways,      true,  -1,    void,           int) \
+  COLUMN(DBEnd,                  "db.end",                    kSkimAlways,      true,  -1,    void,           int) \
+  COLUMN(DBConfig,               "db.config",                 kSkimAlways,      false, {},    void,           TString) \
+  COLUMN(DBCathodeV,             "db.cathodeV",               kSkimAlways,      true,  0,     void,           double) \
+  COLUMN(DBEInd1V,               "db.EInd1V",                 kSkimAlways,      true,  0,     void,           double) \
+  COLUMN(DBEInd2V,               "db.EInd2V",                 kSkimAlways,      true,  0,     void,           double) \
+  COLUMN(DBECollV,               "db.ECollV",                 kSkimAlways,      true,  0,     void,           double) \
+  COLUMN(DBWInd1V,               "db.WInd1V",                 kSkimAlways,      true,  0,     void,           double) \
+  COLUMN(DBWInd2V,               "db.WInd2V",                 kSkimAlways,      true,  0,     void,           double) \
+  COLUMN(DBWCollV,               "db.WCollV",                 kSkimAlways,      true,  0,     void,           double) \
+  COLUMN(DBNTPC,                 "db.NTPC",                   kSkimAlways,      false, -1,    void,           int) \
+  COLUMN(DBNPMT,                 "db.NPMT",                   kSkimAlways,      false, -1,    void,           int) \
+  COLUMN(DBNCRT,                 "db.NCRT",                   kSkimAlways,      false, -1,    void,           int) \
+  COLUMN(DBEvent,                "db.event",                  kSkimAlways,      false, -1,    void,           int) \
+  COLUMN(DBTrigSec,              "db.trigSec",                kSkimAlways,      true,  -1,    void,           int) \
+  COLUMN(DBTrigNanosec,          "db.trigNanosec",            kSkimAlways,      false, -1,    void,           int) \
+  COLUMN(DBGateType,             "db.gateType",               kSkimAlways,      true,  -1,    void,           int) \
+  COLUMN(DBTrigSource,           "db.trigSource",             kSkimAlways,      true,  -1,    void,           int)
+
+// DERIVED(derivedEvent member, branch, read by the hist stage); the type is
+// the member's, so writer and reader cannot disagree on it
+#define DQ_DERIVED_COLUMNS(DERIVED) \
+  DERIVED(NClearCosmics,      "derived.nClearCosmics",      true)  \
+  DERIVED(NNeutrinoCandidate, "derived.nNeutrinoCandidate", true)  \
+  DERIVED(NTrackHits1,        "derived.nTrackHits1",        true)  \
+  DERIVED(NTrackHits2,        "derived.nTrackHits2",        true)  \
+  DERIVED(NTrackHits3,        "derived.nTrackHits3",        true)  \
+  DERIVED(NTracks,            "derived.nTracks",            true)  \
+  DERIVED(PFPLength,          "derived.pfpLength",          false) \
+  DERIVED(PFPPlane,           "derived.pfpPlane",           false)
+
+// a column without a narrow form
+struct noNarrowForm {};
+
+// T with its innermost element replaced by Elem (noNarrowForm for void)
+template <typename T, typename Elem> struct narrowOf { using type = Elem; };
+template <typename T, typename Elem> struct narrowOf<std::vector<T>, Elem> { using type = std::vector<typename narrowOf<T, Elem>::type>; };
+template <typename T> struct narrowOf<T, void> { using type = noNarrowForm; };
+template <typename T> struct narrowOf<std::vector<T>, void> { using type = noNarrowForm; };
+
+// a kSkimDirect column has to be one the passthrough skim clones
+constexpr bool sameBranch(const char* lhs, const char* rhs)
+{
+  while (*lhs && *lhs == *rhs)
+  {
+    ++lhs;
+    ++rhs;
+  }
+  return *lhs == *rhs;
+}
+constexpr bool clonedByPassthrough(const char* branch)
+{
+  for (const auto& passthrough : kPassthroughBranches)
+    if (sameBranch(passthrough.Name, branch))
+      return true;
+  return false;
+}
+
+// one tag type per column, carrying what the list says about it
+namespace skimColumns
+{
+#define DQ_SKIM_TAG(Tag, BranchName, ColumnGroup, ReadByHist, NoData, NarrowElement, ...)                        \
+  struct Tag                                                                                                      \
+  {                                                                                                               \
+    static constexpr const char* Branch = BranchName;                                                             \
+    static constexpr skimColumnGroup Group = ColumnGroup;                                                         \
+    static constexpr bool Hist = ReadByHist;                                                                      \
+    using Type = __VA_ARGS__;                                                                                     \
+    using Narrow = narrowOf<Type, NarrowElement>::type;                                                           \
+    static_assert(Group != kSkimDirect || clonedByPassthrough(BranchName), BranchName " is not in kPassthroughBranches"); \
+  };
+DQ_SKIM_COLUMNS(DQ_SKIM_TAG)
+#undef DQ_SKIM_TAG
+
+#define DQ_DERIVED_TAG(Member, BranchName, ReadByHist)       \
+  struct Derived##Member                                     \
+  {                                                          \
+    static constexpr const char* Branch = BranchName;        \
+    static constexpr skimColumnGroup Group = kSkimDerived;   \
+    static constexpr bool Hist = ReadByHist;                 \
+    using Type = decltype(derivedEvent::Member);             \
+    using Narrow = noNarrowForm;                             \
+  };
+DQ_DERIVED_COLUMNS(DQ_DERIVED_TAG)
+#undef DQ_DERIVED_TAG
+}
+
+// func(tag) for every column, derived ones last
+template <typename Func>
+void forEachSkimColumn(Func&& func)
+{
+#define DQ_VISIT_TAG(Tag, ...) func(skimColumns::Tag{});
+#define DQ_VISIT_DERIVED_TAG(Member, ...) func(skimColumns::Derived##Member{});
+  DQ_SKIM_COLUMNS(DQ_VISIT_TAG)
+  DQ_DERIVED_COLUMNS(DQ_VISIT_DERIVED_TAG)
+#undef DQ_VISIT_TAG
+#undef DQ_VISIT_DERIVED_TAG
+}
+
+// empty an array column; scalars are overwritten every entry
+template <typename T>
+void clearColumn(std::vector<T>& values) { values.clear(); }
+template <typename T>
+void clearColumn(T&) {}
+
+// the skim's output buffers, each column in its declared type and, where it
+// has one, its narrow form; reused from entry to entry
+struct skimRecord
+{
+#define DQ_SKIM_BUFFER(Tag, BranchName, ColumnGroup, ReadByHist, NoData, ...) \
+  skimColumns::Tag::Type Tag = NoData;                                         \
+  skimColumns::Tag::Narrow Tag##Narrow;
+  DQ_SKIM_COLUMNS(DQ_SKIM_BUFFER)
+#undef DQ_SKIM_BUFFER
+  derivedEvent Derived;
+
+  // func(tag, buffer, narrow buffer) for every column, derived ones last
+  template <typename Func>
+  void forEachColumn(Func&& func)
+  {
+#define DQ_VISIT_BUFFER(Tag, ...) func(skimColumns::Tag{}, Tag, Tag##Narrow);
+#define DQ_VISIT_DERIVED(Member, ...) func(skimColumns::Derived##Member{}, Derived.Member, NoNarrow);
+    DQ_SKIM_COLUMNS(DQ_VISIT_BUFFER)
+    DQ_DERIVED_COLUMNS(DQ_VISIT_DERIVED)
+#undef DQ_VISIT_BUFFER
+#undef DQ_VISIT_DERIVED
+  }
+  void clear()
+  {
+    forEachColumn([](auto, auto& values, auto& narrow)
+    {
+      clearColumn(values);
+      clearColumn(narrow);
+    });
+  }
+
+private:
+  noNarrowForm NoNarrow;
+};
+
+// whether branch stores T, compared the way SetBranchAddress would
+template <typename T>
+bool branchHolds(TBranch* branch)
+{
+  TClass* storedClass = nullptr;
+  EDataType storedType = kOther_t;
+  if (branch->GetExpectedType(storedClass, storedType) != 0)
+    return false;
+  if constexpr (std::is_arithmetic<T>::value)
+    return storedClass == nullptr && storedType == TDataType::GetType(typeid(T));
+  else
+    return storedClass != nullptr && storedClass == TClass::GetClass(typeid(T));
+}
+
+// T as ROOT names it, for reports
+template <typename T>
+std::string schemaTypeName()
+{
+  if constexpr (std::is_arithmetic<T>::value)
+    return TDataType::GetTypeName(TDataType::GetType(typeid(T)));
+  TClass* typeClass = TClass::GetClass(typeid(T));
+  return (typeClass) ? typeClass->GetName() : typeid(T).name();
+}
+
+// Every column tree has must hold the type declared above (its narrow form
+// if narrow); reports each one that does not and returns false, before a
+// SetBranchAddress fails on it or converts it behind our back. Columns the
+// tree lacks are left to the caller, older skims miss some.
+inline bool checkSkimSchema(TTree* tree, bool narrow, std::ostream& report)
+{
+  bool good = true;
+  forEachSkimColumn([&](auto column)
+  {
+    using col = decltype(column);
+    constexpr bool hasNarrow = not std::is_same<typename col::Narrow, noNarrowForm>::value;
+    TBranch* branch = tree->GetBranch(col::Branch);
+    if (not branch)
+      return;
+    bool holdsWide = branchHolds<typename col::Type>(branch);
+    bool holdsNarrow = false;
+    if constexpr (hasNarrow)
+      holdsNarrow = branchHolds<typename col::Narrow>(branch);
+    if ((narrow && hasNarrow) ? holdsNarrow : holdsWide)
+      return;
+    good = false;
+    if constexpr (hasNarrow)
+      report << "Column " << col::Branch << " of " << tree->GetName() << " is not a "
+             << ((narrow) ? schemaTypeName<typename col::Narrow>() : schemaTypeName<typename col::Type>());
+    else
+      report << "Column " << col::Branch << " of " << tree->GetName() << " is not a "
+             << schemaTypeName<typename col::Type>();
+    if (holdsNarrow)
+      report << " (the skim has the narrow layout)";
+    else if (holdsWide && hasNarrow)
+      report << " (the skim has the default layout)";
+    report << std::endl;
+  });
+  return good;
+}
+
+// The skim's time_index: (trigger second, entry) of every entry of tree with
+// a trigger time, sorted by time. Scanned from the trigSec column alone; the
+// branch is pointed at a local for the scan and handed back afterwards.
+inline std::vector<timeIndexEntry> scanTimeIndex(TTree* tree)
+{
+  std::vector<timeIndexEntry> timeIndex;
+  TBranch* trigSecBranch = tree->GetBranch(skimColumns::TrigSec::Branch);
+  if (not trigSecBranch)
+    return timeIndex;
+  char* boundAddr = trigSecBranch->GetAddress();
+  int trigSec = -1;
+  trigSecBranch->SetAddress(&trigSec);
+  for (Long64_t entry = 0; entry < tree->GetEntries(); ++entry)
+  {
+    if (trigSecBranch->GetEntry(entry) > 0 && trigSec >= 0)
+      timeIndex.push_back({trigSec, entry});
+  }
+  if (boundAddr)
+    trigSecBranch->SetAddress(boundAddr);
+  else
+    tree->ResetBranchAddress(trigSecBranch);
+  std::sort(timeIndex.begin(), timeIndex.end());
+  return timeIndex;
+}
+
+// write timeIndex as the time_index tree of dir, replacing any there
+inline void writeTimeIndex(const std::vector<timeIndexEntry>& timeIndex, TDirectory* dir)
+{
+  dir->cd();
+  dir->Delete("time_index;*");
+  TTree* timeIndexTree = new TTree("time_index", "Trigger Time To Entry");
+  int indexSec;
+  Long64_t indexEntry;
+  timeIndexTree->Branch("trigSec", &indexSec);
+  timeIndexTree->Branch("entry", &indexEntry);
+  for (const auto& indexed : timeIndex)
+  {
+    indexSec = indexed.Sec;
+    indexEntry = indexed.Entry;
+    timeIndexTree->Fill();
+  }
+  timeIndexTree->Write("", TObject::kOverwrite);
+  delete timeIndexTree;
+}
+
+#endif
@@ -0,0 +1,505 @@
+#ifndef DQTREND_H
+#define DQTREND_H
+
+// Trend pyramid: aggregates of every histogram's values (count, sum, sum of
+// squares, min, max and a coarse sketch of the distribution) at subrun, run,
+// day and era level, so a trend view reads a few hundred aggregates instead
+// of scanning the skim or the per-run TH2Ds. makeHists_db_postgre builds the
+// subrun level (option trend=FILE) and merges it into FILE: a subrun it has
+// seen replaces the stored one, everything else is kept, and the run, day
+// and era levels are rolled up again from the subruns. A subrun counts
+// toward the day (Chicago standard time, like the shift histograms) of its
+// first trigger, the CAF header time in the skim's trigSec column; subruns
+// without trigger times (older skims, CAFs without one) are in no day, so the
+// day level stays empty for them. Update it from whole (merged) skims: a
+// subrun split over two skims keeps only the last.
+//
+// Layout, little-endian, strings as uint32 length + bytes:
+//   "DQTRENDS", uint32 version, uint64 header size (everything up to the nodes)
+//   uint32 nMetrics, per metric: string name, double lo, double hi
+//   uint32 nEras, per era: string name, uint32 first run, uint32 last run
+//   uint32 nSources, nSources x string          skims merged in so far
+//   per level (subrun, run, day, era): uint32 nNodes, nNodes x uint64 key
+//     (ascending), uint64 offset of the level's first node
+//   nodes, fixed size (trendNodeSize): int64 nEvents, int32 firstSec,
+//     int32 lastSec, double pot, int64 gates, per metric: double n, sum,
+//     sum2, min, max, nonFinite, (kTrendSketchBins + 2) x uint32 sketch
+// Subrun keys are run << 32 | subrun, run keys the run, day keys days since
+// the epoch, era keys the era's index.
+
+// std includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// local includes
+#include "dqRunExport.h"
+
+constexpr char kTrendMagic[8] = {'D', 'Q', 'T', 'R', 'E', 'N', 'D', 'S'};
+constexpr uint32_t kTrendVersion = 2;
+// sketch bins between a metric's lo and hi, plus under- and overflow
+constexpr int kTrendSketchBins = 16;
+
+enum trendLevel { kTrendSubrun, kTrendRun, kTrendDay, kTrendEra, kNTrendLevels };
+const char* const kTrendLevelName[kNTrendLevels] = {"subrun", "run", "day", "era"};
+
+inline uint64_t trendSubrunKey(unsigned int run, unsigned int subrun)
+{
+  return (static_cast<uint64_t>(run) << 32) | subrun;
+}
+inline uint64_t trendDayKey(int sec)
+{
+  const int cst = 6 * 3600;  // 00:00 CST in UTC
+  return static_cast<uint64_t>(sec - cst) / 86400;
+}
+
+// one metric: the histogram it follows and the range its sketch covers
+// (lo >= hi: no sketch, e.g. a per-run TH1D filled with weights)
+struct trendMetric
+{
+  std::string Name;
+  double Lo = 0;
+  double Hi = 0;
+  bool operator==(const trendMetric& other) const
+  {
+    return Name == other.Name && Lo == other.Lo && Hi == other.Hi;
+  }
+};
+
+// the values of one metric in one node
+struct trendAggregate
+{
+  double N = 0;
+  double Sum = 0;
+  double Sum2 = 0;
+  double Min = std::numeric_limits<double>::infinity();
+  double Max = -std::numeric_limits<double>::infinity();
+  double NonFinite = 0;  // NaN and inf values (a ratio over an empty event), kept out of the rest
+  uint32_t Sketch[kTrendSketchBins + 2] = {};
+
+  void add(double value, double lo, double hi)
+  {
+    if (not std::isfinite(value))
+    {
+      NonFinite += 1;
+      return;
+    }
+    N += 1;
+    Sum += value;
+    Sum2 += value * value;
+    Min = std::min(Min, value);
+    Max = std::max(Max, value);
+    if (lo < hi)
+    {
+      // rounding can put a value just below hi one past the last bin
+      int bin = (value < lo) ? 0 : (value >= hi) ? kTrendSketchBins + 1
+              : std::min(1 + static_cast<int>((value - lo) / (hi - lo) * kTrendSketchBins), kTrendSketchBins);
+      ++Sketch[bin];
+    }
+  }
+  void merge(const trendAggregate& other)
+  {
+    N += other.N;
+    Sum += other.Sum;
+    Sum2 += other.Sum2;
+    Min = std::min(Min, other.Min);
+    Max = std::max(Max, other.Max);
+    NonFinite += other.NonFinite;
+    for (int bin = 0; bin < kTrendSketchBins + 2; ++bin)
+      Sketch[bin] += other.Sketch[bin];
+  }
+  double mean() const { return (N > 0) ? Sum / N : 0; }
+  double rms() const { return (N > 0) ? std::sqrt(std::max(0., Sum2 / N - mean() * mean())) : 0; }
+  // q-quantile from the sketch, linear within a bin; values outside
+  // [lo, hi] are taken to sit at its edges
+  double quantile(double q, double lo, double hi) const
+  {
+    double total = 0;
+    for (uint32_t count : Sketch)
+      total += count;
+    if (total == 0 || lo >= hi)
+      return mean();
+    double want = q * total, seen = 0;
+    double width = (hi - lo) / kTrendSketchBins;
+    for (int bin = 0; bin < kTrendSketchBins + 2; ++bin)
+    {
+      if (seen + Sketch[bin] >= want && Sketch[bin] > 0)
+      {
+        if (bin == 0)
+          return lo;
+        if (bin == kTrendSketchBins + 1)
+          return hi;
+        return lo + (bin - 1 + (want - seen) / Sketch[bin]) * width;
+      }
+      seen += Sketch[bin];
+    }
+    return hi;
+  }
+};
+
+// one subrun, run, day or era
+struct trendNode
+{
+  uint64_t Key = 0;
+  long long NEvents = 0;
+  int FirstSec = -1;
+  int LastSec = -1;
+  double POT = 0;
+  long long Gates = 0;
+  std::vector<trendAggregate> Metrics;
+
+  trendNode(uint64_t key = 0, size_t nMetrics = 0) : Key(key), Metrics(nMetrics) {}
+  // an event, with its trigger time if it has one
+  void addEvent(int sec)
+  {
+    ++NEvents;
+    if (sec >= 0)
+    {
+      FirstSec = (FirstSec < 0) ? sec : std::min(FirstSec, sec);
+      LastSec = std::max(LastSec, sec);
+    }
+  }
+  void merge(const trendNode& other)
+  {
+    NEvents += other.NEvents;
+    if (other.FirstSec >= 0)
+    {
+      FirstSec = (FirstSec < 0) ? other.FirstSec : std::min(FirstSec, other.FirstSec);
+      LastSec = std::max(LastSec, other.LastSec);
+    }
+    POT += other.POT;
+    Gates += other.Gates;
+    for (size_t metric = 0; metric < Metrics.size() && metric < other.Metrics.size(); ++metric)
+      Metrics[metric].merge(other.Metrics[metric]);
+  }
+  void write(exportBuffer& buffer) const
+  {
+    buffer.put<int64_t>(NEvents);
+    buffer.put<int32_t>(FirstSec);
+    buffer.put<int32_t>(LastSec);
+    buffer.put<double>(POT);
+    buffer.put<int64_t>(Gates);
+    for (const auto& metric : Metrics)
+    {
+      buffer.put<double>(metric.N);
+      buffer.put<double>(metric.Sum);
+      buffer.put<double>(metric.Sum2);
+      buffer.put<double>(metric.Min);
+      buffer.put<double>(metric.Max);
+      buffer.put<double>(metric.NonFinite);
+      for (uint32_t count : metric.Sketch)
+        buffer.put<uint32_t>(count);
+    }
+  }
+  bool read(exportCursor& cursor, size_t nMetrics)
+  {
+    NEvents = cursor.get<int64_t>();
+    FirstSec = cursor.get<int32_t>();
+    LastSec = cursor.get<int32_t>();
+    POT = cursor.get<double>();
+    Gates = cursor.get<int64_t>();
+    Metrics.assign(nMetrics, trendAggregate());
+    for (auto& metric : Metrics)
+    {
+      metric.N = cursor.get<double>();
+      metric.Sum = cursor.get<double>();
+      metric.Sum2 = cursor.get<double>();
+      metric.Min = cursor.get<double>();
+      metric.Max = cursor.get<double>();
+      metric.NonFinite = cursor.get<double>();
+      for (uint32_t& count : metric.Sketch)
+        count = cursor.get<uint32_t>();
+    }
+    return cursor.ok();
+  }
+};
+
+inline size_t trendNodeSize(size_t nMetrics)
+{
+  return 2 * sizeof(int64_t) + 2 * sizeof(int32_t) + sizeof(double)
+       + nMetrics * (6 * sizeof(double) + (kTrendSketchBins + 2) * sizeof(uint32_t));
+}
+
+// a named run range
+struct trendEra
+{
+  std::string Name;
+  uint32_t FirstRun = 0;
+  uint32_t LastRun = std::numeric_limits<uint32_t>::max();
+};
+
+// Opens a pyramid, reads its header and key index once; read() then returns
+// the nodes of a level in a key range with a single read, without touching
+// the rest of the file.
+class trendReader
+{
+public:
+  bool open(const std::string& fileName)
+  {
+    File.open(fileName, std::ios::binary);
+    char magic[sizeof(kTrendMagic)];
+    uint32_t version = 0;
+    uint64_t headerSize = 0;
+    if (not File.read(magic, sizeof(magic)) || std::memcmp(magic, kTrendMagic, sizeof(magic)) != 0
+        || not File.read(reinterpret_cast<char*>(&version), sizeof(version)) || version != kTrendVersion
+        || not File.read(reinterpret_cast<char*>(&headerSize), sizeof(headerSize)))
+      return false;
+    size_t prefix = sizeof(magic) + sizeof(version) + sizeof(headerSize);
+    if (headerSize < prefix || headerSize > (1ULL << 32))
+      return false;
+    std::string header(headerSize - prefix, '\0');
+    if (not File.read(&header[0], header.size()))
+      return false;
+    exportCursor cursor(header);
+    Metrics.assign(cursor.get<uint32_t>(), trendMetric());
+    for (auto& metric : Metrics)
+    {
+      metric.Name = cursor.getString();
+      metric.Lo = cursor.get<double>();
+      metric.Hi = cursor.get<double>();
+    }
+    Eras.assign(cursor.get<uint32_t>(), trendEra());
+    for (auto& era : Eras)
+    {
+      era.Name = cursor.getString();
+      era.FirstRun = cursor.get<uint32_t>();
+      era.LastRun = cursor.get<uint32_t>();
+    }
+    Sources.assign(cursor.get<uint32_t>(), "");
+    for (auto& source : Sources)
+      source = cursor.getString();
+    for (int level = 0; level < kNTrendLevels; ++level)
+    {
+      Keys[level] = cursor.getVector<uint64_t>(cursor.get<uint32_t>());
+      Offsets[level] = cursor.get<uint64_t>();
+    }
+    return cursor.ok();
+  }
+  const std::vector<trendMetric>& metrics() const { return Metrics; }
+  const std::vector<trendEra>& eras() const { return Eras; }
+  const std::vector<std::string>& sources() const { return Sources; }
+  const std::vector<uint64_t>& keys(trendLevel level) const { return Keys[level]; }
+  // nodes of level with keys in [keyLo, keyHi]
+  bool read(trendLevel level, uint64_t keyLo, uint64_t keyHi, std::vector<trendNode>& nodes)
+  {
+    const std::vector<uint64_t>& keys = Keys[level];
+    size_t first = std::lower_bound(keys.begin(), keys.end(), keyLo) - keys.begin();
+    size_t last = std::upper_bound(keys.begin(), keys.end(), keyHi) - keys.begin();
+    nodes.clear();
+    if (first >= last)
+      return true;
+    size_t nodeSize = trendNodeSize(Metrics.size());
+    std::string block((last - first) * nodeSize, '\0');
+    File.clear();
+    if (not File.seekg(Offsets[level] + first * nodeSize) || not File.read(&block[0], block.size()))
+      return false;
+    exportCursor cursor(block);
+    nodes.resize(last - first);
+    for (size_t idx = 0; idx < nodes.size(); ++idx)
+    {
+      nodes[idx].Key = keys[first + idx];
+      if (not nodes[idx].read(cursor, Metrics.size()))
+        return false;
+    }
+    return true;
+  }
+  bool readAll(trendLevel level, std::vector<trendNode>& nodes)
+  {
+    return read(level, 0, std::numeric_limits<uint64_t>::max(), nodes);
+  }
+
+private:
+  std::ifstream File;
+  std::vector<trendMetric> Metrics;
+  std::vector<trendEra> Eras;
+  std::vector<std::string> Sources;
+  std::vector<uint64_t> Keys[kNTrendLevels];
+  uint64_t Offsets[kNTrendLevels] = {};
+};
+
+// The whole pyramid in memory, for merging new subruns in and writing it back.
+struct trendPyramid
+{
+  std::vector<trendMetric> Metrics;
+  std::vector<trendEra> Eras;
+  std::vector<std::string> Sources;
+  std::vector<trendNode> Levels[kNTrendLevels];  // each sorted by key
+
+  // an existing pyramid (false if unreadable, or kept for other metrics),
+  // or a new one for metrics if fileName does not exist yet
+  bool load(const std::string& fileName, const std::vector<trendMetric>& metrics)
+  {
+    Metrics = metrics;
+    if (not std::ifstream(fileName))
+      return true;
+    trendReader reader;
+    if (not reader.open(fileName) || not reader.readAll(kTrendSubrun, Levels[kTrendSubrun]))
+    {
+      std::cout << "Trend pyramid " << fileName << " is unreadable" << std::endl;
+      return false;
+    }
+    if (not (reader.metrics() == metrics))
+    {
+      std::cout << "Trend pyramid " << fileName << " follows other histograms than this config" << std::endl;
+      return false;
+    }
+    Eras = reader.eras();
+    Sources = reader.sources();
+    return true;
+  }
+
+  // eras from a file, one "name firstRun lastRun" per line, '#' comments
+  bool loadEras(const std::string& fileName)
+  {
+    std::ifstream eraFile(fileName);
+    if (not eraFile)
+    {
+      std::cout << "Cannot open era list " << fileName << std::endl;
+      return false;
+    }
+    std::vector<trendEra> eras;
+    std::string line;
+    while (std::getline(eraFile, line))
+    {
+      line = line.substr(0, line.find('#'));
+      std::stringstream lineStrm(line);
+      trendEra era;
+      if (not (lineStrm >> era.Name))
+        continue;
+      if (not (lineStrm >> era.FirstRun >> era.LastRun))
+      {
+        std::cout << "Bad era line in " << fileName << ": " << line << std::endl;
+        return false;
+      }
+      eras.push_back(era);
+    }
+    Eras = eras;
+    return true;
+  }
+
+  // merge in the subruns of one pass over source; each replaces the stored
+  // subrun with its key, then the upper levels are rolled up again
+  void update(const std::map<uint64_t, trendNode>& subruns, const std::string& source)
+  {
+    std::vector<trendNode>& stored = Levels[kTrendSubrun];
+    std::vector<trendNode> merged;
+    merged.reserve(stored.size() + subruns.size());
+    auto fresh = subruns.begin();
+    for (const auto& node : stored)
+    {
+      for (; fresh != subruns.end() && fresh->first < node.Key; ++fresh)
+        merged.push_back(fresh->second);
+      if (fresh != subruns.end() && fresh->first == node.Key)
+        merged.push_back((fresh++)->second);
+      else
+        merged.push_back(node);
+    }
+    for (; fresh != subruns.end(); ++fresh)
+      merged.push_back(fresh->second);
+    stored = std::move(merged);
+    if (std::find(Sources.begin(), Sources.end(), source) == Sources.end())
+      Sources.push_back(source);
+    rollUp();
+  }
+
+  void rollUp()
+  {
+    if (Eras.empty())
+      Eras.push_back(trendEra{"all"});
+    std::map<uint64_t, trendNode> upper[kNTrendLevels];
+    auto into = [&](int level, uint64_t key, const trendNode& node)
+    {
+      auto found = upper[level].find(key);
+      if (found == upper[level].end())
+        found = upper[level].emplace(key, trendNode(key, Metrics.size())).first;
+      found->second.merge(node);
+    };
+    for (const auto& node : Levels[kTrendSubrun])
+    {
+      uint32_t run = node.Key >> 32;
+      into(kTrendRun, run, node);
+      if (node.FirstSec >= 0)
+        into(kTrendDay, trendDayKey(node.FirstSec), node);
+      for (size_t era = 0; era < Eras.size(); ++era)
+        if (run >= Eras[era].FirstRun && run <= Eras[era].LastRun)
+          into(kTrendEra, era, node);
+    }
+    for (int level = kTrendRun; level < kNTrendLevels; ++level)
+    {
+      Levels[level].clear();
+      for (auto& node : upper[level])
+        Levels[level].push_back(std::move(node.second));
+    }
+  }
+
+  // write to a temporary and rename, like the skim checkpoint
+  bool save(const std::string& fileName) const
+  {
+    exportBuffer header;
+    header.Data.append(kTrendMagic, sizeof(kTrendMagic));
+    header.put<uint32_t>(kTrendVersion);
+    header.put<uint64_t>(0);  // header size, patched below
+    header.put<uint32_t>(Metrics.size());
+    for (const auto& metric : Metrics)
+    {
+      header.put(metric.Name);
+      header.put<double>(metric.Lo);
+      header.put<double>(metric.Hi);
+    }
+    header.put<uint32_t>(Eras.size());
+    for (const auto& era : Eras)
+    {
+      header.put(era.Name);
+      header.put<uint32_t>(era.FirstRun);
+      header.put<uint32_t>(era.LastRun);
+    }
+    header.put<uint32_t>(Sources.size());
+    for (const auto& source : Sources)
+      header.put(source);
+    size_t indexSize = 0;
+    for (const auto& level : Levels)
+      indexSize += sizeof(uint32_t) + level.size() * sizeof(uint64_t) + sizeof(uint64_t);
+    uint64_t offset = header.Data.size() + indexSize;
+    size_t nodeSize = trendNodeSize(Metrics.size());
+    for (const auto& level : Levels)
+    {
+      header.put<uint32_t>(level.size());
+      for (const auto& node : level)
+        header.put<uint64_t>(node.Key);
+      header.put<uint64_t>(offset);
+      offset += level.size() * nodeSize;
+    }
+    uint64_t headerSize = header.Data.size();
+    std::memcpy(&header.Data[sizeof(kTrendMagic) + sizeof(uint32_t)], &headerSize, sizeof(headerSize));
+
+    std::string tmpName = fileName + ".tmp";
+    {
+      std::ofstream outStrm(tmpName, std::ios::binary | std::ios::trunc);
+      outStrm.write(header.Data.data(), header.Data.size());
+      for (const auto& level : Levels)
+      {
+        exportBuffer nodes;
+        for (const auto& node : level)
+          node.write(nodes);
+        outStrm.write(nodes.Data.data(), nodes.Data.size());
+      }
+      if (not outStrm)
+      {
+        std::remove(tmpName.c_str());
+        return false;
+      }
+    }
+    return std::rename(tmpName.c_str(), fileName.c_str()) == 0;
+  }
+};
+
+#endif
@@ -0,0 +1,461 @@
+// root includes
+#include "TBranch.h"
+#include "TClass.h"
+#include "TFile.h"
+#include "TLeaf.h"
+#include "TStopwatch.h"
+#include "TString.h"
+#include "TTree.h"
+
+// arrow includes
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <arrow/util/compression.h>
+
+// std incldes
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// local includes
+#include "dqCommon.h"
+
+// The element types a skim column can have, whatever ROOT calls them
+enum arrowValueKind { kArrowNone, kArrowInt8, kArrowUInt8, kArrowInt16, kArrowUInt16, kArrowInt32,
+                      kArrowUInt32, kArrowInt64, kArrowUInt64, kArrowFloat, kArrowDouble, kArrowBool };
+
+// a C++ type name as ROOT spells it in a class name ("unsigned short") or a
+// leaf type ("UShort_t"), spaces removed
+inline arrowValueKind arrowKindOf(const std::string& typeName)
+{
+  static const std::vector<std::pair<std::string, arrowValueKind>> names = {
+    {"char", kArrowInt8},              {"Char_t", kArrowInt8},
+    {"unsignedchar", kArrowUInt8},     {"UChar_t", kArrowUInt8},
+    {"short", kArrowInt16},            {"Short_t", kArrowInt16},
+    {"unsignedshort", kArrowUInt16},   {"UShort_t", kArrowUInt16},
+    {"int", kArrowInt32},              {"Int_t", kArrowInt32},
+    {"unsignedint", kArrowUInt32},     {"UInt_t", kArrowUInt32},
+    {"Long64_t", kArrowInt64},         {"longlong", kArrowInt64},
+    {"ULong64_t", kArrowUInt64},       {"unsignedlonglong", kArrowUInt64},
+    {"float", kArrowFloat},            {"Float_t", kArrowFloat},
+    {"double", kArrowDouble},          {"Double_t", kArrowDouble},
+    {"bool", kArrowBool},              {"Bool_t", kArrowBool},
+  };
+  for (const auto& name : names)
+    if (name.first == typeName)
+      return name.second;
+  return kArrowNone;
+}
+
+inline arrowValueKind arrowKindOf(EDataType type)
+{
+  switch (type)
+  {
+    case kChar_t:    return kArrowInt8;
+    case kUChar_t:   return kArrowUInt8;
+    case kShort_t:   return kArrowInt16;
+    case kUShort_t:  return kArrowUInt16;
+    case kInt_t:     return kArrowInt32;
+    case kUInt_t:    return kArrowUInt32;
+    case kLong64_t:  return kArrowInt64;
+    case kULong64_t: return kArrowUInt64;
+    case kFloat_t:   return kArrowFloat;
+    case kDouble_t:  return kArrowDouble;
+    case kBool_t:    return kArrowBool;
+    default:         return kArrowNone;
+  }
+}
+
+// One output column: holds the tree's buffer for one branch and appends each
+// entry to an arrow builder; finish() hands out the batch built so far and
+// starts the next one, so memory stays at one record batch.
+class arrowColumn
+{
+public:
+  arrowColumn(const std::string& name) : Name(name) {}
+  virtual ~arrowColumn() = default;
+  virtual std::shared_ptr<arrow::DataType> type() const = 0;
+  virtual bool bind(TTree* tree) = 0;
+  virtual arrow::Status append() = 0;
+  virtual arrow::Status finish(std::shared_ptr<arrow::Array>* out) = 0;
+  std::shared_ptr<arrow::Field> field() const { return arrow::field(Name, type()); }
+  std::string Name;
+};
+
+// Root is the type the tree stores, Value the C type arrow has a builder for
+// (same size: char -> int8_t, Long64_t -> int64_t)
+template <typename Root, typename Value>
+struct arrowTypes
+{
+  static_assert(sizeof(Root) == sizeof(Value), "ROOT and arrow element types differ in size");
+  using Builder = typename arrow::CTypeTraits<Value>::BuilderType;
+  static std::shared_ptr<arrow::DataType> type() { return arrow::CTypeTraits<Value>::type_singleton(); }
+  // a run of elements; bools go one by one (arrow packs them into bits, and
+  // vector<bool> has no data())
+  static arrow::Status appendAll(Builder* builder, const Root* values, size_t size)
+  {
+    if constexpr (std::is_same<Value, bool>::value)
+    {
+      for (size_t idx = 0; idx < size; ++idx)
+        ARROW_RETURN_NOT_OK(builder->Append(values[idx]));
+      return arrow::Status::OK();
+    } else {
+      return builder->AppendValues(reinterpret_cast<const Value*>(values), size);
+    }
+  }
+  static arrow::Status appendAll(Builder* builder, const std::vector<Root>& values)
+  {
+    if constexpr (std::is_same<Root, bool>::value)
+    {
+      for (bool value : values)
+        ARROW_RETURN_NOT_OK(builder->Append(value));
+      return arrow::Status::OK();
+    } else {
+      return appendAll(builder, values.data(), values.size());
+    }
+  }
+};
+
+// per-event scalars
+template <typename Root, typename Value>
+class scalarColumn : public arrowColumn
+{
+public:
+  using arrowColumn::arrowColumn;
+  std::shared_ptr<arrow::DataType> type() const override { return arrowTypes<Root, Value>::type(); }
+  bool bind(TTree* tree) override { return tree->SetBranchAddress(Name.c_str(), &Data) >= 0; }
+  arrow::Status append() override { return Values.Append(static_cast<Value>(Data)); }
+  arrow::Status finish(std::shared_ptr<arrow::Array>* out) override { return Values.Finish(out); }
+  Root Data{};
+
+private:
+  typename arrowTypes<Root, Value>::Builder Values;
+};
+
+// per-slice, per-flash, ... values: vector<T> -> list<T>
+template <typename Root, typename Value>
+class listColumn : public arrowColumn
+{
+public:
+  using Types = arrowTypes<Root, Value>;
+  listColumn(const std::string& name)
+    : arrowColumn(name), List(arrow::default_memory_pool(), std::make_shared<typename Types::Builder>())
+  {
+    Values = static_cast<typename Types::Builder*>(List.value_builder());
+  }
+  std::shared_ptr<arrow::DataType> type() const override { return arrow::list(Types::type()); }
+  bool bind(TTree* tree) override { return tree->SetBranchAddress(Name.c_str(), &Data) >= 0; }
+  arrow::Status append() override
+  {
+    ARROW_RETURN_NOT_OK(List.Append());
+    return Types::appendAll(Values, *Data);
+  }
+  arrow::Status finish(std::shared_ptr<arrow::Array>* out) override { return List.Finish(out); }
+  std::vector<Root>* Data = nullptr;
+
+private:
+  arrow::ListBuilder List;
+  typename Types::Builder* Values;
+};
+
+// per-PFP and per-matched-hit values: vector<vector<T>> -> list<list<T>>
+template <typename Root, typename Value>
+class listListColumn : public arrowColumn
+{
+public:
+  using Types = arrowTypes<Root, Value>;
+  listListColumn(const std::string& name)
+    : arrowColumn(name),
+      Outer(arrow::default_memory_pool(),
+            std::make_shared<arrow::ListBuilder>(arrow::default_memory_pool(), std::make_shared<typename Types::Builder>()))
+  {
+    Inner = static_cast<arrow::ListBuilder*>(Outer.value_builder());
+    Values = static_cast<typename Types::Builder*>(Inner->value_builder());
+  }
+  std::shared_ptr<arrow::DataType> type() const override { return arrow::list(arrow::list(Types::type())); }
+  bool bind(TTree* tree) override { return tree->SetBranchAddress(Name.c_str(), &Data) >= 0; }
+  arrow::Status append() override
+  {
+    ARROW_RETURN_NOT_OK(Outer.Append());
+    for (const auto& inner : *Data)
+    {
+      ARROW_RETURN_NOT_OK(Inner->Append());
+      ARROW_RETURN_NOT_OK(Types::appendAll(Values, inner));
+    }
+    return arrow::Status::OK();
+  }
+  arrow::Status finish(std::shared_ptr<arrow::Array>* out) override { return Outer.Finish(out); }
+  std::vector<std::vector<Root>>* Data = nullptr;
+
+private:
+  arrow::ListBuilder Outer;
+  arrow::ListBuilder* Inner;
+  typename Types::Builder* Values;
+};
+
+// a passthrough skim's flash and CRT columns: CAF leaf arrays sized by their
+// count leaf, exported as list<T> under the skim's name
+template <typename Root, typename Value>
+class leafListColumn : public arrowColumn
+{
+public:
+  using Types = arrowTypes<Root, Value>;
+  leafListColumn(const std::string& name, const std::string& cafName)
+    : arrowColumn(name), CAFName(cafName), List(arrow::default_memory_pool(), std::make_shared<typename Types::Builder>())
+  {
+    Values = static_cast<typename Types::Builder*>(List.value_builder());
+  }
+  std::shared_ptr<arrow::DataType> type() const override { return arrow::list(Types::type()); }
+  bool bind(TTree* tree) override
+  {
+    TBranch* branch = tree->GetBranch(CAFName.c_str());
+    Leaf = (branch && branch->GetNleaves() == 1) ? static_cast<TLeaf*>(branch->GetListOfLeaves()->At(0)) : nullptr;
+    return Leaf != nullptr;
+  }
+  arrow::Status append() override
+  {
+    ARROW_RETURN_NOT_OK(List.Append());
+    return Types::appendAll(Values, static_cast<const Root*>(Leaf->GetValuePointer()), Leaf->GetLen());
+  }
+  arrow::Status finish(std::shared_ptr<arrow::Array>* out) override { return List.Finish(out); }
+
+private:
+  std::string CAFName;
+  TLeaf* Leaf = nullptr;
+  arrow::ListBuilder List;
+  typename Types::Builder* Values;
+};
+
+// per-event strings (db.config)
+class stringColumn : public arrowColumn
+{
+public:
+  using arrowColumn::arrowColumn;
+  std::shared_ptr<arrow::DataType> type() const override { return arrow::utf8(); }
+  bool bind(TTree* tree) override { return tree->SetBranchAddress(Name.c_str(), &Data) >= 0; }
+  arrow::Status append() override { return Values.Append(Data->Data(), Data->Length()); }
+  arrow::Status finish(std::shared_ptr<arrow::Array>* out) override { return Values.Finish(out); }
+  TString* Data = nullptr;
+
+private:
+  arrow::StringBuilder Values;
+};
+
+// Column<Root, Value> for an element kind; nullptr for one arrow has no type for
+template <template <typename, typename> class Column, typename... Args>
+std::unique_ptr<arrowColumn> makeArrowColumn(arrowValueKind kind, Args&&... args)
+{
+  switch (kind)
+  {
+    case kArrowInt8:   return std::make_unique<Column<char, int8_t>>(args...);
+    case kArrowUInt8:  return std::make_unique<Column<unsigned char, uint8_t>>(args...);
+    case kArrowInt16:  return std::make_unique<Column<short, int16_t>>(args...);
+    case kArrowUInt16: return std::make_unique<Column<unsigned short, uint16_t>>(args...);
+    case kArrowInt32:  return std::make_unique<Column<int, int32_t>>(args...);
+    case kArrowUInt32: return std::make_unique<Column<unsigned int, uint32_t>>(args...);
+    case kArrowInt64:  return std::make_unique<Column<Long64_t, int64_t>>(args...);
+    case kArrowUInt64: return std::make_unique<Column<ULong64_t, uint64_t>>(args...);
+    case kArrowFloat:  return std::make_unique<Column<float, float>>(args...);
+    case kArrowDouble: return std::make_unique<Column<double, double>>(args...);
+    case kArrowBool:   return std::make_unique<Column<bool, bool>>(args...);
+    default:           return nullptr;
+  }
+}
+
+// the column for one skim branch, from the type ROOT expects it to hold
+std::unique_ptr<arrowColumn> arrowColumnFor(TBranch* branch)
+{
+  TClass* cls = nullptr;
+  EDataType dataType = kNoType_t;
+  if (branch->GetExpectedType(cls, dataType) != 0)
+    return nullptr;
+  std::string name = branch->GetName();
+  if (not cls)
+    return makeArrowColumn<scalarColumn>(arrowKindOf(dataType), name);
+  std::string className = cls->GetName();
+  className.erase(std::remove(className.begin(), className.end(), ' '), className.end());
+  if (className == "TString")
+    return std::make_unique<stringColumn>(name);
+  const std::string vectorOfVector = "vector<vector<", vectorOf = "vector<";
+  if (className.compare(0, vectorOfVector.size(), vectorOfVector) == 0)
+    return makeArrowColumn<listListColumn>(arrowKindOf(className.substr(vectorOfVector.size(), className.size() - vectorOfVector.size() - 2)), name);
+  if (className.compare(0, vectorOf.size(), vectorOf) == 0)
+    return makeArrowColumn<listColumn>(arrowKindOf(className.substr(vectorOf.size(), className.size() - vectorOf.size() - 1)), name);
+  return nullptr;
+}
+
+// one record batch of every column
+arrow::Status writeArrowBatch(arrow::ipc::RecordBatchWriter* writer, const std::shared_ptr<arrow::Schema>& schema,
+                              std::vector<std::unique_ptr<arrowColumn>>& columns, int64_t nRows)
+{
+  std::vector<std::shared_ptr<arrow::Array>> arrays(columns.size());
+  for (size_t col = 0; col < columns.size(); ++col)
+    ARROW_RETURN_NOT_OK(columns[col]->finish(&arrays[col]));
+  return writer->WriteRecordBatch(*arrow::RecordBatch::Make(schema, nRows, arrays));
+}
+
+// options (comma separated):
+//   batch=N         entries per record batch, which bounds the memory used
+//                   (default 65536)
+//   branches=A:B:.. only these branches (default all of data_validation_tree)
+//   compression=C   lz4 or zstd record batch bodies; smaller, but then
+//                   readers decompress instead of mapping the file
+// Converts a skim's data_validation_tree into an Arrow IPC file (Feather v2)
+// with one column per branch: per-event scalars as plain columns, vector<T>
+// as list<T> and vector<vector<T>> as list<list<T>>. A passthrough skim's
+// flash and CRT columns are read from passthrough_tree under their skim
+// names, and its dropped entries are left out. Python maps the result
+// without copying:
+//   pyarrow.ipc.open_file(pyarrow.memory_map(arrowFileName)).read_all()
+// Needs the Arrow C++ headers and libarrow where ROOT can find them.
+void exportArrow(std::string skimFileName, std::string arrowFileName = "", std::string options = "")
+{
+  optionMap opts = parseOptions(options);
+  int64_t batchRows = std::max<int64_t>(1, optionValue<int64_t>(opts, "batch", 65536));
+  std::string compression = optionValue<std::string>(opts, "compression", "");
+  if (arrowFileName.empty())
+  {
+    arrowFileName = skimFileName;
+    if (arrowFileName.size() > 5 && arrowFileName.compare(arrowFileName.size() - 5, 5, ".root") == 0)
+      arrowFileName.resize(arrowFileName.size() - 5);
+    arrowFileName += ".arrow";
+  }
+  std::vector<std::string> branchNames;
+  {
+    std::stringstream branchStrm(optionValue<std::string>(opts, "branches", ""));
+    std::string branchName;
+    while (std::getline(branchStrm, branchName, ':'))
+      if (not branchName.empty())
+        branchNames.push_back(branchName);
+  }
+  TStopwatch watch;
+
+  std::unique_ptr<TFile> skimFile(TFile::Open(skimFileName.c_str(), "READ"));
+  TTree* skimTree = (skimFile && not skimFile->IsZombie()) ? skimFile->Get<TTree>("data_validation_tree") : nullptr;
+  if (not skimTree)
+  {
+    std::cout << "No data_validation_tree in " << skimFileName << ". Bail." << std::endl;
+    return;
+  }
+  TTree* passthroughTree = skimFile->Get<TTree>("passthrough_tree");
+  if (branchNames.empty())
+  {
+    for (TObject* branch : *skimTree->GetListOfBranches())
+      if (std::string(branch->GetName()) != "dropped")
+        branchNames.push_back(branch->GetName());
+    if (passthroughTree)
+      for (const auto& passthrough : kPassthroughBranches)
+        branchNames.push_back(passthrough.Name);
+  }
+
+  // a column per branch, bound to whichever tree holds it
+  std::vector<std::unique_ptr<arrowColumn>> columns;
+  skimTree->SetBranchStatus("*", 0);
+  if (passthroughTree)
+    passthroughTree->SetBranchStatus("*", 0);
+  for (const auto& branchName : branchNames)
+  {
+    std::unique_ptr<arrowColumn> column;
+    TTree* tree = skimTree;
+    const passthroughBranch* passthrough = (passthroughTree) ? findPassthrough(branchName) : nullptr;
+    if (passthrough)
+    {
+      tree = passthroughTree;
+      TBranch* branch = tree->GetBranch(passthrough->CAFName);
+      TLeaf* leaf = (branch && branch->GetNleaves() == 1) ? static_cast<TLeaf*>(branch->GetListOfLeaves()->At(0)) : nullptr;
+      if (leaf)
+        column = makeArrowColumn<leafListColumn>(arrowKindOf(std::string(leaf->GetTypeName())),
+                                                 std::string(passthrough->Name), std::string(passthrough->CAFName));
+      tree->SetBranchStatus(passthrough->CAFName, 1);
+      tree->SetBranchStatus(passthrough->CAFCount, 1);
+    } else if (TBranch* branch = skimTree->GetBranch(branchName.c_str())) {
+      column = arrowColumnFor(branch);
+      skimTree->SetBranchStatus(branchName.c_str(), 1);
+    }
+    if (not column || not column->bind(tree))
+    {
+      std::cout << "Cannot export branch " << branchName << ", skipping it" << std::endl;
+      continue;
+    }
+    columns.push_back(std::move(column));
+  }
+  bool dropped = false;
+  if (skimTree->GetBranch("dropped"))
+  {
+    skimTree->SetBranchStatus("dropped", 1);
+    skimTree->SetBranchAddress("dropped", &dropped);
+  }
+  if (columns.empty())
+  {
+    std::cout << "Nothing to export. Bail." << std::endl;
+    return;
+  }
+
+  arrow::FieldVector fields;
+  for (const auto& column : columns)
+    fields.push_back(column->field());
+  auto schema = arrow::schema(fields, arrow::key_value_metadata({"source"}, {skimFileName}));
+  arrow::ipc::IpcWriteOptions writeOptions = arrow::ipc::IpcWriteOptions::Defaults();
+  if (not compression.empty())
+  {
+    auto codecType = arrow::util::Codec::GetCompressionType(compression);
+    auto codec = (codecType.ok()) ? arrow::util::Codec::Create(*codecType) : codecType.status();
+    if (not codec.ok())
+    {
+      std::cout << "Cannot compress with " << compression << ": " << codec.status().ToString() << ". Bail." << std::endl;
+      return;
+    }
+    writeOptions.codec = std::move(*codec);
+  }
+  std::string tmpName = arrowFileName + ".tmp";
+  auto outStream = arrow::io::FileOutputStream::Open(tmpName);
+  auto writer = (outStream.ok()) ? arrow::ipc::MakeFileWriter(*outStream, schema, writeOptions) : outStream.status();
+  if (not writer.ok())
+  {
+    std::cout << "Cannot write " << tmpName << ": " << writer.status().ToString() << ". Bail." << std::endl;
+    return;
+  }
+
+  Long64_t nEntries = skimTree->GetEntries();
+  int64_t nRows = 0, nBatchRows = 0;
+  arrow::Status status;
+  for (Long64_t entry = 0; entry < nEntries && status.ok(); ++entry)
+  {
+    skimTree->GetEntry(entry);
+    if (dropped)
+      continue;
+    if (passthroughTree)
+      passthroughTree->GetEntry(entry);
+    for (auto& column : columns)
+      if (not (status = column->append()).ok())
+        break;
+    ++nRows;
+    if (status.ok() && ++nBatchRows == batchRows)
+    {
+      status = writeArrowBatch(writer->get(), schema, columns, nBatchRows);
+      nBatchRows = 0;
+    }
+  }
+  if (status.ok() && nBatchRows > 0)
+    status = writeArrowBatch(writer->get(), schema, columns, nBatchRows);
+  if (status.ok())
+    status = (*writer)->Close();
+  if (status.ok())
+    status = (*outStream)->Close();
+  if (not status.ok())
+  {
+    std::cout << "Writing " << tmpName << " failed: " << status.ToString() << ". Bail." << std::endl;
+    std::remove(tmpName.c_str());
+    return;
+  }
+  // write to a temporary and rename, like the skim checkpoint
+  std::rename(tmpName.c_str(), arrowFileName.c_str());
+  std::cout << "Exported " << nRows << " of " << nEntries << " entries, " << columns.size() << " columns, to "
+            << arrowFileName << " in " << watch.RealTime() << " s" << std::endl;
+}
@@ -0,0 +1,294 @@
+// root includes
+#include "TFile.h"
+#include "TH2.h"
+#include "TKey.h"
+#include "TStopwatch.h"
+
+// std incldes
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "dqCommon.h"
+#include "dqRunExport.h"
+
+// one run column of a per-run TH2 as an exportProjection: nonzero bins,
+// under/overflow, mean and rms over the y bin centers, and the preview
+// summed over previewGroup consecutive y bins
+exportProjection projectRun(const TH2* hist, int xBin, const std::vector<double>& yCenters,
+                            const exportHist& layout)
+{
+  exportProjection projection;
+  int nXBins = hist->GetNbinsX();
+  const double* sumw2 = (layout.Weighted) ? hist->GetSumw2()->GetArray() : nullptr;
+  auto content = [&](int yBin) { return hist->GetBinContent(xBin, yBin); };
+  projection.Underflow = content(0);
+  projection.Overflow = content(layout.NBins + 1);
+  projection.Preview.assign((layout.NBins + layout.PreviewGroup - 1) / layout.PreviewGroup, 0);
+  double sumY = 0, sumY2 = 0;
+  for (uint32_t yBin = 1; yBin <= layout.NBins; ++yBin)
+  {
+    double count = content(yBin);
+    if (count == 0)
+      continue;
+    projection.Bins.push_back(yBin);
+    projection.Contents.push_back(count);
+    if (sumw2)
+      projection.Sumw2.push_back(sumw2[xBin + (nXBins + 2) * yBin]);
+    projection.Preview[(yBin - 1) / layout.PreviewGroup] += count;
+    projection.Sum += count;
+    sumY += count * yCenters[yBin];
+    sumY2 += count * yCenters[yBin] * yCenters[yBin];
+  }
+  if (projection.Sum != 0)
+  {
+    projection.Mean = sumY / projection.Sum;
+    projection.RMS = std::sqrt(std::max(0., sumY2 / projection.Sum - projection.Mean * projection.Mean));
+  }
+  return projection;
+}
+
+// names in JSON strings
+std::string jsonEscape(const std::string& text)
+{
+  std::string escaped;
+  for (char ch : text)
+  {
+    if (ch == '"' || ch == '\\')
+      escaped += '\\';
+    escaped += ch;
+  }
+  return escaped;
+}
+
+// options (comma separated):
+//   hists=A:B:...   only these per-run TH2s (default every per-run TH2)
+//   preview=N       y bins of the rebinned preview (default 100)
+//   threads=N       runs are projected on N threads (default all cores)
+//   json            also write <outFileName>.json, per run its totals and
+//                   each histogram's sum, mean and rms
+// Writes the per-run export of histFileName (format in dqRunExport.h) to
+// outFileName, by default histFileName with .root replaced by .dqx. Per-run
+// TH1s (nEventsPerRun, POTPerRun, ...) go in as per-run totals.
+void exportRuns(std::string histFileName, std::string outFileName = "", std::string options = "")
+{
+  optionMap opts = parseOptions(options);
+  int nPreview = std::max(1, optionValue<int>(opts, "preview", 100));
+  unsigned int nThreads = optionValue<unsigned int>(opts, "threads", std::max(1u, std::thread::hardware_concurrency()));
+  bool writeJSON = hasOption(opts, "json");
+  if (outFileName.empty())
+  {
+    outFileName = histFileName;
+    if (outFileName.size() > 5 && outFileName.compare(outFileName.size() - 5, 5, ".root") == 0)
+      outFileName.resize(outFileName.size() - 5);
+    outFileName += ".dqx";
+  }
+  std::vector<std::string> histNames;
+  {
+    std::stringstream histStrm(optionValue<std::string>(opts, "hists", ""));
+    std::string histName;
+    while (std::getline(histStrm, histName, ':'))
+      if (not histName.empty())
+        histNames.push_back(histName);
+  }
+  TStopwatch watch;
+
+  std::unique_ptr<TFile> histFile(TFile::Open(histFileName.c_str(), "READ"));
+  if (not histFile || histFile->IsZombie())
+  {
+    std::cout << "Could not open " << histFileName << ". Bail." << std::endl;
+    return;
+  }
+  TH1* nEventsPerRun = histFile->Get<TH1>("nEventsPerRun");
+  if (not nEventsPerRun)
+  {
+    std::cout << "No nEventsPerRun in " << histFileName << ", not a makeHists output? Bail." << std::endl;
+    return;
+  }
+  const TAxis* runAxis = nEventsPerRun->GetXaxis();
+  auto perRun = [&](const TH1* hist)
+  {
+    return hist->GetNbinsX() == runAxis->GetNbins() && hist->GetXaxis()->GetXmin() == runAxis->GetXmin()
+        && hist->GetXaxis()->GetXmax() == runAxis->GetXmax();
+  };
+
+  // per-run TH1s become totals, per-run TH2s are projected
+  std::vector<std::string> totalNames;
+  bool listed = not histNames.empty();
+  TIter nextKey(histFile->GetListOfKeys());
+  while (TKey* key = static_cast<TKey*>(nextKey()))
+  {
+    if (std::strncmp(key->GetClassName(), "TH1", 3) == 0)
+      totalNames.push_back(key->GetName());
+    else if (not listed && std::strncmp(key->GetClassName(), "TH2", 3) == 0)
+      histNames.push_back(key->GetName());
+  }
+
+  // the runs: every run bin with events
+  std::vector<int> runBins;
+  std::vector<unsigned int> runs;
+  for (int xBin = 1; xBin <= runAxis->GetNbins(); ++xBin)
+    if (nEventsPerRun->GetBinContent(xBin) > 0)
+    {
+      runBins.push_back(xBin);
+      runs.push_back(static_cast<unsigned int>(std::lround(runAxis->GetBinCenter(xBin))));
+    }
+  if (runs.empty())
+  {
+    std::cout << "No runs with events in " << histFileName << ". Bail." << std::endl;
+    return;
+  }
+
+  std::vector<exportBuffer> blocks(runs.size());
+  std::vector<std::string> exportedTotals;
+  for (const auto& totalName : totalNames)
+  {
+    std::unique_ptr<TH1> total(histFile->Get<TH1>(totalName.c_str()));
+    if (not total || not perRun(total.get()))
+      continue;
+    exportedTotals.push_back(totalName);
+    for (size_t runIdx = 0; runIdx < runs.size(); ++runIdx)
+      blocks[runIdx].put<double>(total->GetBinContent(runBins[runIdx]));
+  }
+  // summary numbers for the JSON, [run][hist]
+  std::vector<std::vector<exportProjection>> summaries(runs.size());
+
+  // one histogram at a time in memory; its run columns are projected in
+  // parallel, each thread appending to the blocks of the runs it takes
+  std::vector<exportHist> layouts;
+  for (const auto& histName : histNames)
+  {
+    std::unique_ptr<TH2> hist(histFile->Get<TH2>(histName.c_str()));
+    if (not hist || not perRun(hist.get()))
+    {
+      std::cout << "Skipping " << histName << ": not a per-run TH2" << std::endl;
+      continue;
+    }
+    const TAxis* yAxis = hist->GetYaxis();
+    exportHist layout;
+    layout.Name = histName;
+    layout.Title = hist->GetTitle();
+    layout.NBins = yAxis->GetNbins();
+    layout.YMin = yAxis->GetXmin();
+    layout.YMax = yAxis->GetXmax();
+    if (yAxis->GetXbins()->GetSize() > 0)
+      layout.Edges.assign(yAxis->GetXbins()->GetArray(), yAxis->GetXbins()->GetArray() + layout.NBins + 1);
+    layout.PreviewGroup = std::max(1, (static_cast<int>(layout.NBins) + nPreview - 1) / nPreview);
+    // errors only need storing when they are not the square root of the counts
+    if (hist->GetSumw2N() > 0)
+    {
+      const double* sumw2 = hist->GetSumw2()->GetArray();
+      for (int cell = 0; cell < hist->GetNcells() && not layout.Weighted; ++cell)
+        layout.Weighted = (sumw2[cell] != hist->GetBinContent(cell));
+    }
+    std::vector<double> yCenters(layout.NBins + 2);
+    for (uint32_t yBin = 0; yBin <= layout.NBins + 1; ++yBin)
+      yCenters[yBin] = yAxis->GetBinCenter(yBin);
+
+    std::atomic<size_t> nextRun(0);
+    auto worker = [&]()
+    {
+      for (size_t runIdx = nextRun++; runIdx < runs.size(); runIdx = nextRun++)
+      {
+        exportProjection projection = projectRun(hist.get(), runBins[runIdx], yCenters, layout);
+        projection.write(blocks[runIdx], layout.Weighted);
+        if (writeJSON)
+        {
+          projection.Bins.clear();
+          projection.Contents.clear();
+          projection.Sumw2.clear();
+          projection.Preview.clear();
+          summaries[runIdx].push_back(std::move(projection));
+        }
+      }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned int threadIdx = 1; threadIdx < nThreads; ++threadIdx)
+      workers.emplace_back(worker);
+    worker();
+    for (auto& thread : workers)
+      thread.join();
+    layouts.push_back(std::move(layout));
+  }
+  if (layouts.empty())
+  {
+    std::cout << "No per-run histograms to export. Bail." << std::endl;
+    return;
+  }
+
+  // header, then the index, whose offsets follow from the header size
+  exportBuffer header;
+  header.Data.append(kRunExportMagic, sizeof(kRunExportMagic));
+  header.put<uint32_t>(kRunExportVersion);
+  header.put<uint32_t>(exportedTotals.size());
+  for (const auto& total : exportedTotals)
+    header.put(total);
+  header.put<uint32_t>(layouts.size());
+  for (const auto& layout : layouts)
+    layout.write(header);
+  header.put<uint32_t>(runs.size());
+  uint64_t offset = header.Data.size() + runs.size() * (sizeof(uint32_t) + 2 * sizeof(uint64_t));
+  for (size_t runIdx = 0; runIdx < runs.size(); ++runIdx)
+  {
+    header.put<uint32_t>(runs[runIdx]);
+    header.put<uint64_t>(offset);
+    header.put<uint64_t>(blocks[runIdx].Data.size());
+    offset += blocks[runIdx].Data.size();
+  }
+
+  // write to a temporary and rename, like the skim checkpoint
+  std::string tmpName = outFileName + ".tmp";
+  {
+    std::ofstream outStrm(tmpName, std::ios::binary | std::ios::trunc);
+    outStrm.write(header.Data.data(), header.Data.size());
+    for (const auto& block : blocks)
+      outStrm.write(block.Data.data(), block.Data.size());
+    if (not outStrm)
+    {
+      std::cout << "Could not write " << tmpName << ". Bail." << std::endl;
+      std::remove(tmpName.c_str());
+      return;
+    }
+  }
+  std::rename(tmpName.c_str(), outFileName.c_str());
+
+  if (writeJSON)
+  {
+    std::string jsonName = outFileName + ".json";
+    std::ofstream jsonStrm(jsonName + ".tmp", std::ios::trunc);
+    jsonStrm.precision(10);
+    jsonStrm << "{\"source\": \"" << jsonEscape(histFileName) << "\", \"runs\": [";
+    for (size_t runIdx = 0; runIdx < runs.size(); ++runIdx)
+    {
+      exportCursor totals(blocks[runIdx].Data);
+      jsonStrm << ((runIdx > 0) ? ",\n  " : "\n  ") << "{\"run\": " << runs[runIdx] << ", \"totals\": {";
+      for (size_t total = 0; total < exportedTotals.size(); ++total)
+        jsonStrm << ((total > 0) ? ", \"" : "\"") << jsonEscape(exportedTotals[total]) << "\": " << totals.get<double>();
+      jsonStrm << "}, \"hists\": {";
+      for (size_t hist = 0; hist < layouts.size(); ++hist)
+      {
+        const exportProjection& summary = summaries[runIdx][hist];
+        jsonStrm << ((hist > 0) ? ", \"" : "\"") << jsonEscape(layouts[hist].Name) << "\": {\"sum\": " << summary.Sum
+                 << ", \"mean\": " << summary.Mean << ", \"rms\": " << summary.RMS << "}";
+      }
+      jsonStrm << "}}";
+    }
+    jsonStrm << "\n]}\n";
+    jsonStrm.close();
+    std::rename((jsonName + ".tmp").c_str(), jsonName.c_str());
+  }
+
+  std::cout << "Exported " << layouts.size() << " histograms for " << runs.size() << " runs ("
+            << offset / 1024 << " kB) to " << outFileName << " in " << watch.RealTime() << " s on "
+            << nThreads << " threads" << std::endl;
+}
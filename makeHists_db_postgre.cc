@@ -7,6 +7,8 @@
 #include "TTreeReader.h"
 #include "TTreeReaderArray.h"
 #include "TTreeReaderValue.h"
+#include "TNamed.h"
+#include "TProfile.h"
 
 // sbn includes
 /*#include "sbnanaobj/StandardRecord/StandardRecord.h"
@@ -15,18 +17,93 @@
 #include "sbnanaobj/StandardRecord/SRPFP.h"
 */
 // std incldes
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+// local includes
+#include "dqCommon.h"
+#include "dqHistPlan.h"
+#include "dqColumnCache.h"
+#include "dqSchema.h"
+
+// multiply one run (x) bin of a per-run histogram, errors included
+void scaleRunColumn(TH1* hist, int runBin, double scale)
+{
+  int nYBins = (hist->GetDimension() > 1) ? hist->GetNbinsY() + 1 : 0;
+  for (int yBin = 0; yBin <= nYBins; ++yBin)
+  {
+    int bin = hist->GetBin(runBin, yBin);
+    hist->SetBinContent(bin, hist->GetBinContent(bin) * scale);
+    hist->SetBinError(bin, hist->GetBinError(bin) * scale);
+  }
+}
+
+// options (comma separated):
+//   preview=F       fill only a deterministic fraction F of events (same hash
+//                   as the skim), scale each run back to its full event count
+//                   and write per-run means with their errors to preview_summary;
+//                   a skim made with preview=F is scaled the same way
+//   tmin=T, tmax=T  only use events triggered in [tmin, tmax] (unix seconds,
+//                   the CAF header's trigger time in the trigSec column); the
+//                   entries are looked up in the skim's time_index. A skim
+//                   without trigger times cannot take a time window.
+//   hists=FILE      histogram config to book and fill instead of
+//                   kDefaultHistConfig (format in dqHistPlan.h)
+//   cache[=DIR]     read through the columnar cache in DIR (default
+//                   <inFileName>.colcache, or <name>.colcache in the working
+//                   directory for a remote input; see dqColumnCache.h),
+//                   building it first if it is missing or older than the input
+//   classify=FILE   classify PFPs with the selection expressions in FILE,
+//                   compiled at startup (format in dqHistPlan.h); implies
+//                   recomputing from the slice payload
+//   noderived       recompute the derived quantities even if the skim has them
+//   trend=FILE      merge per-subrun aggregates of every histogram's values
+//                   into the trend pyramid FILE and roll them up to run, day
+//                   and era level (see dqTrend.h); not with preview or tmin/tmax.
+//                   Days come from trigSec: skims without it (older skims,
+//                   CAFs without a trigger time) leave the day level empty
+//   eras=FILE       the pyramid's eras, one "name firstRun lastRun" per line
+//                   (default: as stored in FILE, or a single era)
+//   minrun=N, maxrun=N, goodruns=FILE, badruns=FILE, skipempty
+//                   skip events by run or without slices (see eventFilter);
+//                   these are judged on the header branches alone, so a
+//                   skipped event costs no payload read. minrun/maxrun
+//                   default to minRun/maxRun. gates= is refused until the
+//                   skim fills db.gateType
 void makeHists_db_postgre(std::string inFileName,
                           std::string outFileName,
                           unsigned int minRun = std::numeric_limits<unsigned int>::min(),//max //Era 1 starts run1825
                           unsigned int maxRun = std::numeric_limits<unsigned int>::max(),//min //Era 1 ends circa run18593
-                          bool debug = false)
+                          bool debug = false,
+                          std::string options = "")
 {
+  optionMap opts = parseOptions(options);
+  previewSampler preview(optionValue<double>(opts, "preview", 1));
+  pfpSelection selection;
+  if (not loadSelection(opts, selection))
+  {
+    std::cout << "Selection " << optionValue<std::string>(opts, "classify", "") << " has errors. Bail." << std::endl;
+    return;
+  }
+  eventFilter filter;
+  if (not filter.load(opts, minRun, maxRun))
+  {
+    std::cout << "Event filter options have errors. Bail." << std::endl;
+    return;
+  }
+  if (not filter.GateTypes.empty())
+  {
+    // db.gateType stays -1 while the skim's trigger database lookup is off
+    std::cout << "The skim has no gate types yet (db.gateType is not filled), gates= would drop every event. Bail." << std::endl;
+    return;
+  }
+
   // get the weights stored correctly
   TH1::SetDefaultSumw2(true);
 
@@ -42,65 +119,144 @@ void makeHists_db_postgre(std::string inFileName,
   // by storing vectors in the TTree we can pluck the leaves as individual values
   TTree* inTree= (TTree*) inFile->Get("data_validation_tree");
   //TTreeReader inTree("data_validation_tree", inFile.get());
-  unsigned int                     run                    =0; inTree->SetBranchAddress("run",            &             run                  );
-  unsigned int                     subrun                 =0; inTree->SetBranchAddress("subrun",            &          subrun               );
-  unsigned int                     event                  =0; inTree->SetBranchAddress("event",            &           event                );
-  float                            pot                    =0; inTree->SetBranchAddress("POT",            &             pot                  );
-  int                              nslc                   =0; inTree->SetBranchAddress("nslc",            &            nslc                 );
-  std::vector<ULong64_t>          * npfp                   =0; inTree->SetBranchAddress("slc.npfp",            &        npfp                 );
-  std::vector<char>               * clear_cosmic           =0; inTree->SetBranchAddress("slc.clear_cosmic",         &   clear_cosmic         );   
-  std::vector<float>              * CRLongestTrackDirY     =0; inTree->SetBranchAddress("slc.CRLongestTrackDirY",   &   CRLongestTrackDirY   );   
-  std::vector<bool>               * FMatchPresent          =0; inTree->SetBranchAddress("slc.FMatchPresent",        &   FMatchPresent        );   
-  std::vector<float>              * FMatchLightPE          =0; inTree->SetBranchAddress("slc.FMatchLightPE",        &   FMatchLightPE        );   
-  std::vector<float>              * FMatchScore            =0; inTree->SetBranchAddress("slc.FMatchScore",          &   FMatchScore          );   
-  std::vector<std::vector<float>> *  trackLength            =0; inTree->SetBranchAddress("slc.pfp.trackLength",      &trackLength          );
-  std::vector<std::vector<double>>*  showerLength          =0; inTree->SetBranchAddress("slc.pfp.showerLength",     &   showerLength         );
-  std::vector<std::vector<double>>*  trackBestPlane      =0; inTree->SetBranchAddress("slc.pfp.trackBestPlane",   &     trackBestPlane       );
-  std::vector<std::vector<double>>*  showerBestPlane     =0; inTree->SetBranchAddress("slc.pfp.showerBestPlane",  &     showerBestPlane      );
-  std::vector<std::vector<double>>*  trackDirY             =0; inTree->SetBranchAddress("slc.pfp.trackDirY",  &         trackDirY            );
-  std::vector<std::vector<double>>*  trackVtxX             =0; inTree->SetBranchAddress("slc.pfp.trackVtxX",  &         trackVtxX            );
-  std::vector<std::vector<double>>*  trackVtxY             =0; inTree->SetBranchAddress("slc.pfp.trackVtxY",  &         trackVtxY            );
-  std::vector<std::vector<double>>*  trackVtxZ             =0; inTree->SetBranchAddress("slc.pfp.trackVtxZ",  &         trackVtxZ            );
-  std::vector<std::vector<double>>*  trackNHit1          =0; inTree->SetBranchAddress("slc.pfp.trackNHit1",  &          trackNHit1           );
-  std::vector<std::vector<double>>*  trackNHit2          =0; inTree->SetBranchAddress("slc.pfp.trackNHit2",  &          trackNHit2           );
-  std::vector<std::vector<double>>*  trackNHit3          =0; inTree->SetBranchAddress("slc.pfp.trackNHit3",  &          trackNHit3           );
-  int                               nflash                 =0; inTree->SetBranchAddress("nflash",            &        nflash                 );
-  std::vector<float>              * flashTimeWidth         =0; inTree->SetBranchAddress("flash.timeWidth",     &      flashTimeWidth         );
-  std::vector<float>              * flashTimeSD            =0; inTree->SetBranchAddress("flash.timeSD",        &      flashTimeSD            );
-  std::vector<float>              * flashPE                =0; inTree->SetBranchAddress("flash.PE",            &      flashPE                );
-  int                              nCRTHit                =0; inTree->SetBranchAddress("ncrthit",            &       nCRTHit                );
-  std::vector<int>                * CRTHitPlane            =0; inTree->SetBranchAddress("crt_hit.plane",       &      CRTHitPlane            );
-  std::vector<float>              * CRTHitPE               =0; inTree->SetBranchAddress("crt_hit.PE",           &     CRTHitPE               );
-  std::vector<float>              * CRTHitErrX             =0; inTree->SetBranchAddress("crt_hit.err_x",       &      CRTHitErrX             );
-  std::vector<float>              * CRTHitErrY             =0; inTree->SetBranchAddress("crt_hit.err_y",       &      CRTHitErrY             );
-  std::vector<float>              * CRTHitErrZ             =0; inTree->SetBranchAddress("crt_hit.err_z",       &      CRTHitErrZ             );
-  int                              nCRTTrack              =0; inTree->SetBranchAddress("ncrt_track",          &      nCRTTrack              );
-  std::vector<float>              * CRTTrackTime           =0; inTree->SetBranchAddress("crt_track.time",      &      CRTTrackTime           );
-  int                              nCRTPMTMatch           =0; inTree->SetBranchAddress("ncrtpmt_match",       &      nCRTPMTMatch           );   
-  std::vector<int>                * nCRTPMTMatchHit        =0; inTree->SetBranchAddress("crtpmt_match.nhit",   &      nCRTPMTMatchHit        );   
-  std::vector<std::vector<double>>* nCRTPMTMatchHitTimeDiff=0; inTree->SetBranchAddress("crtpmt_match.hit.timeDiff", &nCRTPMTMatchHitTimeDiff);         
-  /*bool                             dbRunInfoExists        =0; inTree->SetBranchAddress("db.runinfo_exists",    &     dbRunInfoExists        );    
-  bool                             dbTriggerDataExists    =0; inTree->SetBranchAddress("db.triggerdata_exists", &    dbTriggerDataExists    );    
-  int                              dbRun                  =0; inTree->SetBranchAddress("db.run",     &               dbRun                  );
-  int                              dbStart                =0; inTree->SetBranchAddress("db.start",     &             dbStart                );
-  int                              dbEnd                  =0; inTree->SetBranchAddress("db.end",     &               dbEnd                  );
-  TString                          dbConfig               =""; inTree->SetBranchAddress("db.config",     &            dbConfig               );
-  double                           dbCath                 =0; inTree->SetBranchAddress("db.cathodeV",     &          dbCath                 );
-  double                           dbEInd1                =0; inTree->SetBranchAddress("db.EInd1V",     &            dbEInd1                );
-  double                           dbEInd2                =0; inTree->SetBranchAddress("db.EInd2V",     &            dbEInd2                );
-  double                           dbEColl                =0; inTree->SetBranchAddress("db.ECollV",     &            dbEColl                );
-  double                           dbWInd1                =0; inTree->SetBranchAddress("db.WInd1V",     &            dbWInd1                );
-  double                           dbWInd2                =0; inTree->SetBranchAddress("db.WInd2V",     &            dbWInd2                );
-  double                           dbWColl                =0; inTree->SetBranchAddress("db.WCollV",     &            dbWColl                );
-  int                              dbNTPC                 =0; inTree->SetBranchAddress("db.NTPC",     &              dbNTPC                 );
-  int                              dbNPMT                 =0; inTree->SetBranchAddress("db.NPMT",     &              dbNPMT                 );
-  int                              dbNCRT                 =0; inTree->SetBranchAddress("db.NCRT",     &              dbNCRT                 );
-  int                              dbTrigSec              =0; inTree->SetBranchAddress("db.trigSec",    &            dbTrigSec              );
-  int                              dbTrigNanosec          =0; inTree->SetBranchAddress("db.trigNanosec",    &        dbTrigNanosec          ); 
-  int                              dbGateType             =0; inTree->SetBranchAddress("db.gateType",    &           dbGateType             );
-  int                              dbTrigSource           =0; inTree->SetBranchAddress("db.trigSource",    &         dbTrigSource           );
-  */                                                                                                                                        
+  // the columns have to be the types DQ_SKIM_COLUMNS declares (in their narrow
+  // form for the compact, fast and small layouts) before we bind to them
+  bool narrowSkim = false;
+  if (TNamed* layoutRecord = inFile->Get<TNamed>("skim_layout"))
+    narrowSkim = hasOption(parseOptions(layoutRecord->GetTitle()), "narrow");
+  if (not checkSkimSchema(inTree, narrowSkim, std::cout))
+  {
+    std::cout << inFileName << " does not match the skim schema compiled in here. Bail." << std::endl;
+    return;
+  }
+  if (debug && narrowSkim) std::cout << "Reading the narrow layout, widened per entry" << std::endl;
+  histEvent evt;
+  evt.bind(inTree, narrowSkim);
   int nEntries=inTree->GetEntries();
+
+  // per-run event totals for preview scaling: from the skim's preview_runs if
+  // the skim was itself a preview, otherwise counted from the headers here
+  std::map<unsigned int, previewCounts> previewRunCounts;
+  bool previewSkim = false;
+  if (TTree* previewTree = inFile->Get<TTree>("preview_runs"))
+  {
+    previewSkim = true;
+    unsigned int previewRun = 0;
+    Long64_t previewTotal = 0;
+    previewTree->SetBranchAddress("run", &previewRun);
+    previewTree->SetBranchAddress("nEvents", &previewTotal);
+    for (Long64_t previewEntry = 0; previewEntry < previewTree->GetEntries(); ++previewEntry)
+    {
+      previewTree->GetEntry(previewEntry);
+      previewRunCounts[previewRun].Total += previewTotal;
+    }
+    std::cout << "Input skim is a preview, scaling to the full per-run counts" << std::endl;
+  }
+  bool previewScaling = previewSkim || preview.active();
+
+  // exposure is a subrun quantity, so join the skim's per-subrun table per run
+  // once here rather than reading a per-event value; runs the filter drops
+  // keep none, as in the skim
+  std::map<unsigned int, double> runPOT;
+  std::map<unsigned int, Long64_t> runGates;
+  std::map<uint64_t, std::pair<double, Long64_t>> subrunExposure;  // for the trend pyramid
+  if (TTree* exposureTree = inFile->Get<TTree>("subrun_exposure"))
+  {
+    unsigned int exposureRun = 0;
+    unsigned int exposureSubrun = 0;
+    double exposurePOT = 0;
+    Long64_t exposureGates = 0;
+    exposureTree->SetBranchAddress("run", &exposureRun);
+    exposureTree->SetBranchAddress("subrun", &exposureSubrun);
+    exposureTree->SetBranchAddress("pot", &exposurePOT);
+    exposureTree->SetBranchAddress("gates", &exposureGates);
+    for (Long64_t exposureEntry = 0; exposureEntry < exposureTree->GetEntries(); ++exposureEntry)
+    {
+      exposureTree->GetEntry(exposureEntry);
+      if (not filter.keepsRun(exposureRun))
+        continue;
+      runPOT[exposureRun] += exposurePOT;
+      runGates[exposureRun] += exposureGates;
+      auto& exposure = subrunExposure[trendSubrunKey(exposureRun, exposureSubrun)];
+      exposure.first += exposurePOT;
+      exposure.second += exposureGates;
+    }
+  } else {
+    std::cout << "No subrun_exposure in " << inFileName << ", POT histograms will be empty" << std::endl;
+  }
+  // derived columns from the skim replace the whole slice/PFP payload, but
+  // only if they were made with the definition compiled in here and no other
+  // classification was asked for
+  bool useDerived = false;
+  if (selection.active() || hasOption(opts, "noderived"))
+    std::cout << "Deriving from the slice payload" << ((selection.active()) ? " with the compiled selection" : "") << std::endl;
+  else if (TNamed* derivedRecord = inFile->Get<TNamed>("derived_version"))
+  {
+    useDerived = (std::stoi(derivedRecord->GetTitle()) == kDerivedVersion) && inTree->GetBranch("derived.nTracks");
+    if (not useDerived)
+      std::cout << "Derived columns version " << derivedRecord->GetTitle() << " is stale (now "
+                << kDerivedVersion << "), recomputing from the slice payload" << std::endl;
+  }
+  if (useDerived)
+  {
+    evt.bindDerived(inTree);
+    if (debug) std::cout << "Reading derived columns version " << kDerivedVersion << std::endl;
+  }
+  // trigger time -> entry index: the skim's time_index if it has one,
+  // otherwise built here from the trigSec branch alone
+  std::vector<timeIndexEntry> timeIndex;
+  if (TTree* timeIndexTree = inFile->Get<TTree>("time_index"))
+  {
+    int indexSec = 0;
+    Long64_t indexEntry = 0;
+    timeIndexTree->SetBranchAddress("trigSec", &indexSec);
+    timeIndexTree->SetBranchAddress("entry", &indexEntry);
+    timeIndex.reserve(timeIndexTree->GetEntries());
+    for (Long64_t idx = 0; idx < timeIndexTree->GetEntries(); ++idx)
+    {
+      timeIndexTree->GetEntry(idx);
+      timeIndex.push_back({indexSec, indexEntry});
+    }
+  } else {
+    timeIndex = scanTimeIndex(inTree);
+  }
+  bool timeWindow = hasOption(opts, "tmin") || hasOption(opts, "tmax");
+  int tMin = optionValue<int>(opts, "tmin", std::numeric_limits<int>::min());
+  int tMax = optionValue<int>(opts, "tmax", std::numeric_limits<int>::max());
+  // the rows a window uses have to point at entries of this tree that hold
+  // their trigger time; an index joined from shards without offsetting its
+  // entries does not, so scan trigSec instead
+  if (timeWindow && not timeIndex.empty())
+  {
+    TBranch* trigSecBranch = inTree->GetBranch("trigSec");
+    auto first = std::lower_bound(timeIndex.begin(), timeIndex.end(), timeIndexEntry{tMin, std::numeric_limits<long long>::min()});
+    auto last = std::upper_bound(timeIndex.begin(), timeIndex.end(), timeIndexEntry{tMax, std::numeric_limits<long long>::max()});
+    bool indexGood = (trigSecBranch != nullptr);
+    for (auto indexed = first; indexGood && indexed != last; ++indexed)
+      indexGood = indexed->Entry >= 0 && indexed->Entry < nEntries
+               && trigSecBranch->GetEntry(indexed->Entry) > 0 && evt.TrigSec == indexed->Sec;
+    if (not indexGood)
+    {
+      std::cout << "time_index of " << inFileName << " does not match its tree, scanning trigSec instead" << std::endl;
+      timeIndex = scanTimeIndex(inTree);
+    }
+  }
+  if (timeWindow && timeIndex.empty())
+  {
+    // older skims and CAFs without a trigger time have trigSec -1 throughout
+    std::cout << inFileName << " has no trigger times, so tmin/tmax would select nothing. Bail." << std::endl;
+    return;
+  }
+  std::vector<long long> windowEntries;
+  if (timeWindow)
+  {
+    windowEntries = entriesInWindow(timeIndex, tMin, tMax);
+    std::cout << windowEntries.size() << " of " << nEntries << " entries triggered in ["
+              << tMin << ", " << tMax << "]" << std::endl;
+  }
+  TBranch* droppedBranch = inTree->GetBranch("dropped");
+  unsigned int countsRun = 0;
+  previewCounts* runCounts = nullptr;
   
   // Get Min/Max runs
   /*while (inTree.Next())
@@ -128,460 +284,317 @@ void makeHists_db_postgre(std::string inFileName,
                                                                       ";DAQ Run;Protons On Target",
                                                                       bins, lwEdge, upEdge);
   if (debug) std::cout << "initialized histogram " << POTPerRun           ->GetName() << std::endl;
-  // DB (fill for each event, but should be normalized for evaluation)
-  std::unique_ptr<TH1D> runDuration          = std::make_unique<TH1D>("runDuration",
-                                                                      ";DAQ Run;Duration (s)",
-                                                                      bins, lwEdge, upEdge);
-  std::unique_ptr<TH1D> not_inDB             = std::make_unique<TH1D>("not_inDB",
-                                                                      ";DAQ Run;In Database?",
-                                                                      bins, lwEdge, upEdge);
-  std::unique_ptr<TH1D> not_physics          = std::make_unique<TH1D>("not_physics",
-                                                                      ";DAQ Run;Is Not Physics?",
-                                                                      bins, lwEdge, upEdge);
-  std::unique_ptr<TH1D> test_config          = std::make_unique<TH1D>("test_config",
-                                                                      ";DAQ Run;Used Test Config?",
-                                                                      bins, lwEdge, upEdge);
-  std::unique_ptr<TH1D> cathodeV             = std::make_unique<TH1D>("cathodeV",
-                                                                      ";DAQ Run;Cathode Voltage (V)",
+  std::unique_ptr<TH1D> GatesPerRun          = std::make_unique<TH1D>("GatesPerRun",
+                                                                      ";DAQ Run;Off-Beam Gates",
                                                                       bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << cathodeV            ->GetName() << std::endl;
-  std::unique_ptr<TH1D> EInd1V               = std::make_unique<TH1D>("EInd1V",
-                                                                      ";DAQ Run;East Induction 1 Voltage (V)",
-                                                                      bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << EInd1V              ->GetName() << std::endl;
-  std::unique_ptr<TH1D> EInd2V               = std::make_unique<TH1D>("EInd2V",
-                                                                      ";DAQ Run;East Induction 2 Voltage (V)",
-                                                                      bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << EInd2V              ->GetName() << std::endl;
-  std::unique_ptr<TH1D> ECollV               = std::make_unique<TH1D>("ECollV",
-                                                                      ";DAQ Run;East Collection Voltage (V)",
-                                                                      bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << ECollV              ->GetName() << std::endl;
-  std::unique_ptr<TH1D> WInd1V               = std::make_unique<TH1D>("WInd1V",
-                                                                      ";DAQ Run;West Induction 1 Voltage (V)",
-                                                                      bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << WInd1V              ->GetName() << std::endl;
-  std::unique_ptr<TH1D> WInd2V               = std::make_unique<TH1D>("WInd2V",
-                                                                      ";DAQ Run;West Induction 2 Voltage (V)",
-                                                                      bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << WInd2V              ->GetName() << std::endl;
-  std::unique_ptr<TH1D> WCollV               = std::make_unique<TH1D>("WCollV",
-                                                                      ";DAQ Run;West Collection Voltage (V)",
-                                                                      bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << WCollV              ->GetName() << std::endl;
-  std::unique_ptr<TH1D> ETriggers            = std::make_unique<TH1D>("ETriggers",
-                                                                      ";DAQ Run;East Cryostat Triggers",
-                                                                      bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << ETriggers           ->GetName() << std::endl;
-  std::unique_ptr<TH1D> WTriggers            = std::make_unique<TH1D>("WTriggers",
-                                                                      ";DAQ Run;West Cryostat Triggers",
-                                                                      bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << WTriggers           ->GetName() << std::endl;
-  std::unique_ptr<TH1D> UTriggers            = std::make_unique<TH1D>("UTriggers",
-                                                                      ";DAQ Run;Undecided Triggers",
-                                                                      bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << UTriggers           ->GetName() << std::endl;
-  std::unique_ptr<TH1D> BTriggers            = std::make_unique<TH1D>("BTriggers",
-                                                                      ";DAQ Run;Triggers From Both Cryostats",
-                                                                      bins, lwEdge, upEdge);
-  if (debug) std::cout << "initialized histogram " << BTriggers           ->GetName() << std::endl;
-  // TPC
-  std::unique_ptr<TH2D> nSlicePerEvent       = std::make_unique<TH2D>("nSlicePerEvent",
-                                                                      ";DAQ Run;Number of Slices Per Event",
-                                                                      bins, lwEdge, upEdge,
-                                                                      101,   -0.5, 100.5);
-  if (debug) std::cout << "initialized histogram " << nSlicePerEvent      ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nSlicePerEvent_wgt   = std::make_unique<TH2D>("nSlicePerEvent_wgt",
-  //                                                                    ";DAQ Run;Slices Per Event (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    101,   -0.5, 100.5);
-  //if (debug) std::cout << "initialized histogram " << nSlicePerEvent_wgt  ->GetName() << std::endl;
-  std::unique_ptr<TH2D> nPFPPerEvent         = std::make_unique<TH2D>("nPFPPerEvent",
-                                                                      ";DAQ Run;Number of PFPs Per Event",
-                                                                      bins, lwEdge, upEdge,
-                                                                      101,   -0.5, 100.5);
-  if (debug) std::cout << "initialized histogram " << nPFPPerEvent        ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nPFPPerEvent_wgt     = std::make_unique<TH2D>("nPFPPerEvent_wgt",
-  //                                                                    ";DAQ Run;PFPs Per Event (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    101,   -0.5, 100.5);
-  //if (debug) std::cout << "initialized histogram " << nPFPPerEvent_wgt    ->GetName() << std::endl;
-  std::unique_ptr<TH2D> nCCPerEvent          = std::make_unique<TH2D>("nCCPerEvent",
-                                                                      ";DAQ Run;Number of Clear Cosmics Per Event",
-                                                                      bins, lwEdge, upEdge,
-                                                                      1001,   -0.5, 1000.5);
-  if (debug) std::cout << "initialized histogram " << nCCPerEvent         ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nCCPerEvent_wgt      = std::make_unique<TH2D>("nCCPerEvent_wgt",
-  //                                                                    ";DAQ Run;Clear Cosmics Per Event (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    1001,   -0.5, 1000.5);
-  //if (debug) std::cout << "initialized histogram " << nCCPerEvent_wgt     ->GetName() << std::endl;
-  std::unique_ptr<TH2D> nNeutrinoPure        = std::make_unique<TH2D>("nNeutrinoPure",
-                                                                      ";DAQ Run;Beam-like Slices per Event",
-                                                                      bins, lwEdge, upEdge,
-                                                                      26,   -0.5, 25.5);
-  if (debug) std::cout << "initialized histogram " << nNeutrinoPure       ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nNeutrinoPure_wgt    = std::make_unique<TH2D>("nNeutrinoPure_wgt",
-  //                                                                    ";DAQ Run;Beam-like Slices per Event (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    26,   -0.5, 25.5);
-  //if (debug) std::cout << "initialized histogram " << nNeutrinoPure_wgt   ->GetName() << std::endl;
-  std::unique_ptr<TH2D> nTrkHitsPlane1       = std::make_unique<TH2D>("nTrkHitsPlane1",
-                                                                      ";DAQ Run;Number of Hits in Ind1",
-                                                                      bins, lwEdge, upEdge,
-                                                                      40001,   -0.5, 40000.5);
-  if (debug) std::cout << "initialized histogram " << nTrkHitsPlane1      ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nTrkHitsPlane1_wgt   = std::make_unique<TH2D>("nTrkHitsPlane1_wgt",
-  //                                                                    ";DAQ Run;Number of Hits in Ind1 (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    40001,   -0.5, 40000.5);
-  //if (debug) std::cout << "initialized histogram " << nTrkHitsPlane1_wgt  ->GetName() << std::endl;
-  std::unique_ptr<TH2D> nTrkHitsPlane2       = std::make_unique<TH2D>("nTrkHitsPlane2",
-                                                                      ";DAQ Run;Number of Hits in Ind2",
-                                                                      bins, lwEdge, upEdge,
-                                                                      40001,   -0.5, 40000.5);
-  if (debug) std::cout << "initialized histogram " << nTrkHitsPlane2      ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nTrkHitsPlane2_wgt   = std::make_unique<TH2D>("nTrkHitsPlane2_wgt",
-  //                                                                    ";DAQ Run;Number of Hits in Ind2 (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    40001,   -0.5, 40000.5);
-  //if (debug) std::cout << "initialized histogram " << nTrkHitsPlane2_wgt  ->GetName() << std::endl;
-  std::unique_ptr<TH2D> nTrkHitsPlane3       = std::make_unique<TH2D>("nTrkHitsPlane3",
-                                                                      ";DAQ Run;Number of Hits in Coll",
-                                                                      bins, lwEdge, upEdge,
-                                                                      40001,   -0.5, 40000.5);
-  if (debug) std::cout << "initialized histogram " << nTrkHitsPlane3      ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nTrkHitsPlane3_wgt   = std::make_unique<TH2D>("nTrkHitsPlane3_wgt",
-  //                                                                    ";DAQ Run;Number of Hits in Coll (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    40001,   -0.5, 40000.5);
-  //if (debug) std::cout << "initialized histogram " << nTrkHitsPlane3_wgt  ->GetName() << std::endl;
-  std::unique_ptr<TH2D> nHitPerTrkPlane1     = std::make_unique<TH2D>("nHitPerTrkPlane1",
-                                                                      ";DAQ Run;Number of Ind1 Hits per Track",
-                                                                      bins, lwEdge, upEdge,
-                                                                      5001,   -0.5, 100.5);
-  if (debug) std::cout << "initialized histogram " << nHitPerTrkPlane1    ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nHitPerTrkPlane1_wgt = std::make_unique<TH2D>("nHitPerTrkPlane1_wgt",
-  //                                                                    ";DAQ Run;Number of Ind1 Hits per Track (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    5001,   -0.5, 100.5);
-  //if (debug) std::cout << "initialized histogram " << nHitPerTrkPlane1_wgt->GetName() << std::endl;
-  std::unique_ptr<TH2D> nHitPerTrkPlane2     = std::make_unique<TH2D>("nHitPerTrkPlane2",
-                                                                      ";DAQ Run;Number of Ind2 Hits per Track",
-                                                                      bins, lwEdge, upEdge,
-                                                                      5001,   -0.5, 100.5);
-  if (debug) std::cout << "initialized histogram " << nHitPerTrkPlane2    ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nHitPerTrkPlane2_wgt = std::make_unique<TH2D>("nHitPerTrkPlane2_wgt",
-  //                                                                    ";DAQ Run;Number of Ind2 Hits per Track (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    5001,   -0.5, 100.5);
-  //if (debug) std::cout << "initialized histogram " << nHitPerTrkPlane2_wgt->GetName() << std::endl;
-  std::unique_ptr<TH2D> nHitPerTrkPlane3     = std::make_unique<TH2D>("nHitPerTrkPlane3",
-                                                                      ";DAQ Run;Number of Coll Hits per Track",
-                                                                      bins, lwEdge, upEdge,
-                                                                      5001,   -0.5, 100.5);
-  if (debug) std::cout << "initialized histogram " << nHitPerTrkPlane3    ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nHitPerTrkPlane3_wgt = std::make_unique<TH2D>("nHitPerTrkPlane3_wgt",
-  //                                                                    ";DAQ Run;Number of Coll Hits per Track (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    5001,   -0.5, 100.5);
-  //if (debug) std::cout << "initialized histogram " << nHitPerTrkPlane3_wgt->GetName() << std::endl;
-
-  // PMT
-  std::unique_ptr<TH2D> nFlashPerEvent       = std::make_unique<TH2D>("nFlashPerEvent",
-                                                                      ";DAQ Run;Number of PMT FLashes",
-                                                                      bins, lwEdge, upEdge,
-                                                                      101,   -0.5, 100.5);
-  if (debug) std::cout << "initialized histogram " << nFlashPerEvent      ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nFlashPerEvent_wgt   = std::make_unique<TH2D>("nFlashPerEvent_wgt",
-  //                                                                    ";DAQ Run;Number of PMT FLashes (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    101,   -0.5, 100.5);
-  //if (debug) std::cout << "initialized histogram " << nFlashPerEvent_wgt  ->GetName() << std::endl;
-  std::unique_ptr<TH2D> flashPerCC           = std::make_unique<TH2D>("flashPerCC",
-                                                                      ";DAQ Run;Number of PMT FLashes per Clear Cosmic",
-                                                                      bins, lwEdge, upEdge,
-                                                                      1001, -0.5, 1.5);
-  if (debug) std::cout << "initialized histogram " << flashPerCC          ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> flashPerCC_wgt       = std::make_unique<TH2D>("flashPerCC_wgt",
-  //                                                                    ";DAQ Run;Number of PMT FLashes per Clear Cosmic (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    1001, -0.5, 1.5);
-  //if (debug) std::cout << "initialized histogram " << flashPerCC_wgt      ->GetName() << std::endl;
+  if (debug) std::cout << "initialized histogram " << GatesPerRun         ->GetName() << std::endl;
+  // everything else comes from the histogram config
+  histPlan plan;
+  plan.Selection = selection;
+  if (not plan.build(histConfigText(opts), bins, lwEdge, upEdge, debug))
+    std::cout << "Histogram config has errors, booked what could be read" << std::endl;
+  std::vector<std::string> alwaysRead = {"run", "subrun", "event", "nslc", "nflash"};
+  if (inTree->GetBranch("trigSec"))
+    alwaysRead.push_back("trigSec");
+  if (not filter.GateTypes.empty())
+    alwaysRead.push_back("db.gateType");
+  // a passthrough skim keeps its flash and CRT columns in passthrough_tree,
+  // and flags the entries it only kept to stay aligned with it
+  passthroughReader passthrough;
+  TTree* passthroughTree = inFile->Get<TTree>("passthrough_tree");
+  bool usePassthrough = passthroughTree && passthrough.bind(passthroughTree, plan.branchesRead(useDerived, alwaysRead), evt);
+  if (droppedBranch)
+    alwaysRead.push_back("dropped");
+  // what the first read phase looks at: the event id, and what the filters need
+  std::vector<std::string> headerRead = {"run", "subrun", "event"};
+  if (droppedBranch)
+    headerRead.push_back("dropped");
+  if (filter.SkipEmpty)
+    headerRead.push_back("nslc");
+  if (not filter.GateTypes.empty())
+    headerRead.push_back("db.gateType");
+  std::vector<TBranch*> headerBranches;
+  for (const auto& branch : headerRead)
+  {
+    headerBranches.push_back(inTree->GetBranch(branch.c_str()));
+    if (not headerBranches.back())
+    {
+      std::cout << "Filtering needs branch " << branch << ", which " << inFileName << " does not have. Bail." << std::endl;
+      return;
+    }
+  }
+  // reruns over the same skim can skip decompression via the column cache
+  columnCache cache;
+  bool useCache = false;
+  if (hasOption(opts, "cache") && droppedBranch)
+  {
+    std::cout << "The column cache does not cover passthrough skims, reading the tree" << std::endl;
+  } else if (hasOption(opts, "cache")) {
+    std::string localName = (inFileName.find("://") != std::string::npos)
+                          ? inFileName.substr(inFileName.find_last_of('/') + 1) : inFileName;
+    std::string cacheDir = optionValue<std::string>(opts, "cache", localName + ".colcache");
+    useCache = cache.open(cacheDir, inFile);
+    if (not useCache)
+    {
+      std::cout << "Building column cache " << cacheDir << std::endl;
+      useCache = cache.build(cacheDir, inFile, inTree, evt, useDerived) && cache.open(cacheDir, inFile);
+    }
+    useCache = useCache && cache.entries() == nEntries && cache.activate(evt, plan.branchesRead(useDerived, alwaysRead), headerRead);
+    if (not useCache)
+      std::cout << "Column cache " << cacheDir << " is unusable, reading the tree" << std::endl;
+    else if (debug)
+      std::cout << "Reading through column cache " << cacheDir << std::endl;
+  }
+  plan.activate(inTree, useDerived, alwaysRead);
+  // per-subrun aggregates of every histogram's values, merged into the trend
+  // pyramid; a preview or time window would store partial subruns
+  std::string trendName = optionValue<std::string>(opts, "trend", "");
+  trendPyramid trend;
+  std::map<uint64_t, trendNode> trendSubruns;
+  if (not trendName.empty() && (previewScaling || timeWindow))
+  {
+    std::cout << "Not updating trend pyramid " << trendName << " from a preview or time window" << std::endl;
+    trendName.clear();
+  }
+  if (not trendName.empty()
+      && (not trend.load(trendName, plan.trendMetrics())
+          || (hasOption(opts, "eras") && not trend.loadEras(optionValue<std::string>(opts, "eras", "")))))
+  {
+    std::cout << "Cannot update trend pyramid " << trendName << ". Bail." << std::endl;
+    return;
+  }
+  uint64_t trendKey = 0;
+  trendNode* trendSubrun = nullptr;
+  // time trending, binned in wall-clock hours and in 8 hour shifts (owl, day
+  // and swing starting at 00:00, 08:00 and 16:00 Chicago standard time)
+  std::unique_ptr<TH1D> TriggersPerHour;
+  std::unique_ptr<TH1D> TriggersPerShift;
+  std::unique_ptr<TProfile> nSlicePerEventVsHour;
+  std::unique_ptr<TProfile> nFlashPerEventVsHour;
+  {
+    auto first = std::lower_bound(timeIndex.begin(), timeIndex.end(), timeIndexEntry{tMin, std::numeric_limits<long long>::min()});
+    auto last = std::upper_bound(timeIndex.begin(), timeIndex.end(), timeIndexEntry{tMax, std::numeric_limits<long long>::max()});
+    if (first != last)
+    {
+      const long hour = 3600;
+      const long shift = 8 * hour;
+      const long shiftStart = 6 * hour;  // 00:00 CST in UTC
+      long firstSec = first->Sec;
+      long lastSec = (last - 1)->Sec;
+      long hourLo = (firstSec / hour) * hour;
+      long hourHi = (lastSec / hour + 1) * hour;
+      long shiftLo = ((firstSec - shiftStart) / shift) * shift + shiftStart;
+      long shiftHi = ((lastSec - shiftStart) / shift + 1) * shift + shiftStart;
+      int nHours = (hourHi - hourLo) / hour;
+      int nShifts = (shiftHi - shiftLo) / shift;
+      TriggersPerHour      = std::make_unique<TH1D>("TriggersPerHour",
+                                                    ";Trigger Time (UTC);Events per Hour",
+                                                    nHours, hourLo, hourHi);
+      TriggersPerShift     = std::make_unique<TH1D>("TriggersPerShift",
+                                                    ";Trigger Time (UTC);Events per Shift",
+                                                    nShifts, shiftLo, shiftHi);
+      nSlicePerEventVsHour = std::make_unique<TProfile>("nSlicePerEventVsHour",
+                                                        ";Trigger Time (UTC);Mean Number of Slices",
+                                                        nHours, hourLo, hourHi);
+      nFlashPerEventVsHour = std::make_unique<TProfile>("nFlashPerEventVsHour",
+                                                        ";Trigger Time (UTC);Mean Number of PMT Flashes",
+                                                        nHours, hourLo, hourHi);
+      for (TH1* hist : std::vector<TH1*>{TriggersPerHour.get(), TriggersPerShift.get(),
+                                         nSlicePerEventVsHour.get(), nFlashPerEventVsHour.get()})
+      {
+        hist->GetXaxis()->SetTimeDisplay(1);
+        hist->GetXaxis()->SetTimeFormat("%m/%d %H:%M%F1970-01-01 00:00:00");
+        if (debug) std::cout << "initialized histogram " << hist->GetName() << std::endl;
+      }
+    } else {
+      std::cout << "No trigger times in range, skipping the time trending histograms" << std::endl;
+    }
+  }
 
-  std::unique_ptr<TH2D> FlashTimeWidth       = std::make_unique<TH2D>("FlashTimeWidth",
-                                                                      ";DAQ Run;Average Flash Width",
-                                                                      bins, lwEdge, upEdge,
-                                                                      101,   -0.5, 10.5);
-  if (debug) std::cout << "initialized histogram " << FlashTimeWidth      ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> FlashTimeWidth_wgt   = std::make_unique<TH2D>("FlashTimeWidth_wgt",
-  //                                                                    ";DAQ Run;Average Flash Width (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    101,   -0.5, 10.5);
-  //if (debug) std::cout << "initialized histogram " << FlashTimeWidth_wgt  ->GetName() << std::endl;
-  std::unique_ptr<TH2D> FlashTimeSD          = std::make_unique<TH2D>("FlashTimeSD",
-                                                                      ";DAQ Run;Average Flash SD",
-                                                                      bins, lwEdge, upEdge,
-                                                                      510,   -0.5, 5.5);
-  if (debug) std::cout << "initialized histogram " << FlashTimeSD         ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> FlashTimeSD_wgt      = std::make_unique<TH2D>("FlashTimeSD_wgt",
-  //                                                                    ";DAQ Run;Average Flash SD (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    510,   -0.5, 5.5);
-  //if (debug) std::cout << "initialized histogram " << FlashTimeSD_wgt     ->GetName() << std::endl;
-  std::unique_ptr<TH2D> FlashPE              = std::make_unique<TH2D>("FlashPE",
-                                                                      ";DAQ Run;Average Flash PE",
-                                                                      bins, lwEdge, upEdge,
-                                                                      20001,   -0.5, 200000.5);
-  if (debug) std::cout << "initialized histogram " << FlashPE             ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> FlashPE_wgt          = std::make_unique<TH2D>("FlashPE_wgt",
-  //                                                                    ";DAQ Run;Average Flash PE (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    20001,   -0.5, 200000.5);
-  //if (debug) std::cout << "initialized histogram " << FlashPE_wgt         ->GetName() << std::endl;
-  // CRT
-  //std::unique_ptr<TH2D> NCRTHit              = std::make_unique<TH2D>("NCRTHit",
-  //                                                                    ";DAQ Run;CRT Hits",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    501,   -0.5, 500.5);
-  //std::unique_ptr<TH2D> NCRTHit_wgt          = std::make_unique<TH2D>("NCRTHit_wgt",
-  //                                                                    ";DAQ Run;CRT Hits (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    501,   -0.5, 500.5);
-  //std::unique_ptr<TH2D> CRTHitPEPerHit       = std::make_unique<TH2D>("CRTHitPEPerHit",
-  //                                                                    ";DAQ Run;CRT PE Per Event",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    50001,   -0.5, 5000.5);
-  //std::unique_ptr<TH2D> CRTHitPEPerHit_wgt   = std::make_unique<TH2D>("CRTHitPEPerHit_wgt",
-  //                                                                    ";DAQ Run;CRT PE Per Hit (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    50001,   -0.5, 5000.5);
-  //std::unique_ptr<TH2D> avgCRTHitErr         = std::make_unique<TH2D>("avgCRTHitErr",
-  //                                                                    ";DAQ Run;Average CRT Hit Error",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    5001,   -0.5, 500.5);
-  //std::unique_ptr<TH2D> avgCRTHitErr_wgt     = std::make_unique<TH2D>("avgCRTHitErr_wgt",
-  //                                                                    ";DAQ Run;Average CRT Hit Error (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    5001,   -0.5, 500.5);
-  //std::unique_ptr<TH2D> nCRTTrkPerEvent      = std::make_unique<TH2D>("nCRTTrkPerEvent",
-  //                                                                    ";DAQ Run;Average CRT Tracks Per Event",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    251,   -0.5, 250.5);
-  //std::unique_ptr<TH2D> nCRTTrkPerEvent_wgt  = std::make_unique<TH2D>("nCRTTrkPerEvent_wgt",
-  //                                                                    ";DAQ Run;Average CRT Tracks Per Event (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    251,   -0.5, 250.5);
-  //std::unique_ptr<TH2D> CRTTrkTime           = std::make_unique<TH2D>("CRTTrkTime",
-  //                                                                    ";DAQ Run;Average CRT Track Time",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    101,   -0.5, 10.5);
-  //std::unique_ptr<TH2D> CRTTrkTime_wgt       = std::make_unique<TH2D>("CRTTrkTime_wgt",
-  //                                                                    ";DAQ Run;Average CRT Track Time (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    101,   -0.5, 10.5);
-  std::unique_ptr<TH2D> nMatchesPerEvent     = std::make_unique<TH2D>("nMatchesPerEvent",
-                                                                      ";DAQ Run;Flash Matches Per Event",
-                                                                      bins, lwEdge, upEdge,
-                                                                      51,   -0.5, 50.5);
-  if (debug) std::cout << "initialized histogram " << nMatchesPerEvent    ->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nMatchesPerEvent_wgt = std::make_unique<TH2D>("nMatchesPerEvent_wgt",
-  //                                                                    ";DAQ Run;Flash Matches Per Event (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    51,   -0.5, 50.5);
-  //if (debug) std::cout << "initialized histogram " << nMatchesPerEvent_wgt->GetName() << std::endl;
-  //std::unique_ptr<TH2D> nMchHitsPerEvent     = std::make_unique<TH2D>("nMchHitsPerEvent",
-  //                                                                    ";DAQ Run;Flash Match Hits Per Event",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    101,   -0.5, 100.5);
-  //std::unique_ptr<TH2D> nMchHitsPerEvent_wgt = std::make_unique<TH2D>("nMchHitsPerEvent_wgt",
-  //                                                                    ";DAQ Run;Flash Match Hits Per Event (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    101,   -0.5, 100.5);
-  //std::unique_ptr<TH2D> fmTimeDiff           = std::make_unique<TH2D>("fmTimeDiff",
-  //                                                                    ";DAQ Run;Flash Match Time Difference",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    1001,   -0.5, 1.5);
-  //std::unique_ptr<TH2D> fmTimeDiff_wgt       = std::make_unique<TH2D>("fmTimeDiff_wgt",
-  //                                                                    ";DAQ Run;Flash Match Time Difference (POT Weighted)",
-  //                                                                    bins, lwEdge, upEdge,
-  //                                                                    1001,   -0.5, 1.5);
 // read the TTree
   size_t nEvt = 1;
   if (debug) std::cout << "READY TO LOOP" << std::endl;
   int loopcount=0;
   if (debug) cout<< "Will loop over "<<nEntries<<" entries"<<endl;
   //while (inTree.Next())
-  for(int iEntry=0; iEntry<nEntries; iEntry++){
-    cout<<"iEntry: "<<iEntry<<endl;
-    inTree->GetEntry(iEntry);
-    cout<<"Run: "<<run<<endl;
+  Long64_t nLoop = (timeWindow) ? static_cast<Long64_t>(windowEntries.size()) : nEntries;
+  for(Long64_t iLoop=0; iLoop<nLoop; iLoop++){
+    Long64_t iEntry = (timeWindow) ? windowEntries[iLoop] : iLoop;
+    if (debug) cout<<"iEntry: "<<iEntry<<endl;
+    if (previewScaling || filter.active())
+    {
+      // read just the header first; unsampled and filtered events stop here
+      if (useCache)
+      {
+        cache.loadHeader(iEntry, evt);
+      } else {
+        for (TBranch* branch : headerBranches)
+          branch->GetEntry(iEntry);
+        if (evt.Dropped)
+          continue;
+      }
+      if (not filter.passRun(evt.Run))
+        continue;
+      if (previewScaling)
+      {
+        if (not runCounts || countsRun != evt.Run)
+        {
+          runCounts = &previewRunCounts[evt.Run];
+          countsRun = evt.Run;
+        }
+        if (not previewSkim)
+          ++runCounts->Total;
+        if (not preview.keep(evt.Run, evt.Subrun, evt.Event))
+          continue;
+        ++runCounts->Sampled;
+      }
+      // after the preview count: the per-run scale is the sampling rate,
+      // and a preview skim's totals include these events
+      if (not filter.passEvent(evt.NSlices, evt.DBGateType))
+        continue;
+    }
+    if (useCache)
+    {
+      cache.load(iEntry, evt);
+    } else {
+      inTree->GetEntry(iEntry);
+      evt.widen();
+    }
+    if (evt.Dropped)
+      continue;
+    if (usePassthrough && not passthrough.read(iEntry))
+    {
+      std::cout << "Could not read passthrough_tree entry " << iEntry << ". Bail." << std::endl;
+      return;
+    }
+    if (debug) cout<<"Run: "<<evt.Run<<endl;
     if(debug) cout<<"Loop count: "<<loopcount<<endl;
     loopcount++;
-    // skip explicit tests and non-physics on beam streams
-    //if ((not dbRunInfoExists) || (not dbTriggerDataExists))
-    /*if (not dbTriggerDataExists)
-      not_inDB->Fill(run);
-    if ((not (dbConfig.Contains("physics", TString::kIgnoreCase))) || ((dbGateType == 1) || (dbGateType == 2)))
-      not_physics->Fill(run);
-    if (dbConfig.Contains("test", TString::kIgnoreCase))
-      test_config->Fill(run);
-    */
-    // fill the ones which require no processing
-    nEventsPerRun->Fill(run);
-    POTPerRun->Fill(run, pot);
-    nSlicePerEvent->Fill(run, nslc);
-  
-    /*
-    runDuration->Fill(run, dbEnd - dbStart);
-    cathodeV ->Fill(run, dbCath );
-    EInd1V   ->Fill(run, dbEInd1);
-    EInd2V   ->Fill(run, dbEInd2);
-    ECollV   ->Fill(run, dbEColl);
-    WInd1V   ->Fill(run, dbWInd1);
-    WInd2V   ->Fill(run, dbWInd2);
-    WCollV   ->Fill(run, dbWColl);
-    switch (dbTrigSource)
+
+    nEventsPerRun->Fill(evt.Run);
+    if (TriggersPerHour && evt.TrigSec >= 0)
     {
-      case 1:
-        ETriggers->Fill(run);
-        break;
-      case 2:
-        WTriggers->Fill(run);
-        break;
-      case 0:
-        UTriggers->Fill(run);
-        break;
-      case 7:
-        BTriggers->Fill(run);
-        break;
-      default:
-        std::cerr << "CANNOT RESOLVE TRIGGER SOURCE " << dbTrigSource << std::endl;
-        break;
+      TriggersPerHour->Fill(evt.TrigSec);
+      TriggersPerShift->Fill(evt.TrigSec);
+      nSlicePerEventVsHour->Fill(evt.TrigSec, evt.NSlices);
+      nFlashPerEventVsHour->Fill(evt.TrigSec, evt.NFlashes);
     }
-    */
-    //nSlicePerEvent_wgt->Fill(run, nslc, pot);
-    nFlashPerEvent->Fill(run, nflash);
-    //nFlashPerEvent_wgt->Fill(run, nflash, pot);
-    //NCRTHit->Fill(run, nCRTHit);
-    //NCRTHit_wgt->Fill(run, nCRTHit, pot);
-    //nCRTTrkPerEvent->Fill(run, nCRTTrack);
-    //nCRTTrkPerEvent_wgt->Fill(run, nCRTTrack, pot);
-    //nMatchesPerEvent->Fill(run, nCRTPMTMatch);
-    //nMatchesPerEvent_wgt->Fill(run, nCRTPMTMatch, pot);
 
-    // initialize counters/variables
-    size_t nClearCosmics = 0;
-    size_t nNeutrinoCandidate = 0;
-    size_t nTrackHits1 = 0;
-    size_t nTrackHits2 = 0;
-    size_t nTrackHits3 = 0;
-    size_t nTracks = 0;
-    float  crtHitErr = std::numeric_limits<float>::lowest();
-
-    // loop over the slices
-    for (size_t slc_idx = 0; slc_idx < nslc; ++slc_idx)
+    if (not trendName.empty())
     {
-      // Fill simple slice hists
-      nPFPPerEvent->Fill(run, npfp->at(slc_idx));
-      //nPFPPerEvent_wgt->Fill(run, npfp->at(slc_idx), pot);
-
-      // loop over the PFPs
-      for (size_t pfp_idx = 0; pfp_idx < npfp->at(slc_idx); ++pfp_idx)
+      if (not trendSubrun || trendKey != trendSubrunKey(evt.Run, evt.Subrun))
       {
-        //cout<<"slc: "<<slc_idx<<" pfp: "<<pfp_idx<<endl;
-        //cout<<trackLength->size()<<endl;
-        // check whether it's better as a track or a shower
-        bool trkGood = (trackLength->at(slc_idx)[pfp_idx] > 0);
-        bool shwGood = (showerLength->at(slc_idx)[pfp_idx] > 0);
-        if (not trkGood && not shwGood)
-          continue;
-
-        // use the shower info only if the track info isn't good
-        float pfpLength = (trkGood) ? trackLength->at(slc_idx)[pfp_idx]
-                                    : showerLength->at(slc_idx)[pfp_idx];
-        int   pfpPlane  = (trkGood) ? trackBestPlane->at(slc_idx)[pfp_idx]
-                                    : showerBestPlane->at(slc_idx)[pfp_idx];
+        trendKey = trendSubrunKey(evt.Run, evt.Subrun);
+        trendSubrun = &trendSubruns.emplace(trendKey, trendNode(trendKey, plan.Hists.size())).first->second;
+      }
+      trendSubrun->addEvent(evt.TrigSec);
+    }
 
-        // get PFP level info
-        if (trkGood)
-        {
-          nTrackHits1 += trackNHit1->at(slc_idx)[pfp_idx];
-          nTrackHits2 += trackNHit2->at(slc_idx)[pfp_idx];
-          nTrackHits3 += trackNHit3->at(slc_idx)[pfp_idx];
-          ++nTracks;
-        }
-        if (clear_cosmic->at(slc_idx))
-        {
-          ++nClearCosmics;
-        } else if (std::abs(CRLongestTrackDirY->at(slc_idx)) < 0.1) {
-          ++nNeutrinoCandidate;
-        }
+    plan.fill(evt, useDerived, trendSubrun);
+  }
+  if (filter.active())
+    filter.report(std::cout);
+  if (not trendName.empty())
+  {
+    for (auto& subrun : trendSubruns)
+    {
+      auto exposure = subrunExposure.find(subrun.first);
+      if (exposure != subrunExposure.end())
+      {
+        subrun.second.POT = exposure->second.first;
+        subrun.second.Gates = exposure->second.second;
       }
     }
+    trend.update(trendSubruns, inFileName);
+    if (trend.save(trendName))
+      std::cout << "Trend pyramid " << trendName << ": " << trendSubruns.size() << " subruns updated, now "
+                << trend.Levels[kTrendSubrun].size() << " subruns, " << trend.Levels[kTrendRun].size() << " runs, "
+                << trend.Levels[kTrendDay].size() << " days, " << trend.Levels[kTrendEra].size() << " eras" << std::endl;
+    else
+      std::cout << "Could not write trend pyramid " << trendName << std::endl;
+  }
+
+  // preview: record each run's means with their statistical errors from the
+  // sampled events, then scale every run column up to the full run
+  if (previewScaling)
+  {
+    std::vector<TH1*> perRunHists = {nEventsPerRun.get()};
+    perRunHists.insert(perRunHists.end(), plan.Hists.begin(), plan.Hists.end());
+    std::vector<TH1*> perRunDists;
+    for (TH1* hist : perRunHists)
+      if (hist->GetDimension() > 1)
+        perRunDists.push_back(hist);
 
-    // loop over flashes
-    for (size_t flsh_idx = 0; flsh_idx < nflash; ++flsh_idx)
+    outFile->cd();
+    TTree* previewSummary = new TTree("preview_summary", "Preview Per-Run Summaries");
+    unsigned int summaryRun;
+    Long64_t summaryTotal;
+    Long64_t summarySampled;
+    std::vector<double> summaryMean(perRunDists.size());
+    std::vector<double> summaryMeanErr(perRunDists.size());
+    previewSummary->Branch("run", &summaryRun);
+    previewSummary->Branch("nEvents", &summaryTotal);
+    previewSummary->Branch("nSampled", &summarySampled);
+    for (size_t dist = 0; dist < perRunDists.size(); ++dist)
     {
-      FlashTimeWidth->Fill(run, flashTimeWidth->at(flsh_idx));
-      //FlashTimeWidth_wgt->Fill(run, flashTimeWidth->at(flsh_idx), pot);
-      FlashTimeSD->Fill(run, flashTimeSD->at(flsh_idx));
-      //FlashTimeSD_wgt->Fill(run, flashTimeSD->at(flsh_idx), pot);
-      FlashPE->Fill(run, flashPE->at(flsh_idx));
-      //FlashPE_wgt->Fill(run, flashPE->at(flsh_idx), pot);
+      std::string distName = perRunDists[dist]->GetName();
+      previewSummary->Branch((distName + "_mean").c_str(), &summaryMean[dist]);
+      previewSummary->Branch((distName + "_meanErr").c_str(), &summaryMeanErr[dist]);
     }
 
-    // loop over CRT hits
-    //for (size_t crt_hit_idx = 0; crt_hit_idx < nCRTHit; ++crt_hit_idx)
-    //{
-    //  CRTHitPEPerHit->Fill(run, CRTHitPE->at(crt_hit_idx));
-    //  CRTHitPEPerHit_wgt->Fill(run, CRTHitPE->at(crt_hit_idx), pot);
-    //  crtHitErr = std::sqrt(std::pow(CRTHitErrX->at(crt_hit_idx), 2)
-    //                      + std::pow(CRTHitErrY->at(crt_hit_idx), 2)
-    //                      + std::pow(CRTHitErrZ->at(crt_hit_idx), 2));
-    //  avgCRTHitErr->Fill(run, crtHitErr);
-    //  avgCRTHitErr_wgt->Fill(run, crtHitErr, pot);
-    //}
+    for (const auto& counts : previewRunCounts)
+    {
+      if (counts.second.Sampled == 0)
+        continue;
+      int runBin = nEventsPerRun->GetXaxis()->FindFixBin(counts.first);
+      for (size_t dist = 0; dist < perRunDists.size(); ++dist)
+      {
+        TH1* hist = perRunDists[dist];
+        double sumW = 0, sumWY = 0, sumWY2 = 0;
+        for (int yBin = 1; yBin <= hist->GetNbinsY(); ++yBin)
+        {
+          double w = hist->GetBinContent(runBin, yBin);
+          double y = hist->GetYaxis()->GetBinCenter(yBin);
+          sumW += w;
+          sumWY += w * y;
+          sumWY2 += w * y * y;
+        }
+        summaryMean[dist] = (sumW > 0) ? sumWY / sumW : 0;
+        summaryMeanErr[dist] = (sumW > 1) ? std::sqrt(std::max(0., sumWY2 / sumW - summaryMean[dist] * summaryMean[dist]) / sumW) : 0;
+      }
+      summaryRun = counts.first;
+      summaryTotal = counts.second.Total;
+      summarySampled = counts.second.Sampled;
+      previewSummary->Fill();
 
-    // loop over CRT tracks
-    //for (size_t crt_trk_idx = 0; crt_trk_idx < nCRTTrack; ++crt_trk_idx)
-    //{
-    //  CRTTrkTime->Fill(run, CRTTrackTime->at(crt_trk_idx));
-    //  CRTTrkTime_wgt->Fill(run, CRTTrackTime->at(crt_trk_idx), pot);
-    //}
+      double scale = static_cast<double>(counts.second.Total) / counts.second.Sampled;
+      for (TH1* hist : perRunHists)
+        scaleRunColumn(hist, runBin, scale);
+      if (debug) std::cout << "Run " << counts.first << ": sampled " << counts.second.Sampled
+                           << " of " << counts.second.Total << " events" << std::endl;
+    }
+  }
 
-    // loop over CRT PMT matches
-    //for (size_t mch_idx = 0; mch_idx < nCRTPMTMatch; ++mch_idx)
-    //{
-    //  nMchHitsPerEvent->Fill(run, nCRTPMTMatchHit->at(mch_idx));
-    //  nMchHitsPerEvent_wgt->Fill(run, nCRTPMTMatchHit->at(mch_idx));
-    //  // loop over the match hits
-    //  for (size_t hit_idx = 0; hit_idx < nCRTPMTMatchHit->at(mch_idx); ++hit_idx)
-    //  {
-    //    fmTimeDiff->Fill(run, nCRTPMTMatchHitTimeDiff->at(mch_idx)[hit_idx]);
-    //    fmTimeDiff_wgt->Fill(run, nCRTPMTMatchHitTimeDiff->at(mch_idx)[hit_idx], pot);
-    //  }
-    //}
+  // exposure, filled once per run
+  for (const auto& pot : runPOT)
+    POTPerRun->Fill(pot.first, pot.second);
+  for (const auto& gates : runGates)
+    GatesPerRun->Fill(gates.first, gates.second);
 
-    // fill the more complex ones
-    nCCPerEvent->Fill(run, nClearCosmics);
-    //nCCPerEvent_wgt->Fill(run, nClearCosmics, pot);
-    flashPerCC->Fill(run, static_cast<double>(nflash) / static_cast<double>(nClearCosmics));
-    //flashPerCC_wgt->Fill(run, static_cast<double>(nflash) / static_cast<double>(nClearCosmics), pot);
-    nNeutrinoPure->Fill(run, nNeutrinoCandidate);
-    //nNeutrinoPure_wgt->Fill(run, nNeutrinoCandidate, pot);
-    nTrkHitsPlane1->Fill(run, nTrackHits1);
-    //nTrkHitsPlane1_wgt->Fill(run, nTrackHits1, pot);
-    nTrkHitsPlane2->Fill(run, nTrackHits2);
-    //nTrkHitsPlane2_wgt->Fill(run, nTrackHits2, pot);
-    nTrkHitsPlane3->Fill(run, nTrackHits3);
-    //nTrkHitsPlane3_wgt->Fill(run, nTrackHits3, pot);
-    nHitPerTrkPlane1->Fill(run, static_cast<double>(nTrackHits1) / static_cast<double>(nTracks));
-    //nHitPerTrkPlane1_wgt->Fill(run, static_cast<double>(nTrackHits1) / static_cast<double>(nTracks), pot);
-    nHitPerTrkPlane2->Fill(run, static_cast<double>(nTrackHits2) / static_cast<double>(nTracks));
-    //nHitPerTrkPlane2_wgt->Fill(run, static_cast<double>(nTrackHits2) / static_cast<double>(nTracks), pot);
-    nHitPerTrkPlane3->Fill(run, static_cast<double>(nTrackHits3) / static_cast<double>(nTracks));
-    //nHitPerTrkPlane3_wgt->Fill(run, static_cast<double>(nTrackHits3) / static_cast<double>(nTracks), pot);
+  // POT weighted versions: every event carries an equal share of its run's
+  // POT, so each run column is the unweighted one times POT / events
+  for (TH1* hist : plan.POTWeightedHists)
+  {
+    TH1* histWgt = static_cast<TH1*>(hist->Clone((std::string(hist->GetName()) + "_wgt").c_str()));
+    histWgt->SetDirectory(outFile.get());
+    histWgt->GetYaxis()->SetTitle((std::string(hist->GetYaxis()->GetTitle()) + " (POT Weighted)").c_str());
+    for (int runBin = 0; runBin <= histWgt->GetNbinsX() + 1; ++runBin)
+    {
+      double nRunEvents = nEventsPerRun->GetBinContent(runBin);
+      double runBinPOT = POTPerRun->GetBinContent(runBin);
+      scaleRunColumn(histWgt, runBin, (nRunEvents > 0) ? runBinPOT / nRunEvents : 0);
+    }
+    if (debug) std::cout << "initialized histogram " << histWgt->GetName() << std::endl;
   }
 
   outFile->Write();
@@ -589,68 +602,12 @@ void makeHists_db_postgre(std::string inFileName,
   if (debug) outFile->ls();
   outFile->Close();
 
-  // clean up unique_ptrs
+  // clean up unique_ptrs; the planned histograms are owned by outFile
   nEventsPerRun .release();
   POTPerRun     .release();
-  runDuration   .release();
-  not_inDB      .release();
-  not_physics   .release();
-  test_config   .release();
-  cathodeV      .release();
-  EInd1V        .release();
-  EInd2V        .release();
-  ECollV        .release();
-  WInd1V        .release();
-  WInd2V        .release();
-  WCollV        .release();
-  ETriggers     .release();
-  WTriggers     .release();
-  UTriggers     .release();
-  BTriggers     .release();
-  nSlicePerEvent.release();
-  //nSlicePerEvent_wgt.release();
-  nFlashPerEvent.release();
-  //nFlashPerEvent_wgt.release();
-  //NCRTHit.release();
-  //NCRTHit_wgt.release();
-  //nCRTTrkPerEvent.release();
-  //nCRTTrkPerEvent_wgt.release();
-  nMatchesPerEvent.release();
-  //nMatchesPerEvent_wgt.release();
-  nPFPPerEvent.release();
-  //nPFPPerEvent_wgt.release();
-  FlashTimeWidth.release();
-  //FlashTimeWidth_wgt.release();
-  FlashTimeSD.release();
-  //FlashTimeSD_wgt.release();
-  FlashPE.release();
-  //FlashPE_wgt.release();
-  //CRTHitPEPerHit.release();
-  //CRTHitPEPerHit_wgt.release();
-  //avgCRTHitErr.release();
-  //avgCRTHitErr_wgt.release();
-  //CRTTrkTime.release();
-  //CRTTrkTime_wgt.release();
-  //nMchHitsPerEvent.release();
-  //nMchHitsPerEvent_wgt.release();
-  //fmTimeDiff.release();
-  //fmTimeDiff_wgt.release();
-  nCCPerEvent.release();
-  //nCCPerEvent_wgt.release();
-  flashPerCC.release();
-  //flashPerCC_wgt.release();
-  nNeutrinoPure.release();
-  //nNeutrinoPure_wgt.release();
-  nTrkHitsPlane1.release();
-  //nTrkHitsPlane1_wgt.release();
-  nTrkHitsPlane2.release();
-  //nTrkHitsPlane2_wgt.release();
-  nTrkHitsPlane3.release();
-  //nTrkHitsPlane3_wgt.release();
-  nHitPerTrkPlane1.release();
-  //nHitPerTrkPlane1_wgt.release();
-  nHitPerTrkPlane2.release();
-  //nHitPerTrkPlane2_wgt.release();
-  nHitPerTrkPlane3.release();
-  //nHitPerTrkPlane3_wgt.release();
+  GatesPerRun   .release();
+  TriggersPerHour.release();
+  TriggersPerShift.release();
+  nSlicePerEventVsHour.release();
+  nFlashPerEventVsHour.release();
 }
@@ -7,8 +7,14 @@
 #include "TTreeReader.h"
 #include "TTreeReaderArray.h"
 #include "TTreeReaderValue.h"
+#include "TBufferFile.h"
 #include "TChain.h"
 #include "TInterpreter.h"
+#include "TLeaf.h"
+#include "TNamed.h"
+#include "TROOT.h"
+#include "Compression.h"
+#include "TSystem.h"
 
 // sbn includes
 #include "sbnanaobj/StandardRecord/StandardRecord.h"
@@ -17,19 +23,39 @@
 #include "sbnanaobj/StandardRecord/SRPFP.h"
 
 // std incldes
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <deque>
 #include <chrono>
+#include <cmath>
 #include <fstream>
+#include <functional>
+#include <limits>
 #include <sstream>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+// system includes
+#include <sys/resource.h>
+#include <sys/stat.h>
+
 // SQL includes
 #include <libpq-fe.h>
 #include "sqlite3.h"
 
+// local includes
+#include "dqCommon.h"
+#include "dqSchema.h"
+
 // Custom deleters for SQL ptrs
 struct PGConnDeleter
 {
@@ -143,102 +169,1008 @@ struct runInfo
   }
 };
 
+// timestamp strings from the run database look like
+//   "Tue Jun 04 13:22:05 CDT 2024"
+// and are indexed as
+// [ 0 -  2] Day of the week
+// [ 4 -  6] Month
+// [ 8 -  9] Day
+// [11 - 12] Hour
+// [14 - 15] Minute
+// [17 - 18] Second
+// [20 - 22] Timezone
+// [24 - 27] Year
+constexpr size_t kTimeStrLength = 28;
+
+// three letter names packed into one integer, so a lookup is a few integer
+// compares instead of string comparisons
+constexpr uint32_t packName(const char* name)
+{
+  return (static_cast<uint32_t>(static_cast<unsigned char>(name[0])) << 16)
+       | (static_cast<uint32_t>(static_cast<unsigned char>(name[1])) <<  8)
+       |  static_cast<uint32_t>(static_cast<unsigned char>(name[2]));
+}
+constexpr uint32_t kMonthNames[12] = {packName("Jan"), packName("Feb"), packName("Mar"), packName("Apr"),
+                                      packName("May"), packName("Jun"), packName("Jul"), packName("Aug"),
+                                      packName("Sep"), packName("Oct"), packName("Nov"), packName("Dec")};
+constexpr uint32_t kWeekdayNames[7] = {packName("Sun"), packName("Mon"), packName("Tue"), packName("Wed"),
+                                       packName("Thu"), packName("Fri"), packName("Sat")};
+
+// index of name in table, or size if it isn't there
+template <size_t N>
+inline int lookupName(const uint32_t (&table)[N], const char* name)
+{
+  uint32_t packed = packName(name);
+  int idx = 0;
+  while (idx < static_cast<int>(N) && table[idx] != packed)
+    ++idx;
+  return idx;
+}
+
+// fixed width decimal field; returns -1 on a non-digit
+inline int parseDigits(const char* field, int width)
+{
+  int value = 0;
+  bool good = true;
+  for (int idx = 0; idx < width; ++idx)
+  {
+    unsigned digit = static_cast<unsigned char>(field[idx]) - '0';
+    good = good && (digit < 10);
+    value = value * 10 + static_cast<int>(digit);
+  }
+  return (good) ? value : -1;
+}
+
+// days since 1970-01-01 of a proleptic Gregorian date (month 1-12)
+inline long daysFromCivil(int year, int month, int day)
+{
+  year -= (month <= 2);
+  const long era = (year >= 0 ? year : year - 399) / 400;
+  const long yoe = year - era * 400;
+  const long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// offset from UTC of the zone in a timestamp; the detector is on Chicago
+// time, anything else falls back to this machine's offset, computed once
+inline long zoneOffset(const char* zone)
+{
+  static const long localOffset = []()
+  {
+    std::time_t now = std::time(nullptr);
+    std::tm utc = *std::gmtime(&now);
+    utc.tm_isdst = -1;
+    return static_cast<long>(std::difftime(now, std::mktime(&utc)));
+  }();
+  uint32_t packed = packName(zone);
+  return (packed == packName("CDT")) ? -5 * 3600 :
+         (packed == packName("CST")) ? -6 * 3600 :
+         (packed == packName("UTC")) ?  0        :
+         (packed == packName("GMT")) ?  0        :
+                                        localOffset;
+}
+
+// parse one timestamp without allocating; false if it is malformed
+inline bool parseTimestamp(const char* timeStr, size_t length, std::time_t& timePoint)
+{
+  if (length < kTimeStrLength)
+    return false;
+  int sec   = parseDigits(timeStr + 17, 2);
+  int min   = parseDigits(timeStr + 14, 2);
+  int hour  = parseDigits(timeStr + 11, 2);
+  int day   = parseDigits(timeStr +  8, 2);
+  int year  = parseDigits(timeStr + 24, 4);
+  int month = lookupName(kMonthNames, timeStr + 4);
+  int weekday = lookupName(kWeekdayNames, timeStr);
+  if (sec < 0 || min < 0 || hour < 0 || day < 1 || year < 0 || month == 12 || weekday == 7)
+    return false;
+  timePoint = static_cast<std::time_t>(daysFromCivil(year, month + 1, day) * 86400L
+                                       + hour * 3600L + min * 60L + sec - zoneOffset(timeStr + 20));
+  return true;
+}
+
+// parse a batch of timestamps; the fields sit at fixed offsets, so the loop
+// is straight-line integer arithmetic per string. Malformed entries get -1.
+inline void parseTimestamps(const std::vector<std::string>& timeStrs, std::vector<std::time_t>& timePoints)
+{
+  timePoints.resize(timeStrs.size());
+  for (size_t idx = 0; idx < timeStrs.size(); ++idx)
+    if (not parseTimestamp(timeStrs[idx].data(), timeStrs[idx].size(), timePoints[idx]))
+      timePoints[idx] = -1;
+}
+
 // format a time from a TString
 std::time_t makeTime(TString timeStr, bool debug = false)
 {
-  // initialize return
-  std::tm parsedTime{};
-
-  // timeStr should be indexed as
-  // [ 0 -  2] Day of the week
-  // [ 4 -  6] Month
-  // [ 8 -  9] Day
-  // [11 - 12] Hour
-  // [14 - 15] Minute
-  // [17 - 18] Second
-  // [20 - 22] Timezone
-  // [24 - 27] Year
   if (debug) std::cout << "Parsing time from string " << timeStr.Data() << std::endl;
-  TString secStr(timeStr(17, 2));
-  int sec = secStr.Atoi();
-  if (debug) std::cout << "  From " << '"' << secStr.Data() << '"' << " we get " << sec << std::endl;
-  TString minStr(timeStr(14, 2));
-  int min = minStr.Atoi();
-  if (debug) std::cout << "  From " << '"' << minStr.Data() << '"' << " we get " << min << std::endl;
-  TString hourStr(timeStr(11, 2));
-  int hour = hourStr.Atoi();
-  if (debug) std::cout << "  From " << '"' << hourStr.Data() << '"' << " we get " << hour << std::endl;
-  TString dayStr(timeStr(8, 2));
-  int day = dayStr.Atoi();
-  if (debug) std::cout << "  From " << '"' << dayStr.Data() << '"' << " we get " << day << std::endl;
-  TString monthStr(timeStr(4, 3));
-  int month = (monthStr.EqualTo("Jan")) ?  0 :
-              (monthStr.EqualTo("Feb")) ?  1 :
-              (monthStr.EqualTo("Mar")) ?  2 :
-              (monthStr.EqualTo("Apr")) ?  3 :
-              (monthStr.EqualTo("May")) ?  4 :
-              (monthStr.EqualTo("Jun")) ?  5 :
-              (monthStr.EqualTo("Jul")) ?  6 :
-              (monthStr.EqualTo("Aug")) ?  7 :
-              (monthStr.EqualTo("Sep")) ?  8 :
-              (monthStr.EqualTo("Oct")) ?  9 :
-              (monthStr.EqualTo("Nov")) ? 10 :
-              (monthStr.EqualTo("Dec")) ? 11 :
-                                          12 ;
-  if (debug) std::cout << "  From " << '"' << monthStr.Data() << '"' << " we get " << month << std::endl;
-  TString yearStr(timeStr(24, 4));
-  int year = yearStr.Atoi();
-  if (debug) std::cout << "  From " << '"' << yearStr.Data() << '"' << " we get " << year << std::endl;
-  TString wdStr(timeStr(0, 3));
-  int weekday = (wdStr.EqualTo("Sun")) ? 0 :
-                (wdStr.EqualTo("Mon")) ? 1 :
-                (wdStr.EqualTo("Tue")) ? 2 :
-                (wdStr.EqualTo("Wed")) ? 3 :
-                (wdStr.EqualTo("Thu")) ? 4 :
-                (wdStr.EqualTo("Fri")) ? 5 :
-                (wdStr.EqualTo("Sat")) ? 6 :
-                                         7 ;
-  if (debug) std::cout << "  From " << '"' << wdStr.Data() << '"' << " we get " << weekday << std::endl;
-  TString dlStr(timeStr(20, 3));
-  int daylight = (dlStr.EqualTo("CDT")) ? 1 :
-                 (dlStr.EqualTo("CST")) ? 0 :
-                                         -1 ;
-  if (debug) std::cout << "  From " << '"' << dlStr.Data() << '"' << " we get " << daylight << std::endl;
-
-  parsedTime.tm_sec = sec;
-  parsedTime.tm_min = min;
-  parsedTime.tm_hour = hour;
-  parsedTime.tm_mday = day;
-  parsedTime.tm_mon = month;
-  parsedTime.tm_year = year - 1900;
-  parsedTime.tm_wday = weekday;
-  parsedTime.tm_isdst = daylight;
-  std::time_t timePoint = std::mktime(&parsedTime);
-
-  if (month == 12 || weekday == 7 || daylight == -1)
-  {
-    std::string badInput(timeStr.Data());
-    std::cerr << "Error, invalid date string " << badInput << '\n'
-              << "  sec " << sec << '\n'
-              << "  min " << min << '\n'
-              << "  hour " << hour << '\n'
-              << "  day " << day << '\n'
-              << "  month " << '\n'
-              << "  year " << year << '\n'
-              << "  weekday " << weekday << '\n'
-              << "  daylight " << daylight << std::endl;
-    return std::mktime(&parsedTime);
+  std::time_t timePoint = -1;
+  if (not parseTimestamp(timeStr.Data(), timeStr.Length(), timePoint))
+    std::cerr << "Error, invalid date string " << timeStr.Data() << std::endl;
+  if (debug) std::cout << "  we get " << timePoint << std::endl;
+  return timePoint;
+}
+
+// what the chain needs to know about one input file
+struct inputFileMeta
+{
+  Long64_t Size = 0;
+  long long MTime = 0;                 // 0 for remote files
+  Long64_t Entries = 0;
+  std::string Schema;                  // key of its recTree leaf list in chainMetadata::Schemas
+};
+
+// size and mtime of a local file; false for remote (xrootd) ones and files
+// that are not there
+inline bool localStamp(const std::string& fileName, Long64_t& size, long long& mtime)
+{
+  struct stat fileStat;
+  if (fileName.find("://") != std::string::npos || stat(fileName.c_str(), &fileStat) != 0)
+    return false;
+  size = fileStat.st_size;
+  mtime = fileStat.st_mtime;
+  return true;
+}
+
+// check that an input file opens cleanly and holds a readable recTree, and
+// record its entries and leaves in meta
+bool checkInputFile(const std::string& fileName, inputFileMeta& meta, std::string& leaves, std::string& reason)
+{
+  meta = inputFileMeta();
+  std::unique_ptr<TFile> inFile(TFile::Open(fileName.c_str(), "READ"));
+  if (not inFile || inFile->IsZombie())
+  {
+    reason = "could not open file";
+    return false;
+  }
+  // ROOT recovers keys from files that were never closed, i.e. truncated ones
+  if (inFile->TestBit(TFile::kRecovered))
+  {
+    reason = "file is truncated (keys had to be recovered)";
+    return false;
+  }
+  TTree* inTree = inFile->Get<TTree>("recTree");
+  if (not inTree)
+  {
+    reason = "no recTree in file";
+    return false;
   }
+  meta.Size = inFile->GetSize();
+  Long64_t statSize;
+  localStamp(fileName, statSize, meta.MTime);
+  meta.Entries = inTree->GetEntries();
+  leaves.clear();
+  TObjArray* leafList = inTree->GetListOfLeaves();
+  for (int leafIdx = 0; leafIdx < leafList->GetEntriesFast(); ++leafIdx)
+  {
+    TLeaf* leaf = (TLeaf*)leafList->At(leafIdx);
+    leaves += std::string((leaves.empty()) ? "" : " ") + leaf->GetName() + ":" + leaf->GetTypeName();
+  }
+  std::stringstream schemaStrm;
+  schemaStrm << std::hex << std::hash<std::string>()(leaves);
+  meta.Schema = schemaStrm.str();
+  return true;
+}
 
-  return timePoint;
+// sidecar of inputFileMeta for every good file of a list (<list>.meta), so a
+// rerun puts the list in the chain without opening a single file. Local
+// files are looked at again when their size or mtime changes; remote files
+// are taken to be immutable under their name, as SAM files are. Leaf lists
+// are stored once per distinct schema. The file name ends its line, so names
+// with spaces survive.
+struct chainMetadata
+{
+  static constexpr int kVersion = 2;
+  std::map<std::string, inputFileMeta> Files;
+  std::map<std::string, std::string> Schemas;
+  bool Dirty = false;
+
+  bool read(const std::string& metaName)
+  {
+    std::ifstream metaStrm(metaName);
+    std::string key;
+    int version = 0;
+    if (not (metaStrm >> key >> version) || key != "version" || version != kVersion)
+      return false;
+    while (metaStrm >> key)
+    {
+      if (key == "schema")
+      {
+        std::string schema;
+        metaStrm >> schema;
+        std::getline(metaStrm >> std::ws, Schemas[schema]);
+      }
+      else if (key == "file")
+      {
+        std::string fileName;
+        inputFileMeta meta;
+        if (metaStrm >> meta.Size >> meta.MTime >> meta.Entries >> meta.Schema && metaStrm.ignore(1)
+            && std::getline(metaStrm, fileName) && not fileName.empty())
+          Files[fileName] = meta;
+      }
+    }
+    return true;
+  }
+
+  // write to a temporary and rename so a crash never leaves half a sidecar
+  bool write(const std::string& metaName) const
+  {
+    std::string tmpName = metaName + ".tmp";
+    {
+      std::ofstream metaStrm(tmpName, std::ios::trunc);
+      metaStrm << "version " << kVersion << '\n';
+      for (const auto& schema : Schemas)
+        metaStrm << "schema " << schema.first << ' ' << schema.second << '\n';
+      for (const auto& file : Files)
+      {
+        const inputFileMeta& meta = file.second;
+        metaStrm << "file " << meta.Size << ' ' << meta.MTime << ' ' << meta.Entries << ' ' << meta.Schema
+                 << ' ' << file.first << '\n';
+      }
+      if (not metaStrm.good())
+        return false;
+    }
+    return std::rename(tmpName.c_str(), metaName.c_str()) == 0;
+  }
+
+  // the recorded metadata of fileName, or nullptr if it is new or changed
+  const inputFileMeta* find(const std::string& fileName) const
+  {
+    auto file = Files.find(fileName);
+    if (file == Files.end())
+      return nullptr;
+    Long64_t size;
+    long long mtime;
+    if (localStamp(fileName, size, mtime) && (size != file->second.Size || mtime != file->second.MTime))
+      return nullptr;
+    return &file->second;
+  }
+
+  void add(const std::string& fileName, const inputFileMeta& meta, const std::string& leaves)
+  {
+    Files[fileName] = meta;
+    Schemas[meta.Schema] = leaves;
+    Dirty = true;
+  }
+};
+
+// append a file we could not use to the quarantine report so it can be rerun
+// later, unless an earlier pass (before a resume) already reported it. A file
+// that failed midway adds the output entries it had already written as a
+// third column, out_entries=A:B, so they can be dropped or kept knowingly.
+void quarantineFile(const std::string& reportName, const std::string& fileName, const std::string& reason,
+                    const std::string& outEntries = "")
+{
+  {
+    std::ifstream reported(reportName);
+    std::string line;
+    while (std::getline(reported, line))
+    {
+      if (line.substr(0, line.find('\t')) == fileName)
+      {
+        std::cerr << "Already quarantined " << fileName << ": " << reason << std::endl;
+        return;
+      }
+    }
+  }
+  std::cerr << "Quarantining " << fileName << ": " << reason << std::endl;
+  std::ofstream report(reportName, std::ios::app);
+  report << fileName << '\t' << reason;
+  if (not outEntries.empty())
+    report << "\tout_entries=" << outEntries;
+  report << '\n';
+}
+
+// sidecar recording where a skim got to: the next input entry to process
+// (as file name and entry within that file), how many entries the output
+// tree held at the matching AutoSave and the output entry that file's
+// entries start at (-1 in sidecars written before it was recorded)
+struct skimCheckpoint
+{
+  std::string FileName;
+  Long64_t Entry = 0;
+  Long64_t OutEntries = 0;
+  Long64_t FileOutEntry = -1;
+  bool read(const std::string& ckptName)
+  {
+    std::ifstream ckptStrm(ckptName);
+    if (not ckptStrm.good())
+      return false;
+    std::string key;
+    while (ckptStrm >> key)
+    {
+      // the name is the rest of the line, spaces and all
+      if (key == "file" && ckptStrm.ignore(1))
+        std::getline(ckptStrm, FileName);
+      else if (key == "entry")
+        ckptStrm >> Entry;
+      else if (key == "out_entries")
+        ckptStrm >> OutEntries;
+      else if (key == "file_out_entry")
+        ckptStrm >> FileOutEntry;
+    }
+    return not FileName.empty();
+  }
+  // write to a temporary and rename so a crash never leaves half a sidecar
+  bool write(const std::string& ckptName) const
+  {
+    std::string tmpName = ckptName + ".tmp";
+    {
+      std::ofstream ckptStrm(tmpName, std::ios::trunc);
+      ckptStrm << "file "        << FileName   << '\n'
+               << "entry "       << Entry      << '\n'
+               << "out_entries " << OutEntries << '\n'
+               << "file_out_entry " << FileOutEntry << '\n';
+      if (not ckptStrm.good())
+        return false;
+    }
+    return std::rename(tmpName.c_str(), ckptName.c_str()) == 0;
+  }
+};
+
+// compact set of seen (run, subrun, event) ids for dropping duplicates: per
+// (run, subrun), a hash of fixed 65536-event bitmaps keyed by event >> 16, so
+// a subrun of N consecutive events costs about N/8 bytes, a stray event
+// number costs one 8 kB chunk rather than a bitmap spanning the gap, and a
+// lookup is a hash (skipped while the chunk does not change) plus a bit test
+struct eventKeySet
+{
+  static constexpr unsigned int kChunkBits = 16;
+  static constexpr size_t kChunkWords = (size_t(1) << kChunkBits) / 64;
+  using subrunChunks = std::unordered_map<unsigned int, std::vector<uint64_t>>;
+  std::unordered_map<uint64_t, subrunChunks> Subruns;
+  uint64_t LastKey = std::numeric_limits<uint64_t>::max();
+  unsigned int LastChunk = 0;
+  uint64_t* Last = nullptr;
+  // add an event, returning false if it was already in the set
+  bool insert(unsigned int run, unsigned int subrun, unsigned int event)
+  {
+    uint64_t key = (static_cast<uint64_t>(run) << 32) | subrun;
+    unsigned int chunk = event >> kChunkBits;
+    if (not Last || key != LastKey || chunk != LastChunk)
+    {
+      std::vector<uint64_t>& words = Subruns[key][chunk];
+      if (words.empty())
+        words.resize(kChunkWords, 0);
+      Last = words.data();
+      LastKey = key;
+      LastChunk = chunk;
+    }
+    unsigned int bit = event & ((1u << kChunkBits) - 1);
+    uint64_t mask = 1ULL << (bit % 64);
+    if (Last[bit / 64] & mask)
+      return false;
+    Last[bit / 64] |= mask;
+    return true;
+  }
+};
+
+// exposure the CAF header records on the first event of each subrun in a
+// file; a subrun split over several files contributes once from each
+struct exposureRecord
+{
+  Long64_t Entry;
+  unsigned int Run;
+  unsigned int Subrun;
+  double POT;
+  Long64_t Gates;
+};
+
+// on-disk layout of the skim output: integer widths, lossy float precision,
+// compression and basket/cluster sizes
+struct skimLayout
+{
+  bool NarrowInts = false;  // hit counts as uint16, planes as int8/int16
+  int FloatBits = 0;        // mantissa bits kept for vertices and flashes, 0 = all
+  int Compression = -1;     // ROOT compression setting (100 * algorithm + level), -1 = default
+  int BasketSize = 0;       // bytes per branch basket, 0 = default
+  Long64_t Cluster = 0;     // AutoFlush: > 0 entries, < 0 bytes, 0 = default
+  // presets, then individual options on top:
+  //   layout=default|compact|fast|small
+  //   compression=ALG:LEVEL (ZLIB, LZMA, LZ4, ZSTD) or a plain ROOT setting, basket=BYTES, cluster=N, floatbits=N, narrow
+  skimLayout(const optionMap& opts)
+  {
+    std::string profile = optionValue<std::string>(opts, "layout", "default");
+    if (profile == "compact")
+    {
+      NarrowInts = true;
+      Compression = ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kZSTD, 5);
+    } else if (profile == "fast") {
+      NarrowInts = true;
+      Compression = ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kLZ4, 4);
+      BasketSize = 256000;
+    } else if (profile == "small") {
+      NarrowInts = true;
+      Compression = ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kLZMA, 8);
+      Cluster = -100000000;
+    } else if (profile != "default") {
+      std::cerr << "Unknown layout " << profile << ", using default" << std::endl;
+    }
+    NarrowInts = NarrowInts || hasOption(opts, "narrow");
+    FloatBits = optionValue<int>(opts, "floatbits", FloatBits);
+    BasketSize = optionValue<int>(opts, "basket", BasketSize);
+    Cluster = optionValue<Long64_t>(opts, "cluster", Cluster);
+    std::string compression = optionValue<std::string>(opts, "compression", "");
+    if (not compression.empty() && compression.find_first_not_of("0123456789") == std::string::npos)
+    {
+      Compression = std::stoi(compression);
+    } else if (not compression.empty()) {
+      std::string algoName = compression.substr(0, compression.find(':'));
+      int level = (compression.find(':') != std::string::npos) ? std::stoi(compression.substr(compression.find(':') + 1)) : 5;
+      int algo = (algoName == "ZLIB") ? ROOT::RCompressionSetting::EAlgorithm::kZLIB :
+                 (algoName == "LZMA") ? ROOT::RCompressionSetting::EAlgorithm::kLZMA :
+                 (algoName == "LZ4" ) ? ROOT::RCompressionSetting::EAlgorithm::kLZ4  :
+                 (algoName == "ZSTD") ? ROOT::RCompressionSetting::EAlgorithm::kZSTD :
+                                        -1;
+      if (algo < 0)
+        std::cerr << "Unknown compression " << compression << ", keeping " << Compression << std::endl;
+      else
+        Compression = 100 * algo + level;
+    }
+  }
+  // fit the writer into a memory budget: the baskets of one cluster are what
+  // it holds between flushes, so cap a cluster at an eighth of the budget
+  // and shrink baskets that would not fit 64 branches into that
+  void fitBudget(Long64_t budgetBytes)
+  {
+    Long64_t clusterBytes = budgetBytes / 8;
+    if (Cluster == 0 || Cluster < -clusterBytes)
+      Cluster = -clusterBytes;
+    int basketCap = static_cast<int>(std::min<Long64_t>(clusterBytes / 64, std::numeric_limits<int>::max()));
+    if (BasketSize == 0 || BasketSize > basketCap)
+      BasketSize = std::min(32000, basketCap);
+  }
+  // what we record in the output, so a resume (or a reader) knows the layout
+  std::string describe() const
+  {
+    std::string layoutStr = "compression=" + std::to_string(Compression)
+                          + ",basket=" + std::to_string(BasketSize)
+                          + ",cluster=" + std::to_string(Cluster)
+                          + ",floatbits=" + std::to_string(FloatBits);
+    return (NarrowInts) ? layoutStr + ",narrow" : layoutStr;
+  }
+};
+
+// convert to a narrower integer type, saturating at its limits
+template <typename Narrow, typename Wide>
+Narrow narrowValue(Wide value)
+{
+  return (value > std::numeric_limits<Narrow>::max()) ? std::numeric_limits<Narrow>::max() :
+         (value < std::numeric_limits<Narrow>::min()) ? std::numeric_limits<Narrow>::min() :
+                                                        static_cast<Narrow>(value);
+}
+
+// the same for a whole vector
+template <typename Narrow, typename Wide>
+std::vector<Narrow> narrowCopy(const std::vector<Wide>& wide)
+{
+  std::vector<Narrow> narrow;
+  narrow.reserve(wide.size());
+  for (Wide value : wide)
+    narrow.push_back(narrowValue<Narrow>(value));
+  return narrow;
+}
+
+// round a float to its leading mantissa bits (relative precision 2^-bits);
+// the zeroed low bits are what the compressor then squeezes out
+float truncateMantissa(float value, int bits)
+{
+  if (bits <= 0 || bits >= 23 || not std::isfinite(value))
+    return value;
+  uint32_t raw;
+  std::memcpy(&raw, &value, sizeof(raw));
+  uint32_t dropBits = 23 - bits;
+  raw += 1u << (dropBits - 1);
+  raw &= ~((1u << dropBits) - 1);
+  std::memcpy(&value, &raw, sizeof(raw));
+  return value;
+}
+
+// buffer for one input array branch, reused from entry to entry: it only
+// grows (with headroom), and the chain is re-pointed at it only when it
+// moves, so once the largest event has gone by reading allocates nothing
+template <typename T>
+struct inputColumn
+{
+  const char* Name;
+  std::vector<T> Data;
+  TBranch* Branch = nullptr;
+  inputColumn(const char* name) : Name(name) {}
+  T& operator[](size_t idx) { return Data[idx]; }
+  void fit(TChain* chain, size_t size)
+  {
+    if (size <= Data.size() && Branch)
+      return;
+    if (size > Data.size() || Data.empty())
+      Data.resize(std::max<size_t>({size, 2 * Data.size(), 1}));
+    chain->SetBranchAddress(Name, Data.data(), &Branch);
+  }
+};
+
+// one event's slice and PFP input: per-slice arrays, and flat per-PFP ones
+// that the slices' PFP counts split up
+struct sliceInput
+{
+  size_t NSlices = 0;
+  const ULong64_t* NPFP = nullptr;
+  const Char_t* ClearCosmic = nullptr;
+  const float* CRLongestTrackDirY = nullptr;
+  const float* TrackLength = nullptr;
+  const float* ShowerLength = nullptr;
+  const caf::Plane_t* TrackBestPlane = nullptr;
+  const int* ShowerBestPlane = nullptr;
+  const float* TrackDirY = nullptr;
+  const float* TrackVtxX = nullptr;
+  const float* TrackVtxY = nullptr;
+  const float* TrackVtxZ = nullptr;
+  const int* TrackNHit1 = nullptr;
+  const int* TrackNHit2 = nullptr;
+  const int* TrackNHit3 = nullptr;
+};
+
+// the rest of one event's array input
+struct eventInput
+{
+  sliceInput Slices;
+  const float* FlashTimeWidth = nullptr;
+  const float* FlashTimeSD = nullptr;
+  const float* FlashTotalPE = nullptr;
+  const int* CRTHitPlane = nullptr;
+  const float* CRTHitPE = nullptr;
+  const float* CRTHitErrX = nullptr;
+  const float* CRTHitErrY = nullptr;
+  const float* CRTHitErrZ = nullptr;
+  const float* CRTTrackTime = nullptr;
+  const int* NMatchedCRTPMTHits = nullptr;
+  const double* MatchedCRTPMTimeDiff = nullptr;
+};
+
+// the nested slice/PFP fill of one event into out's vectors of vectors, the
+// columns with a narrow form in the form the layout writes; the per-slice
+// scratch is kept across events so its capacity is reused
+struct sliceFill
+{
+  // with a narrow layout, fill the wide forms as well (the derived columns
+  // are computed from them)
+  bool KeepWide = false;
+  std::vector<float> TrackLength;
+  std::vector<float> ShowerLength;
+  std::vector<int> TrackBestPlane;
+  std::vector<int> ShowerBestPlane;
+  std::vector<float> TrackDirY;
+  std::vector<float> TrackVtxX;
+  std::vector<float> TrackVtxY;
+  std::vector<float> TrackVtxZ;
+  std::vector<int> TrackNHit1;
+  std::vector<int> TrackNHit2;
+  std::vector<int> TrackNHit3;
+
+  void fill(skimRecord& out, const sliceInput& in, const skimLayout& layout, bool debug = false)
+  {
+    size_t pfpIdx = 0;
+    for (size_t slc_idx = 0; slc_idx < in.NSlices; ++slc_idx)
+    {
+      out.NPFP.emplace_back(in.NPFP[slc_idx]);
+      out.ClearCosmic.emplace_back(in.ClearCosmic[slc_idx]);
+      if (debug) std::cout << "Add ClearCosmic " << in.ClearCosmic[slc_idx] << std::endl;
+      out.CRLongestTrackDirY.emplace_back(in.CRLongestTrackDirY[slc_idx]);
+      if (debug) std::cout << "Add CRLongestTrackDirY " << in.CRLongestTrackDirY[slc_idx] << std::endl;
+      TrackLength.clear();
+      ShowerLength.clear();
+      TrackBestPlane.clear();
+      ShowerBestPlane.clear();
+      TrackDirY.clear();
+      TrackVtxX.clear();
+      TrackVtxY.clear();
+      TrackVtxZ.clear();
+      TrackNHit1.clear();
+      TrackNHit2.clear();
+      TrackNHit3.clear();
+      for (size_t pfp_idx = 0; pfp_idx < in.NPFP[slc_idx]; ++pfp_idx)
+      {
+        TrackLength.emplace_back(in.TrackLength[pfpIdx]);
+        ShowerLength.emplace_back(in.ShowerLength[pfpIdx]);
+        TrackBestPlane.emplace_back(in.TrackBestPlane[pfpIdx]);
+        ShowerBestPlane.emplace_back(in.ShowerBestPlane[pfpIdx]);
+        TrackDirY.emplace_back(in.TrackDirY[pfpIdx]);
+        TrackVtxX.emplace_back(truncateMantissa(in.TrackVtxX[pfpIdx], layout.FloatBits));
+        TrackVtxY.emplace_back(truncateMantissa(in.TrackVtxY[pfpIdx], layout.FloatBits));
+        TrackVtxZ.emplace_back(truncateMantissa(in.TrackVtxZ[pfpIdx], layout.FloatBits));
+        TrackNHit1.emplace_back(in.TrackNHit1[pfpIdx]);
+        TrackNHit2.emplace_back(in.TrackNHit2[pfpIdx]);
+        TrackNHit3.emplace_back(in.TrackNHit3[pfpIdx]);
+        ++pfpIdx;
+      }
+      out.TrackLength.emplace_back(TrackLength);
+      out.ShowerLength.emplace_back(ShowerLength);
+      out.TrackDirY.emplace_back(TrackDirY);
+      out.TrackVtxX.emplace_back(TrackVtxX);
+      out.TrackVtxY.emplace_back(TrackVtxY);
+      out.TrackVtxZ.emplace_back(TrackVtxZ);
+      if (not layout.NarrowInts || KeepWide)
+      {
+        out.TrackBestPlane.emplace_back(TrackBestPlane);
+        out.ShowerBestPlane.emplace_back(ShowerBestPlane);
+        out.TrackNHit1.emplace_back(TrackNHit1);
+        out.TrackNHit2.emplace_back(TrackNHit2);
+        out.TrackNHit3.emplace_back(TrackNHit3);
+      }
+      if (layout.NarrowInts)
+      {
+        out.TrackBestPlaneNarrow.emplace_back(narrowCopy<char>(TrackBestPlane));
+        out.ShowerBestPlaneNarrow.emplace_back(narrowCopy<char>(ShowerBestPlane));
+        out.TrackNHit1Narrow.emplace_back(narrowCopy<unsigned short>(TrackNHit1));
+        out.TrackNHit2Narrow.emplace_back(narrowCopy<unsigned short>(TrackNHit2));
+        out.TrackNHit3Narrow.emplace_back(narrowCopy<unsigned short>(TrackNHit3));
+      }
+    }
+  }
+};
+
+// the CRT-PMT matches of one event: the flat hit time differences split per
+// match by its hit count
+struct matchFill
+{
+  std::vector<double> TimeDiff;
+
+  void fill(skimRecord& out, size_t nMatches, const int* nHits, const double* timeDiff)
+  {
+    size_t hitIdx = 0;
+    for (size_t crt_mtch_idx = 0; crt_mtch_idx < nMatches; ++crt_mtch_idx)
+    {
+      out.CRTPMTMatchNHit.emplace_back(nHits[crt_mtch_idx]);
+      TimeDiff.clear();
+      for (size_t crt_mtch_hit_idx = 0; crt_mtch_hit_idx < static_cast<size_t>(nHits[crt_mtch_idx]); ++crt_mtch_hit_idx)
+      {
+        TimeDiff.emplace_back(timeDiff[hitIdx]);
+        ++hitIdx;
+      }
+      out.CRTPMTMatchHitTimeDiff.emplace_back(TimeDiff);
+    }
+  }
+};
+
+// one scalar input branch over a stretch of entries: a basket at a time
+// through ROOT's bulk I/O (TBulkBranchRead) where the branch allows it, i.e.
+// a single fixed size leaf of exactly T, and entry by entry otherwise
+class batchScalarBase
+{
+public:
+  TBranch* Branch = nullptr;  // the current tree's, kept up to date by the chain
+  bool Optional = false;      // a tree without the branch reads its fallback value
+  virtual ~batchScalarBase() = default;
+  // local entries [first, end) of the current tree
+  virtual bool load(Long64_t first, Long64_t end, bool bulk) = 0;
+  // copy the value of the idx'th loaded entry to the bound scalar
+  virtual void set(size_t idx) = 0;
+};
+
+template <typename T>
+class batchScalar : public batchScalarBase
+{
+public:
+  explicit batchScalar(T* target, T fallback = T()) : Target(target), Fallback(fallback) {}
+
+  bool load(Long64_t first, Long64_t end, bool bulk) override
+  {
+    Data.resize(end - first);
+    if (not Branch)
+    {
+      std::fill(Data.begin(), Data.end(), Fallback);
+      return true;
+    }
+    Long64_t entry = first;
+    if (bulk && bulkReadable())
+    {
+      // bulk reads hand back whole baskets, so ask from the start of the one holding entry
+      const Long64_t* basketEntry = Branch->GetBasketEntry();
+      int nBaskets = Branch->GetWriteBasket();
+      while (entry < end)
+      {
+        int basket = std::upper_bound(basketEntry, basketEntry + nBaskets + 1, entry) - basketEntry - 1;
+        Long64_t basketFirst = basketEntry[basket];
+        Int_t count = Branch->GetBulkRead().GetBulkEntries(basketFirst, Buffer);
+        if (count <= 0 || basketFirst + count <= entry)
+          break;
+        const T* values = reinterpret_cast<const T*>(Buffer.GetCurrent()) + (entry - basketFirst);
+        Long64_t take = std::min(end, basketFirst + count) - entry;
+        std::copy(values, values + take, Data.begin() + (entry - first));
+        entry += take;
+      }
+    }
+    // whatever bulk could not do, through the bound scalar
+    for (; entry < end; ++entry)
+    {
+      if (Branch->GetEntry(entry) <= 0)
+        return false;
+      Data[entry - first] = *Target;
+    }
+    return true;
+  }
+
+  void set(size_t idx) override { *Target = Data[idx]; }
+  // the loaded entries' values
+  const std::vector<T>& values() const { return Data; }
+
+private:
+  bool bulkReadable() const
+  {
+    if (Branch->GetNleaves() != 1 || not Branch->GetBulkRead().SupportsBulkRead())
+      return false;
+    TLeaf* leaf = (TLeaf*)Branch->GetListOfLeaves()->At(0);
+    return leaf->GetLenType() == sizeof(T) && leaf->GetLen() == 1;
+  }
+
+  T* Target;
+  T Fallback;
+  std::vector<T> Data;
+  TBufferFile Buffer{TBuffer::kWrite, 32 * 1024};
+};
+
+// the header and count scalars the per-event decisions (dedup, exposure,
+// preview) need, loaded a cluster at a time so the loop indexes plain arrays
+struct headerBatch
+{
+  std::vector<std::unique_ptr<batchScalarBase>> Columns;
+  Long64_t First = 0;  // chain entries held, [First, End)
+  Long64_t End = 0;
+  bool Bulk = true;
+
+  template <typename T>
+  batchScalar<T>* bind(TChain* chain, const char* name, T* target)
+  {
+    auto column = new batchScalar<T>(target);
+    Columns.emplace_back(column);
+    chain->SetBranchAddress(name, target, &Columns.back()->Branch);
+    return column;
+  }
+  // a branch older CAFs lack: their entries read fallback instead of failing
+  template <typename T>
+  void bindOptional(TChain* chain, const char* name, T* target, T fallback)
+  {
+    Columns.emplace_back(new batchScalar<T>(target, fallback));
+    Columns.back()->Optional = true;
+    chain->SetBranchAddress(name, target, &Columns.back()->Branch);
+  }
+
+  // set the bound scalars to chain entry evt (local entry localEntry of the
+  // tree the chain has loaded), loading the rest of its cluster first if it
+  // is not held yet; false on a read error
+  bool read(TChain* chain, Long64_t evt, Long64_t localEntry)
+  {
+    if (evt < First || evt >= End)
+    {
+      TTree* tree = chain->GetTree();
+      auto clusters = tree->GetClusterIterator(localEntry);
+      clusters.Next();
+      Long64_t clusterEnd = std::min(clusters.GetNextEntry(), tree->GetEntries());
+      First = evt;
+      End = evt + (clusterEnd - localEntry);
+      for (auto& column : Columns)
+      {
+        if ((not column->Branch && not column->Optional) || not column->load(localEntry, clusterEnd, Bulk))
+        {
+          First = End = 0;
+          return false;
+        }
+      }
+    }
+    for (auto& column : Columns)
+      column->set(evt - First);
+    return true;
+  }
+};
+
+// one payload array of a header batch's entries: each entry's elements back
+// to back in Data, entry idx's from Offsets[idx]. ROOT's bulk interface does
+// not cover variable length arrays, so the entries are still read one at a
+// time, but a column at a time over the whole batch, through the column's
+// reused inputColumn buffer: the branch's baskets are decompressed in order
+// and the transform then indexes flat memory
+class payloadColumnBase
+{
+public:
+  virtual ~payloadColumnBase() = default;
+  // local entries first + idx, sizes[idx] elements each (0: not read);
+  // returns how many leading entries read cleanly
+  virtual size_t load(TChain* chain, Long64_t first, const std::vector<size_t>& sizes) = 0;
+};
+
+template <typename T>
+class payloadColumn : public payloadColumnBase
+{
+public:
+  explicit payloadColumn(inputColumn<T>& input) : Input(input) {}
+
+  size_t load(TChain* chain, Long64_t first, const std::vector<size_t>& sizes) override
+  {
+    Offsets.assign(1, 0);
+    size_t total = 0;
+    for (size_t size : sizes)
+      total += size;
+    // resize keeps the capacity from batch to batch
+    Data.resize(total);
+    for (size_t idx = 0; idx < sizes.size(); ++idx)
+    {
+      if (sizes[idx] > 0)
+      {
+        Input.fit(chain, sizes[idx]);
+        // (an array read returns 0 bytes for an empty entry, only < 0 is an error)
+        if (not Input.Branch || Input.Branch->GetEntry(first + idx) < 0)
+          return idx;
+        std::copy(Input.Data.begin(), Input.Data.begin() + sizes[idx], Data.begin() + Offsets.back());
+      }
+      Offsets.push_back(Offsets.back() + sizes[idx]);
+    }
+    return sizes.size();
+  }
+
+  const T* at(size_t idx) const { return Data.data() + Offsets[idx]; }
+
+private:
+  inputColumn<T>& Input;
+  std::vector<T> Data;
+  std::vector<size_t> Offsets;
+};
+
+// the payload of the entries of a header batch that the skim will write,
+// loaded column by column: first the arrays sized by the header counts, then
+// those sized by the per-slice PFP and per-match hit counts just read.
+// Entries it is not told to want (filtered, not sampled) are never read.
+struct payloadBatch
+{
+  enum sizeKind { kPerSlice, kPerFlash, kPerCRTHit, kPerCRTTrack, kPerMatch, kNCountKinds,
+                  kPerPFP = kNCountKinds, kPerMatchHit };
+  const std::vector<int>* Counts[kNCountKinds] = {};  // the header batch's, per entry
+  payloadColumn<ULong64_t>* NPFP = nullptr;            // per slice, sizes kPerPFP
+  payloadColumn<int>* NMatchHits = nullptr;            // per match, sizes kPerMatchHit
+  Long64_t First = -1;                                 // chain entry of index 0
+  size_t Good = 0;                                     // leading entries that read cleanly
+
+  template <typename T>
+  payloadColumn<T>* add(inputColumn<T>& input, sizeKind kind)
+  {
+    auto column = new payloadColumn<T>(input);
+    Columns.emplace_back(std::unique_ptr<payloadColumnBase>(column), kind);
+    return column;
+  }
+
+  // chain entries [first, first + want.size()), local entry localFirst on
+  void load(TChain* chain, Long64_t first, Long64_t localFirst, const std::vector<char>& want)
+  {
+    size_t nEntries = want.size();
+    First = first;
+    Good = nEntries;
+    std::vector<size_t> sizes(nEntries);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+      for (auto& column : Columns)
+      {
+        if ((column.second >= kNCountKinds) != (pass == 1))
+          continue;
+        for (size_t idx = 0; idx < nEntries; ++idx)
+          sizes[idx] = (want[idx] && idx < Good) ? entrySize(column.second, idx) : 0;
+        Good = std::min(Good, column.first->load(chain, localFirst, sizes));
+      }
+    }
+  }
+
+private:
+  size_t entrySize(int kind, size_t idx) const
+  {
+    if (kind < kNCountKinds)
+      return std::max(0, (*Counts[kind])[idx]);
+    size_t size = 0;
+    if (kind == kPerPFP)
+    {
+      const ULong64_t* npfp = NPFP->at(idx);
+      for (int slc = 0; slc < (*Counts[kPerSlice])[idx]; ++slc)
+        size += npfp[slc];
+    } else {
+      const int* nHits = NMatchHits->at(idx);
+      for (int match = 0; match < (*Counts[kPerMatch])[idx]; ++match)
+        size += std::max(0, nHits[match]);
+    }
+    return size;
+  }
+
+  std::vector<std::pair<std::unique_ptr<payloadColumnBase>, int>> Columns;
+};
+
+// resident and peak resident memory of this process, in MB
+inline double residentMB()
+{
+  ProcInfo_t procInfo;
+  gSystem->GetProcInfo(&procInfo);
+  return procInfo.fMemResident / 1024.;
+}
+inline double peakResidentMB()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.;
 }
 
-void makeTTree_db_postgre(std::string srFileName, std::string outFileName, bool debug = false)
+// options (comma separated):
+//   resume          continue from <outFileName>.ckpt instead of starting over
+//   checkpoint=N    AutoSave the output and update the sidecar every N entries
+//                   (default 100000, 0 disables)
+//   preview=F       keep only a deterministic fraction F of events (picked by
+//                   a hash of run/subrun/event) and record the per-run totals
+//                   in preview_runs so the hist stage can scale back up
+//   nodedup         keep events whose (run, subrun, event) was already seen;
+//                   by default repeats are dropped and counted in
+//                   <outFileName>.duplicates.txt
+//   layout=P, ...   output layout profile and overrides, see skimLayout
+//   derived         also store the per-event quantities of derivedEvent as
+//                   flat derived.* columns, tagged with kDerivedVersion
+//   membudget=MB    keep resident memory under MB megabytes: sizes output
+//                   clusters and baskets (skimLayout::fitBudget) and the input
+//                   cache from it, and flushes baskets early whenever RSS
+//                   gets close; peak RSS is reported at the end either way
+//   entries=A:B     only skim chain entries [A, B) (B defaults to the end), so
+//                   one large file can be split over several processes on its
+//                   cluster boundaries (run_shards.py does this for a .root input);
+//                   a passthrough skim then copies its columns entry by entry
+//   imt=N           decompress input and compress output baskets on N threads
+//                   (ROOT implicit MT; 0 uses every core)
+//   nobulk          read the input header entry by entry and the payload with
+//                   one TTree::GetEntry per event, i.e. every branch of the
+//                   CAF (the old per-entry path, for benchSkimBatch)
+//   passthrough     fast-clone the flash and CRT hit/track columns from the CAF
+//                   into passthrough_tree instead of rewriting them (see
+//                   kPassthroughBranches); duplicates are then kept as entries
+//                   flagged dropped so the two trees stay aligned
+//   meta=FILE       chain metadata sidecar (default <srFileName>.meta for a
+//                   .txt list, see chainMetadata); nometa opens every file
+//   minrun=N, maxrun=N, goodruns=FILE, badruns=FILE, skipempty
+//                   drop events by run or without slices, on the header alone
+//                   (see eventFilter); dropped runs keep no exposure either,
+//                   and a passthrough skim keeps them as dropped entries
+void makeTTree_db_postgre(std::string srFileName, std::string outFileName, bool debug = false, std::string options = "")
 {
+  optionMap opts = parseOptions(options);
+  bool resume = hasOption(opts, "resume");
+  Long64_t checkpointEvery = optionValue<Long64_t>(opts, "checkpoint", 100000);
+  std::string ckptName = outFileName + ".ckpt";
+  std::string quarantineName = outFileName + ".quarantine.txt";
+  bool dedup = not hasOption(opts, "nodedup");
+  std::string duplicatesName = outFileName + ".duplicates.txt";
+  Long64_t memBudgetMB = optionValue<Long64_t>(opts, "membudget", 0);
+  Long64_t memBudgetBytes = memBudgetMB * 1024 * 1024;
+  previewSampler preview(optionValue<double>(opts, "preview", 1));
+  if (hasOption(opts, "imt"))
+    ROOT::EnableImplicitMT(optionValue<unsigned>(opts, "imt", 0));
+  eventFilter filter;
+  if (not filter.load(opts))
+  {
+    std::cout << "Event filter options have errors. Bail." << std::endl;
+    return;
+  }
+  if (not filter.GateTypes.empty())
+  {
+    // the gate type comes from the trigger database, which the skim does not query
+    std::cout << "The skim has no gate type to filter on, use gates= in makeHists_db_postgre. Bail." << std::endl;
+    return;
+  }
+  if (preview.active())
+  {
+    // a preview takes minutes, and its per-run totals are only written at the end
+    if (resume)
+    {
+      std::cout << "Cannot resume a preview skim, rerun it instead. Bail." << std::endl;
+      return;
+    }
+    checkpointEvery = 0;
+    std::cout << "Preview mode: keeping a fraction " << preview.Fraction << " of events" << std::endl;
+  }
+
   // get the weights stored correctly
   TH1::SetDefaultSumw2(true);
   gInterpreter->GenerateDictionary("vector<vector<float>>", "vector");
   gInterpreter->GenerateDictionary("vector<vector<int>>", "vector");
+  gInterpreter->GenerateDictionary("vector<vector<unsigned short>>", "vector");
+  gInterpreter->GenerateDictionary("vector<vector<char>>", "vector");
 
 
   // open the trigger database
@@ -256,508 +1188,933 @@ void makeTTree_db_postgre(std::string srFileName, std::string outFileName, bool
     return;
     }*/
   //make tchain lists instead of looping over individual files
-
-  //TFile* srFile;
-  TChain* srTree=new TChain("recTree");
+  std::vector<std::string> inFileNames;
   if(srFileName.find(".txt")!=std::string::npos){//contains substring
     std::ifstream infileList(srFileName);
-    string infile;
+    std::string infile;
     while (std::getline(infileList, infile)){
-      cout<<"infile: "<<infile<<endl;
-      srTree->Add(infile.c_str() );
+      if (not infile.empty())
+        inFileNames.push_back(infile);
     }
   }
   else{//single root file input
-    
-    // open the file and get the StandardRecord TTree
-    //std::unique_ptr<TFile> srFile(TFile::Open(srFileName.c_str(), "READ"));
-    /*srFile=new TFile(srFileName.c_str(), "READ");
-    if (not srFile){
-      std::cout << "Could not open file. Bail." << std::endl;
-      return;
-      }*/
+    inFileNames.push_back(srFileName);
+  }
 
-    // TTreeReaderArrays can't handle multi-dimensional arrays, so we have to do it the old fasioned way
-    /*if (not srFile->GetListOfKeys()->FindObject("recTree"))
-      {
-        std::cout << "Could not find recTree in file. Bail." << std::endl;
-        return;
-        }*/
-    srTree->Add(srFileName.c_str() );
-    //std::unique_ptr<TTree> srTree(srFile->Get<TTree>("recTree"));
-    if (not srTree)
+  // vet each file before it goes in the chain, so one bad file costs us that
+  // file rather than the job; passing the entry count means the chain never
+  // has to reopen the file just to count. Files the metadata sidecar already
+  // vetted are not opened at all.
+  if (not resume)
+  {
+    std::remove(quarantineName.c_str());
+    std::remove(duplicatesName.c_str());
+  }
+  std::string metaName = (hasOption(opts, "nometa")) ? ""
+                       : optionValue<std::string>(opts, "meta", (srFileName.find(".txt") != std::string::npos) ? srFileName + ".meta" : "");
+  chainMetadata chainMeta;
+  if (not metaName.empty() && chainMeta.read(metaName) && debug)
+    std::cout << "Read metadata of " << chainMeta.Files.size() << " files from " << metaName << std::endl;
+  TChain* srTree=new TChain("recTree");
+  std::vector<std::string> chainFiles;
+  std::vector<Long64_t> chainFileOffset;
+  std::vector<Long64_t> chainFileEntries;
+  Long64_t nChainEntries = 0;
+  size_t nOpened = 0;
+  std::set<std::string> chainSchemas;
+  for (const auto& infile : inFileNames)
+  {
+    cout<<"infile: "<<infile<<endl;
+    const inputFileMeta* meta = chainMeta.find(infile);
+    if (not meta)
+    {
+      inputFileMeta newMeta;
+      std::string leaves, reason;
+      ++nOpened;
+      if (not checkInputFile(infile, newMeta, leaves, reason))
       {
-        std::cout << "Could not open recTree. Bail." << std::endl;
-        return;
+        quarantineFile(quarantineName, infile, reason);
+        continue;
       }
+      chainMeta.add(infile, newMeta, leaves);
+      meta = &chainMeta.Files[infile];
+    }
+    Long64_t fileEntries = meta->Entries;
+    chainSchemas.insert(meta->Schema);
+    if (fileEntries == 0)
+      continue;
+    srTree->Add(infile.c_str(), fileEntries);
+    chainFiles.push_back(infile);
+    chainFileOffset.push_back(nChainEntries);
+    chainFileEntries.push_back(fileEntries);
+    nChainEntries += fileEntries;
+  }
+  std::cout << "Chained " << chainFiles.size() << " of " << inFileNames.size() << " files, opened "
+            << nOpened << " not in the metadata sidecar" << std::endl;
+  if (chainSchemas.size() > 1)
+    std::cout << "Warning: the input files have " << chainSchemas.size() << " different recTree layouts" << std::endl;
+  if (not metaName.empty() && chainMeta.Dirty && not chainMeta.write(metaName))
+    std::cerr << "Could not write chain metadata " << metaName << std::endl;
+  if (chainFiles.empty())
+  {
+    std::cout << "No readable recTree entries in " << srFileName << ". Bail." << std::endl;
+    delete srTree;
+    return;
+  }
+  // index of the chain file holding a given chain entry
+  auto chainFileOf = [&](Long64_t evt) -> size_t
+  {
+    return std::upper_bound(chainFileOffset.begin(), chainFileOffset.end(), evt) - chainFileOffset.begin() - 1;
+  };
+
+  // the stretch of the chain this job skims
+  Long64_t firstEntry = 0;
+  Long64_t lastEntry = nChainEntries;
+  if (hasOption(opts, "entries"))
+  {
+    std::string entryRange = optionValue<std::string>(opts, "entries", "");
+    size_t colon = entryRange.find(':');
+    firstEntry = std::stoll(entryRange.substr(0, colon));
+    if (colon != std::string::npos && colon + 1 < entryRange.size())
+      lastEntry = std::min(lastEntry, std::stoll(entryRange.substr(colon + 1)));
+    if (firstEntry < 0 || firstEntry >= lastEntry)
+    {
+      std::cout << "Entry range " << entryRange << " is empty in " << nChainEntries << " chain entries. Bail." << std::endl;
+      delete srTree;
+      return;
+    }
+    std::cout << "Skimming chain entries [" << firstEntry << ", " << lastEntry << ")" << std::endl;
   }
+
+  // the range as asked for, before a resume moves its start
+  const Long64_t rangeFirstEntry = firstEntry;
+
+  // pick up where the checkpoint left off
+  skimCheckpoint ckpt;
+  if (resume)
+  {
+    if (not ckpt.read(ckptName))
+    {
+      std::cout << "Could not read checkpoint " << ckptName << ". Bail." << std::endl;
+      delete srTree;
+      return;
+    }
+    auto ckptFile = std::find(chainFiles.begin(), chainFiles.end(), ckpt.FileName);
+    if (ckptFile == chainFiles.end())
+    {
+      std::cout << "Checkpoint file " << ckpt.FileName << " is not in the input list. Bail." << std::endl;
+      delete srTree;
+      return;
+    }
+    firstEntry = chainFileOffset[ckptFile - chainFiles.begin()] + ckpt.Entry;
+    std::cout << "Resuming at " << ckpt.FileName << " entry " << ckpt.Entry
+              << " (chain entry " << firstEntry << ")" << std::endl;
+  }
+
   // Open an output file
   // make a TTree to fill
-  std::unique_ptr<TFile> outFile = std::make_unique<TFile>(outFileName.c_str(), "RECREATE");
+  std::unique_ptr<TFile> outFile = std::make_unique<TFile>(outFileName.c_str(), (resume) ? "UPDATE" : "RECREATE");
   outFile->cd();
-  std::unique_ptr<TTree> outTree = std::make_unique<TTree>("data_validation_tree", "Data Validation Tree");
-
-  // loop to get how big each slice-pfp "array" should be
-  std::vector<size_t> sizeSliceArr(srTree->GetEntries(), 0);
-  std::vector<size_t> sizePFPArr(srTree->GetEntries(), 0);
-  std::vector<size_t> sizeOpFlashArr(srTree->GetEntries(), 0);
-  std::vector<size_t> sizeCRTHitArr(srTree->GetEntries(), 0);
-  std::vector<size_t> sizeCRTTrackArr(srTree->GetEntries(), 0);
-  std::vector<size_t> sizeCRTPMTMatchArr(srTree->GetEntries(), 0);
-  std::vector<size_t> sizeCRTPMTMatchHitArr(srTree->GetEntries(), 0);
-  cout<<"First entry loop"<<endl;
-  double nentries=srTree->GetEntries();
-  for (size_t evt = 0; evt < srTree->GetEntries(); ++evt)
-  {
-    if(evt%10000==0) cout<<"Entry "<<evt<< "/"<<nentries<<"\t "<<100.*evt/nentries<<"% done in first loop."<<endl;
-    int srbNSlices;
-    srTree->SetBranchAddress("rec.nslc", &srbNSlices);
-    int srbNOpFlashes;
-    srTree->SetBranchAddress("rec.nopflashes", &srbNOpFlashes);
-    int srbNCRTHits;
-    srTree->SetBranchAddress("rec.ncrt_hits", &srbNCRTHits);
-    int srbNCRTTracks;
-    srTree->SetBranchAddress("rec.ncrt_tracks", &srbNCRTTracks);
-    int srbNCRTPMTMatches;
-    srTree->SetBranchAddress("rec.ncrtpmt_matches", &srbNCRTPMTMatches);
-    srTree->GetEntry(evt);
-    sizeSliceArr[evt] = srbNSlices;
-    sizeOpFlashArr[evt] = srbNOpFlashes;
-    sizeCRTHitArr[evt] = srbNCRTHits;
-    sizeCRTTrackArr[evt] = srbNCRTTracks;
-    sizeCRTPMTMatchArr[evt] = srbNCRTPMTMatches;
-    std::unique_ptr<ULong64_t[]> srbNPFPinSlice = std::make_unique<ULong64_t[]>(sizeSliceArr[evt]);
-    srTree->SetBranchAddress("rec.slc.reco.npfp", srbNPFPinSlice.get());
-    std::unique_ptr<int[]> srbNHitInMatch = std::make_unique<int[]>(srbNCRTPMTMatches);
-    srTree->SetBranchAddress("rec.crtpmt_matches.matchedCRTHits..length", srbNHitInMatch.get());
-    srTree->GetEntry(evt);
-    for (size_t slc = 0; slc < sizeSliceArr[evt]; ++slc)
-    {
-      sizePFPArr[evt] += srbNPFPinSlice[slc];
-    }
-    for (size_t match = 0; match < sizeCRTPMTMatchArr[evt]; ++match)
-    {
-      sizeCRTPMTMatchHitArr[evt] += srbNHitInMatch[match];
+  // a resumed tree already has its branch types, so take the layout it was made with
+  skimLayout layout(opts);
+  if (resume)
+  {
+    if (TNamed* layoutRecord = outFile->Get<TNamed>("skim_layout"))
+      layout = skimLayout(parseOptions(layoutRecord->GetTitle()));
+  } else {
+    if (memBudgetBytes > 0)
+      layout.fitBudget(memBudgetBytes);
+    if (layout.Compression >= 0)
+      outFile->SetCompressionSettings(layout.Compression);
+    TNamed("skim_layout", layout.describe().c_str()).Write();
+  }
+  if (debug) std::cout << "Output layout: " << layout.describe() << std::endl;
+  // likewise the derived columns: a resume keeps them if and only if the
+  // output already has them, and never mixes two definitions in one tree
+  bool storeDerived = hasOption(opts, "derived");
+  if (resume)
+  {
+    TNamed* derivedRecord = outFile->Get<TNamed>("derived_version");
+    storeDerived = (derivedRecord != nullptr);
+    if (storeDerived && std::stoi(derivedRecord->GetTitle()) != kDerivedVersion)
+    {
+      std::cout << "Output has derived columns version " << derivedRecord->GetTitle()
+                << ", this skim makes version " << kDerivedVersion << ". Start over. Bail." << std::endl;
+      delete srTree;
+      return;
     }
-    srTree->ResetBranchAddresses();
+  } else if (storeDerived) {
+    TNamed("derived_version", std::to_string(kDerivedVersion).c_str()).Write();
+  }
+  // and the passthrough columns, which are cloned from every input entry of
+  // the range, so the output has to keep one entry per input entry
+  bool passthrough = (resume) ? (outFile->Get<TNamed>("passthrough") != nullptr) : hasOption(opts, "passthrough");
+  if (passthrough && preview.active())
+  {
+    std::cout << "A passthrough skim needs every input entry, it cannot be a preview. Bail." << std::endl;
+    delete srTree;
+    return;
+  }
+  if (passthrough && not resume)
+  {
+    std::string passthroughNames;
+    for (const auto& branch : kPassthroughBranches)
+      passthroughNames += std::string((passthroughNames.empty()) ? "" : ",") + branch.Name;
+    TNamed("passthrough", passthroughNames.c_str()).Write();
+  }
+  std::unique_ptr<TTree> outTree;
+  if (resume)
+  {
+    outTree.reset(outFile->Get<TTree>("data_validation_tree"));
+    if (not outTree || outTree->GetEntries() < ckpt.OutEntries)
+    {
+      std::cout << "Output tree in " << outFileName << " does not match the checkpoint. Bail." << std::endl;
+      outTree.release();
+      delete srTree;
+      return;
+    }
+    if (outTree->GetEntries() > ckpt.OutEntries)
+    {
+      // an AutoSave landed but the sidecar was never updated, so drop the
+      // unrecorded entries and redo that stretch of input
+      std::cout << "Trimming output from " << outTree->GetEntries() << " to " << ckpt.OutEntries << " entries" << std::endl;
+      TTree* trimmedTree = outTree->CloneTree(0);
+      trimmedTree->CopyEntries(outTree.get(), ckpt.OutEntries);
+      trimmedTree->ResetBranchAddresses();
+      outFile->Delete("data_validation_tree;*");
+      outTree.reset(trimmedTree);
+      outTree->AutoSave("SaveSelf");
+    }
+    // its columns have to be the types we are about to bind
+    if (not checkSkimSchema(outTree.get(), layout.NarrowInts, std::cout))
+    {
+      std::cout << "Output tree in " << outFileName << " does not match the skim schema compiled in here. Bail." << std::endl;
+      outTree.release();
+      delete srTree;
+      return;
+    }
+  } else {
+    outTree = std::make_unique<TTree>("data_validation_tree", "Data Validation Tree");
   }
 
-  // declare our new branches
-  unsigned int newRun;
-  unsigned int newSubrun;
-  unsigned int newEvent;
-  float newPOT;
-  // TPC
-  int newNSlices;
-  std::vector<unsigned long long> newNPFPinSlice;
-  std::vector<char> newClearCosmic;
-  std::vector<float> newCRLongestTrackDirY;
-  std::vector<bool> newFMatchPresent;
-  std::vector<float> newFMatchLightPE;
-  std::vector<float> newFMatchScore;
-  std::vector<std::vector<float>> newTrackLength;
-  std::vector<std::vector<float>> newShowerLength;
-  std::vector<std::vector<int>> newTrackBestPlane;
-  std::vector<std::vector<int>> newShowerBestPlane;
-  std::vector<std::vector<float>> newTrackDirY;
-  std::vector<std::vector<float>> newTrackVtxX;
-  std::vector<std::vector<float>> newTrackVtxY;
-  std::vector<std::vector<float>> newTrackVtxZ;
-  std::vector<std::vector<int>> newTrackNHit1;
-  std::vector<std::vector<int>> newTrackNHit2;
-  std::vector<std::vector<int>> newTrackNHit3;
-  // PMT
-  int newNOpFlashes;
-  std::vector<float> newFlashTimeWidth;
-  std::vector<float> newFlashTimeSD;
-  std::vector<float> newFlashTotalPE;
-  // CRT
-  int newNCRTHits;
-  std::vector<int> newCRTHitPlane;
-  std::vector<float> newCRTHitPE;
-  std::vector<float> newCRTHitErrX;
-  std::vector<float> newCRTHitErrY;
-  std::vector<float> newCRTHitErrZ;
-  int newNCRTTracks;
-  std::vector<float> newCRTTrackTime;
-  int newNCRTPMTMatches;
-  std::vector<int> newNMatchedCRTPMTHits;
-  std::vector<std::vector<double>> newMatchedCRTPMTimeDiff;
-  // DB
-  bool             dbRunInfoExists;
-  bool             dbTriggerDataExists;
-  int              dbRun;
-  int              dbStart;
-  int              dbEnd;
-  TString          dbConfig;
-  double           dbCath;
-  double           dbEInd1;
-  double           dbEInd2;
-  double           dbEColl;
-  double           dbWInd1;
-  double           dbWInd2;
-  double           dbWColl;
-  int              dbNTPC;
-  int              dbNPMT;
-  int              dbNCRT;
-  int              dbEventNumber;
-  int              dbTrigSec;
-  int              dbTrigNanosec;
-  int              dbGateType;
-  int              dbTrigSource;
-
-  // set up output branches for each variable
-  outTree->Branch("run", &newRun);
-  outTree->Branch("subrun", &newSubrun);
-  outTree->Branch("event", &newEvent);
-  outTree->Branch("POT", &newPOT);
-  outTree->Branch("nslc", &newNSlices);
-  outTree->Branch("slc.npfp", &newNPFPinSlice);
-  outTree->Branch("slc.clear_cosmic", &newClearCosmic);
-  outTree->Branch("slc.CRLongestTrackDirY", &newCRLongestTrackDirY);
-  outTree->Branch("slc.FMatchPresent", &newFMatchPresent);
-  outTree->Branch("slc.FMatchLightPE", &newFMatchLightPE);
-  outTree->Branch("slc.FMatchScore", &newFMatchScore);
-  outTree->Branch("slc.pfp.trackLength", &newTrackLength);
-  outTree->Branch("slc.pfp.showerLength", &newShowerLength);
-  outTree->Branch("slc.pfp.trackBestPlane", &newTrackBestPlane);
-  outTree->Branch("slc.pfp.showerBestPlane", &newShowerBestPlane);
-  outTree->Branch("slc.pfp.trackDirY", &newTrackDirY);
-  outTree->Branch("slc.pfp.trackVtxX", &newTrackVtxX);
-  outTree->Branch("slc.pfp.trackVtxY", &newTrackVtxY);
-  outTree->Branch("slc.pfp.trackVtxZ", &newTrackVtxZ);
-  outTree->Branch("slc.pfp.trackNHit1", &newTrackNHit1);
-  outTree->Branch("slc.pfp.trackNHit2", &newTrackNHit2);
-  outTree->Branch("slc.pfp.trackNHit3", &newTrackNHit3);
-  outTree->Branch("nflash", &newNOpFlashes);
-  outTree->Branch("flash.timeWidth", &newFlashTimeWidth);
-  outTree->Branch("flash.timeSD", &newFlashTimeSD);
-  outTree->Branch("flash.PE", &newFlashTotalPE);
-  outTree->Branch("ncrthit", &newNCRTHits);
-  outTree->Branch("crt_hit.plane", &newCRTHitPlane);
-  outTree->Branch("crt_hit.PE", &newCRTHitPE);
-  outTree->Branch("crt_hit.err_x", &newCRTHitErrX);
-  outTree->Branch("crt_hit.err_y", &newCRTHitErrY);
-  outTree->Branch("crt_hit.err_z", &newCRTHitErrZ);
-  outTree->Branch("ncrt_track", &newNCRTTracks);
-  outTree->Branch("crt_track.time", &newCRTTrackTime);
-  outTree->Branch("ncrtpmt_match", &newNCRTPMTMatches);
-  outTree->Branch("crtpmt_match.nhit", &newNMatchedCRTPMTHits);
-  outTree->Branch("crtpmt_match.hit.timeDiff", &newMatchedCRTPMTimeDiff);
-  outTree->Branch("db.runinfo_exists", &dbRunInfoExists);
-  outTree->Branch("db.triggerdata_exists", &dbTriggerDataExists);
-  outTree->Branch("db.run", &dbRun);
-  outTree->Branch("db.start", &dbStart);
-  outTree->Branch("db.end", &dbEnd);
-  outTree->Branch("db.config", &dbConfig);
-  outTree->Branch("db.cathodeV", &dbCath);
-  outTree->Branch("db.EInd1V", &dbEInd1);
-  outTree->Branch("db.EInd2V", &dbEInd2);
-  outTree->Branch("db.ECollV", &dbEColl);
-  outTree->Branch("db.WInd1V", &dbWInd1);
-  outTree->Branch("db.WInd2V", &dbWInd2);
-  outTree->Branch("db.WCollV", &dbWColl);
-  outTree->Branch("db.NTPC", &dbNTPC);
-  outTree->Branch("db.NPMT", &dbNPMT);
-  outTree->Branch("db.NCRT", &dbNCRT);
-  outTree->Branch("db.event", &dbEventNumber);
-  outTree->Branch("db.trigSec", &dbTrigSec);
-  outTree->Branch("db.trigNanosec", &dbTrigNanosec);
-  outTree->Branch("db.gateType", &dbGateType);
-  outTree->Branch("db.trigSource", &dbTrigSource);
-
-
-  cout<<"Second loop over all entries."<<endl;
+  // events already written count as seen, so duplicates are caught across a resume
+  eventKeySet seenEvents;
+  if (resume && dedup)
+  {
+    unsigned int seenRun, seenSubrun, seenEvent;
+    TBranch* seenRunBranch = nullptr;
+    TBranch* seenSubrunBranch = nullptr;
+    TBranch* seenEventBranch = nullptr;
+    outTree->SetBranchAddress("run", &seenRun, &seenRunBranch);
+    outTree->SetBranchAddress("subrun", &seenSubrun, &seenSubrunBranch);
+    outTree->SetBranchAddress("event", &seenEvent, &seenEventBranch);
+    for (Long64_t outEntry = 0; outEntry < outTree->GetEntries(); ++outEntry)
+    {
+      seenRunBranch->GetEntry(outEntry);
+      seenSubrunBranch->GetEntry(outEntry);
+      seenEventBranch->GetEntry(outEntry);
+      seenEvents.insert(seenRun, seenSubrun, seenEvent);
+    }
+    outTree->ResetBranchAddresses();
+  }
+
+  // per-subrun exposure: what an earlier pass already saved, plus the records
+  // the first loop collects; the first loop runs ahead of the output, so a
+  // checkpoint saves only the records before its entry
+  std::unordered_map<uint64_t, std::pair<double, Long64_t>> savedExposure;
+  std::vector<exposureRecord> exposureRecords;
+  if (resume)
+  {
+    if (TTree* exposureTree = outFile->Get<TTree>("subrun_exposure"))
+    {
+      unsigned int exposureRun, exposureSubrun;
+      double exposurePOT;
+      Long64_t exposureGates;
+      exposureTree->SetBranchAddress("run", &exposureRun);
+      exposureTree->SetBranchAddress("subrun", &exposureSubrun);
+      exposureTree->SetBranchAddress("pot", &exposurePOT);
+      exposureTree->SetBranchAddress("gates", &exposureGates);
+      for (Long64_t exposureEntry = 0; exposureEntry < exposureTree->GetEntries(); ++exposureEntry)
+      {
+        exposureTree->GetEntry(exposureEntry);
+        savedExposure[(static_cast<uint64_t>(exposureRun) << 32) | exposureSubrun] = {exposurePOT, exposureGates};
+      }
+      delete exposureTree;
+    }
+  }
+  auto writeExposure = [&](Long64_t nextEntry)
+  {
+    std::unordered_map<uint64_t, std::pair<double, Long64_t>> exposure = savedExposure;
+    for (const auto& record : exposureRecords)
+    {
+      if (record.Entry >= nextEntry)
+        continue;
+      auto& subrunExposure = exposure[(static_cast<uint64_t>(record.Run) << 32) | record.Subrun];
+      subrunExposure.first += record.POT;
+      subrunExposure.second += record.Gates;
+    }
+    outFile->cd();
+    TTree* exposureTree = new TTree("subrun_exposure", "Exposure Per Subrun");
+    unsigned int exposureRun, exposureSubrun;
+    double exposurePOT;
+    Long64_t exposureGates;
+    exposureTree->Branch("run", &exposureRun);
+    exposureTree->Branch("subrun", &exposureSubrun);
+    exposureTree->Branch("pot", &exposurePOT);
+    exposureTree->Branch("gates", &exposureGates);
+    for (const auto& subrunExposure : exposure)
+    {
+      exposureRun = subrunExposure.first >> 32;
+      exposureSubrun = subrunExposure.first & 0xffffffff;
+      exposurePOT = subrunExposure.second.first;
+      exposureGates = subrunExposure.second.second;
+      exposureTree->Fill();
+    }
+    exposureTree->Write("", TObject::kOverwrite);
+    delete exposureTree;
+  };
+
+  // the output entry each input file's entries start at: -1 until the loop
+  // reaches the file, -2 for a resumed file whose start an older sidecar did
+  // not record
+  std::vector<Long64_t> chainFileFirstOut(chainFiles.size(), -1);
+  if (resume)
+  {
+    size_t ckptFileIdx = std::find(chainFiles.begin(), chainFiles.end(), ckpt.FileName) - chainFiles.begin();
+    chainFileFirstOut[ckptFileIdx] = (ckpt.FileOutEntry >= 0) ? ckpt.FileOutEntry : -2;
+  }
+
+  // record the next entry to process; call only right after an AutoSave
+  auto saveCheckpoint = [&](Long64_t nextEntry)
+  {
+    size_t fileIdx = (nextEntry < nChainEntries) ? chainFileOf(nextEntry) : chainFiles.size() - 1;
+    ckpt.FileName = chainFiles[fileIdx];
+    ckpt.Entry = nextEntry - chainFileOffset[fileIdx];
+    ckpt.OutEntries = outTree->GetEntries();
+    ckpt.FileOutEntry = (chainFileFirstOut[fileIdx] == -1) ? ckpt.OutEntries : std::max<Long64_t>(chainFileFirstOut[fileIdx], -1);
+    if (not ckpt.write(ckptName))
+      std::cerr << "Could not write checkpoint " << ckptName << std::endl;
+  };
+
+  // a file that fails mid-read is quarantined and the rest of its entries
+  // skipped; the entries it already wrote stay in the output, and the report
+  // says which they are
+  std::vector<bool> chainFileFailed(chainFiles.size(), false);
+  bool anyFileFailed = false;
+  auto failChainFile = [&](Long64_t evt) -> Long64_t
+  {
+    size_t fileIdx = chainFileOf(evt);
+    chainFileFailed[fileIdx] = true;
+    anyFileFailed = true;
+    Long64_t outEnd = outTree->GetEntries();
+    std::string outEntries;
+    if (chainFileFirstOut[fileIdx] < outEnd)
+      outEntries = ((chainFileFirstOut[fileIdx] >= 0) ? std::to_string(chainFileFirstOut[fileIdx]) : "")
+                 + ":" + std::to_string(outEnd);
+    quarantineFile(quarantineName, chainFiles[fileIdx],
+                   "read error at entry " + std::to_string(evt - chainFileOffset[fileIdx]), outEntries);
+    return chainFileOffset[fileIdx] + chainFileEntries[fileIdx] - 1;
+  };
+
+  // duplicate and preview bookkeeping
+  std::map<unsigned int, previewCounts> previewRunCounts;
+  std::map<size_t, Long64_t> fileDuplicates;
+  std::map<unsigned int, Long64_t> runDuplicates;
+  double nentries=lastEntry;
+
+  // our new branches, one buffer per DQ_SKIM_COLUMNS column (DB ones at
+  // their no-data values while the lookup below is switched off)
+  skimRecord out;
+
+  // a resumed tree already has its branches, so point them at our buffers
+  // instead; object branches want the address of a pointer that outlives the loop
+  std::deque<void*> resumeObjAddrs;
+  auto bindBranch = [&](const char* name, auto* buffer)
+  {
+    using bufferType = std::remove_pointer_t<decltype(buffer)>;
+    if (not resume)
+      outTree->Branch(name, buffer);
+    else if (std::is_arithmetic<bufferType>::value)
+      outTree->SetBranchAddress(name, static_cast<void*>(buffer));
+    else
+    {
+      resumeObjAddrs.push_back(buffer);
+      outTree->SetBranchAddress(name, static_cast<void*>(&resumeObjAddrs.back()));
+    }
+  };
+
+  // set up output branches for each column this skim writes, in its narrow
+  // form if it has one and the layout asks for it
+  out.forEachColumn([&](auto column, auto& buffer, auto& narrow)
+  {
+    using col = decltype(column);
+    if (not skimWrites(col::Group, passthrough, storeDerived))
+      return;
+    if constexpr (not std::is_same<typename col::Narrow, noNarrowForm>::value)
+      if (layout.NarrowInts)
+      {
+        bindBranch(col::Branch, &narrow);
+        return;
+      }
+    bindBranch(col::Branch, &buffer);
+  });
+  if (not resume)
+  {
+    if (layout.BasketSize > 0)
+      outTree->SetBasketSize("*", layout.BasketSize);
+    if (layout.Cluster != 0)
+      outTree->SetAutoFlush(layout.Cluster);
+  }
+
+
+  if (memBudgetBytes > 0)
+  {
+    srTree->SetCacheSize(std::min<Long64_t>(memBudgetBytes / 16, 30000000));
+    srTree->SetMaxVirtualSize(memBudgetBytes / 8);
+  }
+
+  // input buffers, bound once: the header and counts as scalars loaded a
+  // cluster at a time, the arrays as columns sized to the largest event seen
+  // so far (which the payload batch reads through, a column at a time)
+  unsigned int srbRun;
+  unsigned int srbSubrun;
+  unsigned int srbEvent;
+  bool srbFirstInSubrun;
+  float srbPOT;
+  unsigned int srbOffbeamGates;
+  int srbNSlices;
+  int srbNOpFlashes;
+  int srbNCRTHits;
+  int srbNCRTTracks;
+  int srbNCRTPMTMatches;
+  ULong64_t srbTriggerTime;
+  headerBatch srbHeader;
+  srbHeader.Bulk = not hasOption(opts, "nobulk");
+  auto batchRun = srbHeader.bind(srTree, "rec.hdr.run", &srbRun);
+  auto batchSubrun = srbHeader.bind(srTree, "rec.hdr.subrun", &srbSubrun);
+  auto batchEvent = srbHeader.bind(srTree, "rec.hdr.evt", &srbEvent);
+  srbHeader.bind(srTree, "rec.hdr.first_in_subrun", &srbFirstInSubrun);
+  srbHeader.bind(srTree, "rec.hdr.pot", &srbPOT);
+  srbHeader.bind(srTree, "rec.hdr.noffbeambnb", &srbOffbeamGates);
+  auto batchNSlices = srbHeader.bind(srTree, "rec.nslc", &srbNSlices);
+  auto batchNOpFlashes = srbHeader.bind(srTree, "rec.nopflashes", &srbNOpFlashes);
+  auto batchNCRTHits = srbHeader.bind(srTree, "rec.ncrt_hits", &srbNCRTHits);
+  auto batchNCRTTracks = srbHeader.bind(srTree, "rec.ncrt_tracks", &srbNCRTTracks);
+  auto batchNCRTPMTMatches = srbHeader.bind(srTree, "rec.ncrtpmt_matches", &srbNCRTPMTMatches);
+  // the trigger time (ns since the epoch) the time index and trending use;
+  // 0 where the CAF does not record it
+  if (srTree->GetBranch("rec.hdr.triggerinfo.global_trigger_time"))
+    srbHeader.bindOptional<ULong64_t>(srTree, "rec.hdr.triggerinfo.global_trigger_time", &srbTriggerTime, 0);
+  else
+  {
+    srbTriggerTime = 0;
+    std::cout << "The CAF header has no global trigger time, trigSec stays -1" << std::endl;
+  }
+  // (TPC)
+  inputColumn<ULong64_t> srbNPFPinSlice("rec.slc.reco.npfp");
+  inputColumn<Char_t> srbClearCosmic("rec.slc.is_clear_cosmic");
+  inputColumn<float> srbCRLongestTrackDirY("rec.slc.nuid.crlongtrkdiry");
+  inputColumn<float> srbTrackLength("rec.slc.reco.pfp.trk.len");
+  inputColumn<float> srbShowerLength("rec.slc.reco.pfp.shw.len");
+  inputColumn<caf::Plane_t> srbTrackBestPlane("rec.slc.reco.pfp.trk.bestplane");
+  inputColumn<int> srbShowerBestPlane("rec.slc.reco.pfp.shw.bestplane");
+  inputColumn<float> srbTrackDirY("rec.slc.reco.pfp.trk.dir.y");
+  inputColumn<float> srbTrackVtxX("rec.slc.reco.pfp.trk.start.x");
+  inputColumn<float> srbTrackVtxY("rec.slc.reco.pfp.trk.start.y");
+  inputColumn<float> srbTrackVtxZ("rec.slc.reco.pfp.trk.start.z");
+  inputColumn<int> srbTrackNHit1("rec.slc.reco.pfp.trk.calo.0.nhit");
+  inputColumn<int> srbTrackNHit2("rec.slc.reco.pfp.trk.calo.1.nhit");
+  inputColumn<int> srbTrackNHit3("rec.slc.reco.pfp.trk.calo.2.nhit");
+  // (PMT)
+  inputColumn<float> srbFlashTimeWidth("rec.opflashes.timewidth");
+  inputColumn<float> srbFlashTimeSD("rec.opflashes.timesd");
+  inputColumn<float> srbFlashTotalPE("rec.opflashes.totalpe");
+  // (CRT)
+  inputColumn<int> srbCRTHitPlane("rec.crt_hits.plane");
+  inputColumn<float> srbCRTHitPE("rec.crt_hits.pe");
+  inputColumn<float> srbCRTHitErrX("rec.crt_hits.position_err.x");
+  inputColumn<float> srbCRTHitErrY("rec.crt_hits.position_err.y");
+  inputColumn<float> srbCRTHitErrZ("rec.crt_hits.position_err.z");
+  inputColumn<float> srbCRTTrackTime("rec.crt_tracks.time");
+  inputColumn<int> srbNMatchedCRTPMTHits("rec.crtpmt_matches.matchedCRTHits..length");
+  inputColumn<double> srbMatchedCRTPMTimeDiff("rec.crtpmt_matches.matchedCRTHits.PMTTimeDiff");
+  // the payload of a header batch's entries, read a column at a time when
+  // the header batch moves on (nobulk reads each event's entry instead);
+  // passthrough columns are never decompressed here
+  payloadBatch srbPayload;
+  srbPayload.Counts[payloadBatch::kPerSlice] = &batchNSlices->values();
+  srbPayload.Counts[payloadBatch::kPerFlash] = &batchNOpFlashes->values();
+  srbPayload.Counts[payloadBatch::kPerCRTHit] = &batchNCRTHits->values();
+  srbPayload.Counts[payloadBatch::kPerCRTTrack] = &batchNCRTTracks->values();
+  srbPayload.Counts[payloadBatch::kPerMatch] = &batchNCRTPMTMatches->values();
+  srbPayload.NPFP = srbPayload.add(srbNPFPinSlice, payloadBatch::kPerSlice);
+  srbPayload.NMatchHits = srbPayload.add(srbNMatchedCRTPMTHits, payloadBatch::kPerMatch);
+  auto batchClearCosmic = srbPayload.add(srbClearCosmic, payloadBatch::kPerSlice);
+  auto batchCRLongestTrackDirY = srbPayload.add(srbCRLongestTrackDirY, payloadBatch::kPerSlice);
+  auto batchTrackLength = srbPayload.add(srbTrackLength, payloadBatch::kPerPFP);
+  auto batchShowerLength = srbPayload.add(srbShowerLength, payloadBatch::kPerPFP);
+  auto batchTrackBestPlane = srbPayload.add(srbTrackBestPlane, payloadBatch::kPerPFP);
+  auto batchShowerBestPlane = srbPayload.add(srbShowerBestPlane, payloadBatch::kPerPFP);
+  auto batchTrackDirY = srbPayload.add(srbTrackDirY, payloadBatch::kPerPFP);
+  auto batchTrackVtxX = srbPayload.add(srbTrackVtxX, payloadBatch::kPerPFP);
+  auto batchTrackVtxY = srbPayload.add(srbTrackVtxY, payloadBatch::kPerPFP);
+  auto batchTrackVtxZ = srbPayload.add(srbTrackVtxZ, payloadBatch::kPerPFP);
+  auto batchTrackNHit1 = srbPayload.add(srbTrackNHit1, payloadBatch::kPerPFP);
+  auto batchTrackNHit2 = srbPayload.add(srbTrackNHit2, payloadBatch::kPerPFP);
+  auto batchTrackNHit3 = srbPayload.add(srbTrackNHit3, payloadBatch::kPerPFP);
+  auto batchMatchedCRTPMTimeDiff = srbPayload.add(srbMatchedCRTPMTimeDiff, payloadBatch::kPerMatchHit);
+  payloadColumn<float>* batchFlashTimeWidth = nullptr;
+  payloadColumn<float>* batchFlashTimeSD = nullptr;
+  payloadColumn<float>* batchFlashTotalPE = nullptr;
+  payloadColumn<int>* batchCRTHitPlane = nullptr;
+  payloadColumn<float>* batchCRTHitPE = nullptr;
+  payloadColumn<float>* batchCRTHitErrX = nullptr;
+  payloadColumn<float>* batchCRTHitErrY = nullptr;
+  payloadColumn<float>* batchCRTHitErrZ = nullptr;
+  payloadColumn<float>* batchCRTTrackTime = nullptr;
+  if (not passthrough)
+  {
+    batchFlashTimeWidth = srbPayload.add(srbFlashTimeWidth, payloadBatch::kPerFlash);
+    batchFlashTimeSD = srbPayload.add(srbFlashTimeSD, payloadBatch::kPerFlash);
+    batchFlashTotalPE = srbPayload.add(srbFlashTotalPE, payloadBatch::kPerFlash);
+    batchCRTHitPlane = srbPayload.add(srbCRTHitPlane, payloadBatch::kPerCRTHit);
+    batchCRTHitPE = srbPayload.add(srbCRTHitPE, payloadBatch::kPerCRTHit);
+    batchCRTHitErrX = srbPayload.add(srbCRTHitErrX, payloadBatch::kPerCRTHit);
+    batchCRTHitErrY = srbPayload.add(srbCRTHitErrY, payloadBatch::kPerCRTHit);
+    batchCRTHitErrZ = srbPayload.add(srbCRTHitErrZ, payloadBatch::kPerCRTHit);
+    batchCRTTrackTime = srbPayload.add(srbCRTTrackTime, payloadBatch::kPerCRTTrack);
+  }
+  // which of the header batch's entries the loop below will write: the
+  // stateless forms of its filter and preview decisions (duplicates are
+  // still read, they are only known once reached)
+  std::vector<char> srbPayloadWant;
+  auto loadPayload = [&](Long64_t localFirst)
+  {
+    const std::vector<unsigned int>& runs = batchRun->values();
+    srbPayloadWant.assign(runs.size(), 0);
+    for (size_t idx = 0; idx < runs.size(); ++idx)
+      srbPayloadWant[idx] = filter.keepsRun(runs[idx]) && filter.keepsEvent(batchNSlices->values()[idx], -1)
+                          && (not preview.active()
+                              || preview.keep(runs[idx], batchSubrun->values()[idx], batchEvent->values()[idx]));
+    srbPayload.load(srTree, srbHeader.First, localFirst, srbPayloadWant);
+  };
+
+  // per-slice and per-match scratch, kept across entries
+  sliceFill slices;
+  slices.KeepWide = storeDerived;
+  matchFill matches;
+
+  cout<<"Loop over all entries."<<endl;
+  Long64_t nBudgetFlushes = 0;
   // loop over events
-  for (size_t evt = 0; evt < srTree->GetEntries(); ++evt)
-  {
-    if(evt%10000==0) cout<<"Entry "<<evt<< "/"<<nentries<<"\t "<<100.*evt/nentries<<"% done in first loop."<<endl;
-    // set up the vars
-    unsigned int srbRun;
-    srTree->SetBranchAddress("rec.hdr.run", &srbRun);
-    unsigned int srbSubrun;
-    srTree->SetBranchAddress("rec.hdr.subrun", &srbSubrun);
-    unsigned int srbEvent;
-    srTree->SetBranchAddress("rec.hdr.evt", &srbEvent);
-    int srbNSlices;
-    srTree->SetBranchAddress("rec.nslc", &srbNSlices);
-    std::unique_ptr<ULong64_t[]> srbNPFPinSlice = std::make_unique<ULong64_t[]>(sizeSliceArr[evt]);
-    srTree->SetBranchAddress("rec.slc.reco.npfp", srbNPFPinSlice.get());
-    std::unique_ptr<Char_t[]> srbClearCosmic = std::make_unique<Char_t[]>(sizeSliceArr[evt]);
-    srTree->SetBranchAddress("rec.slc.is_clear_cosmic", srbClearCosmic.get());
-    std::unique_ptr<float[]> srbCRLongestTrackDirY = std::make_unique<float[]>(sizeSliceArr[evt]);
-    srTree->SetBranchAddress("rec.slc.nuid.crlongtrkdiry", srbCRLongestTrackDirY.get());
-    std::string recoPFPStr = "rec.slc.reco.pfp";
-    std::unique_ptr<float[]> srbTrackLength = std::make_unique<float[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".trk.len").c_str(), srbTrackLength.get());
-    std::unique_ptr<float[]> srbShowerLength = std::make_unique<float[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".shw.len").c_str(), srbShowerLength.get());
-    std::unique_ptr<caf::Plane_t[]> srbTrackBestPlane = std::make_unique<caf::Plane_t[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".trk.bestplane").c_str(), srbTrackBestPlane.get());
-    std::unique_ptr<int[]> srbShowerBestPlane = std::make_unique<int[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".shw.bestplane").c_str(), srbShowerBestPlane.get());
-    std::unique_ptr<float[]> srbTrackDirY = std::make_unique<float[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".trk.dir.y").c_str(), srbTrackDirY.get());
-    std::unique_ptr<float[]> srbTrackVtxX = std::make_unique<float[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".trk.start.x").c_str(), srbTrackVtxX.get());
-    std::unique_ptr<float[]> srbTrackVtxY = std::make_unique<float[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".trk.start.y").c_str(), srbTrackVtxY.get());
-    std::unique_ptr<float[]> srbTrackVtxZ = std::make_unique<float[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".trk.start.z").c_str(), srbTrackVtxZ.get());
-    std::unique_ptr<int[]> srbTrackNHit1 = std::make_unique<int[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".trk.calo.0.nhit").c_str(), srbTrackNHit1.get());
-    std::unique_ptr<int[]> srbTrackNHit2 = std::make_unique<int[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".trk.calo.1.nhit").c_str(), srbTrackNHit2.get());
-    std::unique_ptr<int[]> srbTrackNHit3 = std::make_unique<int[]>(sizePFPArr[evt]);
-    srTree->SetBranchAddress((recoPFPStr+".trk.calo.2.nhit").c_str(), srbTrackNHit3.get());
-    int srbNOpFlashes;
-    srTree->SetBranchAddress("rec.nopflashes", &srbNOpFlashes);
-    std::unique_ptr<float[]> srbFlashTimeWidth = std::make_unique<float[]>(sizeOpFlashArr[evt]);
-    srTree->SetBranchAddress("rec.opflashes.timewidth", srbFlashTimeWidth.get());
-    std::unique_ptr<float[]> srbFlashTimeSD = std::make_unique<float[]>(sizeOpFlashArr[evt]);
-    srTree->SetBranchAddress("rec.opflashes.timesd", srbFlashTimeSD.get());
-    std::unique_ptr<float[]> srbFlashTotalPE = std::make_unique<float[]>(sizeOpFlashArr[evt]);
-    srTree->SetBranchAddress("rec.opflashes.totalpe", srbFlashTotalPE.get());
-    int srbNCRTHits;
-    srTree->SetBranchAddress("rec.ncrt_hits", &srbNCRTHits);
-    std::unique_ptr<int[]> srbCRTHitPlane = std::make_unique<int[]>(sizeCRTHitArr[evt]);
-    srTree->SetBranchAddress("rec.crt_hits.plane", srbCRTHitPlane.get());
-    std::unique_ptr<float[]> srbCRTHitPE = std::make_unique<float[]>(sizeCRTHitArr[evt]);
-    srTree->SetBranchAddress("rec.crt_hits.pe", srbCRTHitPE.get());
-    std::unique_ptr<float[]> srbCRTHitErrX = std::make_unique<float[]>(sizeCRTHitArr[evt]);
-    srTree->SetBranchAddress("rec.crt_hits.position_err.x", srbCRTHitErrX.get());
-    std::unique_ptr<float[]> srbCRTHitErrY = std::make_unique<float[]>(sizeCRTHitArr[evt]);
-    srTree->SetBranchAddress("rec.crt_hits.position_err.y", srbCRTHitErrY.get());
-    std::unique_ptr<float[]> srbCRTHitErrZ = std::make_unique<float[]>(sizeCRTHitArr[evt]);
-    srTree->SetBranchAddress("rec.crt_hits.position_err.z", srbCRTHitErrZ.get());
-    int srbNCRTTracks;
-    srTree->SetBranchAddress("rec.ncrt_tracks", &srbNCRTTracks);
-    std::unique_ptr<float[]> srbCRTTrackTime = std::make_unique<float[]>(sizeCRTTrackArr[evt]);
-    srTree->SetBranchAddress("rec.crt_tracks.time", srbCRTTrackTime.get());
-    int srbNCRTPMTMatches;
-    srTree->SetBranchAddress("rec.ncrtpmt_matches", &srbNCRTPMTMatches);
-    std::unique_ptr<int[]> srbNMatchedCRTPMTHits = std::make_unique<int[]>(sizeCRTPMTMatchArr[evt]);
-    srTree->SetBranchAddress("rec.crtpmt_matches.matchedCRTHits..length", srbNMatchedCRTPMTHits.get());
-    std::unique_ptr<double[]> srbMatchedCRTPMTimeDiff = std::make_unique<double[]>(sizeCRTPMTMatchHitArr[evt]);
-    srTree->SetBranchAddress("rec.crtpmt_matches.matchedCRTHits.PMTTimeDiff", srbMatchedCRTPMTimeDiff.get());
-
-    // get the entry
-    srTree->GetEntry(evt);
+  for (Long64_t evt = firstEntry; evt < lastEntry; ++evt)
+  {
+    if(evt%10000==0) cout<<"Entry "<<evt<< "/"<<nentries<<"\t "<<100.*(evt-rangeFirstEntry)/(lastEntry-rangeFirstEntry)<<"% done."<<endl;
+    // a passthrough skim cannot skip entries, so a bad file ends it
+    if (passthrough && anyFileFailed)
+      break;
+    // files that failed earlier are skipped wholesale
+    size_t chainFileIdx = chainFileOf(evt);
+    if (chainFileFailed[chainFileIdx])
+    {
+      evt = chainFileOffset[chainFileIdx] + chainFileEntries[chainFileIdx] - 1;
+      continue;
+    }
+    if (chainFileFirstOut[chainFileIdx] == -1)
+      chainFileFirstOut[chainFileIdx] = outTree->GetEntries();
+    // header and counts first, from their own branches, so dropped and
+    // unsampled events cost no payload read
+    Long64_t localEntry = srTree->LoadTree(evt);
+    if (localEntry < 0 || not srbHeader.read(srTree, evt, localEntry))
+    {
+      evt = failChainFile(evt);
+      continue;
+    }
+    if (srbHeader.Bulk && srbPayload.First != srbHeader.First)
+      loadPayload(localEntry);
+    // filtered runs and duplicates keep no exposure; empty events still
+    // count theirs
+    bool dropEvent = not filter.passRun(srbRun);
+    if (not dropEvent && dedup && not seenEvents.insert(srbRun, srbSubrun, srbEvent))
+    {
+      ++fileDuplicates[chainFileIdx];
+      ++runDuplicates[srbRun];
+      dropEvent = true;
+    }
+    // exposure counts whether or not a preview keeps the event
+    if (srbFirstInSubrun && not dropEvent)
+      exposureRecords.push_back({evt, srbRun, srbSubrun, srbPOT, srbOffbeamGates});
+    dropEvent = dropEvent || not filter.passEvent(srbNSlices, -1);
+    if (dropEvent)
+    {
+      if (not passthrough)
+        continue;
+      // a passthrough skim keeps it as an empty entry flagged dropped
+      srbNSlices = srbNOpFlashes = srbNCRTHits = srbNCRTTracks = srbNCRTPMTMatches = 0;
+    }
+    if (preview.active())
+    {
+      previewCounts& runCounts = previewRunCounts[srbRun];
+      ++runCounts.Total;
+      if (not preview.keep(srbRun, srbSubrun, srbEvent))
+        continue;
+      ++runCounts.Sampled;
+    }
+    eventInput in;
+    if (srbHeader.Bulk)
+    {
+      // from the payload batch, up to the first entry a column failed to read
+      size_t batchIdx = evt - srbPayload.First;
+      if (not dropEvent && batchIdx >= srbPayload.Good)
+      {
+        evt = failChainFile(evt);
+        continue;
+      }
+      in.Slices.NPFP = srbPayload.NPFP->at(batchIdx);
+      in.Slices.ClearCosmic = batchClearCosmic->at(batchIdx);
+      in.Slices.CRLongestTrackDirY = batchCRLongestTrackDirY->at(batchIdx);
+      in.Slices.TrackLength = batchTrackLength->at(batchIdx);
+      in.Slices.ShowerLength = batchShowerLength->at(batchIdx);
+      in.Slices.TrackBestPlane = batchTrackBestPlane->at(batchIdx);
+      in.Slices.ShowerBestPlane = batchShowerBestPlane->at(batchIdx);
+      in.Slices.TrackDirY = batchTrackDirY->at(batchIdx);
+      in.Slices.TrackVtxX = batchTrackVtxX->at(batchIdx);
+      in.Slices.TrackVtxY = batchTrackVtxY->at(batchIdx);
+      in.Slices.TrackVtxZ = batchTrackVtxZ->at(batchIdx);
+      in.Slices.TrackNHit1 = batchTrackNHit1->at(batchIdx);
+      in.Slices.TrackNHit2 = batchTrackNHit2->at(batchIdx);
+      in.Slices.TrackNHit3 = batchTrackNHit3->at(batchIdx);
+      in.NMatchedCRTPMTHits = srbPayload.NMatchHits->at(batchIdx);
+      in.MatchedCRTPMTimeDiff = batchMatchedCRTPMTimeDiff->at(batchIdx);
+      if (not passthrough)
+      {
+        in.FlashTimeWidth = batchFlashTimeWidth->at(batchIdx);
+        in.FlashTimeSD = batchFlashTimeSD->at(batchIdx);
+        in.FlashTotalPE = batchFlashTotalPE->at(batchIdx);
+        in.CRTHitPlane = batchCRTHitPlane->at(batchIdx);
+        in.CRTHitPE = batchCRTHitPE->at(batchIdx);
+        in.CRTHitErrX = batchCRTHitErrX->at(batchIdx);
+        in.CRTHitErrY = batchCRTHitErrY->at(batchIdx);
+        in.CRTHitErrZ = batchCRTHitErrZ->at(batchIdx);
+        in.CRTTrackTime = batchCRTTrackTime->at(batchIdx);
+      }
+    } else {
+      // the whole entry, through the column buffers: the per-slice pfp and
+      // per-match hit counts first, which size the rest
+      srbNPFPinSlice.fit(srTree, srbNSlices);
+      srbNMatchedCRTPMTHits.fit(srTree, srbNCRTPMTMatches);
+      // (an array read returns 0 bytes for an empty entry, only < 0 is an error)
+      if (not dropEvent
+          && (not srbNPFPinSlice.Branch || srbNPFPinSlice.Branch->GetEntry(localEntry) < 0
+              || not srbNMatchedCRTPMTHits.Branch || srbNMatchedCRTPMTHits.Branch->GetEntry(localEntry) < 0))
+      {
+        evt = failChainFile(evt);
+        continue;
+      }
+      size_t srbNPFP = 0;
+      for (int slc = 0; slc < srbNSlices; ++slc)
+        srbNPFP += srbNPFPinSlice[slc];
+      size_t srbNMatchHits = 0;
+      for (int match = 0; match < srbNCRTPMTMatches; ++match)
+        srbNMatchHits += srbNMatchedCRTPMTHits[match];
+      srbClearCosmic.fit(srTree, srbNSlices);
+      srbCRLongestTrackDirY.fit(srTree, srbNSlices);
+      srbTrackLength.fit(srTree, srbNPFP);
+      srbShowerLength.fit(srTree, srbNPFP);
+      srbTrackBestPlane.fit(srTree, srbNPFP);
+      srbShowerBestPlane.fit(srTree, srbNPFP);
+      srbTrackDirY.fit(srTree, srbNPFP);
+      srbTrackVtxX.fit(srTree, srbNPFP);
+      srbTrackVtxY.fit(srTree, srbNPFP);
+      srbTrackVtxZ.fit(srTree, srbNPFP);
+      srbTrackNHit1.fit(srTree, srbNPFP);
+      srbTrackNHit2.fit(srTree, srbNPFP);
+      srbTrackNHit3.fit(srTree, srbNPFP);
+      srbFlashTimeWidth.fit(srTree, srbNOpFlashes);
+      srbFlashTimeSD.fit(srTree, srbNOpFlashes);
+      srbFlashTotalPE.fit(srTree, srbNOpFlashes);
+      srbCRTHitPlane.fit(srTree, srbNCRTHits);
+      srbCRTHitPE.fit(srTree, srbNCRTHits);
+      srbCRTHitErrX.fit(srTree, srbNCRTHits);
+      srbCRTHitErrY.fit(srTree, srbNCRTHits);
+      srbCRTHitErrZ.fit(srTree, srbNCRTHits);
+      srbCRTTrackTime.fit(srTree, srbNCRTTracks);
+      srbMatchedCRTPMTimeDiff.fit(srTree, srbNMatchHits);
+      if (not dropEvent && srTree->GetEntry(evt) <= 0)
+      {
+        evt = failChainFile(evt);
+        continue;
+      }
+      in.Slices.NPFP = srbNPFPinSlice.Data.data();
+      in.Slices.ClearCosmic = srbClearCosmic.Data.data();
+      in.Slices.CRLongestTrackDirY = srbCRLongestTrackDirY.Data.data();
+      in.Slices.TrackLength = srbTrackLength.Data.data();
+      in.Slices.ShowerLength = srbShowerLength.Data.data();
+      in.Slices.TrackBestPlane = srbTrackBestPlane.Data.data();
+      in.Slices.ShowerBestPlane = srbShowerBestPlane.Data.data();
+      in.Slices.TrackDirY = srbTrackDirY.Data.data();
+      in.Slices.TrackVtxX = srbTrackVtxX.Data.data();
+      in.Slices.TrackVtxY = srbTrackVtxY.Data.data();
+      in.Slices.TrackVtxZ = srbTrackVtxZ.Data.data();
+      in.Slices.TrackNHit1 = srbTrackNHit1.Data.data();
+      in.Slices.TrackNHit2 = srbTrackNHit2.Data.data();
+      in.Slices.TrackNHit3 = srbTrackNHit3.Data.data();
+      in.FlashTimeWidth = srbFlashTimeWidth.Data.data();
+      in.FlashTimeSD = srbFlashTimeSD.Data.data();
+      in.FlashTotalPE = srbFlashTotalPE.Data.data();
+      in.CRTHitPlane = srbCRTHitPlane.Data.data();
+      in.CRTHitPE = srbCRTHitPE.Data.data();
+      in.CRTHitErrX = srbCRTHitErrX.Data.data();
+      in.CRTHitErrY = srbCRTHitErrY.Data.data();
+      in.CRTHitErrZ = srbCRTHitErrZ.Data.data();
+      in.CRTTrackTime = srbCRTTrackTime.Data.data();
+      in.NMatchedCRTPMTHits = srbNMatchedCRTPMTHits.Data.data();
+      in.MatchedCRTPMTimeDiff = srbMatchedCRTPMTimeDiff.Data.data();
+    }
+    in.Slices.NSlices = srbNSlices;
 
     // get info from DB
     //runInfo dbRunInfo(srbRun);
-    /*dbTriggerDataExists = true;
+    /*out.DBTriggerDataExists = true;
     std::string trgStmtStrFull = trgStmtStr + std::to_string(srbRun)
                                + " AND event_no=" + std::to_string(srbEvent) + "; ";
     std::unique_ptr<PGresult, PGResultDeleter> trgRes(PQexec(dbConnection.get() ,trgStmtStrFull.c_str()));
     if (PQresultStatus(trgRes.get()) != PGRES_TUPLES_OK)
     {
       std::cerr << "Statement '" << trgStmtStrFull << "' failed" << std::endl;
-      dbTriggerDataExists = false;
+      out.DBTriggerDataExists = false;
     } else {
       std::string queryMin = trgStmtStr + std::to_string(srbRun) + " ORDER BY seconds ASC LIMIT 1 ; ";
       std::string queryMax = trgStmtStr + std::to_string(srbRun) + " ORDER BY seconds DESC LIMIT 1 ; ";
       std::unique_ptr<PGresult, PGResultDeleter> secMin(PQexec(dbConnection.get() ,queryMin.c_str()));
       std::unique_ptr<PGresult, PGResultDeleter> secMax(PQexec(dbConnection.get() ,queryMax.c_str()));
-      dbStart = std::stol(PQgetvalue(secMin.get(), 0, 3));
-      dbEnd   = std::stol(PQgetvalue(secMax.get(), 0, 3));
-    }
-    dbRun              = (dbRunInfo.epicsExists) ? dbRunInfo.Run                              : -1;
-    dbStart            = (dbTriggerDataExists)   ? dbStart                                    : -1;
-    dbEnd              = (dbTriggerDataExists)   ? dbEnd                                      : -1;
-    dbConfig           = (dbRunInfo.confgExists) ? dbRunInfo.Config                           : "";
-    dbCath             = (dbRunInfo.epicsExists) ? dbRunInfo.Cath                             : 0;
-    dbEInd1            = (dbRunInfo.epicsExists) ? dbRunInfo.EInd1                            : 0;
-    dbEInd2            = (dbRunInfo.epicsExists) ? dbRunInfo.EInd2                            : 0;
-    dbEColl            = (dbRunInfo.epicsExists) ? dbRunInfo.EColl                            : 0;
-    dbWInd1            = (dbRunInfo.epicsExists) ? dbRunInfo.WInd1                            : 0;
-    dbWInd2            = (dbRunInfo.epicsExists) ? dbRunInfo.WInd2                            : 0;
-    dbWColl            = (dbRunInfo.epicsExists) ? dbRunInfo.WColl                            : 0;
-    dbNTPC             = (dbRunInfo.confgExists) ? dbRunInfo.NTPC                             : -1;
-    dbNPMT             = (dbRunInfo.confgExists) ? dbRunInfo.NPMT                             : -1;
-    dbNCRT             = (dbRunInfo.confgExists) ? dbRunInfo.NCRT                             : -1;
-    dbEventNumber      = (dbTriggerDataExists)   ? std::stol(PQgetvalue(trgRes.get(), 0,  2)) : -1;
-    dbTrigSec          = (dbTriggerDataExists)   ? std::stol(PQgetvalue(trgRes.get(), 0,  3)) : -1;
-    dbTrigNanosec      = (dbTriggerDataExists)   ? std::stol(PQgetvalue(trgRes.get(), 0,  4)) : -1;
-    dbGateType         = (dbTriggerDataExists)   ? std::stol(PQgetvalue(trgRes.get(), 0, 13)) : -1;
-    dbTrigSource       = (dbTriggerDataExists)   ? std::stol(PQgetvalue(trgRes.get(), 0, 20)) : -1;
+      out.DBStart = std::stol(PQgetvalue(secMin.get(), 0, 3));
+      out.DBEnd   = std::stol(PQgetvalue(secMax.get(), 0, 3));
+    }
+    out.DBRun              = (dbRunInfo.epicsExists)   ? dbRunInfo.Run                              : -1;
+    out.DBStart            = (out.DBTriggerDataExists) ? out.DBStart                                    : -1;
+    out.DBEnd              = (out.DBTriggerDataExists) ? out.DBEnd                                      : -1;
+    out.DBConfig           = (dbRunInfo.confgExists)   ? dbRunInfo.Config                           : "";
+    out.DBCathodeV         = (dbRunInfo.epicsExists)   ? dbRunInfo.Cath                             : 0;
+    out.DBEInd1V           = (dbRunInfo.epicsExists)   ? dbRunInfo.EInd1                            : 0;
+    out.DBEInd2V           = (dbRunInfo.epicsExists)   ? dbRunInfo.EInd2                            : 0;
+    out.DBECollV           = (dbRunInfo.epicsExists)   ? dbRunInfo.EColl                            : 0;
+    out.DBWInd1V           = (dbRunInfo.epicsExists)   ? dbRunInfo.WInd1                            : 0;
+    out.DBWInd2V           = (dbRunInfo.epicsExists)   ? dbRunInfo.WInd2                            : 0;
+    out.DBWCollV           = (dbRunInfo.epicsExists)   ? dbRunInfo.WColl                            : 0;
+    out.DBNTPC             = (dbRunInfo.confgExists)   ? dbRunInfo.NTPC                             : -1;
+    out.DBNPMT             = (dbRunInfo.confgExists)   ? dbRunInfo.NPMT                             : -1;
+    out.DBNCRT             = (dbRunInfo.confgExists)   ? dbRunInfo.NCRT                             : -1;
+    out.DBEvent            = (out.DBTriggerDataExists) ? std::stol(PQgetvalue(trgRes.get(), 0,  2)) : -1;
+    out.DBTrigSec          = (out.DBTriggerDataExists) ? std::stol(PQgetvalue(trgRes.get(), 0,  3)) : -1;
+    out.DBTrigNanosec      = (out.DBTriggerDataExists) ? std::stol(PQgetvalue(trgRes.get(), 0,  4)) : -1;
+    out.DBGateType         = (out.DBTriggerDataExists) ? std::stol(PQgetvalue(trgRes.get(), 0, 13)) : -1;
+    out.DBTrigSource       = (out.DBTriggerDataExists) ? std::stol(PQgetvalue(trgRes.get(), 0, 20)) : -1;
     if (debug)
       std::cout << "~~~From CSVs ~~~" << '\n'
-                << "   Run "                      << dbRun           << '\n'
-                << "   Started (global trigger) " << dbStart         << '\n'
-                << "   Ended (global trigger) "   << dbEnd           << '\n'
-                << "   Cathode at "               << dbCath  << " V" << '\n'
-                << "   East Ind1 Wire Bias at "   << dbEInd1 << " V" << '\n'
-                << "   East Ind2 Wire Bias at "   << dbEInd2 << " V" << '\n'
-                << "   East Coll Wire Bias at "   << dbEColl << " V" << '\n'
-                << "   West Ind1 Wire Bias at "   << dbWInd1 << " V" << '\n'
-                << "   West Ind2 Wire Bias at "   << dbWInd2 << " V" << '\n'
-                << "   West Coll Wire Bias at "   << dbWColl << " V" << '\n'
-                << "   Configuration "            << dbConfig        << '\n'
-                << "   TPC Components:  "         << dbNTPC          << '\n'
-                << "   PMT Components:  "         << dbNPMT          << '\n'
-                << "   CRT Components:  "         << dbNCRT          << '\n'
+                << "   Run "                      << out.DBRun           << '\n'
+                << "   Started (global trigger) " << out.DBStart         << '\n'
+                << "   Ended (global trigger) "   << out.DBEnd           << '\n'
+                << "   Cathode at "               << out.DBCathodeV  << " V" << '\n'
+                << "   East Ind1 Wire Bias at "   << out.DBEInd1V << " V" << '\n'
+                << "   East Ind2 Wire Bias at "   << out.DBEInd2V << " V" << '\n'
+                << "   East Coll Wire Bias at "   << out.DBECollV << " V" << '\n'
+                << "   West Ind1 Wire Bias at "   << out.DBWInd1V << " V" << '\n'
+                << "   West Ind2 Wire Bias at "   << out.DBWInd2V << " V" << '\n'
+                << "   West Coll Wire Bias at "   << out.DBWCollV << " V" << '\n'
+                << "   Configuration "            << out.DBConfig        << '\n'
+                << "   TPC Components:  "         << out.DBNTPC          << '\n'
+                << "   PMT Components:  "         << out.DBNPMT          << '\n'
+                << "   CRT Components:  "         << out.DBNCRT          << '\n'
                 << "~~~From DataBase using statement << " << trgStmtStrFull << "~~~" << '\n'
-                << "   Event "                    << dbEventNumber   << '\n'
-                << "   Seconds "                  << dbTrigSec       << '\n'
-                << "   Nanoseconds "              << dbTrigNanosec   << '\n'
-                << "   Gate Type "                << dbGateType      << '\n'
-                << "   Source "                   << dbTrigSource    << std::endl;
+                << "   Event "                    << out.DBEvent   << '\n'
+                << "   Seconds "                  << out.DBTrigSec       << '\n'
+                << "   Nanoseconds "              << out.DBTrigNanosec   << '\n'
+                << "   Gate Type "                << out.DBGateType      << '\n'
+                << "   Source "                   << out.DBTrigSource    << std::endl;
     */            
-    // set the event here
-    newRun = srbRun;
-    newSubrun = srbSubrun;
-    newEvent = srbEvent;
+    // set the event here, on emptied arrays
+    out.clear();
+    out.Run = srbRun;
+    out.Subrun = srbSubrun;
+    out.Event = srbEvent;
+    out.TrigSec = (srbTriggerTime > 0) ? static_cast<int>(srbTriggerTime / 1000000000ULL) : -1;
     // TPC
-    newNSlices = srbNSlices;
-    newNPFPinSlice.clear();
-    newClearCosmic.clear();
-    newCRLongestTrackDirY.clear();
-    newTrackLength.clear();
-    newShowerLength.clear();
-    newTrackBestPlane.clear();
-    newShowerBestPlane.clear();
-    newTrackDirY.clear();
-    newTrackVtxX.clear();
-    newTrackVtxY.clear();
-    newTrackVtxZ.clear();
-    newTrackNHit1.clear();
-    newTrackNHit2.clear();
-    newTrackNHit3.clear();
+    out.NSlices = srbNSlices;
     // PMT
-    newNOpFlashes = srbNOpFlashes;
-    newFlashTimeWidth.clear();
-    newFlashTimeSD.clear();
-    newFlashTotalPE.clear();
+    out.NFlashes = srbNOpFlashes;
     // CRT
-    newNCRTHits = srbNCRTHits;
-    newCRTHitPlane.clear();
-    newCRTHitPE.clear();
-    newCRTHitErrX.clear();
-    newCRTHitErrY.clear();
-    newCRTHitErrZ.clear();
-    newNCRTTracks = srbNCRTTracks;
-    newCRTTrackTime.clear();
-    newNCRTPMTMatches = srbNCRTPMTMatches;
-    newNMatchedCRTPMTHits.clear();
-    newMatchedCRTPMTimeDiff.clear();
+    out.NCRTHits = srbNCRTHits;
+    out.NCRTTracks = srbNCRTTracks;
+    out.NCRTPMTMatches = srbNCRTPMTMatches;
+    out.Dropped = dropEvent;
 
     // Fill TPC info
-    std::vector<float> tempTrackLength;
-    std::vector<float> tempShowerLength;
-    std::vector<int> tempTrackBestPlane;
-    std::vector<int> tempShowerBestPlane;
-    std::vector<float> tempTrackDirY;
-    std::vector<float> tempTrackVtxX;
-    std::vector<float> tempTrackVtxY;
-    std::vector<float> tempTrackVtxZ;
-    std::vector<int> tempTrackNHit1;
-    std::vector<int> tempTrackNHit2;
-    std::vector<int> tempTrackNHit3;
-    size_t srbSlicePFPIdx = 0;
-    for (size_t slc_idx = 0; slc_idx < srbNSlices; ++slc_idx)
-    {
-      newNPFPinSlice.emplace_back(srbNPFPinSlice[slc_idx]);
-      newClearCosmic.emplace_back(srbClearCosmic[slc_idx]);
-      if (debug) std::cout << "Add ClearCosmic " << srbClearCosmic[slc_idx] << std::endl;
-      newCRLongestTrackDirY.emplace_back(srbCRLongestTrackDirY[slc_idx]);
-      if (debug) std::cout << "Add CRLongestTrackDirY " << srbCRLongestTrackDirY[slc_idx] << std::endl;
-      tempTrackLength.clear();
-      tempShowerLength.clear();
-      tempTrackBestPlane.clear();
-      tempShowerBestPlane.clear();
-      tempTrackDirY.clear();
-      tempTrackVtxX.clear();
-      tempTrackVtxY.clear();
-      tempTrackVtxZ.clear();
-      tempTrackNHit1.clear();
-      tempTrackNHit2.clear();
-      tempTrackNHit3.clear();
-      for (size_t pfp_idx = 0; pfp_idx < srbNPFPinSlice[slc_idx]; ++pfp_idx)
-      {
-        tempTrackLength.emplace_back(srbTrackLength[srbSlicePFPIdx]);
-        tempShowerLength.emplace_back(srbShowerLength[srbSlicePFPIdx]);
-        tempTrackBestPlane.emplace_back(srbTrackBestPlane[srbSlicePFPIdx]);
-        tempShowerBestPlane.emplace_back(srbShowerBestPlane[srbSlicePFPIdx]);
-        tempTrackDirY.emplace_back(srbTrackDirY[srbSlicePFPIdx]);
-        tempTrackVtxX.emplace_back(srbTrackVtxX[srbSlicePFPIdx]);
-        tempTrackVtxY.emplace_back(srbTrackVtxY[srbSlicePFPIdx]);
-        tempTrackVtxZ.emplace_back(srbTrackVtxZ[srbSlicePFPIdx]);
-        tempTrackNHit1.emplace_back(srbTrackNHit1[srbSlicePFPIdx]);
-        tempTrackNHit2.emplace_back(srbTrackNHit2[srbSlicePFPIdx]);
-        tempTrackNHit3.emplace_back(srbTrackNHit3[srbSlicePFPIdx]);
-        ++srbSlicePFPIdx;
-      }
-      newTrackLength.emplace_back(tempTrackLength);
-      newShowerLength.emplace_back(tempShowerLength);
-      newTrackBestPlane.emplace_back(tempTrackBestPlane);
-      newShowerBestPlane.emplace_back(tempShowerBestPlane);
-      newTrackDirY.emplace_back(tempTrackDirY);
-      newTrackVtxX.emplace_back(tempTrackVtxX);
-      newTrackVtxY.emplace_back(tempTrackVtxY);
-      newTrackVtxZ.emplace_back(tempTrackVtxZ);
-      newTrackNHit1.emplace_back(tempTrackNHit1);
-      newTrackNHit2.emplace_back(tempTrackNHit2);
-      newTrackNHit3.emplace_back(tempTrackNHit3);
-    }
-    // Fill PMT info
-    for (size_t flsh_idx = 0; flsh_idx < srbNOpFlashes; ++flsh_idx)
-    {
-      newFlashTimeWidth.emplace_back(srbFlashTimeWidth[flsh_idx]);
-      newFlashTimeSD.emplace_back(srbFlashTimeSD[flsh_idx]);
-      newFlashTotalPE.emplace_back(srbFlashTotalPE[flsh_idx]);
+    slices.fill(out, in.Slices, layout, debug);
+    if (storeDerived)
+      out.Derived.derive(out.NPFP, out.ClearCosmic, out.CRLongestTrackDirY,
+                         out.TrackLength, out.ShowerLength, out.TrackBestPlane, out.ShowerBestPlane,
+                         out.TrackNHit1, out.TrackNHit2, out.TrackNHit3);
+    // Fill PMT info (a passthrough skim clones it instead, as the CRT hits and tracks)
+    for (size_t flsh_idx = 0; flsh_idx < srbNOpFlashes && not passthrough; ++flsh_idx)
+    {
+      out.FlashTimeWidth.emplace_back(truncateMantissa(in.FlashTimeWidth[flsh_idx], layout.FloatBits));
+      out.FlashTimeSD.emplace_back(truncateMantissa(in.FlashTimeSD[flsh_idx], layout.FloatBits));
+      out.FlashPE.emplace_back(truncateMantissa(in.FlashTotalPE[flsh_idx], layout.FloatBits));
     }
     // Fill CRT info
     // (hits)
-    for (size_t crt_hit_idx = 0; crt_hit_idx < srbNCRTHits; ++crt_hit_idx)
+    for (size_t crt_hit_idx = 0; crt_hit_idx < srbNCRTHits && not passthrough; ++crt_hit_idx)
     {  
-      newCRTHitPlane.emplace_back(srbCRTHitPlane[crt_hit_idx]);
-      newCRTHitPE.emplace_back(srbCRTHitPE[crt_hit_idx]);
-      newCRTHitErrX.emplace_back(srbCRTHitErrX[crt_hit_idx]);
-      newCRTHitErrY.emplace_back(srbCRTHitErrY[crt_hit_idx]);
-      newCRTHitErrZ.emplace_back(srbCRTHitErrZ[crt_hit_idx]);
+      if (layout.NarrowInts)
+        out.CRTHitPlaneNarrow.emplace_back(narrowValue<short>(in.CRTHitPlane[crt_hit_idx]));
+      else
+        out.CRTHitPlane.emplace_back(in.CRTHitPlane[crt_hit_idx]);
+      out.CRTHitPE.emplace_back(in.CRTHitPE[crt_hit_idx]);
+      out.CRTHitErrX.emplace_back(in.CRTHitErrX[crt_hit_idx]);
+      out.CRTHitErrY.emplace_back(in.CRTHitErrY[crt_hit_idx]);
+      out.CRTHitErrZ.emplace_back(in.CRTHitErrZ[crt_hit_idx]);
     }
     // (tracks)
-    for (size_t crt_trk_idx = 0; crt_trk_idx < srbNCRTTracks; ++crt_trk_idx)
+    for (size_t crt_trk_idx = 0; crt_trk_idx < srbNCRTTracks && not passthrough; ++crt_trk_idx)
     {
-      newCRTTrackTime.emplace_back(srbCRTTrackTime[crt_trk_idx]);
+      out.CRTTrackTime.emplace_back(in.CRTTrackTime[crt_trk_idx]);
     }
     // (matches)
-    std::vector<double> tempMatchedCRTPMTimeDiff;
-    size_t srbMatchHitIdx = 0;
-    for (size_t crt_mtch_idx = 0; crt_mtch_idx < srbNCRTPMTMatches; ++crt_mtch_idx)
-    {
-      newNMatchedCRTPMTHits.emplace_back(srbNMatchedCRTPMTHits[crt_mtch_idx]);
-      tempMatchedCRTPMTimeDiff.clear();
-      for (size_t crt_mtch_hit_idx = 0; crt_mtch_hit_idx < srbNMatchedCRTPMTHits[crt_mtch_idx]; ++crt_mtch_hit_idx)
-      {
-        tempMatchedCRTPMTimeDiff.emplace_back(srbMatchedCRTPMTimeDiff[srbMatchHitIdx]);
-        ++srbMatchHitIdx;
-      }
-      newMatchedCRTPMTimeDiff.emplace_back(tempMatchedCRTPMTimeDiff);
-    }
+    matches.fill(out, srbNCRTPMTMatches, in.NMatchedCRTPMTHits, in.MatchedCRTPMTimeDiff);
 
     // fill new TTree
     outTree->Fill();
 
-    // we have to reset the branch addresses before we clean up
+    // near the budget, write out the baskets we hold and drop the input ones
+    if (memBudgetMB > 0 && (evt + 1 - firstEntry) % 1000 == 0 && residentMB() > 0.9 * memBudgetMB)
+    {
+      outTree->FlushBaskets();
+      if (srTree->GetTree())
+        srTree->GetTree()->DropBaskets();
+      ++nBudgetFlushes;
+    }
+
+    if (checkpointEvery > 0 && (evt + 1 - firstEntry) % checkpointEvery == 0)
+    {
+      writeExposure(evt + 1);
+      outTree->AutoSave("SaveSelf");
+      saveCheckpoint(evt + 1);
+    }
+  }
+
+  if (passthrough && anyFileFailed)
+  {
+    std::cout << "A passthrough skim cannot skip the rest of a bad file; rerun without the quarantined files"
+              << " in " << quarantineName << " or without passthrough. Bail." << std::endl;
+    delete srTree;
+    return;
+  }
+
+  // duplicate report: which files repeated events, and which runs they hit
+  if (not fileDuplicates.empty())
+  {
+    Long64_t nDuplicates = 0;
+    std::ofstream duplicatesReport(duplicatesName, std::ios::app);
+    for (const auto& fileCount : fileDuplicates)
+    {
+      duplicatesReport << "file\t" << chainFiles[fileCount.first] << '\t' << fileCount.second << '\n';
+      nDuplicates += fileCount.second;
+    }
+    for (const auto& runCount : runDuplicates)
+      duplicatesReport << "run\t" << runCount.first << '\t' << runCount.second << '\n';
+    std::cout << "Dropped " << nDuplicates << " duplicate events, see " << duplicatesName << std::endl;
+  }
+  if (filter.active())
+    filter.report(std::cout);
+
+  // per-run totals behind a preview, owned by outFile
+  if (preview.active())
+  {
+    outFile->cd();
+    TTree* previewTree = new TTree("preview_runs", "Preview Sampling Per Run");
+    unsigned int previewRun;
+    Long64_t previewTotal;
+    Long64_t previewSampled;
+    double previewFraction = preview.Fraction;
+    previewTree->Branch("run", &previewRun);
+    previewTree->Branch("nEvents", &previewTotal);
+    previewTree->Branch("nSampled", &previewSampled);
+    previewTree->Branch("fraction", &previewFraction);
+    for (const auto& runCounts : previewRunCounts)
+    {
+      previewRun = runCounts.first;
+      previewTotal = runCounts.second.Total;
+      previewSampled = runCounts.second.Sampled;
+      previewTree->Fill();
+    }
+  }
+
+  // time -> entry index, sorted by trigger time, so the hist stage can pick
+  // out a time window without reading the rest; rebuilt from the output tree
+  // so it also covers entries written before a resume
+  writeTimeIndex(scanTimeIndex(outTree.get()), outFile.get());
+
+  // the passthrough columns: the compressed baskets of every input entry,
+  // copied as they are; an entry range does not end on basket boundaries, so
+  // its entries are copied one by one (only the passthrough branches are read)
+  if (passthrough)
+  {
     srTree->ResetBranchAddresses();
+    srTree->SetBranchStatus("*", 0);
+    for (const auto& branch : kPassthroughBranches)
+    {
+      srTree->SetBranchStatus(branch.CAFCount, 1);
+      srTree->SetBranchStatus(branch.CAFName, 1);
+    }
+    outFile->cd();
+    outFile->Delete("passthrough_tree;*");
+    TTree* passthroughTree = nullptr;
+    if (rangeFirstEntry == 0 && lastEntry == nChainEntries)
+    {
+      passthroughTree = srTree->CloneTree(-1, "fast");
+    } else if ((passthroughTree = srTree->CloneTree(0))) {
+      for (Long64_t entry = rangeFirstEntry; entry < lastEntry; ++entry)
+        if (srTree->GetEntry(entry) > 0)
+          passthroughTree->Fill();
+    }
+    if (not passthroughTree || passthroughTree->GetEntries() != outTree->GetEntries())
+    {
+      std::cout << "Passthrough tree has " << ((passthroughTree) ? passthroughTree->GetEntries() : 0)
+                << " entries for " << outTree->GetEntries() << " in the output. Bail." << std::endl;
+      delete srTree;
+      return;
+    }
+    passthroughTree->SetName("passthrough_tree");
+    passthroughTree->Write("", TObject::kOverwrite);
+    delete passthroughTree;
   }
 
   if (debug)
     std::cout << "...writing..." << std::endl;
-  outFile->Write();
+  writeExposure(lastEntry);
+  outFile->Write("", TObject::kOverwrite);
+  // a finished job leaves a checkpoint at the end, so resuming it is a no-op
+  saveCheckpoint(lastEntry);
   if (debug)
     outTree->Print();
   if (debug)
     std::cout << "...release ptrs owned by TFiles..." << std::endl;
   //srTree->release();
+  srTree->ResetBranchAddresses();
   delete srTree;
   outTree.release();
   if (debug)
     std::cout << "...closing..." << std::endl;
   //if(srFile) srFile->Close();
   outFile->Close();
+  double peakMB = peakResidentMB();
+  std::cout << "Peak RSS " << peakMB << " MB";
+  if (memBudgetMB > 0)
+    std::cout << " (budget " << memBudgetMB << " MB, " << nBudgetFlushes << " early flushes)";
+  std::cout << std::endl;
+  if (memBudgetMB > 0 && peakMB > memBudgetMB)
+    std::cerr << "Warning: peak RSS " << peakMB << " MB went over the " << memBudgetMB << " MB budget" << std::endl;
   if (debug)
     std::cout << "...done!" << std::endl;
 }
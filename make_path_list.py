@@ -1,100 +1,219 @@
-import samweb_client
-import os,sys
+import argparse
+import json
+import os
+import sys
+import threading
+import time
+from concurrent.futures import FIRST_COMPLETED, ThreadPoolExecutor, wait
 
 
 # Define data_dict, a dict of SAM web queries with your choice of keys (will be used in the output file name)
 data_dict = { #"rolling": "defname: data_MCP2025B_02_DevSample_1e20_bnblight_v10_06_00_02_flatcaf_sbnd and run_number >= 18250 and run_number < 18592 and sbnd.random < 0.02",
               "offbeamlightfull": "defname: data_MCP2025B_02_InTimeCosmics_offbeamlight_v10_06_00_02_flatcaf_sbnd and run_number >= 18250 and run_number < 18592"} # and sbnd.random < 0.02" }
-#"initial": "file_type data and data_tier raw and data_stream bnblight and (run_number 18255 or (run_number 18259 and sbnd.random < 0.74))", 
+#"initial": "file_type data and data_tier raw and data_stream bnblight and (run_number 18255 or (run_number 18259 and sbnd.random < 0.74))",
               #"rolling": "defname: data_MCP2025B_02_DevSample_1e20_bnblight_v10_06_00_02_flatcaf_sbnd and ((run_number >= 18250 and run_number != 18255 and run_number != 18259 and run_number < 18592 and sbnd.random < 0.007) or (run_number 18259 and sbnd.random >= 0.74 and sbnd.random < 0.7439))"}
 #,               "test": "file_type data and data_tier raw and data_stream bnblight and run_number 18255 and sbnd.random < 0.017" }
 
-# Initialize connection to SAMWeb client
-samweb = samweb_client.SAMWebClient(experiment='sbnd')
-print("Initialized connection to SAMWeb client")
 
-# Loop over datasets
-for key in data_dict:
+class ResolveError(Exception):
+    pass
 
-    print("Doing dataset: ", key)
 
-    # Get list of files in the dataset
-    try:
-        file_list = samweb.listFiles(data_dict[key])
-    #except samweb_client._exceptions.DefinitionNotFound:
-    #    print "Definition not found in SAM. Definition: ", dataset
-    #    print "Exiting..."
-    #    sys.exit(1)
-    except:
-        print("SAM query failed. Query: ", data_dict[key])
-    # Additional error handling
-    if not file_list:
-        print("Getting file list failed. Dataset ", key, " with query: ", data_dict[key])
-        print("Exiting...")
-        sys.exit(2)
+class TransientResolveError(ResolveError):
+    # SAM itself failed (timeout, server error) rather than answering that
+    # the file has no location; worth asking again
+    pass
 
-    # Declare path list to fill
-    path_list = []
-    url_list = []
 
-    # Loop over files in the dataset
-    for f in file_list:
+def default_client():
+    # SAMWeb client for this thread; the client keeps a session, so each
+    # resolver thread gets its own
+    import samweb_client
+    local = default_client.local
+    if not hasattr(local, 'client'):
+        local.client = samweb_client.SAMWebClient(experiment='sbnd')
+    return local.client
+default_client.local = threading.local()
 
-        # Clear location, path variables
-        location_out = []
-        file_path = ''
 
-        # Locate the file
+def resolve_file(client, f, want_path):
+    # One file: its xrootd URL, or with want_path its full path (one SAM
+    # round-trip either way)
+    if want_path:
         try:
-            location_out = samweb.locateFile(f)
-        except samweb_client._exceptions.FileNotFound:
-            print("File not found in SAM. File: ", f)
-            print("Exiting...")
-            sys.ext(3)
-        # Additional error handling
-        if not location_out:
-            print("Getting file location failed. File: ", f)
-            print("Exiting...")
-            sys.exit(4)
-
-        # Extract the file's path
-        #print(location_out)
-        if 'full_path' in location_out[0]:
-            path = location_out[0]['full_path'].split(':')[1]
-        # Error handling
-        else:
-            print("File does not have a path in SAM. File: ", f)
-            print("Exiting...")
-            sys.exit(5)
-        # Addtional error handling
+            location_out = client.locateFile(f)
+        except Exception as err:
+            raise TransientResolveError("file not found in SAM ({})".format(err))
+        if not location_out or 'full_path' not in location_out[0]:
+            raise ResolveError("file does not have a path in SAM")
+        path = location_out[0]['full_path'].split(':')[1]
         if not path:
-            print("Getting file path failed. File: ", f)
-            print("Exiting...")
-            sys.exit(6)
-
-        # Add file with its path to the list
-        path_list.append(os.path.join(path, f))
+            raise ResolveError("getting file path failed")
+        return os.path.join(path, f)
+    try:
+        urls = client.getFileAccessUrls(f, 'root')
+    except Exception as err:
+        raise TransientResolveError("file does not have a xrootd URL in SAM ({})".format(err))
+    if not urls:
+        raise ResolveError("file does not have a xrootd URL in SAM")
+    return urls[0]
+
+
+class ResolveCache:
+    # Resolved locations on disk, keyed by file name, so a rerun only asks
+    # SAM about files it has not seen; saved by write-and-rename. Each
+    # location carries the time it was resolved: entries older than max_age
+    # seconds (None: never expire) are resolved again, and refresh ignores
+    # the stored entries altogether (they are still overwritten).
+    def __init__(self, name, max_age=None, refresh=False):
+        self.name = name
+        self.entries = {}
+        self.dirty = 0
+        self.max_age = max_age
+        self.refresh = refresh
+        if name and os.path.exists(name):
+            try:
+                with open(name) as f:
+                    self.entries = json.load(f)
+            except ValueError:
+                print("Ignoring unreadable resolver cache", name)
+
+    def get(self, kind, f):
+        if self.refresh:
+            return None
+        entry = self.entries.get(f, {})
+        # caches written before entries had times count as expired
+        if self.max_age is not None and time.time() - entry.get(kind + '_time', 0) > self.max_age:
+            return None
+        return entry.get(kind)
+
+    def put(self, kind, f, location):
+        entry = self.entries.setdefault(f, {})
+        entry[kind] = location
+        entry[kind + '_time'] = time.time()
+        self.dirty += 1
+        if self.dirty >= 500:
+            self.save()
+
+    def save(self):
+        if not self.name or not self.dirty:
+            return
+        with open(self.name + '.tmp', 'w') as f:
+            json.dump(self.entries, f)
+        os.replace(self.name + '.tmp', self.name)
+        self.dirty = 0
+
+
+def resolve_files(file_list, cache, want_path=False, window=64, jobs=16, client=default_client,
+                  retries=2, retry_wait=1.):
+    # Resolve every file with at most window lookups in flight; returns the
+    # locations in file_list order (None where it failed) and the failures.
+    # client is called in the worker thread to get the SAM client, so a
+    # stand-in can replace SAM entirely. A lookup SAM fails on is tried up
+    # to retries more times, retry_wait seconds apart (doubling).
+    kind = 'path' if want_path else 'root'
+    locations = [cache.get(kind, f) for f in file_list]
+    todo = [idx for idx, location in enumerate(locations) if location is None]
+    failures = {}
+    print("Resolving", len(todo), "of", len(file_list), "files,", len(file_list) - len(todo), "cached")
+
+    def lookup(idx):
+        wait_time = retry_wait
+        for attempt in range(retries + 1):
+            try:
+                return resolve_file(client(), file_list[idx], want_path)
+            except TransientResolveError:
+                if attempt == retries:
+                    raise
+            time.sleep(wait_time)
+            wait_time *= 2
+
+    with ThreadPoolExecutor(max_workers=jobs) as pool:
+        pending = {}
+        next_idx = 0
+        done_count = 0
+        while next_idx < len(todo) or pending:
+            while next_idx < len(todo) and len(pending) < window:
+                pending[pool.submit(lookup, todo[next_idx])] = todo[next_idx]
+                next_idx += 1
+            done, _ = wait(pending, return_when=FIRST_COMPLETED)
+            for future in done:
+                idx = pending.pop(future)
+                try:
+                    locations[idx] = future.result()
+                    cache.put(kind, file_list[idx], locations[idx])
+                except ResolveError as err:
+                    failures[file_list[idx]] = str(err)
+                done_count += 1
+                if done_count % 1000 == 0:
+                    print("Resolved", done_count, "/", len(todo))
+    cache.save()
+    return locations, failures
+
+
+def resolve_dataset(query, output_file, cache_name=None, want_path=False, window=64, jobs=16, client=default_client,
+                    max_age=None, refresh=False, retries=2):
+    # List a SAM query and write the .txt list makeTTree_db_postgre reads;
+    # files that could not be resolved go to <output_file>.failed.txt and are
+    # left out. Returns False if nothing could be written.
+    try:
+        file_list = client().listFiles(query)
+    except Exception as err:
+        print("SAM query failed. Query: ", query, "(", err, ")")
+        return False
+    if not file_list:
+        print("Getting file list failed for query: ", query)
+        return False
 
-        # Better yet, extract the file's xrootd URL
-        try:
-            url = samweb.getFileAccessUrls(f, 'root')[0]
-        except:
-            print("File does not have a xrootd URL in SAM. File: ", f)
-            print("Exiting...")
-            sys.exit(7)
-        
-        # Add URL to the list
-        url_list.append(url)
-
-
-    # Declare the output file to write out to
-    output_file = 'file_list_' + key + '.txt'
-    # Write the contents of path_list to that file
+    cache = ResolveCache(cache_name, max_age, refresh)
+    locations, failures = resolve_files(file_list, cache, want_path, window, jobs, client, retries)
     with open(output_file, 'w') as f:
-        #for path in path_list:
-        for path in url_list:
-            f.write('{}\n'.format(path))
-        
+        for location in locations:
+            if location is not None:
+                f.write('{}\n'.format(location))
+    failed_name = output_file + '.failed.txt'
+    if failures:
+        with open(failed_name, 'w') as f:
+            for name, reason in failures.items():
+                f.write('{}\t{}\n'.format(name, reason))
+        print(len(failures), "files could not be resolved, see", failed_name)
+    elif os.path.exists(failed_name):
+        os.remove(failed_name)
     print("Wrote output file list: ", output_file)
+    return True
+
+
+def cache_age(days):
+    # --cache-days in the seconds ResolveCache takes; 0 or less never expires
+    return days * 86400 if days > 0 else None
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Resolve SAM queries into the .txt file lists makeTTree_db_postgre reads')
+    parser.add_argument('--query', action='append', default=[], metavar='KEY=QUERY',
+                        help='resolve this query into file_list_KEY.txt instead of data_dict (repeatable)')
+    parser.add_argument('--paths', action='store_true', help='write full paths instead of xrootd URLs')
+    parser.add_argument('--cache', default='resolved_files.json', help='on-disk cache of resolved locations ("" to disable)')
+    parser.add_argument('--cache-days', type=float, default=30,
+                        help='re-resolve cached locations older than this many days (0: never expire)')
+    parser.add_argument('--refresh', action='store_true', help='ignore the cached locations and resolve every file again')
+    parser.add_argument('--retries', type=int, default=2, help='extra attempts for a lookup SAM fails on')
+    parser.add_argument('--window', type=int, default=64, help='SAM lookups in flight at once')
+    parser.add_argument('-j', '--jobs', type=int, default=16, help='resolver threads')
+    args = parser.parse_args()
+
+    datasets = dict(q.split('=', 1) for q in args.query) if args.query else data_dict
+    ok = True
+    # Loop over datasets
+    for key in datasets:
+        print("Doing dataset: ", key)
+        ok = resolve_dataset(datasets[key], 'file_list_' + key + '.txt', args.cache or None,
+                             args.paths, args.window, args.jobs, max_age=cache_age(args.cache_days),
+                             refresh=args.refresh, retries=args.retries) and ok
+    if not ok:
+        sys.exit(2)
+    print("Done!")
+
 
-print("Done!")
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,81 @@
+// root includes
+#include "TFile.h"
+#include "TFileMerger.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+// std incldes
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// local includes
+#include "dqSchema.h"
+
+// Merge skim or hist outputs into one file. TTrees (data_validation_tree and
+// any side trees) are fast-cloned basket by basket without decompressing,
+// histograms and other objects are combined with their Merge method.
+// A skim's time_index holds entry numbers of its own tree, so the merged one
+// is rebuilt from the merged data_validation_tree rather than joined.
+// inFileNames is either a .txt list (one file per line) or comma separated.
+void mergeOutputs(std::string outFileName, std::string inFileNames, bool debug = false)
+{
+  std::vector<std::string> inFiles;
+  if (inFileNames.find(".txt") != std::string::npos)
+  {
+    std::ifstream inFileList(inFileNames);
+    std::string inFile;
+    while (std::getline(inFileList, inFile))
+      if (not inFile.empty())
+        inFiles.push_back(inFile);
+  } else {
+    std::stringstream inFileStrm(inFileNames);
+    std::string inFile;
+    while (std::getline(inFileStrm, inFile, ','))
+      if (not inFile.empty())
+        inFiles.push_back(inFile);
+  }
+  if (inFiles.empty())
+  {
+    std::cout << "Nothing to merge. Bail." << std::endl;
+    return;
+  }
+
+  TFileMerger merger(false, false);
+  merger.SetFastMethod(true);
+  if (not merger.OutputFile(outFileName.c_str(), "RECREATE"))
+  {
+    std::cout << "Could not open output " << outFileName << ". Bail." << std::endl;
+    return;
+  }
+  // never leave a partial output behind, the driver takes existence as success
+  for (const auto& inFile : inFiles)
+  {
+    if (debug) std::cout << "Adding " << inFile << std::endl;
+    if (not merger.AddFile(inFile.c_str(), false))
+    {
+      std::cout << "Could not add " << inFile << ". Bail." << std::endl;
+      gSystem->Unlink(outFileName.c_str());
+      return;
+    }
+  }
+  if (not merger.Merge())
+  {
+    std::cout << "Merge into " << outFileName << " failed." << std::endl;
+    gSystem->Unlink(outFileName.c_str());
+    return;
+  }
+  {
+    std::unique_ptr<TFile> mergedFile(TFile::Open(outFileName.c_str(), "UPDATE"));
+    TTree* mergedTree = (mergedFile) ? mergedFile->Get<TTree>("data_validation_tree") : nullptr;
+    if (mergedTree && mergedFile->Get<TTree>("time_index"))
+    {
+      writeTimeIndex(scanTimeIndex(mergedTree), mergedFile.get());
+      if (debug) std::cout << "Rebuilt time_index of " << outFileName << std::endl;
+    }
+  }
+  if (debug) std::cout << "Merged " << inFiles.size() << " files into " << outFileName << std::endl;
+}
@@ -0,0 +1,324 @@
+import argparse
+import bisect
+import heapq
+import json
+import os
+import shutil
+import subprocess
+import sys
+from concurrent.futures import ThreadPoolExecutor
+
+
+# Split a .txt file list into N shards, run makeTTree_db_postgre and
+# makeHists_db_postgre on each shard as separate local processes, then merge
+# the shard outputs with a parallel tree reduction (mergeOutputs.cc).
+#
+# The shard manifest (shards.json plus one shard_NNN.txt list per shard) is
+# written before anything runs, so the same shards can be submitted as grid
+# jobs with
+#     python run_shards.py --manifest <workdir>/shards.json --shard K
+# and merged afterwards with
+#     python run_shards.py --manifest <workdir>/shards.json --merge-only
+# With --sam QUERY the file list is resolved from SAM first (make_path_list.py)
+# into <workdir>/file_list.txt.
+#
+# A single .root file instead of a list is split by recTree entry range on
+# its cluster boundaries (makeTTree_db_postgre option entries=A:B), so one big
+# merged CAF file is skimmed on every core; the shards merge back in entry order.
+
+macro_dir = os.path.dirname(os.path.abspath(__file__))
+
+
+def root_call(macro, *args):
+    # Format a ROOT macro call, e.g. makeTTree_db_postgre.cc("a.txt","b.root",false,"")
+    def fmt(arg):
+        if isinstance(arg, bool):
+            return 'true' if arg else 'false'
+        if isinstance(arg, str):
+            return '"{}"'.format(arg)
+        return str(arg)
+    return ['root', '-l', '-b', '-q', '{}({})'.format(os.path.join(macro_dir, macro), ','.join(fmt(a) for a in args))]
+
+
+def run(cmd, log_name):
+    # Run one worker process, logging to a file; success means exit code 0
+    with open(log_name, 'w') as log:
+        return subprocess.call(cmd, stdout=log, stderr=subprocess.STDOUT) == 0
+
+
+def file_size(path):
+    # Size of a local file or an xrootd URL (via xrdfs), None if unknown
+    if not path.startswith('root://'):
+        try:
+            return os.path.getsize(path)
+        except OSError:
+            return None
+    server, _, remote = path[len('root://'):].partition('/')
+    try:
+        out = subprocess.run(['xrdfs', server, 'stat', '/' + remote.lstrip('/')],
+                             capture_output=True, text=True, timeout=60).stdout
+    except (OSError, subprocess.TimeoutExpired):
+        return None
+    for line in out.splitlines():
+        if line.strip().startswith('Size:'):
+            return int(line.split()[1])
+    return None
+
+
+def entry_count(path):
+    # Entries in recTree, via PyROOT, None if unknown
+    try:
+        import ROOT
+    except ImportError:
+        return None
+    f = ROOT.TFile.Open(path, 'READ')
+    if not f or f.IsZombie():
+        return None
+    tree = f.Get('recTree')
+    n = tree.GetEntries() if tree else None
+    f.Close()
+    return n
+
+
+def make_shards(files, n_shards, balance, n_jobs):
+    # Weigh each file, then greedily hand the heaviest remaining file to the
+    # lightest shard (longest-processing-time first); each shard keeps the
+    # input order of its files
+    if balance == 'count':
+        weights = [1] * len(files)
+    else:
+        measure = file_size if balance == 'size' else entry_count
+        with ThreadPoolExecutor(max_workers=n_jobs * 4) as pool:
+            weights = list(pool.map(measure, files))
+        known = [w for w in weights if w]
+        if len(known) < len(weights):
+            print("Could not get the", balance, "of", len(weights) - len(known), "files, using the mean for those")
+        fallback = sum(known) / len(known) if known else 1
+        weights = [w if w else fallback for w in weights]
+
+    loads = [(0, shard) for shard in range(n_shards)]
+    heapq.heapify(loads)
+    members = [[] for _ in range(n_shards)]
+    for idx in sorted(range(len(files)), key=lambda i: -weights[i]):
+        load, shard = heapq.heappop(loads)
+        members[shard].append(idx)
+        heapq.heappush(loads, (load + weights[idx], shard))
+    return [([files[i] for i in sorted(m)], sum(weights[i] for i in m)) for m in members if m]
+
+
+def cluster_starts(path):
+    # First entry of every recTree cluster, and the entry count, via PyROOT
+    import ROOT
+    f = ROOT.TFile.Open(path, 'READ')
+    if not f or f.IsZombie() or not f.Get('recTree'):
+        return None, None
+    tree = f.Get('recTree')
+    n_entries = tree.GetEntries()
+    starts = []
+    clusters = tree.GetClusterIterator(0)
+    start = clusters.Next()
+    while start < n_entries:
+        starts.append(start)
+        start = clusters.Next()
+    f.Close()
+    return starts, n_entries
+
+
+def make_ranges(starts, n_entries, n_shards):
+    # Cut [0, n_entries) into n_shards nearly equal entry ranges, each cut
+    # moved to the nearest cluster start so no basket is read by two shards
+    cuts = [0]
+    for shard in range(1, n_shards):
+        target = shard * n_entries // n_shards
+        idx = bisect.bisect_left(starts, target)
+        nearest = min(starts[max(0, idx - 1):idx + 1], key=lambda s: abs(s - target))
+        if nearest > cuts[-1]:
+            cuts.append(nearest)
+    cuts.append(n_entries)
+    return list(zip(cuts[:-1], cuts[1:]))
+
+
+def write_manifest(args):
+    os.makedirs(args.workdir, exist_ok=True)
+    if args.file_list.endswith('.root'):
+        starts, n_entries = cluster_starts(args.file_list)
+        if not starts:
+            print("No readable recTree entries in", args.file_list)
+            sys.exit(1)
+        ranges = make_ranges(starts, n_entries, args.n_shards)
+        shards = [([args.file_list], last - first, '{}:{}'.format(first, last)) for first, last in ranges]
+    else:
+        with open(args.file_list) as f:
+            files = [line.strip() for line in f if line.strip()]
+        if not files:
+            print("No files in", args.file_list)
+            sys.exit(1)
+        shards = [(shard_files, weight, None)
+                  for shard_files, weight in make_shards(files, min(args.n_shards, len(files)), args.balance, args.jobs)]
+    manifest = {'file_list': os.path.abspath(args.file_list),
+                'balance': args.balance,
+                'min_run': args.min_run,
+                'max_run': args.max_run,
+                'skim_options': args.skim_options,
+                'imt': args.imt,
+                'output': os.path.abspath(args.output),
+                'shards': []}
+    for idx, (shard_files, weight, entries) in enumerate(shards):
+        stem = os.path.join(os.path.abspath(args.workdir), 'shard_{:03d}'.format(idx))
+        with open(stem + '.txt', 'w') as f:
+            for path in shard_files:
+                f.write('{}\n'.format(path))
+        manifest['shards'].append({'list': stem + '.txt',
+                                   'skim': stem + '_skim.root',
+                                   'hists': stem + '_hists.root',
+                                   'n_files': len(shard_files),
+                                   'entries': entries,
+                                   'weight': weight})
+        if entries:
+            print("Shard", idx, ": entries", entries)
+        else:
+            print("Shard", idx, ":", len(shard_files), "files, weight", weight)
+
+    manifest_name = os.path.join(args.workdir, 'shards.json')
+    with open(manifest_name, 'w') as f:
+        json.dump(manifest, f, indent=2)
+    print("Wrote shard manifest: ", manifest_name)
+    return manifest
+
+
+def run_shard(manifest, idx):
+    # Skim then histogram one shard; a rerun resumes an unfinished skim
+    shard = manifest['shards'][idx]
+    skim_options = [manifest['skim_options']]
+    if shard.get('entries'):
+        skim_options.append('entries=' + shard['entries'])
+    if manifest.get('imt'):
+        skim_options.append('imt={}'.format(manifest['imt']))
+    if os.path.exists(shard['skim'] + '.ckpt') and os.path.exists(shard['skim']):
+        skim_options.append('resume')
+    skim_options = ','.join(o for o in skim_options if o)
+    if not run(root_call('makeTTree_db_postgre.cc', shard['list'], shard['skim'], False, skim_options),
+               shard['skim'] + '.log') or not os.path.exists(shard['skim']):
+        print("Skim of shard", idx, "failed, see", shard['skim'] + '.log')
+        return False
+    if not run(root_call('makeHists_db_postgre.cc', shard['skim'], shard['hists'],
+                         manifest['min_run'], manifest['max_run']),
+               shard['hists'] + '.log') or not os.path.exists(shard['hists']):
+        print("Histogramming of shard", idx, "failed, see", shard['hists'] + '.log')
+        return False
+    print("Finished shard", idx)
+    return True
+
+
+def tree_merge(inputs, output, fan_in, n_jobs, keep):
+    # Merge level by level, each level's groups in parallel, until one file is left
+    originals = set(inputs)
+    level = 0
+    while len(inputs) > 1:
+        groups = [inputs[i:i + fan_in] for i in range(0, len(inputs), fan_in)]
+        outputs = []
+        jobs = []
+        for idx, group in enumerate(groups):
+            if len(group) == 1:
+                outputs.append(group[0])
+                continue
+            name = '{}.merge{}_{:03d}.root'.format(os.path.splitext(output)[0], level, idx)
+            outputs.append(name)
+            jobs.append((group, name))
+        with ThreadPoolExecutor(max_workers=n_jobs) as pool:
+            ok = list(pool.map(lambda job: run(root_call('mergeOutputs.cc', job[1], ','.join(job[0])), job[1] + '.log')
+                               and os.path.exists(job[1]), jobs))
+        if not all(ok):
+            print("Merge level", level, "failed, see the .merge*.log files")
+            return False
+        if not keep:
+            for group, _ in jobs:
+                for name in group:
+                    if name not in originals:
+                        os.remove(name)
+                        os.remove(name + '.log')
+        inputs = outputs
+        level += 1
+    if inputs[0] not in originals:
+        os.replace(inputs[0], output)
+    else:
+        shutil.copyfile(inputs[0], output)
+    print("Wrote merged output: ", output)
+    return True
+
+
+def merge_all(manifest, fan_in, n_jobs, keep):
+    output = manifest['output']
+    stem = os.path.splitext(output)[0]
+    ok = tree_merge([s['skim'] for s in manifest['shards']], stem + '_skim.root', fan_in, n_jobs, keep)
+    return tree_merge([s['hists'] for s in manifest['shards']], output, fan_in, n_jobs, keep) and ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run the skim and hist macros over a file list in local shards and merge the results')
+    parser.add_argument('file_list', nargs='?',
+                        help='.txt list of CAF files, as made by make_path_list.py, or one .root file to split by entry range')
+    parser.add_argument('--sam', metavar='QUERY', help='resolve this SAM query into the file list instead')
+    parser.add_argument('--resolve-cache', default='resolved_files.json',
+                        help='on-disk cache of SAM lookups for --sam ("" to disable)')
+    parser.add_argument('--refresh', action='store_true', help='with --sam, ignore the cached lookups and resolve every file again')
+    parser.add_argument('--output', default='dq_hists.root', help='merged histogram file (the merged skim goes next to it as *_skim.root)')
+    parser.add_argument('--workdir', default='shards')
+    parser.add_argument('-n', '--n-shards', type=int, default=os.cpu_count())
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(), help='concurrent worker processes')
+    parser.add_argument('--balance', choices=['size', 'entries', 'count'], default='size',
+                        help='balance shards by file size, recTree entries, or file count')
+    parser.add_argument('--min-run', type=int, help='first run of the histogram axes (same for every shard)')
+    parser.add_argument('--max-run', type=int, help='last run of the histogram axes (same for every shard)')
+    parser.add_argument('--skim-options', default='', help='option string passed to makeTTree_db_postgre')
+    parser.add_argument('--imt', type=int,
+                        help='basket (de)compression threads per skim (default: the cores left over by -j, 0 to disable)')
+    parser.add_argument('--fan-in', type=int, default=4, help='files per merge job')
+    parser.add_argument('--keep-intermediate', action='store_true')
+    parser.add_argument('--plan-only', action='store_true', help='write the shard manifest and stop')
+    parser.add_argument('--manifest', help='use an existing shards.json instead of planning')
+    parser.add_argument('--shard', type=int, help='run only this shard of --manifest (e.g. in a grid job)')
+    parser.add_argument('--merge-only', action='store_true', help='only merge the shard outputs of --manifest')
+    args = parser.parse_args()
+
+    if args.sam and not args.manifest:
+        import make_path_list
+        os.makedirs(args.workdir, exist_ok=True)
+        args.file_list = os.path.join(args.workdir, 'file_list.txt')
+        if not make_path_list.resolve_dataset(args.sam, args.file_list, args.resolve_cache or None,
+                                              jobs=args.jobs * 4, max_age=make_path_list.cache_age(30),
+                                              refresh=args.refresh):
+            sys.exit(1)
+
+    if args.manifest:
+        with open(args.manifest) as f:
+            manifest = json.load(f)
+    elif args.file_list:
+        # the per-run histograms only merge if every shard books the same axes
+        if args.min_run is None or args.max_run is None:
+            parser.error('need --min-run and --max-run to plan shards')
+        if args.imt is None:
+            args.imt = os.cpu_count() // args.jobs if os.cpu_count() >= 2 * args.jobs else 0
+        manifest = write_manifest(args)
+    else:
+        parser.error('need a file list or --manifest')
+
+    if args.plan_only:
+        return
+    if args.shard is not None:
+        sys.exit(0 if run_shard(manifest, args.shard) else 1)
+
+    if not args.merge_only:
+        with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+            ok = list(pool.map(lambda idx: run_shard(manifest, idx), range(len(manifest['shards']))))
+        if not all(ok):
+            print(ok.count(False), "shards failed; rerun to resume them")
+            sys.exit(1)
+
+    if not merge_all(manifest, max(2, args.fan_in), args.jobs, args.keep_intermediate):
+        sys.exit(1)
+    print("Done!")
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,130 @@
+# Tests of the concurrent SAM resolver in make_path_list.py against a fake
+# SAM client, so they run without samweb_client or a network:
+#   python3 -m unittest test_make_path_list
+import json
+import os
+import tempfile
+import threading
+import time
+import unittest
+
+import make_path_list
+
+
+class FakeSAM:
+    # Stand-in for SAMWebClient: every file resolves to a made-up xrootd URL
+    # after a short delay, except those in missing (SAM answers with no URL)
+    # and those in flaky (SAM raises the first flaky[f] times it is asked).
+    # Counts the calls and the most lookups that were ever in flight at once.
+    def __init__(self, missing=(), flaky=None, delay=0.005):
+        self.missing = set(missing)
+        self.flaky = dict(flaky or {})
+        self.delay = delay
+        self.lock = threading.Lock()
+        self.calls = {}
+        self.in_flight = 0
+        self.max_in_flight = 0
+
+    def __call__(self):
+        return self
+
+    def getFileAccessUrls(self, f, schema):
+        with self.lock:
+            self.calls[f] = self.calls.get(f, 0) + 1
+            self.in_flight += 1
+            self.max_in_flight = max(self.max_in_flight, self.in_flight)
+        try:
+            time.sleep(self.delay)
+            with self.lock:
+                if self.flaky.get(f, 0) > 0:
+                    self.flaky[f] -= 1
+                    raise RuntimeError("server error")
+            if f in self.missing:
+                return []
+            return ['root://fake.example//{}'.format(f)]
+        finally:
+            with self.lock:
+                self.in_flight -= 1
+
+
+class ResolveFilesTest(unittest.TestCase):
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.cache_name = os.path.join(self.tmp.name, 'cache.json')
+        self.files = ['file_{:03d}.flat.caf.root'.format(idx) for idx in range(60)]
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def resolve(self, sam, cache=None, **kwargs):
+        cache = cache or make_path_list.ResolveCache(self.cache_name)
+        kwargs.setdefault('retry_wait', 0)
+        return make_path_list.resolve_files(self.files, cache, client=sam, **kwargs)
+
+    def test_window_limits_lookups_in_flight(self):
+        sam = FakeSAM()
+        locations, failures = self.resolve(sam, window=4, jobs=16)
+        self.assertEqual(failures, {})
+        self.assertLessEqual(sam.max_in_flight, 4)
+        self.assertGreater(sam.max_in_flight, 1)
+        self.assertEqual(locations, ['root://fake.example//' + f for f in self.files])
+
+    def test_missing_files_fail_without_stopping(self):
+        sam = FakeSAM(missing=[self.files[3], self.files[40]])
+        locations, failures = self.resolve(sam, window=8, jobs=4)
+        self.assertEqual(sorted(failures), [self.files[3], self.files[40]])
+        self.assertIsNone(locations[3])
+        self.assertIsNone(locations[40])
+        self.assertEqual(sum(location is not None for location in locations), len(self.files) - 2)
+        # an answer without a location is not retried
+        self.assertEqual(sam.calls[self.files[3]], 1)
+
+    def test_transient_errors_are_retried(self):
+        sam = FakeSAM(flaky={self.files[5]: 2, self.files[6]: 5})
+        locations, failures = self.resolve(sam, window=8, jobs=4, retries=2)
+        self.assertEqual(locations[5], 'root://fake.example//' + self.files[5])
+        self.assertEqual(sam.calls[self.files[5]], 3)
+        self.assertEqual(list(failures), [self.files[6]])
+        self.assertIn('server error', failures[self.files[6]])
+        self.assertEqual(sam.calls[self.files[6]], 3)
+
+    def test_rerun_is_served_from_the_cache(self):
+        first = FakeSAM(missing=[self.files[7]])
+        self.resolve(first)
+        with open(self.cache_name) as f:
+            self.assertEqual(len(json.load(f)), len(self.files) - 1)
+
+        # only the file that failed is asked about again
+        second = FakeSAM()
+        locations, failures = self.resolve(second)
+        self.assertEqual(failures, {})
+        self.assertEqual(list(second.calls), [self.files[7]])
+        self.assertEqual(locations[0], 'root://fake.example//' + self.files[0])
+
+    def test_expired_and_refreshed_entries_are_resolved_again(self):
+        self.resolve(FakeSAM())
+
+        fresh = FakeSAM()
+        self.resolve(fresh, make_path_list.ResolveCache(self.cache_name, max_age=3600))
+        self.assertEqual(fresh.calls, {})
+
+        expired = FakeSAM()
+        self.resolve(expired, make_path_list.ResolveCache(self.cache_name, max_age=0))
+        self.assertEqual(len(expired.calls), len(self.files))
+
+        refreshed = FakeSAM()
+        self.resolve(refreshed, make_path_list.ResolveCache(self.cache_name, refresh=True))
+        self.assertEqual(len(refreshed.calls), len(self.files))
+
+    def test_untimed_cache_entries_count_as_expired(self):
+        with open(self.cache_name, 'w') as f:
+            json.dump({name: {'root': 'root://old//' + name} for name in self.files}, f)
+        untimed = FakeSAM()
+        self.resolve(untimed, make_path_list.ResolveCache(self.cache_name))
+        self.assertEqual(untimed.calls, {})
+        self.resolve(untimed, make_path_list.ResolveCache(self.cache_name, max_age=3600))
+        self.assertEqual(len(untimed.calls), len(self.files))
+
+
+if __name__ == '__main__':
+    unittest.main()